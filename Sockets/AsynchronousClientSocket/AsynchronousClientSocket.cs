@@ -3,6 +3,7 @@
 // The client is built with an asynchronous socket, so execution of the client application 
 // is not suspended while the server returns a response. The application sends a string to 
 // the server and then displays the string returned by the server on the console.
+// Every message is preceded by its length as a 4-byte big-endian integer.
 
 // http://msdn.microsoft.com/en-us/library/bew39x2a(v=vs.110).aspx
 
@@ -18,14 +19,17 @@ public class StateObject
     // Client socket.
     public Socket workSocket = null;
 
-    // Size of receive buffer.
-    public const int BufferSize = 256;
+    // Size of the length prefix in front of every message.
+    public const int HeaderSize = 4;
 
-    // Receive buffer.
-    public byte[] buffer = new byte[BufferSize];
+    // Length prefix of the message being received.
+    public byte[] header = new byte[HeaderSize];
 
-    // Received data string.
-    public StringBuilder sb = new StringBuilder();
+    // Message body, allocated once the length prefix has arrived.
+    public byte[] payload = null;
+
+    // Bytes received so far into the header, or into the payload once it exists.
+    public int received = 0;
 }
 
 public class AsynchronousClient
@@ -68,7 +72,7 @@ public class AsynchronousClient
             connectDone.WaitOne();
 
             // Send test data to the remote device.
-            Send(client, "Hello from Client. This is a test message.<EOF>");
+            Send(client, "Hello from Client. This is a test message.");
 
             // Block the current thread until the SendCallback has signaled that the data have been sent
             sendDone.WaitOne();
@@ -127,7 +131,7 @@ public class AsynchronousClient
             state.workSocket = client;
 
             // Begin receiving the data from the remote device.
-            client.BeginReceive(state.buffer, 0, StateObject.BufferSize, 0, new AsyncCallback(ReceiveCallback), state);
+            client.BeginReceive(state.header, 0, StateObject.HeaderSize, 0, new AsyncCallback(ReceiveCallback), state);
         }
         catch (Exception e)
         {
@@ -149,23 +153,34 @@ public class AsynchronousClient
 
             if (bytesRead > 0)
             {
-                // There might be more data, so store the data received so far.
-                state.sb.Append(Encoding.ASCII.GetString(state.buffer, 0, bytesRead));
+                state.received += bytesRead;
+
+                if (state.payload == null)
+                {
+                    // Still reading the length prefix. If it is not complete, get the rest of it.
+                    if (state.received < StateObject.HeaderSize)
+                    {
+                        client.BeginReceive(state.header, state.received, StateObject.HeaderSize - state.received, 0, new AsyncCallback(ReceiveCallback), state);
+                        return;
+                    }
+
+                    state.payload = new byte[IPAddress.NetworkToHostOrder(BitConverter.ToInt32(state.header, 0))];
+                    state.received = 0;
+                }
 
                 // Get the rest of the data.
-                client.BeginReceive(state.buffer, 0, StateObject.BufferSize, 0, new AsyncCallback(ReceiveCallback), state);
-            }
-            else
-            {
-                // All the data has arrived; put it in response.
-                if (state.sb.Length > 1)
+                if (state.received < state.payload.Length)
                 {
-                    response = state.sb.ToString();
+                    client.BeginReceive(state.payload, state.received, state.payload.Length - state.received, 0, new AsyncCallback(ReceiveCallback), state);
+                    return;
                 }
 
-                // Signal that all bytes have been received.
-                receiveDone.Set();
+                // All the data has arrived; put it in response.
+                response = Encoding.ASCII.GetString(state.payload);
             }
+
+            // Signal that the whole message has been received or that the server closed the connection.
+            receiveDone.Set();
         }
         catch (Exception e)
         {
@@ -176,7 +191,14 @@ public class AsynchronousClient
     private static void Send(Socket client, String data)
     {
         // Convert the string data to byte data using ASCII encoding.
-        byte[] byteData = Encoding.ASCII.GetBytes(data);
+        byte[] payload = Encoding.ASCII.GetBytes(data);
+
+        // Prefix the data with its length as a 4-byte big-endian integer.
+        byte[] byteData = new byte[StateObject.HeaderSize + payload.Length];
+        byte[] header = BitConverter.GetBytes(IPAddress.HostToNetworkOrder(payload.Length));
+
+        Buffer.BlockCopy(header, 0, byteData, 0, StateObject.HeaderSize);
+        Buffer.BlockCopy(payload, 0, byteData, StateObject.HeaderSize, payload.Length);
 
         // Begin sending the data to the remote device.
         client.BeginSend(byteData, 0, byteData.Length, 0, new AsyncCallback(SendCallback), client);
@@ -4,7 +4,8 @@
 // The server is built with an asynchronous socket, so execution of the server application is NOT 
 // suspended while it waits for a connection from a client. The application receives a string from 
 // the client, displays the string on the console, and then echoes the string back to the client. 
-// The string from the client must contain the string "<EOF>" to signal the end of the message.
+// Every message is preceded by its length as a 4-byte big-endian integer, so the server reads 
+// exactly that many bytes instead of searching the accumulated data for an end-of-message tag.
 
 // http://msdn.microsoft.com/en-us/library/fx6588te(v=vs.110).aspx
 
@@ -20,14 +21,17 @@ public class StateObject
     // Client  socket.
     public Socket workSocket = null;
 
-    // Size of receive buffer.
-    public const int BufferSize = 1024;
+    // Size of the length prefix in front of every message.
+    public const int HeaderSize = 4;
+
+    // Length prefix of the message being received.
+    public byte[] header = new byte[HeaderSize];
 
-    // Receive buffer.
-    public byte[] buffer = new byte[BufferSize];
+    // Message body, allocated once the length prefix has arrived.
+    public byte[] payload = null;
 
-    // Received data string.
-    public StringBuilder sb = new StringBuilder();
+    // Bytes received so far into the header, or into the payload once it exists.
+    public int received = 0;
 }
 
 public class AsynchronousSocketListener
@@ -37,6 +41,9 @@ public class AsynchronousSocketListener
 
     private const int MaxLengthPendingConnections = 2;
 
+    // Largest message the server accepts.
+    private const int MaxMessageSize = 16 * 1024 * 1024;
+
     // Thread signal.
     public static ManualResetEvent allDone = new ManualResetEvent(false);
 
@@ -103,7 +110,7 @@ public class AsynchronousSocketListener
         // Create the state object.
         StateObject state = new StateObject();
         state.workSocket = handler;
-        handler.BeginReceive(state.buffer, 0, StateObject.BufferSize, 0, new AsyncCallback(ReadCallback), state);
+        handler.BeginReceive(state.header, 0, StateObject.HeaderSize, 0, new AsyncCallback(ReadCallback), state);
     }
 
 
@@ -121,27 +128,47 @@ public class AsynchronousSocketListener
 
         if (bytesRead > 0)
         {
-            // There  might be more data, so store the data received so far.
-            state.sb.Append(Encoding.ASCII.GetString(state.buffer, 0, bytesRead));
-
-            // Check for end-of-file tag. If it is not there, read more data.
-            content_received = state.sb.ToString();
+            state.received += bytesRead;
 
-            if (content_received.IndexOf("<EOF>") > -1)
+            if (state.payload == null)
             {
-                // All the data has been read from the client. Display it on the console.
-                Console.WriteLine("Read {0} bytes from socket. \n Data : {1}", content_received.Length, content_received);
-
-                content_replied = content_received.Replace("Client", "Server").Replace("<EOF>", String.Empty);
-
-                // Echo the data back to the client.
-                Send(handler, content_replied);
+                // Still reading the length prefix. If it is not complete, read the rest of it.
+                if (state.received < StateObject.HeaderSize)
+                {
+                    handler.BeginReceive(state.header, state.received, StateObject.HeaderSize - state.received, 0, new AsyncCallback(ReadCallback), state);
+                    return;
+                }
+
+                int length = IPAddress.NetworkToHostOrder(BitConverter.ToInt32(state.header, 0));
+
+                if (length < 0 || length > MaxMessageSize)
+                {
+                    Console.WriteLine("Message length {0} out of range, closing connection.", length);
+                    handler.Shutdown(SocketShutdown.Both);
+                    handler.Close();
+                    return;
+                }
+
+                state.payload = new byte[length];
+                state.received = 0;
             }
-            else
+
+            // The prefix says exactly how many bytes remain. If not all of them are there, read more data.
+            if (state.received < state.payload.Length)
             {
-                // Not all data received. Get more.
-                handler.BeginReceive(state.buffer, 0, StateObject.BufferSize, 0, new AsyncCallback(ReadCallback), state);
+                handler.BeginReceive(state.payload, state.received, state.payload.Length - state.received, 0, new AsyncCallback(ReadCallback), state);
+                return;
             }
+
+            // All the data has been read from the client. Display it on the console.
+            content_received = Encoding.ASCII.GetString(state.payload);
+
+            Console.WriteLine("Read {0} bytes from socket. \n Data : {1}", content_received.Length, content_received);
+
+            content_replied = content_received.Replace("Client", "Server");
+
+            // Echo the data back to the client.
+            Send(handler, content_replied);
         }
     }
 
@@ -149,7 +176,14 @@ public class AsynchronousSocketListener
     private static void Send(Socket handler, String data)
     {
         // Convert the string data to byte data using ASCII encoding.
-        byte[] byteData = Encoding.ASCII.GetBytes(data);
+        byte[] payload = Encoding.ASCII.GetBytes(data);
+
+        // Prefix the data with its length as a 4-byte big-endian integer.
+        byte[] byteData = new byte[StateObject.HeaderSize + payload.Length];
+        byte[] header = BitConverter.GetBytes(IPAddress.HostToNetworkOrder(payload.Length));
+
+        Buffer.BlockCopy(header, 0, byteData, 0, StateObject.HeaderSize);
+        Buffer.BlockCopy(payload, 0, byteData, StateObject.HeaderSize, payload.Length);
 
         // Begin sending the data to the remote device.
         handler.BeginSend(byteData, 0, byteData.Length, 0, new AsyncCallback(SendCallback), handler);
@@ -3,6 +3,7 @@
 // The client is built with a synchronous socket, so execution of the client 
 // application is suspended until the server returns a response. 
 // The application sends a string to the server and then displays the string returned by the server on the console.
+// Every message is preceded by its length as a 4-byte big-endian integer.
 
 // http://msdn.microsoft.com/en-us/library/kb5kfec7(v=vs.110).aspx
 
@@ -13,10 +14,46 @@ using System.Text;
 
 public class SynchronousSocketClient
 {
+    // Size of the length prefix in front of every message.
+    private const int HeaderSize = 4;
+
+    // Receive exactly count bytes into buffer, however the data is split across reads.
+    // Returns false if the server closed the connection first.
+    private static bool ReceiveExactly(Socket sender, byte[] buffer, int count)
+    {
+        int received = 0;
+
+        while (received < count)
+        {
+            int bytesRec = sender.Receive(buffer, received, count - received, SocketFlags.None);
+
+            if (bytesRec == 0)
+            {
+                return false;
+            }
+
+            received += bytesRec;
+        }
+
+        return true;
+    }
+
+    // Prefix the payload with its length as a 4-byte big-endian integer.
+    private static byte[] EncodeFrame(byte[] payload)
+    {
+        byte[] frame = new byte[HeaderSize + payload.Length];
+        byte[] header = BitConverter.GetBytes(IPAddress.HostToNetworkOrder(payload.Length));
+
+        Buffer.BlockCopy(header, 0, frame, 0, HeaderSize);
+        Buffer.BlockCopy(payload, 0, frame, HeaderSize, payload.Length);
+
+        return frame;
+    }
+
     public static void StartClient() 
     {
-        // Data buffer for incoming data.
-        byte[] bytes = new byte[1024];
+        // Buffer for the length prefix of incoming data.
+        byte[] header = new byte[HeaderSize];
 
         // Connect to a remote device.
         try {
@@ -37,15 +74,23 @@ public class SynchronousSocketClient
 
                 Console.WriteLine("Socket connected to {0}", sender.RemoteEndPoint.ToString());
 
-                // Encode the data string into a byte array.
-                byte[] msg = Encoding.ASCII.GetBytes("Hello from Client. This is a test message.<EOF>");
+                // Encode the data string into a byte array preceded by its length.
+                byte[] msg = EncodeFrame(Encoding.ASCII.GetBytes("Hello from Client. This is a test message."));
 
                 // Send the data through the socket.
                 int bytesSent = sender.Send(msg);
 
-                // Receive the response from the remote device.
-                int bytesRec = sender.Receive(bytes);
-                Console.WriteLine("Echoed test = {0}", Encoding.ASCII.GetString(bytes, 0, bytesRec));
+                // Receive the response from the remote device: the length prefix, then the message itself.
+                if (ReceiveExactly(sender, header, HeaderSize))
+                {
+                    int length = IPAddress.NetworkToHostOrder(BitConverter.ToInt32(header, 0));
+                    byte[] bytes = new byte[length];
+
+                    if (ReceiveExactly(sender, bytes, length))
+                    {
+                        Console.WriteLine("Echoed test = {0}", Encoding.ASCII.GetString(bytes, 0, length));
+                    }
+                }
 
                 // Release the socket.
                 sender.Shutdown(SocketShutdown.Both);
@@ -3,7 +3,8 @@
 // The server is built with a synchronous socket, so execution of the server application is suspended 
 // while it waits for a connection from a client. The application receives a string from the client, 
 // displays the string on the console, and then echoes the string back to the client. 
-// The string from the client must contain the string "<EOF>" to signal the end of the message.
+// Every message is preceded by its length as a 4-byte big-endian integer, so the server reads 
+// exactly that many bytes instead of searching the accumulated data for an end-of-message tag.
 
 // http://msdn.microsoft.com/en-us/library/6y0e13d3(v=vs.110).aspx
 
@@ -14,13 +15,52 @@ using System.Text;
 
 public class SynchronousSocketListener
 {
+    // Size of the length prefix in front of every message.
+    private const int HeaderSize = 4;
+
+    // Largest message the server accepts.
+    private const int MaxMessageSize = 16 * 1024 * 1024;
+
     // Incoming data from the client.
     public static string data = null;
 
+    // Receive exactly count bytes into buffer, however the data is split across reads.
+    // Returns false if the client closed the connection first.
+    private static bool ReceiveExactly(Socket handler, byte[] buffer, int count)
+    {
+        int received = 0;
+
+        while (received < count)
+        {
+            int bytesRec = handler.Receive(buffer, received, count - received, SocketFlags.None);
+
+            if (bytesRec == 0)
+            {
+                return false;
+            }
+
+            received += bytesRec;
+        }
+
+        return true;
+    }
+
+    // Prefix the payload with its length as a 4-byte big-endian integer.
+    private static byte[] EncodeFrame(byte[] payload)
+    {
+        byte[] frame = new byte[HeaderSize + payload.Length];
+        byte[] header = BitConverter.GetBytes(IPAddress.HostToNetworkOrder(payload.Length));
+
+        Buffer.BlockCopy(header, 0, frame, 0, HeaderSize);
+        Buffer.BlockCopy(payload, 0, frame, HeaderSize, payload.Length);
+
+        return frame;
+    }
+
     public static void StartListening()
     {
-        // Data buffer for incoming data.
-        byte[] bytes = new Byte[1024];
+        // Buffer for the length prefix of incoming data.
+        byte[] header = new byte[HeaderSize];
 
         // Establish the local endpoint for the socket.
         // Dns.GetHostName returns the name of the host running the application.
@@ -47,25 +87,34 @@ public class SynchronousSocketListener
                 data = null;
 
                 // An incoming connection needs to be processed.
-                while (true)
+                // Read the length prefix first, then exactly the number of bytes it announces.
+                if (ReceiveExactly(handler, header, HeaderSize))
                 {
-                    bytes = new byte[1024];
-                    int bytesRec = handler.Receive(bytes);
-                    data += Encoding.ASCII.GetString(bytes, 0, bytesRec);
+                    int length = IPAddress.NetworkToHostOrder(BitConverter.ToInt32(header, 0));
 
-                    if (data.IndexOf("<EOF>") > -1)
+                    if (length >= 0 && length <= MaxMessageSize)
                     {
-                        break;
+                        byte[] bytes = new byte[length];
+
+                        if (ReceiveExactly(handler, bytes, length))
+                        {
+                            data = Encoding.ASCII.GetString(bytes, 0, length);
+                        }
                     }
                 }
 
-                // Show the data on the console.
-                Console.WriteLine("Text received : {0}", data);
+                // A truncated or oversized message is dropped without a reply.
+                if (data != null)
+                {
+                    // Show the data on the console.
+                    Console.WriteLine("Text received : {0}", data);
 
-                // Echo the data back to the client.
-                byte[] msg = Encoding.ASCII.GetBytes(data);
+                    // Echo the data back to the client.
+                    byte[] msg = EncodeFrame(Encoding.ASCII.GetBytes(data));
+
+                    handler.Send(msg);
+                }
 
-                handler.Send(msg);
                 handler.Shutdown(SocketShutdown.Both);
                 handler.Close();
             }
@@ -0,0 +1,224 @@
+#undef UNICODE
+
+#include "../Common/Socket.h"
+#include "../Common/Coroutine.h"
+#include "../Common/Frame.h"
+#include "../Common/Thread.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Build (Linux): g++ -O2 -std=c++20 -pthread AsyncServer.cpp ../Common/*.cpp -lssl -lcrypto -o asyncserver
+
+// Bytes a connection asks for per recv. The buffer lives in the connection's coroutine frame.
+#define RECEIVE_BUFFER_SIZE (16 * 1024)
+
+// Asynchronous echo server written with coroutines: the counterpart of the C# AsynchronousServerSocket
+// sample and of the callback-driven Server. It speaks the same length-prefixed frames and works with
+// the same client, but each connection is a single function that reads, decodes and writes in order,
+// suspending wherever the C# sample would return from a callback and wait for the next one.
+
+// Command line options.
+struct AsyncServerOptions
+{
+	// Number of worker threads, each with its own SO_REUSEPORT listen socket and coroutine loop.
+	int threads;
+
+	// Pin worker i to CPU (i % CPU count).
+	bool pin;
+
+	// Socket options and listen backlog, from --profile, --config and the individual options.
+	SocketTuning tuning;
+};
+
+static void PrintUsage(const char *program)
+{
+	printf("usage: %s [--threads N] [--pin] [--profile NAME] [--config FILE] [--SETTING VALUE ...]\n", program);
+	printf("  --threads N     run N workers, each with its own SO_REUSEPORT listen socket and loop (default 1)\n");
+	printf("  --pin           pin each worker thread to its own CPU\n");
+	printf("  --profile NAME  latency or throughput socket tuning\n");
+	printf("  --config FILE   read \"name = value\" tuning lines\n");
+	printf("  The remaining tuning settings (--backlog, --rcvbuf, --nodelay, ...) are those of the server.\n");
+}
+
+static bool ParseOptions(int argc, char **argv, AsyncServerOptions &options)
+{
+	options.threads = 1;
+	options.pin = false;
+	DefaultTuning(options.tuning);
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			options.threads = atoi(argv[++i]);
+
+			if (options.threads < 1)
+				return false;
+		}
+		else if (strcmp(argv[i], "--pin") == 0)
+		{
+			options.pin = true;
+		}
+		else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc)
+		{
+			if (!LoadTuningFile(argv[++i], options.tuning))
+				return false;
+		}
+		else if (strncmp(argv[i], "--", 2) == 0 && i + 1 < argc && SetTuningOption(argv[i] + 2, argv[i + 1], options.tuning))
+		{
+			i++;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Append a complete frame to the reply. The header immediately precedes the payload, so the
+// frame is copied as received without being re-encoded.
+static void AppendFrame(const char *payload, size_t len, void *context)
+{
+	vector<char> *reply = (vector<char> *)context;
+
+	reply->insert(reply->end(), payload - FRAME_HEADER_SIZE, payload + len);
+}
+
+// --- Receiving and Sending Data on the Server ---
+
+// One connection from accept to close. Where the C# sample passes a StateObject from ReadCallback
+// to SendCallback, the receive buffer, the decoder and the reply are simply locals of the coroutine.
+// Every frame completed by one recv is echoed with one send, so pipelined requests cost one write.
+static Task<> ServeClient(AsyncSocket client)
+{
+	char buffer[RECEIVE_BUFFER_SIZE];
+	FrameDecoder decoder;
+	vector<char> reply;
+
+	for (;;)
+	{
+		ssize_t received = co_await client.Recv(buffer, sizeof(buffer));
+
+		// 0: the client shut down its side of the connection.
+		if (received <= 0)
+			break;
+
+		reply.clear();
+
+		if (!decoder.Feed(NULL, buffer, (size_t)received, AppendFrame, &reply))
+		{
+			printf("Invalid frame, closing connection\n");
+			break;
+		}
+
+		if (!reply.empty() && co_await client.Send(reply.data(), reply.size()) < 0)
+			break;
+	}
+
+	// Leaving the coroutine destroys the socket handle, which closes the connection.
+}
+
+// --- Accepting Connections ---
+
+// The C# sample blocks its main thread on a ManualResetEvent between BeginAccept calls.
+// Here the accept loop is just another coroutine on the loop, suspended while the accept queue is empty.
+static Task<> AcceptClients(CoroutineLoop &loop, AsyncListener listener)
+{
+	for (;;)
+	{
+		AsyncSocket client = co_await listener.Accept();
+
+		if (!client.Valid())
+			continue;
+
+		// The new connection runs until its first recv would block, then the accept loop continues.
+		loop.Spawn(ServeClient(std::move(client)));
+	}
+}
+
+static int RunWorker(int index, SOCKET ListenSocket, const AsyncServerOptions &options)
+{
+	if (options.pin)
+		PinCurrentThread(index % CpuCount());
+
+	CoroutineLoop loop;
+
+	if (!loop.Init())
+	{
+		closesocket(ListenSocket);
+		return 1;
+	}
+
+	loop.SetTuning(options.tuning);
+
+	AsyncListener listener = loop.Listen(ListenSocket);
+
+	if (!listener.Valid())
+		return 1;
+
+	loop.Spawn(AcceptClients(loop, std::move(listener)));
+
+	return loop.Run();
+}
+
+int __cdecl main(int argc, char **argv)
+{
+	AsyncServerOptions options;
+	vector<SOCKET> ListenSockets;
+
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	if (SocketStartup() != 0)
+		return 1;
+
+	// --- Creating, Binding and Listening on a Socket ---
+
+	// Same listen sockets as the callback-driven server: non-blocking, tuned before listen, and one
+	// per worker bound with SO_REUSEPORT so the kernel spreads connections across the loops.
+	for (int i = 0; i < options.threads; i++)
+	{
+		SOCKET ListenSocket = CreateListenSocket(DEFAULT_PORT, options.tuning.backlog, options.threads > 1, &options.tuning);
+
+		if (ListenSocket == INVALID_SOCKET)
+		{
+			for (size_t j = 0; j < ListenSockets.size(); j++)
+				closesocket(ListenSockets[j]);
+
+			SocketCleanup();
+			return 1;
+		}
+
+		ListenSockets.push_back(ListenSocket);
+	}
+
+	// Worker 0 runs on the main thread; the others get a thread each.
+	vector<thread> workers;
+	vector<int> results(options.threads, 0);
+
+	for (int i = 1; i < options.threads; i++)
+		workers.push_back(thread([i, &ListenSockets, &options, &results]() { results[i] = RunWorker(i, ListenSockets[i], options); }));
+
+	results[0] = RunWorker(0, ListenSockets[0], options);
+
+	int iResult = 0;
+
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	for (int i = 0; i < options.threads; i++)
+		iResult |= results[i];
+
+	SocketCleanup();
+
+	return iResult;
+}
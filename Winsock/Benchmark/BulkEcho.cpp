@@ -0,0 +1,279 @@
+#include "../Common/Socket.h"
+#include "../Common/IoLoop.h"
+#include "../Common/Frame.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#ifndef __linux__
+#error "The bulk echo benchmark requires Linux"
+#endif
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <x86intrin.h>
+
+// Build (Linux): g++ -O2 -std=c++17 -pthread BulkEcho.cpp ../Common/*.cpp -lssl -lcrypto -o bulkecho
+
+// Bulk echo benchmark: CPU cost per byte of echoing large frames through the copy path
+// (recv into user space, reassemble, send back out) versus bulk echo (see IoLoop::SetBulkEcho), 
+// which with the epoll backend splices the payload socket -> pipe -> socket. Both runs use the 
+// same loop, frame size and amount of data; only the bulk echo threshold differs. The client runs in this process on other threads, and only the
+// CPU time of the server loop's thread is counted.
+
+// Command line options.
+struct BenchOptions
+{
+	const char *backend;
+	uint32_t frameSize;
+	uint64_t totalBytes;
+};
+
+// What the server loop's thread measured about itself.
+struct ServerCost
+{
+	uint64_t cpuNs;
+
+	// Core cycles from the CPU's performance counters, or 0 when they are not available
+	// (for example in a VM or with kernel.perf_event_paranoid too strict).
+	uint64_t cycles;
+};
+
+static uint64_t Clock(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Open a cycle counter for the calling thread. Returns -1 when counters are unavailable.
+static int OpenCycleCounter(void)
+{
+	struct perf_event_attr attr;
+	ZeroMemory(&attr, sizeof(attr));
+
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_hv = 1;
+
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Time stamp counter ticks per nanosecond, used to express CPU time in cycles when there are
+// no hardware counters. The TSC ticks at the nominal frequency, so this ignores turbo and idle states.
+static double TscPerNs(void)
+{
+	uint64_t startNs = Clock(CLOCK_MONOTONIC);
+	uint64_t startTsc = __rdtsc();
+
+	while (Clock(CLOCK_MONOTONIC) - startNs < 50000000)
+		;
+
+	return (double)(__rdtsc() - startTsc) / (double)(Clock(CLOCK_MONOTONIC) - startNs);
+}
+
+static void EchoFrame(IoLoop &loop, Connection &conn, const char *payload, size_t len, void *)
+{
+	loop.Send(conn, payload - FRAME_HEADER_SIZE, len + FRAME_HEADER_SIZE);
+}
+
+static void RunServer(IoLoop *loop, SOCKET ListenSocket, ServerCost *cost)
+{
+	// The loop is set up on the thread that runs it: an io_uring ring only accepts 
+	// submissions from the thread that created it.
+	if (!loop->Init() || !loop->AddListener(ListenSocket))
+		abort();
+
+	int counter = OpenCycleCounter();
+	uint64_t cyclesBefore = 0, cyclesAfter = 0;
+
+	if (counter != -1 && read(counter, &cyclesBefore, sizeof(cyclesBefore)) != sizeof(cyclesBefore))
+		cyclesBefore = 0;
+
+	uint64_t start = Clock(CLOCK_THREAD_CPUTIME_ID);
+
+	loop->Run();
+
+	cost->cpuNs = Clock(CLOCK_THREAD_CPUTIME_ID) - start;
+	cost->cycles = 0;
+
+	if (counter != -1)
+	{
+		if (read(counter, &cyclesAfter, sizeof(cyclesAfter)) == sizeof(cyclesAfter))
+			cost->cycles = cyclesAfter - cyclesBefore;
+
+		close(counter);
+	}
+}
+
+static void SendFrames(SOCKET ConnectSocket, const BenchOptions &options)
+{
+	vector<char> frame(FRAME_HEADER_SIZE + (size_t)options.frameSize, 'x');
+	EncodeFrameHeader(frame.data(), options.frameSize);
+
+	for (uint64_t sent = 0; sent < options.totalBytes; sent += frame.size())
+	{
+		size_t offset = 0;
+
+		while (offset < frame.size())
+		{
+			ssize_t iResult = send(ConnectSocket, frame.data() + offset, frame.size() - offset, MSG_NOSIGNAL);
+
+			if (iResult <= 0)
+				return;
+
+			offset += (size_t)iResult;
+		}
+	}
+}
+
+// Echo totalBytes through a fresh loop with the given bulk threshold and report the server's cost.
+static bool RunOnce(const BenchOptions &options, uint32_t bulkThreshold, ServerCost &cost, double &seconds)
+{
+	// Port 0: the kernel picks a free port, so back-to-back runs never collide.
+	SOCKET ListenSocket = CreateListenSocket("0", SOMAXCONN, false);
+
+	if (ListenSocket == INVALID_SOCKET)
+		return false;
+
+	struct sockaddr_in address;
+	socklen_t addressLength = sizeof(address);
+	getsockname(ListenSocket, (struct sockaddr *)&address, &addressLength);
+
+	IoLoop *loop = CreateIoLoop(options.backend);
+
+	loop->SetMessageHandler(EchoFrame, NULL);
+	loop->SetBulkEcho(bulkThreshold);
+
+	thread server(RunServer, loop, ListenSocket, &cost);
+
+	SOCKET ConnectSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (connect(ConnectSocket, (struct sockaddr *)&address, sizeof(address)) == SOCKET_ERROR)
+	{
+		printf("connect failed with error: %d\n", WSAGetLastError());
+		abort();
+	}
+
+	uint64_t start = Clock(CLOCK_MONOTONIC);
+
+	thread sender(SendFrames, ConnectSocket, cref(options));
+
+	// Read the echoes back; the frames are all the same, only the byte count matters.
+	uint64_t expected = (options.totalBytes + FRAME_HEADER_SIZE + options.frameSize - 1) /
+		(FRAME_HEADER_SIZE + options.frameSize) * (FRAME_HEADER_SIZE + options.frameSize);
+	uint64_t received = 0;
+	vector<char> recvbuf(1024 * 1024);
+
+	while (received < expected)
+	{
+		ssize_t iResult = recv(ConnectSocket, recvbuf.data(), recvbuf.size(), 0);
+
+		if (iResult <= 0)
+			break;
+
+		received += (uint64_t)iResult;
+	}
+
+	seconds = (Clock(CLOCK_MONOTONIC) - start) / 1e9;
+
+	sender.join();
+
+	// Closing the connection wakes the loop, which then sees the stop request.
+	loop->Stop();
+	closesocket(ConnectSocket);
+	server.join();
+
+	delete loop;
+
+	return received == expected;
+}
+
+static void PrintUsage(const char *program)
+{
+	printf("usage: %s [--backend epoll|uring] [--frame-size BYTES] [--total MB]\n", program);
+	printf("  --backend B         I/O backend of the server loop (default epoll)\n");
+	printf("  --frame-size BYTES  payload size of every frame (default 1048576)\n");
+	printf("  --total MB          data echoed per run (default 4096)\n");
+}
+
+int __cdecl main(int argc, char **argv)
+{
+	BenchOptions options;
+	options.backend = "epoll";
+	options.frameSize = 1024 * 1024;
+	options.totalBytes = 4096ull * 1024 * 1024;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+			options.backend = argv[++i];
+		else if (strcmp(argv[i], "--frame-size") == 0 && i + 1 < argc)
+			options.frameSize = (uint32_t)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--total") == 0 && i + 1 < argc)
+			options.totalBytes = strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+		else
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (options.frameSize == 0 || options.frameSize > MAX_FRAME_SIZE || options.totalBytes == 0 ||
+		(strcmp(options.backend, "epoll") != 0 && strcmp(options.backend, "uring") != 0))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	if (SocketStartup() != 0)
+		return 1;
+
+	double tscPerNs = TscPerNs();
+
+	printf("Backend: %s  Frame size: %u bytes  Data per run: %llu MB\n", options.backend, options.frameSize,
+		(unsigned long long)(options.totalBytes / (1024 * 1024)));
+
+	const char *names[2] = { "copy", "bulk" };
+	uint32_t thresholds[2] = { 0, options.frameSize };
+	double cyclesPerByte[2] = { 0.0, 0.0 };
+	bool measured = false;
+
+	for (int run = 0; run < 2; run++)
+	{
+		ServerCost cost;
+		double seconds;
+
+		if (!RunOnce(options, thresholds[run], cost, seconds))
+		{
+			printf("%s run failed\n", names[run]);
+			SocketCleanup();
+			return 1;
+		}
+
+		// Bytes crossing the server in both directions.
+		double bytes = 2.0 * (double)options.totalBytes;
+		measured = cost.cycles > 0;
+		double cycles = measured ? (double)cost.cycles : (double)cost.cpuNs * tscPerNs;
+
+		cyclesPerByte[run] = cycles / bytes;
+
+		printf("%-6s  %8.1f MB/s  server CPU %6.3f ns/byte  %6.3f cycles/byte%s\n", names[run],
+			(double)options.totalBytes / seconds / 1e6, (double)cost.cpuNs / bytes, cyclesPerByte[run],
+			measured ? "" : " (TSC)");
+	}
+
+	if (cyclesPerByte[1] > 0.0)
+		printf("bulk echo uses %.2fx the cycles per byte of copy\n", cyclesPerByte[1] / cyclesPerByte[0]);
+
+	SocketCleanup();
+
+	return 0;
+}
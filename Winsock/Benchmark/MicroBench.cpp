@@ -0,0 +1,474 @@
+#include "../Common/Socket.h"
+#include "../Common/IoLoop.h"
+#include "../Common/Frame.h"
+#include "../Common/BufferPool.h"
+#include "../Common/TimerWheel.h"
+#include "../Common/Metrics.h"
+#include "../Common/Trace.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include <benchmark/benchmark.h>
+
+#ifndef __linux__
+#error "The microbenchmarks require Linux"
+#endif
+
+#include <netinet/tcp.h>
+
+// Build (Linux): g++ -O2 -std=c++17 -pthread MicroBench.cpp ../Common/*.cpp -lbenchmark -lssl -lcrypto -o microbench
+// Run:           ./microbench [--benchmark_filter=REGEX] [--benchmark_out=FILE] [--benchmark_repetitions=N]
+
+// Microbenchmarks of the networking core, on Google Benchmark: framing, the buffer pool, the timer
+// wheel, trace recording and a loopback echo round trip through each I/O backend. Every run writes
+// its results as JSON (microbench.json unless --benchmark_out says otherwise), tagged with the git
+// commit of the tree it runs in, so two commits are compared with Google Benchmark's tools/compare.py:
+//
+//     compare.py benchmarks before.json after.json
+//
+// For numbers worth comparing, pin the run to quiet cores (taskset -c 2,3), set the CPU governor
+// to performance and use --benchmark_repetitions=5 so the report includes the spread of the runs.
+
+// Payload sizes of the framing and echo benchmarks: a small request, a typical reply,
+// a frame that spans a pooled buffer and a bulk-sized frame.
+#define SMALL_FRAME 64
+#define LARGE_FRAME (64 * 1024)
+
+// --- Framing ---
+
+static void BM_FrameEncode(benchmark::State &state)
+{
+	uint32_t size = (uint32_t)state.range(0);
+	vector<char> payload(size, 'x');
+	vector<char> frame(FRAME_HEADER_SIZE + size);
+
+	for (auto _ : state)
+	{
+		size_t length = EncodeFrame(frame.data(), payload.data(), size);
+		benchmark::DoNotOptimize(length);
+		benchmark::ClobberMemory();
+	}
+
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * (int64_t)(FRAME_HEADER_SIZE + size));
+}
+BENCHMARK(BM_FrameEncode)->RangeMultiplier(8)->Range(SMALL_FRAME, LARGE_FRAME);
+
+static void CountFrame(const char *payload, size_t len, void *context)
+{
+	benchmark::DoNotOptimize(payload);
+	*(size_t *)context += len;
+}
+
+// A stream of frames of one size fed to a decoder in chunks of chunkSize bytes. Chunks as large as
+// a read hand out most frames in place; chunks the size of a TCP segment split frames across
+// reads, which exercises the reassembly path and its pooled buffers.
+static void DecodeStream(benchmark::State &state, size_t chunkSize)
+{
+	uint32_t size = (uint32_t)state.range(0);
+	size_t frames = (256 * 1024) / (FRAME_HEADER_SIZE + size) + 1;
+	vector<char> stream;
+
+	for (size_t i = 0; i < frames; i++)
+	{
+		size_t offset = stream.size();
+
+		stream.resize(offset + FRAME_HEADER_SIZE + size, 'x');
+		EncodeFrameHeader(stream.data() + offset, size);
+	}
+
+	BufferPool pool;
+	FrameDecoder decoder;
+	size_t decoded = 0;
+
+	for (auto _ : state)
+	{
+		for (size_t offset = 0; offset < stream.size(); offset += chunkSize)
+		{
+			size_t len = stream.size() - offset < chunkSize ? stream.size() - offset : chunkSize;
+
+			if (!decoder.Feed(&pool, stream.data() + offset, len, CountFrame, &decoded))
+				state.SkipWithError("invalid frame");
+		}
+	}
+
+	decoder.Clear(&pool);
+
+	state.SetItemsProcessed(state.iterations() * (int64_t)frames);
+	state.SetBytesProcessed(state.iterations() * (int64_t)stream.size());
+}
+
+static void BM_FrameDecodeInPlace(benchmark::State &state)
+{
+	DecodeStream(state, 64 * 1024);
+}
+BENCHMARK(BM_FrameDecodeInPlace)->RangeMultiplier(8)->Range(SMALL_FRAME, LARGE_FRAME);
+
+static void BM_FrameDecodeSegmented(benchmark::State &state)
+{
+	DecodeStream(state, 1448);
+}
+BENCHMARK(BM_FrameDecodeSegmented)->RangeMultiplier(8)->Range(SMALL_FRAME, LARGE_FRAME);
+
+// --- Buffer Pool ---
+
+// Acquire and release range(0) buffers at a time: 1 is a read borrowing the receive buffer,
+// larger counts are a burst of connections holding output at once.
+static void BM_BufferPool(benchmark::State &state)
+{
+	size_t count = (size_t)state.range(0);
+	BufferPool pool;
+	vector<Buffer *> held(count);
+
+	pool.Reserve(count);
+
+	for (auto _ : state)
+	{
+		for (size_t i = 0; i < count; i++)
+			held[i] = pool.Acquire();
+
+		benchmark::DoNotOptimize(held.data());
+
+		for (size_t i = count; i-- > 0; )
+			pool.Release(held[i]);
+	}
+
+	state.SetItemsProcessed(state.iterations() * (int64_t)count);
+}
+BENCHMARK(BM_BufferPool)->Arg(1)->Arg(64)->Arg(1024);
+
+// The same pattern with malloc and free of a buffer's size, the baseline the pool replaces.
+static void BM_MallocFree(benchmark::State &state)
+{
+	size_t count = (size_t)state.range(0);
+	vector<char *> held(count);
+
+	for (auto _ : state)
+	{
+		for (size_t i = 0; i < count; i++)
+			held[i] = (char *)malloc(POOL_BUFFER_SIZE);
+
+		benchmark::DoNotOptimize(held.data());
+
+		for (size_t i = count; i-- > 0; )
+			free(held[i]);
+	}
+
+	state.SetItemsProcessed(state.iterations() * (int64_t)count);
+}
+BENCHMARK(BM_MallocFree)->Arg(1)->Arg(64)->Arg(1024);
+
+// --- Timer Wheel ---
+
+static const uint64_t NsPerMs = 1000000ull;
+
+static void Fired(TimerNode *node, void *context)
+{
+	benchmark::DoNotOptimize(node);
+	(*(size_t *)context)++;
+}
+
+// Fill a wheel with count timers spread over the next minute, as a loop with that many idle connections has.
+static void FillWheel(TimerWheel &wheel, vector<TimerNode> &nodes, uint64_t start)
+{
+	for (size_t i = 0; i < nodes.size(); i++)
+		wheel.Schedule(&nodes[i], start + (uint64_t)(i * 7919 % 60000) * NsPerMs);
+}
+
+// Schedule and cancel one timer next to range(0) others: the cost of a connection opening and closing.
+static void BM_TimerScheduleCancel(benchmark::State &state)
+{
+	TimerWheel wheel;
+	vector<TimerNode> nodes((size_t)state.range(0));
+	uint64_t start = MetricsClock();
+	TimerNode node;
+	uint64_t delay = 0;
+
+	FillWheel(wheel, nodes, start);
+
+	for (auto _ : state)
+	{
+		wheel.Schedule(&node, start + (1000 + delay) * NsPerMs);
+		wheel.Cancel(&node);
+		delay = (delay + 37) % 30000;
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TimerScheduleCancel)->Arg(0)->Arg(1000)->Arg(100000);
+
+// Move a scheduled timer to a later deadline, as an eager idle timeout would on every read.
+static void BM_TimerReschedule(benchmark::State &state)
+{
+	TimerWheel wheel;
+	vector<TimerNode> nodes((size_t)state.range(0));
+	uint64_t start = MetricsClock();
+	size_t next = 0;
+	uint64_t delay = 0;
+
+	FillWheel(wheel, nodes, start);
+
+	for (auto _ : state)
+	{
+		wheel.Schedule(&nodes[next], start + (1000 + delay) * NsPerMs);
+
+		next = next + 1 < nodes.size() ? next + 1 : 0;
+		delay = (delay + 37) % 30000;
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TimerReschedule)->Arg(1000)->Arg(100000);
+
+// Schedule range(0) timers over a minute and advance the wheel through it in 10 ms steps,
+// firing and cascading every one of them. Items are timers fired.
+static void BM_TimerExpire(benchmark::State &state)
+{
+	size_t count = (size_t)state.range(0);
+	vector<TimerNode> nodes(count);
+	size_t fired = 0;
+
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		nodes.assign(count, TimerNode());
+		TimerWheel *wheel = new TimerWheel();
+		uint64_t start = MetricsClock();
+		FillWheel(*wheel, nodes, start);
+		state.ResumeTiming();
+
+		for (uint64_t t = 0; t <= 60000 + 2 * TIMER_WHEEL_TICK_MS; t += TIMER_WHEEL_TICK_MS)
+			wheel->Advance(start + t * NsPerMs, Fired, &fired);
+
+		state.PauseTiming();
+		delete wheel;
+		state.ResumeTiming();
+	}
+
+	if (fired != (size_t)state.iterations() * count)
+		state.SkipWithError("not every timer fired");
+
+	state.SetItemsProcessed(state.iterations() * (int64_t)count);
+}
+BENCHMARK(BM_TimerExpire)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+// --- Tracing ---
+
+// Record one event into a trace ring of range(0) events: the cost of a trace point with tracing on.
+static void BM_TraceRecord(benchmark::State &state)
+{
+	TraceRing ring;
+
+	if (!ring.Init((size_t)state.range(0), 0, "."))
+	{
+		state.SkipWithError("out of memory");
+		return;
+	}
+
+	uint32_t connection = 0;
+
+	for (auto _ : state)
+	{
+		ring.Record(TRACE_READ, connection++, SMALL_FRAME);
+		benchmark::ClobberMemory();
+	}
+
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TraceRecord)->Arg(4096)->Arg(1 << 20);
+
+// --- Loopback Echo ---
+
+static void EchoFrame(IoLoop &loop, Connection &conn, const char *payload, size_t len, void *)
+{
+	loop.Send(conn, payload - FRAME_HEADER_SIZE, len + FRAME_HEADER_SIZE);
+}
+
+static void RunServer(IoLoop *loop, SOCKET ListenSocket)
+{
+	// The loop is set up on the thread that runs it: an io_uring ring only accepts
+	// submissions from the thread that created it.
+	if (!loop->Init() || !loop->AddListener(ListenSocket))
+		abort();
+
+	loop->SetMessageHandler(EchoFrame, NULL);
+	loop->Run();
+}
+
+static bool SendAll(SOCKET s, const char *data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t iResult = send(s, data, len, MSG_NOSIGNAL);
+
+		if (iResult <= 0)
+			return false;
+
+		data += iResult;
+		len -= (size_t)iResult;
+	}
+
+	return true;
+}
+
+static bool RecvAll(SOCKET s, char *data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t iResult = recv(s, data, len, 0);
+
+		if (iResult <= 0)
+			return false;
+
+		data += iResult;
+		len -= (size_t)iResult;
+	}
+
+	return true;
+}
+
+// One iteration sends a frame of range(0) bytes on each of range(1) connections and waits for all
+// the echoes: with one connection a pure round trip, with many a loop iteration serving a batch.
+// The server loop runs on its own thread, so the time is wall-clock time per round.
+static void BM_Echo(benchmark::State &state, const char *backend)
+{
+	uint32_t size = (uint32_t)state.range(0);
+	size_t connections = (size_t)state.range(1);
+
+	// Port 0: the kernel picks a free port, so back-to-back runs never collide.
+	SOCKET ListenSocket = CreateListenSocket("0", SOMAXCONN, false);
+
+	if (ListenSocket == INVALID_SOCKET)
+	{
+		state.SkipWithError("listen failed");
+		return;
+	}
+
+	struct sockaddr_in address;
+	socklen_t addressLength = sizeof(address);
+	getsockname(ListenSocket, (struct sockaddr *)&address, &addressLength);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	IoLoop *loop = CreateIoLoop(backend);
+	thread server(RunServer, loop, ListenSocket);
+
+	vector<SOCKET> sockets;
+
+	for (size_t i = 0; i < connections; i++)
+	{
+		SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		int noDelay = 1;
+
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+		if (connect(s, (struct sockaddr *)&address, sizeof(address)) == SOCKET_ERROR)
+		{
+			state.SkipWithError("connect failed");
+			closesocket(s);
+			break;
+		}
+
+		sockets.push_back(s);
+	}
+
+	vector<char> frame(FRAME_HEADER_SIZE + (size_t)size, 'x');
+	vector<char> reply(frame.size());
+
+	EncodeFrameHeader(frame.data(), size);
+
+	for (auto _ : state)
+	{
+		if (sockets.size() < connections)
+			break;
+
+		for (size_t i = 0; i < sockets.size(); i++)
+		{
+			if (!SendAll(sockets[i], frame.data(), frame.size()))
+				state.SkipWithError("send failed");
+		}
+
+		for (size_t i = 0; i < sockets.size(); i++)
+		{
+			if (!RecvAll(sockets[i], reply.data(), reply.size()))
+				state.SkipWithError("recv failed");
+		}
+	}
+
+	state.SetItemsProcessed(state.iterations() * (int64_t)connections);
+	state.SetBytesProcessed(state.iterations() * (int64_t)(connections * frame.size() * 2));
+	state.SetLabel(backend);
+
+	// Drain wakes the loop from this thread; with no request in flight every connection closes at once.
+	loop->Drain(1000);
+	server.join();
+
+	for (size_t i = 0; i < sockets.size(); i++)
+		closesocket(sockets[i]);
+
+	delete loop;
+}
+BENCHMARK_CAPTURE(BM_Echo, epoll, "epoll")
+	->ArgsProduct({ { SMALL_FRAME, 1024, 16 * 1024 }, { 1, 16, 64 } })->ArgNames({ "size", "conns" })->UseRealTime();
+BENCHMARK_CAPTURE(BM_Echo, uring, "uring")
+	->ArgsProduct({ { SMALL_FRAME, 1024, 16 * 1024 }, { 1, 16, 64 } })->ArgNames({ "size", "conns" })->UseRealTime();
+
+// --- Running the Suite ---
+
+// Commit checked out in the directory the suite runs from, recorded in the JSON context
+// so results can be matched to the code they measured.
+static string GitCommit(void)
+{
+	FILE *git = popen("git describe --always --dirty 2>/dev/null", "r");
+	char line[128] = "";
+
+	if (git == NULL)
+		return "unknown";
+
+	if (fgets(line, sizeof(line), git) == NULL)
+		line[0] = '\0';
+
+	pclose(git);
+
+	line[strcspn(line, "\r\n")] = '\0';
+
+	return line[0] != '\0' ? line : "unknown";
+}
+
+int main(int argc, char **argv)
+{
+	// Results always go to a JSON file as well as the console, so every run can be compared later.
+	vector<char *> args(argv, argv + argc);
+	string out = "--benchmark_out=microbench.json";
+	string format = "--benchmark_out_format=json";
+	bool hasOut = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strncmp(argv[i], "--benchmark_out=", 16) == 0)
+			hasOut = true;
+	}
+
+	if (!hasOut)
+	{
+		args.push_back(&out[0]);
+		args.push_back(&format[0]);
+	}
+
+	int count = (int)args.size();
+
+	benchmark::Initialize(&count, args.data());
+
+	if (benchmark::ReportUnrecognizedArguments(count, args.data()))
+		return 1;
+
+	benchmark::AddCustomContext("git_commit", GitCommit());
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+
+	return 0;
+}
@@ -0,0 +1,396 @@
+#include "../Common/Socket.h"
+#include "../Common/IoLoop.h"
+#include "../Common/Frame.h"
+#include "../Common/Tls.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#ifndef __linux__
+#error "The TLS echo benchmark requires Linux"
+#endif
+
+#include <poll.h>
+#include <openssl/ssl.h>
+
+// Build (Linux): g++ -O2 -std=c++17 -pthread TlsEcho.cpp ../Common/*.cpp -lssl -lcrypto -o tlsecho
+
+// TLS echo benchmark: throughput and server CPU cost per byte of echoing frames over loopback
+// - in plaintext, through the server's event loop (with bulk echo, so the epoll backend splices);
+// - with userspace TLS: OpenSSL encrypts and decrypts every record, and the server echoes with
+//   SSL_read/SSL_write on a thread of its own, since the loops have no user space record layer;
+// - with kernel TLS: OpenSSL only runs the handshake, then the keys go to the kernel and the same
+//   event loop as in plaintext serves the connection, splice and all (IoLoop::SetTls).
+// Every run uses a fresh self-signed certificate, the same protocol version and cipher, one connection
+// and the same amount of data. The client runs in this process on another thread and also encrypts in
+// the mode of the run; only the CPU time of the server's thread is counted.
+
+// Command line options.
+struct BenchOptions
+{
+	const char *backend;
+	uint32_t frameSize;
+	uint64_t totalBytes;
+};
+
+enum EchoMode { ECHO_PLAIN, ECHO_USER_TLS, ECHO_KERNEL_TLS };
+
+static const char *ModeNames[] = { "plain", "user", "kernel" };
+
+static uint64_t Clock(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// --- Server Side ---
+
+static void EchoFrame(IoLoop &loop, Connection &conn, const char *payload, size_t len, void *)
+{
+	loop.Send(conn, payload - FRAME_HEADER_SIZE, len + FRAME_HEADER_SIZE);
+}
+
+// Plaintext and kernel TLS: the event loop, on the thread that created it (io_uring requires it).
+static void RunLoopServer(IoLoop *loop, SOCKET ListenSocket, SSL_CTX *context, uint64_t *cpuNs)
+{
+	if (!loop->Init() || !loop->AddListener(ListenSocket) || (context != NULL && !loop->SetTls(context)))
+		abort();
+
+	uint64_t start = Clock(CLOCK_THREAD_CPUTIME_ID);
+
+	loop->Run();
+
+	*cpuNs = Clock(CLOCK_THREAD_CPUTIME_ID) - start;
+}
+
+// Userspace TLS: one blocking connection, decrypted into a buffer and encrypted back out.
+static void RunUserTlsServer(SOCKET ListenSocket, SSL_CTX *context, uint64_t *cpuNs)
+{
+	uint64_t start = Clock(CLOCK_THREAD_CPUTIME_ID);
+	SOCKET ClientSocket = INVALID_SOCKET;
+	struct pollfd pfd;
+
+	pfd.fd = ListenSocket;
+	pfd.events = POLLIN;
+
+	// The listen socket is non-blocking.
+	while (ClientSocket == INVALID_SOCKET && poll(&pfd, 1, -1) >= 0)
+		ClientSocket = accept(ListenSocket, NULL, NULL);
+
+	TuneConnection(ClientSocket, SocketTuning());
+
+	SSL *ssl = SSL_new(context);
+	SSL_set_fd(ssl, ClientSocket);
+
+	if (SSL_accept(ssl) == 1)
+	{
+		vector<char> buffer(256 * 1024);
+
+		for (;;)
+		{
+			int received = SSL_read(ssl, buffer.data(), (int)buffer.size());
+
+			if (received <= 0 || SSL_write(ssl, buffer.data(), received) != received)
+				break;
+		}
+	}
+
+	SSL_free(ssl);
+	closesocket(ClientSocket);
+	closesocket(ListenSocket);
+
+	*cpuNs = Clock(CLOCK_THREAD_CPUTIME_ID) - start;
+}
+
+// --- Client Side ---
+
+// Non-blocking read or write on the client's end: plain socket calls (plaintext, or with the kernel doing
+// TLS) or OpenSSL. Returns the bytes moved, 0 at the end of the stream, -1 when the call would block and
+// -2 on an error.
+static ssize_t ClientRead(SOCKET s, SSL *ssl, char *buffer, size_t len)
+{
+	if (ssl == NULL)
+	{
+		ssize_t iResult = recv(s, buffer, len, 0);
+
+		if (iResult < 0)
+			return WouldBlock(WSAGetLastError()) ? -1 : -2;
+
+		return iResult;
+	}
+
+	int iResult = SSL_read(ssl, buffer, (int)len);
+
+	if (iResult > 0)
+		return iResult;
+
+	int error = SSL_get_error(ssl, iResult);
+
+	if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+		return -1;
+
+	return error == SSL_ERROR_ZERO_RETURN ? 0 : -2;
+}
+
+static ssize_t ClientWrite(SOCKET s, SSL *ssl, const char *data, size_t len)
+{
+	if (ssl == NULL)
+	{
+		ssize_t iResult = send(s, data, len, MSG_NOSIGNAL);
+
+		if (iResult < 0)
+			return WouldBlock(WSAGetLastError()) ? -1 : -2;
+
+		return iResult;
+	}
+
+	int iResult = SSL_write(ssl, data, (int)len);
+
+	if (iResult > 0)
+		return iResult;
+
+	int error = SSL_get_error(ssl, iResult);
+
+	return error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE ? -1 : -2;
+}
+
+// Send totalBytes worth of frames and read the echoes back on one thread, so one SSL session serves both
+// directions. Returns the bytes received.
+static uint64_t Pump(SOCKET s, SSL *ssl, const BenchOptions &options, uint64_t expected)
+{
+	vector<char> frame(FRAME_HEADER_SIZE + (size_t)options.frameSize, 'x');
+	vector<char> recvbuf(1024 * 1024);
+	uint64_t sent = 0, received = 0;
+	size_t offset = 0;
+
+	EncodeFrameHeader(frame.data(), options.frameSize);
+	SetNonBlocking(s);
+
+	while (received < expected)
+	{
+		bool progress = false;
+
+		if (sent < expected)
+		{
+			ssize_t iResult = ClientWrite(s, ssl, frame.data() + offset, frame.size() - offset);
+
+			if (iResult == -2)
+				break;
+
+			if (iResult > 0)
+			{
+				sent += (uint64_t)iResult;
+				offset = (offset + (size_t)iResult) % frame.size();
+				progress = true;
+			}
+		}
+
+		ssize_t iResult = ClientRead(s, ssl, recvbuf.data(), recvbuf.size());
+
+		if (iResult == 0 || iResult == -2)
+			break;
+
+		if (iResult > 0)
+		{
+			received += (uint64_t)iResult;
+			progress = true;
+		}
+
+		if (!progress)
+		{
+			struct pollfd pfd;
+			pfd.fd = s;
+			pfd.events = POLLIN | (sent < expected ? POLLOUT : 0);
+			poll(&pfd, 1, 1000);
+		}
+	}
+
+	return received;
+}
+
+// Echo totalBytes over one connection in the given mode and report the server's CPU time.
+static bool RunOnce(const BenchOptions &options, EchoMode mode, uint64_t &cpuNs, double &seconds)
+{
+	TlsMode tlsMode = mode == ECHO_USER_TLS ? TLS_USER : TLS_KERNEL;
+	SSL_CTX *serverContext = NULL;
+	SSL_CTX *clientContext = NULL;
+
+	if (mode != ECHO_PLAIN)
+	{
+		serverContext = CreateTlsServerContext(NULL, NULL, tlsMode);
+		clientContext = CreateTlsClientContext(NULL, tlsMode);
+
+		if (serverContext == NULL || clientContext == NULL)
+			return false;
+	}
+
+	// Port 0: the kernel picks a free port, so back-to-back runs never collide.
+	SOCKET ListenSocket = CreateListenSocket("0", SOMAXCONN, false);
+
+	if (ListenSocket == INVALID_SOCKET)
+		return false;
+
+	struct sockaddr_in address;
+	socklen_t addressLength = sizeof(address);
+	getsockname(ListenSocket, (struct sockaddr *)&address, &addressLength);
+
+	IoLoop *loop = NULL;
+	thread server;
+
+	if (mode == ECHO_USER_TLS)
+	{
+		server = thread(RunUserTlsServer, ListenSocket, serverContext, &cpuNs);
+	}
+	else
+	{
+		// Bulk echo for every frame: with epoll the payload is spliced, through kTLS when it is on.
+		loop = CreateIoLoop(options.backend);
+		loop->SetMessageHandler(EchoFrame, NULL);
+		loop->SetBulkEcho(options.frameSize);
+
+		server = thread(RunLoopServer, loop, ListenSocket, serverContext, &cpuNs);
+	}
+
+	SOCKET ConnectSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (connect(ConnectSocket, (struct sockaddr *)&address, sizeof(address)) == SOCKET_ERROR)
+	{
+		printf("connect failed with error: %d\n", WSAGetLastError());
+		abort();
+	}
+
+	TuneConnection(ConnectSocket, SocketTuning());
+
+	SSL *ssl = NULL;
+	bool ok = true;
+
+	if (mode != ECHO_PLAIN)
+	{
+		ssl = TlsConnect(clientContext, ConnectSocket, NULL, TLS_HANDSHAKE_TIMEOUT_MS);
+		ok = ssl != NULL;
+
+		if (ok && mode == ECHO_KERNEL_TLS)
+		{
+			ok = TlsHandOff(ssl);
+			ssl = NULL;
+
+			if (!ok)
+				printf("TLS keys were not handed to the kernel (kTLS missing or cipher not supported)\n");
+		}
+
+		if (ssl != NULL)
+			SSL_set_mode(ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	}
+
+	uint64_t expected = (options.totalBytes + FRAME_HEADER_SIZE + options.frameSize - 1) /
+		(FRAME_HEADER_SIZE + options.frameSize) * (FRAME_HEADER_SIZE + options.frameSize);
+	uint64_t start = Clock(CLOCK_MONOTONIC);
+	uint64_t received = ok ? Pump(ConnectSocket, ssl, options, expected) : 0;
+
+	seconds = (Clock(CLOCK_MONOTONIC) - start) / 1e9;
+
+	// Closing the connection ends the userspace server's read and wakes the loop, which then sees the stop request.
+	if (loop != NULL)
+		loop->Stop();
+
+	SSL_free(ssl);
+	closesocket(ConnectSocket);
+	server.join();
+
+	delete loop;
+	FreeTlsContext(serverContext);
+	FreeTlsContext(clientContext);
+
+	return received == expected;
+}
+
+static void PrintUsage(const char *program)
+{
+	printf("usage: %s [--backend epoll|uring] [--frame-size BYTES] [--total MB]\n", program);
+	printf("  --backend B         I/O backend of the server loop in the plaintext and kernel TLS runs (default epoll)\n");
+	printf("  --frame-size BYTES  payload size of every frame (default 1048576)\n");
+	printf("  --total MB          data echoed per run (default 2048)\n");
+}
+
+int __cdecl main(int argc, char **argv)
+{
+	BenchOptions options;
+	options.backend = "epoll";
+	options.frameSize = 1024 * 1024;
+	options.totalBytes = 2048ull * 1024 * 1024;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+			options.backend = argv[++i];
+		else if (strcmp(argv[i], "--frame-size") == 0 && i + 1 < argc)
+			options.frameSize = (uint32_t)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--total") == 0 && i + 1 < argc)
+			options.totalBytes = strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+		else
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (options.frameSize == 0 || options.frameSize > MAX_FRAME_SIZE || options.totalBytes == 0 ||
+		(strcmp(options.backend, "epoll") != 0 && strcmp(options.backend, "uring") != 0))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	if (SocketStartup() != 0)
+		return 1;
+
+	printf("Backend: %s  Frame size: %u bytes  Data per run: %llu MB\n", options.backend, options.frameSize,
+		(unsigned long long)(options.totalBytes / (1024 * 1024)));
+
+	double nsPerByte[3] = { 0.0, 0.0, 0.0 };
+
+	for (int mode = ECHO_PLAIN; mode <= ECHO_KERNEL_TLS; mode++)
+	{
+		// Without the kernel's tls module there is nothing to compare; the reason has been printed.
+		if (mode == ECHO_KERNEL_TLS && !KernelTlsAvailable())
+		{
+			printf("%-6s  skipped\n", ModeNames[mode]);
+			continue;
+		}
+
+		uint64_t cpuNs = 0;
+		double seconds;
+
+		if (!RunOnce(options, (EchoMode)mode, cpuNs, seconds))
+		{
+			printf("%s run failed\n", ModeNames[mode]);
+			SocketCleanup();
+			return 1;
+		}
+
+		// Bytes crossing the server in both directions.
+		double bytes = 2.0 * (double)options.totalBytes;
+
+		nsPerByte[mode] = (double)cpuNs / bytes;
+
+		printf("%-6s  %8.1f MB/s  server CPU %6.3f ns/byte\n", ModeNames[mode],
+			(double)options.totalBytes / seconds / 1e6, nsPerByte[mode]);
+	}
+
+	for (int mode = ECHO_USER_TLS; mode <= ECHO_KERNEL_TLS; mode++)
+	{
+		if (nsPerByte[mode] > 0.0 && nsPerByte[ECHO_PLAIN] > 0.0)
+			printf("%s TLS uses %.2fx the server CPU per byte of plaintext\n", ModeNames[mode], nsPerByte[mode] / nsPerByte[ECHO_PLAIN]);
+	}
+
+	SocketCleanup();
+
+	return 0;
+}
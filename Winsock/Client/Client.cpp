@@ -1,224 +1,1498 @@
-#define WIN32_LEAN_AND_MEAN
-
-#include <windows.h>
-#include <winsock2.h>
-#include <ws2tcpip.h>
+#include "../Common/Platform.h"
+#include "../Common/Socket.h"
+#include "../Common/Frame.h"
+#include "../Common/Histogram.h"
+#include "../Common/UdpLoop.h"
+#include "../Common/Connector.h"
+#include "../Common/Tls.h"
+#include "../Common/LocalTransport.h"
 #include <stdlib.h>
 #include <stdio.h>
-#include <iostream>
+#include <string.h>
+#include <time.h>
+#include <deque>
+#include <random>
+#include <thread>
+#include <vector>
 using namespace std;
 
+#ifndef __linux__
+#error "The load generator requires Linux epoll"
+#endif
+
+#include <sys/epoll.h>
+
 // http://msdn.microsoft.com/en-us/library/windows/desktop/bb530750(v=vs.85).aspx
 // http://msdn.microsoft.com/en-us/library/windows/desktop/ms737591(v=vs.85).aspx
 
-// Need to link with Ws2_32.lib, Mswsock.lib, and Advapi32.lib
-#pragma comment (lib, "Ws2_32.lib")
-#pragma comment (lib, "Mswsock.lib")
-#pragma comment (lib, "AdvApi32.lib")
+// Build (Linux): g++ -O2 -std=c++17 -pthread Client.cpp ../Common/Socket.cpp ../Common/Frame.cpp ../Common/BufferPool.cpp ../Common/Histogram.cpp ../Common/Tuning.cpp ../Common/UdpLoop.cpp ../Common/Resolver.cpp ../Common/Connector.cpp ../Common/Tls.cpp ../Common/LocalTransport.cpp -lssl -lcrypto -o client
 
-#define DEFAULT_BUFLEN 512
-#define DEFAULT_PORT "27015"
+// Load generator for the echo server.
+// Every request is one length-prefixed frame; the response is the same frame echoed back.
+// Two modes are supported:
+// - Closed loop (default): each connection keeps --pipeline requests in flight and sends the next
+//   request as soon as a response arrives. This measures the throughput ceiling.
+// - Open loop (--rate R): requests are scheduled at a fixed rate of R per second regardless of how
+//   fast responses come back. Latency is measured from the time a request was scheduled to be sent,
+//   not from when it actually went out, so a stalled server shows up as queueing delay instead of
+//   silently lowering the offered load (coordinated omission).
+// With --udp every request is one datagram instead, sent and received in batches with sendmmsg and
+// recvmmsg, and each of the --connections UDP sockets keeps --pipeline datagrams in flight. 
+// Datagrams can be lost, so this mode runs closed loop only and reports the loss and the packet 
+// rate it reached, which with enough sockets in flight is the server's packets-per-second ceiling.
+// Connections are set up with the non-blocking resolver and happy-eyeballs connector (Connector.h), 
+// all of a worker's connections at once; --hosts and --dns-server point name resolution elsewhere.
+// With --tls every connection runs a TLS handshake once it is connected and then hands its keys to the 
+// kernel (kTLS), so the request and response path below stays plain send and recv, encrypted by the kernel.
+// With --transport unix, shm or auto the connections go to the server's Unix domain socket instead of the 
+// TCP port and negotiate their transport there (LocalTransport.h): the socket itself, or shared-memory 
+// rings that carry the same frames, so a client on the server's host bypasses the TCP/IP stack.
 
-// __cdecl is the default calling convention for C and C++ programs.
-// Because the stack is cleaned up by the caller, it can do vararg functions. 
-// The __cdecl calling convention creates larger executables than __stdcall, 
-// because it requires each function call to include stack cleanup code.
-// This specifier is Microsoft-specific and we should not use them if we want to write portable code.
-// http://www.codeproject.com/Articles/1388/Calling-Conventions-Demystified
+// Seconds to wait for outstanding responses after the test window closes.
+#define DRAIN_SECONDS 2.0
 
-int __cdecl main(int argc, char **argv) 
-{
-	// All processes (applications or DLLs) that call Winsock functions must initialize 
-	// the use of the Windows Sockets DLL before making other Winsock functions calls. 
-	// This also makes certain that Winsock is supported on the system.
-    WSADATA wsaData;
-
-	// Declare a SOCKET object called ConnectSocket for connecting to server.
-    SOCKET ConnectSocket = INVALID_SOCKET;
-
-	// Declare two pointers to and an object of addrinfo type that contains a sockaddr structure. 
-	// The information specified in the sockaddr structure includes:
-	// - The IP address of the server that the client will try to connect to.
-	// - The port number on the server that the client will connect to. 
-	//   This port was specified as port 27015 when the client called the getaddrinfo function.
-
-	int iResult;
-    struct addrinfo *result = NULL, *ptr = NULL, hints;
-    char *sendbuf = "Hello from Winsock client. This is a test message.\0";
-    char recvbuf[DEFAULT_BUFLEN];
-    int const recvbuflen = DEFAULT_BUFLEN;
-    
-	// Validate the parameters
-	// if (argc != 2) 
-	// {
-	//	   printf("usage: %s server-name\n", argv[0]);
-	//     return 1;
-	// }
+// Every request datagram starts with the time it was sent, which the echo brings back: a reply can 
+// be timed without matching it to its request, whatever was lost or reordered on the way.
+#define UDP_TIMESTAMP_SIZE 8
 
-    // Initialize Winsock
-    iResult = WSAStartup(MAKEWORD(2,2), &wsaData);
+// A UDP socket that received nothing for this long has lost its datagrams in flight; its window is refilled.
+#define UDP_LOSS_TIMEOUT_NS 200000000ull
+
+// How long a worker waiting for responses on shared-memory connections polls their rings before it
+// goes to sleep in epoll_wait and has the server ring the doorbell.
+#define DEFAULT_SHM_SPIN_US 50
+
+// How the connections reach the server: TCP, or the server's Unix domain socket (--unix) with the
+// transport negotiated there; auto accepts either local transport and falls back to TCP without a server there.
+enum TransportKind { TRANSPORT_TCP, TRANSPORT_UNIX, TRANSPORT_SHM, TRANSPORT_AUTO };
+
+enum SizeKind { SIZE_FIXED, SIZE_UNIFORM, SIZE_EXPONENTIAL };
+
+// Distribution of request payload sizes.
+struct SizeSpec
+{
+	SizeKind kind;
+	uint32_t min;
+	uint32_t max;
+	double mean;
+};
+
+// Command line options.
+struct ClientOptions
+{
+	const char *host;
+	const char *port;
+	int connections;
+	int pipeline;
+	int threads;
+
+	// Requests per second across all connections; 0 selects closed-loop mode.
+	double rate;
+
+	double duration;
+	SizeSpec size;
+	bool json;
+
+	// Send datagrams instead of frames; optionally as UDP_SEGMENT trains, optionally receiving with UDP_GRO.
+	bool udp;
+	bool udpGso;
+	bool udpGro;
+
+	// Socket buffer sizes, TCP_NODELAY, TCP_QUICKACK and SO_BUSY_POLL of the client connections.
+	SocketTuning tuning;
+
+	// Name resolution (hosts file, DNS server) and connection setup (attempt delay, timeout, family).
+	ResolverOptions resolver;
+	ConnectOptions connect;
+
+	// Talk TLS to the server, verifying its certificate against tlsCa if given; the context is shared by the workers.
+	bool tls;
+	const char *tlsCa;
+	SSL_CTX *tlsContext;
+
+	// Transport, the server's Unix domain socket, and the polling time of shared-memory connections.
+	TransportKind transport;
+	const char *unixPath;
+	int spinUs;
+};
+
+// One request that has been scheduled and not yet answered.
+struct Request
+{
+	// Time the request was scheduled (open loop) or sent (closed loop), in nanoseconds.
+	uint64_t start;
+	uint32_t size;
+};
+
+// Per-connection state of the load generator.
+struct ClientConnection
+{
+	SOCKET socket;
+
+	// Requests sent and awaiting their echo, oldest first; the server answers in order.
+	deque<Request> inflight;
+
+	// Open loop only: requests whose scheduled time has passed but that could not be sent yet
+	// because the connection already has --pipeline requests in flight.
+	deque<Request> waiting;
+
+	vector<char> output;
+	size_t outputOffset;
+	bool writeBlocked;
+
+	// Set once the server closed the connection or it failed; the connection is skipped afterwards.
+	bool closed;
+
+	FrameDecoder decoder;
+
+	// Rings of a shared-memory connection, whose socket then only carries doorbells; NULL otherwise.
+	ShmChannel *shm;
+};
+
+// Results of one worker thread, merged after all workers finish.
+struct WorkerResult
+{
+	Histogram *latency;
+	uint64_t requests;
+	uint64_t errors;
+	uint64_t bytesSent;
+	uint64_t bytesReceived;
+	bool connectFailed;
+
+	// UDP only: datagrams sent. Those never answered, sent minus requests, were lost.
+	uint64_t datagramsSent;
+
+	// Transport the connections ended up with: a LOCAL_TRANSPORT_* value, or 0 for TCP.
+	unsigned transport;
+};
+
+// One UDP socket of the load generator, connected to the server so the kernel filters replies by source.
+struct UdpFlow
+{
+	SOCKET socket;
+
+	// Datagrams sent and not answered yet (an estimate once datagrams have been lost).
+	int inflight;
+	uint64_t lastReply;
+
+	// Set when the server port is unreachable; the flow is skipped afterwards.
+	bool closed;
+};
+
+// Everything a worker thread needs; each worker owns its connections outright.
+struct Worker
+{
+	const ClientOptions *options;
+	int connections;
+	double rate;
+
+	vector<ClientConnection *> conns;
+	vector<UdpFlow> flows;
+	size_t shmConnections;
+	int epollFd;
+	BufferPool pool;
+	mt19937_64 random;
+
+	// Frame currently being decoded belongs to this connection.
+	ClientConnection *current;
+	uint64_t now;
+	bool sending;
+
+	WorkerResult result;
+};
+
+// Largest request payload accepted by --size.
+#define MAX_REQUEST_SIZE (1024 * 1024)
+
+// Request payloads are sent from this zero-filled block; the echo server does not look at the content.
+static const char Payload[MAX_REQUEST_SIZE] = { 0 };
+
+static uint64_t NowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void PrintUsage(const char *program)
+{
+	printf("usage: %s [options]\n", program);
+	printf("  --host H          server name or address (default localhost)\n");
+	printf("  --port P          server port (default %s)\n", DEFAULT_PORT);
+	printf("  --connections N   number of connections (default 1)\n");
+	printf("  --pipeline D      requests in flight per connection (default 1)\n");
+	printf("  --threads T       worker threads; connections are split between them (default 1)\n");
+	printf("  --size SPEC       payload size: N, MIN-MAX (uniform) or exp:MEAN (default 64)\n");
+	printf("  --rate R          open loop at R requests/s in total (default: closed loop)\n");
+	printf("  --duration S      test duration in seconds (default 10)\n");
+	printf("  --json            also print the summary as a JSON object\n");
+	printf("  --udp             send each request as a UDP datagram (closed loop; sizes %d to %d bytes)\n", UDP_TIMESTAMP_SIZE, UDP_MAX_PAYLOAD);
+	printf("  --udp-gso         with --udp and a fixed --size: send datagram trains with UDP_SEGMENT\n");
+	printf("  --udp-gro         with --udp: receive coalesced echoes with UDP_GRO\n");
+	printf("  --connect-timeout MS  give up on connection setup, name resolution included, after MS (default %d)\n", CONNECT_TIMEOUT_MS);
+	printf("  --attempt-delay MS    head start of each connection attempt before the next address is tried (default %d)\n", CONNECT_ATTEMPT_DELAY_MS);
+	printf("  --family 4|6      connect over IPv4 or IPv6 only (default: race both)\n");
+	printf("  --hosts FILE      hosts file consulted before DNS (default /etc/hosts)\n");
+	printf("  --dns-server A    DNS server address[:port] (default: first nameserver of /etc/resolv.conf)\n");
+	printf("  --tls             connect with TLS and let the kernel (kTLS) encrypt the requests\n");
+	printf("  --tls-ca FILE     with --tls: verify the server's certificate against the PEM CA file (default: no check)\n");
+	printf("  --transport T     tcp (default); unix or shm: connect to the server's Unix domain socket and move the\n");
+	printf("                    frames over it or through shared-memory rings; auto: whichever the server offers\n");
+	printf("                    there, or TCP if no server listens on it\n");
+	printf("  --unix PATH       the server's Unix domain socket (default %s)\n", DEFAULT_UNIX_PATH);
+	printf("  --spin-us US      with shared memory: poll for responses for US microseconds before sleeping\n");
+	printf("                    (default %d, 0 on a single CPU, where polling only holds the server up)\n", DEFAULT_SHM_SPIN_US);
+	printf("  --profile NAME    socket tuning profile: latency or throughput\n");
+	printf("  --config FILE     socket tuning file (see the server's usage for the setting names)\n");
+	printf("  --rcvbuf, --sndbuf, --nodelay, --quickack, --busy-poll   individual socket settings\n");
+}
+
+static bool ParseSize(const char *spec, SizeSpec &size)
+{
+	unsigned long a, b;
+	double mean;
+	char tail;
 
-    if (iResult != 0) 
+	if (sscanf(spec, "exp:%lf%c", &mean, &tail) == 1 && mean >= 1.0)
 	{
-        printf("WSAStartup failed with error: %d\n", iResult);
-        return 1;
-    }
+		size.kind = SIZE_EXPONENTIAL;
+		size.mean = mean;
+		size.min = 0;
+		size.max = MAX_REQUEST_SIZE;
+		return true;
+	}
+
+	if (sscanf(spec, "%lu-%lu%c", &a, &b, &tail) == 2 && a <= b && b <= MAX_REQUEST_SIZE)
+	{
+		size.kind = SIZE_UNIFORM;
+		size.min = (uint32_t)a;
+		size.max = (uint32_t)b;
+		return true;
+	}
+
+	if (sscanf(spec, "%lu%c", &a, &tail) == 1 && a <= MAX_REQUEST_SIZE)
+	{
+		size.kind = SIZE_FIXED;
+		size.min = size.max = (uint32_t)a;
+		return true;
+	}
 
+	return false;
+}
 
-	// --- Creating a Socket for the Client ---
+static bool ParseOptions(int argc, char **argv, ClientOptions &options)
+{
+	options.host = "localhost";
+	options.port = DEFAULT_PORT;
+	options.connections = 1;
+	options.pipeline = 1;
+	options.threads = 1;
+	options.rate = 0.0;
+	options.duration = 10.0;
+	options.size.kind = SIZE_FIXED;
+	options.size.min = options.size.max = 64;
+	options.size.mean = 0.0;
+	options.json = false;
+	options.udp = false;
+	options.udpGso = false;
+	options.udpGro = false;
+	options.tls = false;
+	options.tlsCa = NULL;
+	options.tlsContext = NULL;
+	options.transport = TRANSPORT_TCP;
+	options.unixPath = DEFAULT_UNIX_PATH;
+	options.spinUs = thread::hardware_concurrency() > 1 ? DEFAULT_SHM_SPIN_US : 0;
+	DefaultTuning(options.tuning);
+	DefaultResolverOptions(options.resolver);
+	DefaultConnectOptions(options.connect);
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool hasValue = i + 1 < argc;
 
-	// Initialize sockaddr structure. 
-	// For this application, the Internet address family is unspecified so that either an IPv6 or IPv4 address can be returned. 
-	// The application requests the socket type to be a stream socket for the TCP protocol.
-    ZeroMemory(&hints, sizeof(hints));
+		if (strcmp(argv[i], "--host") == 0 && hasValue)
+			options.host = argv[++i];
+		else if (strcmp(argv[i], "--port") == 0 && hasValue)
+			options.port = argv[++i];
+		else if (strcmp(argv[i], "--connections") == 0 && hasValue)
+			options.connections = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--pipeline") == 0 && hasValue)
+			options.pipeline = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--threads") == 0 && hasValue)
+			options.threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--rate") == 0 && hasValue)
+			options.rate = atof(argv[++i]);
+		else if (strcmp(argv[i], "--duration") == 0 && hasValue)
+			options.duration = atof(argv[++i]);
+		else if (strcmp(argv[i], "--size") == 0 && hasValue)
+		{
+			if (!ParseSize(argv[++i], options.size))
+				return false;
+		}
+		else if (strcmp(argv[i], "--json") == 0)
+			options.json = true;
+		else if (strcmp(argv[i], "--udp") == 0)
+			options.udp = true;
+		else if (strcmp(argv[i], "--udp-gso") == 0)
+			options.udpGso = true;
+		else if (strcmp(argv[i], "--udp-gro") == 0)
+			options.udpGro = true;
+		else if (strcmp(argv[i], "--tls") == 0)
+			options.tls = true;
+		else if (strcmp(argv[i], "--tls-ca") == 0 && hasValue)
+			options.tlsCa = argv[++i];
+		else if (strcmp(argv[i], "--transport") == 0 && hasValue)
+		{
+			i++;
 
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
+			if (strcmp(argv[i], "tcp") == 0)
+				options.transport = TRANSPORT_TCP;
+			else if (strcmp(argv[i], "unix") == 0)
+				options.transport = TRANSPORT_UNIX;
+			else if (strcmp(argv[i], "shm") == 0)
+				options.transport = TRANSPORT_SHM;
+			else if (strcmp(argv[i], "auto") == 0)
+				options.transport = TRANSPORT_AUTO;
+			else
+				return false;
+		}
+		else if (strcmp(argv[i], "--unix") == 0 && hasValue)
+			options.unixPath = argv[++i];
+		else if (strcmp(argv[i], "--spin-us") == 0 && hasValue)
+			options.spinUs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--connect-timeout") == 0 && hasValue)
+			options.connect.timeoutMs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--attempt-delay") == 0 && hasValue)
+			options.connect.attemptDelayMs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--family") == 0 && hasValue)
+		{
+			i++;
 
+			if (strcmp(argv[i], "4") == 0)
+				options.connect.family = AF_INET;
+			else if (strcmp(argv[i], "6") == 0)
+				options.connect.family = AF_INET6;
+			else
+				return false;
+		}
+		else if (strcmp(argv[i], "--hosts") == 0 && hasValue)
+			options.resolver.hostsFile = argv[++i];
+		else if (strcmp(argv[i], "--dns-server") == 0 && hasValue)
+			options.resolver.server = argv[++i];
+		else if (strcmp(argv[i], "--config") == 0 && hasValue)
+		{
+			if (!LoadTuningFile(argv[++i], options.tuning))
+				return false;
+		}
+		else if (strncmp(argv[i], "--", 2) == 0 && hasValue && SetTuningOption(argv[i] + 2, argv[i + 1], options.tuning))
+			i++;
+		else
+			return false;
+	}
 
-    // --- Resolving the Server Address and Port ---
+	if (options.connections < 1 || options.pipeline < 1 || options.threads < 1 ||
+		options.rate < 0.0 || options.duration <= 0.0 || options.connect.timeoutMs <= 0)
+		return false;
 
-	// Call the getaddrinfo function requesting the IP address for the server name passed on the command line. 
-	// The TCP port on the server that the client will connect to is defined by DEFAULT_PORT as 27015 in this sample. 
-	// The getaddrinfo function returns its value as an integer that is checked for errors.
+	if ((options.udpGso || options.udpGro) && !options.udp)
+		return false;
 
-	// The getaddrinfo function is used to determine the values in the sockaddr structure. 
-	// In this example, the first IP address returned by the getaddrinfo function is used to specify 
-	// the sockaddr structure passed to the connect. If the connect call fails to the first IP address, 
-	// then try the next addrinfo structure in the linked list returned from the getaddrinfo function.
+	if ((options.tls && options.udp) || (options.tlsCa != NULL && !options.tls) || options.spinUs < 0)
+		return false;
 
-	// iResult = getaddrinfo(argv[1], DEFAULT_PORT, &hints, &result);
-	iResult = getaddrinfo("localhost", DEFAULT_PORT, &hints, &result);
-    
-    if ( iResult != 0 ) 
+	if (options.transport != TRANSPORT_TCP && (options.udp || options.tls))
 	{
-        printf("getaddrinfo failed with error: %d\n", iResult);
-        WSACleanup();
-        return 1;
-    }
+		printf("--transport cannot be combined with --udp or --tls\n");
+		return false;
+	}
 
-	// Attempt to connect to the first address returned by the call to getaddrinfo until one succeeds.
-    for(ptr = result; ptr != NULL; ptr = ptr->ai_next) 
-	{
-		// Create a SOCKET object for connecting to server.
-		// Call the socket function and return its value to the ConnectSocket variable. 
-		// For this application, use the first IP address returned by the call to getaddrinfo function 
-		// that matched the address family, socket type, and protocol specified in the hints parameter. 
-		// In this example, a TCP stream socket was specified with a socket type of SOCK_STREAM and 
-		// a protocol of IPPROTO_TCP. The address family was left unspecified (AF_UNSPEC), so the 
-		// returned IP address could either be an IPv6 or IPv4 address for the server.
-		// If the client application wants to connect using only IPv6 or IPv4, then the address family 
-		// needs to be set to AF_INET6 for IPv6 or AF_INET for IPv4 in the hints parameter.
-		// The parameters passed to the socket function can be changed for different implementations.
-        ConnectSocket = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
-        
-		// Check for errors to ensure that the socket is a valid socket.
-		// Error detection is a key part of successful networking code. 
-		// If the socket call fails, it returns INVALID_SOCKET. 
-		// The if statement is used to catch any errors that may have occurred while creating the socket. 
-		// WSAGetLastError returns an error number associated with the last error that occurred.
-		if (ConnectSocket == INVALID_SOCKET) 
-		{
-            printf("Socket failed with error: %ld\n", WSAGetLastError());
-            WSACleanup();
-            return 1;
-        }
-
-
-		// --- Connecting to a Server Socket ---
-
-		// For a client to communicate on a network, it must connect to a server.
-		// Call the connect function, passing the created socket and the sockaddr structure as parameters. 
-		// Try the next address returned by getaddrinfo if the connect call failed.
-        iResult = connect(ConnectSocket, ptr->ai_addr, (int)ptr->ai_addrlen);
-
-		// Check for general errors.
-        if (iResult == SOCKET_ERROR)
-		{
-            closesocket(ConnectSocket);
-            ConnectSocket = INVALID_SOCKET;
-            continue;
-        }
-
-		// Should really try the next address returned by getaddrinfo if the connect call failed.
-		// But for this example we just free the resources returned by getaddrinfo and print an error message.
-        break;
-    }
+	if (options.udp)
+	{
+		if (options.rate > 0.0)
+		{
+			printf("--rate is not supported with --udp\n");
+			return false;
+		}
 
-    freeaddrinfo(result);
+		if (options.size.kind == SIZE_EXPONENTIAL)
+			options.size.max = UDP_MAX_PAYLOAD;
 
-    if (ConnectSocket == INVALID_SOCKET) 
+		if (options.size.max > UDP_MAX_PAYLOAD || options.size.max < UDP_TIMESTAMP_SIZE)
+		{
+			printf("UDP requests must be %d to %d bytes\n", UDP_TIMESTAMP_SIZE, UDP_MAX_PAYLOAD);
+			return false;
+		}
+
+		if (options.udpGso && options.size.kind != SIZE_FIXED)
+		{
+			printf("--udp-gso needs a fixed --size: every datagram of a train has the same size\n");
+			return false;
+		}
+	}
+
+	if (options.threads > options.connections)
+		options.threads = options.connections;
+
+	return true;
+}
+
+static uint32_t NextSize(Worker &worker)
+{
+	const SizeSpec &size = worker.options->size;
+
+	if (size.kind == SIZE_UNIFORM)
+		return uniform_int_distribution<uint32_t>(size.min, size.max)(worker.random);
+
+	if (size.kind == SIZE_EXPONENTIAL)
 	{
-        printf("Unable to connect to server!\n");
-        WSACleanup();
-        return 1;
-    }
+		double value = exponential_distribution<double>(1.0 / size.mean)(worker.random);
 
+		return value >= size.max ? size.max : (uint32_t)value;
+	}
 
-	// --- Sending and Receiving Data on the Client ---
+	return size.min;
+}
 
-    // Send an initial buffer.
-	// The send and recv functions both return an integer value of the number of bytes sent 
-	// or received, respectively, or an error. Each function also takes the same parameters: 
-	// the active socket, a char buffer, the number of bytes to send or receive, and any flags to use.
+// --- Connecting to the Server ---
 
-    iResult = send(ConnectSocket, sendbuf, (int)strlen(sendbuf), 0 );
+// Connection setup of one worker: the worker that receives the connected sockets, and whether any setup failed.
+struct ConnectSetup
+{
+	Worker *worker;
+	bool failed;
+};
+
+// Start using a connected socket, with the rings of a shared-memory connection or NULL.
+static void AddConnection(Worker &worker, SOCKET ConnectSocket, ShmChannel *shm)
+{
+	ClientConnection *conn = new ClientConnection();
+	conn->socket = ConnectSocket;
+	conn->outputOffset = 0;
+	conn->writeBlocked = false;
+	conn->closed = false;
+	conn->shm = shm;
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = conn;
+	epoll_ctl(worker.epollFd, EPOLL_CTL_ADD, ConnectSocket, &ev);
+
+	worker.conns.push_back(conn);
+
+	if (shm != NULL)
+		worker.shmConnections++;
+}
 
-    if (iResult == SOCKET_ERROR) 
+static void OnConnected(SOCKET ConnectSocket, void *context)
+{
+	ConnectSetup *setup = (ConnectSetup *)context;
+	Worker &worker = *setup->worker;
+
+	if (ConnectSocket == INVALID_SOCKET)
 	{
-        printf("send failed with error: %d\n", WSAGetLastError());
-        closesocket(ConnectSocket);
-        WSACleanup();
-        return 1;
-    }
+		setup->failed = true;
+		return;
+	}
+
+	// Requests are small and latency sensitive: the default tuning disables Nagle's algorithm.
+	TuneConnection(ConnectSocket, worker.options->tuning);
+
+	// The handshake runs right here, one connection after another; setup is not part of the measurement. 
+	// Afterwards the socket carries plaintext for this process and the kernel does the record layer.
+	if (worker.options->tls)
+	{
+		SSL *ssl = TlsConnect(worker.options->tlsContext, ConnectSocket, worker.options->host, worker.options->connect.timeoutMs);
+
+		if (ssl == NULL || !TlsHandOff(ssl))
+		{
+			if (ssl != NULL)
+				printf("TLS keys were not handed to the kernel (kTLS missing or cipher not supported)\n");
+
+			closesocket(ConnectSocket);
+			setup->failed = true;
+			return;
+		}
+	}
+
+	AddConnection(worker, ConnectSocket, NULL);
+}
+
+// Open the worker's connections on the server's Unix domain socket, one after another: a local connect 
+// and the transport negotiation take microseconds. Returns false after printing the reason on failure.
+static bool ConnectLocal(Worker &worker)
+{
+	const ClientOptions &options = *worker.options;
+	unsigned offered = LOCAL_TRANSPORT_UNIX | LOCAL_TRANSPORT_SHM;
+
+	if (options.transport == TRANSPORT_UNIX)
+		offered = LOCAL_TRANSPORT_UNIX;
+	else if (options.transport == TRANSPORT_SHM)
+		offered = LOCAL_TRANSPORT_SHM;
+
+	for (int i = 0; i < worker.connections; i++)
+	{
+		unsigned transport;
+		ShmChannel *shm;
+		SOCKET ConnectSocket = LocalConnect(options.unixPath, offered, options.connect.timeoutMs, &transport, &shm);
+
+		if (ConnectSocket == INVALID_SOCKET)
+			return false;
+
+		AddConnection(worker, ConnectSocket, shm);
+		worker.result.transport = transport;
+	}
+
+	return true;
+}
+
+// Open all of the worker's connections at once. The name is looked up once (the other connections
+// find it in the cache) and every connection races its own attempts, so setting up N connections
+// takes about as long as setting up one, and an unreachable address costs one attempt delay.
+static bool ConnectAll(Worker &worker)
+{
+	const ClientOptions &options = *worker.options;
+
+	if (options.transport != TRANSPORT_TCP)
+	{
+		if (ConnectLocal(worker))
+			return true;
+
+		// Without a server on the Unix domain socket, auto goes on over TCP; once one answered it is there.
+		if (options.transport != TRANSPORT_AUTO || !worker.conns.empty())
+			return false;
+
+		printf("No server on %s, connecting over TCP\n", options.unixPath);
+	}
+
+	Connector connector;
+
+	if (!connector.Init(options.resolver, options.connect, options.tuning))
+		return false;
+
+	ConnectSetup setup;
+	setup.worker = &worker;
+	setup.failed = false;
+
+	for (int i = 0; i < worker.connections; i++)
+		connector.Connect(options.host, options.port, OnConnected, &setup);
+
+	while (connector.Active() > 0)
+		connector.Poll(options.connect.timeoutMs);
+
+	return !setup.failed;
+}
+
+// Shared-memory connection: write queued requests into the ring until it is full; the server reads them in place. If it is asleep, 
+// one doorbell wakes it for everything written. On a full ring the rest waits for the server's doorbell.
+static void FlushShm(Worker &worker, ClientConnection *conn)
+{
+	ShmRing &ring = conn->shm->toServer;
+	bool written = false;
+
+	while (conn->outputOffset < conn->output.size())
+	{
+		size_t copied = ring.Write(conn->output.data() + conn->outputOffset, conn->output.size() - conn->outputOffset);
+
+		conn->outputOffset += copied;
+		worker.result.bytesSent += copied;
+		written = written || copied > 0;
+
+		if (conn->outputOffset < conn->output.size() && ring.ProducerSleep())
+			break;
+	}
+
+	if (conn->outputOffset == conn->output.size())
+	{
+		conn->output.clear();
+		conn->outputOffset = 0;
+	}
+
+	if (written && ring.WakeConsumer())
+		RingDoorbell(conn->socket);
+}
+
+// Write queued requests until the kernel stops taking them.
+static bool Flush(Worker &worker, ClientConnection *conn)
+{
+	if (conn->shm != NULL)
+	{
+		FlushShm(worker, conn);
+		return true;
+	}
+
+	while (conn->outputOffset < conn->output.size())
+	{
+		ssize_t iResult = send(conn->socket, conn->output.data() + conn->outputOffset,
+			conn->output.size() - conn->outputOffset, MSG_NOSIGNAL);
+
+		if (iResult >= 0)
+		{
+			conn->outputOffset += (size_t)iResult;
+			worker.result.bytesSent += (uint64_t)iResult;
+			continue;
+		}
+
+		int error = WSAGetLastError();
+
+		if (error == EINTR)
+			continue;
+
+		if (!WouldBlock(error))
+		{
+			printf("send failed with error: %d\n", error);
+			return false;
+		}
+
+		// Ask for EPOLLOUT until the backlog has been written.
+		if (!conn->writeBlocked)
+		{
+			struct epoll_event ev;
+			ev.events = EPOLLIN | EPOLLOUT;
+			ev.data.ptr = conn;
+			epoll_ctl(worker.epollFd, EPOLL_CTL_MOD, conn->socket, &ev);
+			conn->writeBlocked = true;
+		}
+
+		return true;
+	}
+
+	conn->output.clear();
+	conn->outputOffset = 0;
+
+	if (conn->writeBlocked)
+	{
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = conn;
+		epoll_ctl(worker.epollFd, EPOLL_CTL_MOD, conn->socket, &ev);
+		conn->writeBlocked = false;
+	}
+
+	return true;
+}
+
+// Stop using a failed connection: everything in flight or waiting on it is lost.
+static void CloseConnection(Worker &worker, ClientConnection *conn)
+{
+	worker.result.errors += conn->inflight.size() + conn->waiting.size();
+	conn->inflight.clear();
+	conn->waiting.clear();
+	conn->output.clear();
+	conn->outputOffset = 0;
+	conn->closed = true;
+	epoll_ctl(worker.epollFd, EPOLL_CTL_DEL, conn->socket, NULL);
+}
+
+// Queue one request frame; it is written by the next Flush.
+static void QueueRequest(Worker &worker, ClientConnection *conn, uint64_t start)
+{
+	Request request;
+	request.start = start;
+	request.size = NextSize(worker);
+
+	char header[FRAME_HEADER_SIZE];
+	EncodeFrameHeader(header, request.size);
+
+	conn->output.insert(conn->output.end(), header, header + FRAME_HEADER_SIZE);
+	conn->output.insert(conn->output.end(), Payload, Payload + request.size);
+	conn->inflight.push_back(request);
+}
+
+// One echoed frame arrived: complete the oldest request of the connection.
+static void OnResponse(const char *, size_t len, void *context)
+{
+	Worker &worker = *(Worker *)context;
+	ClientConnection *conn = worker.current;
+
+	if (conn->inflight.empty())
+	{
+		worker.result.errors++;
+		return;
+	}
+
+	Request request = conn->inflight.front();
+	conn->inflight.pop_front();
+
+	if (len != request.size)
+		worker.result.errors++;
+
+	worker.result.latency->Record(worker.now - request.start);
+	worker.result.requests++;
+
+	if (!worker.sending)
+		return;
+
+	// Keep the pipeline full: the next waiting request in open loop, a fresh one in closed loop.
+	if (worker.rate > 0.0)
+	{
+		if (!conn->waiting.empty())
+		{
+			Request next = conn->waiting.front();
+			conn->waiting.pop_front();
+			QueueRequest(worker, conn, next.start);
+		}
+	}
+	else
+	{
+		QueueRequest(worker, conn, worker.now);
+	}
+}
+
+// --- Shared-Memory Connections ---
+
+// Hand the responses in the connection's ring to the decoder. Returns whether there were any.
+static bool ReceiveShm(Worker &worker, ClientConnection *conn)
+{
+	ShmRing &ring = conn->shm->toClient;
+	bool received = false;
+	const char *data;
+	size_t len;
+
+	while (!conn->closed && (len = ring.Peek(&data)) > 0)
+	{
+		worker.result.bytesReceived += len;
+		worker.current = conn;
+
+		if (!conn->decoder.Feed(&worker.pool, data, len, OnResponse, &worker))
+			worker.result.errors++;
+
+		ring.Consume(len);
+		received = true;
+	}
+
+	if (received && ring.WakeProducer())
+		RingDoorbell(conn->socket);
+
+	return received;
+}
+
+// Whether a response is waiting in any ring, polling for up to spinUs while requests are outstanding. 
+// Before returning false every ring's waiting flag is raised, so the epoll_wait that follows is woken 
+// by the server's doorbell; a response that arrived meanwhile makes it return true instead.
+static bool PollShm(Worker &worker, int spinUs)
+{
+	uint64_t spinEnd = NowNs() + (uint64_t)spinUs * 1000ull;
+
+	for (;;)
+	{
+		bool waiting = false;
+
+		for (size_t c = 0; c < worker.conns.size(); c++)
+		{
+			ClientConnection *conn = worker.conns[c];
+			const char *data;
+
+			if (conn->shm == NULL || conn->closed)
+				continue;
+
+			if (conn->shm->toClient.Peek(&data) > 0)
+				return true;
+
+			waiting = waiting || !conn->inflight.empty();
+		}
+
+		if (!waiting || spinUs == 0 || NowNs() >= spinEnd)
+			break;
+
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	}
+
+	bool ready = false;
+
+	for (size_t c = 0; c < worker.conns.size(); c++)
+	{
+		ClientConnection *conn = worker.conns[c];
+
+		if (conn->shm != NULL && !conn->closed && !conn->shm->toClient.ConsumerSleep())
+			ready = true;
+	}
+
+	return ready;
+}
 
-    printf("Bytes Sent: %ld\n", iResult);
+static void RunWorker(Worker &worker)
+{
+	const ClientOptions &options = *worker.options;
+
+	worker.epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (!ConnectAll(worker))
+	{
+		printf("Unable to connect to server!\n");
+		worker.result.connectFailed = true;
+		return;
+	}
+
+	uint64_t begin = NowNs();
+	uint64_t end = begin + (uint64_t)(options.duration * 1e9);
+	uint64_t deadline = end + (uint64_t)(DRAIN_SECONDS * 1e9);
+
+	// Open loop: the interval between scheduled requests of this worker.
+	uint64_t interval = worker.rate > 0.0 ? (uint64_t)(1e9 / worker.rate) : 0;
+	uint64_t nextDue = begin;
+	size_t nextConn = 0;
+
+	worker.sending = true;
+
+	// Closed loop: fill every pipeline up front.
+	if (worker.rate == 0.0)
+	{
+		for (size_t c = 0; c < worker.conns.size(); c++)
+		{
+			for (int d = 0; d < options.pipeline; d++)
+				QueueRequest(worker, worker.conns[c], begin);
+		}
+	}
+
+	vector<char> recvbuf(BUFFER_CAPACITY);
+	struct epoll_event events[256];
+
+	for (;;)
+	{
+		uint64_t now = NowNs();
+
+		if (worker.sending && now >= end)
+			worker.sending = false;
+
+		// Open loop: issue every request whose scheduled time has passed.
+		while (worker.sending && interval > 0 && nextDue <= now)
+		{
+			ClientConnection *conn = worker.conns[nextConn];
+			nextConn = (nextConn + 1) % worker.conns.size();
+
+			Request request;
+			request.start = nextDue;
+			request.size = 0;
+
+			if (conn->inflight.size() < (size_t)options.pipeline)
+				QueueRequest(worker, conn, nextDue);
+			else
+				conn->waiting.push_back(request);
+
+			nextDue += interval;
+		}
+
+		// Coalesce: every request queued during this iteration leaves in one send per connection.
+		bool outstanding = false;
+
+		for (size_t c = 0; c < worker.conns.size(); c++)
+		{
+			ClientConnection *conn = worker.conns[c];
+
+			if (conn->closed)
+				continue;
+
+			if (!Flush(worker, conn))
+				CloseConnection(worker, conn);
+
+			if (!conn->inflight.empty() || !conn->waiting.empty())
+				outstanding = true;
+		}
+
+		if (!worker.sending && (!outstanding || now >= deadline))
+			break;
+
+		// Sleep until the next scheduled request at the latest; round down so requests are not late.
+		int timeout = 100;
+
+		if (worker.sending && interval > 0)
+			timeout = nextDue > now ? (int)((nextDue - now) / 1000000) : 0;
+
+		// Responses on shared-memory connections come without an event: poll the rings first, and only 
+		// sleep (to be woken by a doorbell) if there is nothing. Sockets are checked when the rings are quiet.
+		bool ready = worker.shmConnections > 0 && PollShm(worker, timeout != 0 ? options.spinUs : 0);
+
+		int n = ready ? 0 : epoll_wait(worker.epollFd, events, 256, timeout);
+
+		worker.now = NowNs();
+
+		for (size_t c = 0; c < worker.conns.size() && worker.shmConnections > 0; c++)
+		{
+			if (worker.conns[c]->shm != NULL)
+				ReceiveShm(worker, worker.conns[c]);
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			ClientConnection *conn = (ClientConnection *)events[i].data.ptr;
+
+			if (conn->closed)
+				continue;
+
+			if ((events[i].events & EPOLLOUT) && !Flush(worker, conn))
+			{
+				CloseConnection(worker, conn);
+				continue;
+			}
+
+			if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+				continue;
+
+			// Drain the socket; the decoder completes one request per echoed frame.
+			for (;;)
+			{
+				ssize_t iResult = recv(conn->socket, recvbuf.data(), recvbuf.size(), 0);
+
+				// On a shared-memory connection the socket only carries doorbells, read above through the rings.
+				if (iResult > 0 && conn->shm != NULL)
+					continue;
+
+				if (iResult > 0)
+				{
+					worker.result.bytesReceived += (uint64_t)iResult;
+					worker.current = conn;
+
+					if (!conn->decoder.Feed(&worker.pool, recvbuf.data(), (size_t)iResult, OnResponse, &worker))
+						worker.result.errors++;
+
+					continue;
+				}
+
+				if (iResult < 0 && (WouldBlock(WSAGetLastError()) || WSAGetLastError() == EINTR))
+					break;
+
+				// The server closed the connection or failed: everything in flight is lost.
+				if (iResult < 0)
+					printf("recv failed with error: %d\n", WSAGetLastError());
+				else
+					printf("Connection closed\n");
+
+				CloseConnection(worker, conn);
+				break;
+			}
+		}
+	}
+
+	// Requests still unanswered when the drain period ends count as errors.
+	for (size_t c = 0; c < worker.conns.size(); c++)
+	{
+		ClientConnection *conn = worker.conns[c];
 
-	// --- Disconnecting the Client ---
-    
-	// When the client is done sending data to the server, the shutdown function 
-	// can be called specifying SD_SEND to shutdown the sending side of the socket. 
-	// This allows the server to release some of the resources for this socket. 
-	// The client application can still receive data on the socket.
-	// Shutdown the connection since no more data will be sent.
-	// Shutdown the send half of the connection since no more data will be sent.
-    iResult = shutdown(ConnectSocket, SD_SEND);
+		worker.result.errors += conn->inflight.size() + conn->waiting.size();
 
-    if (iResult == SOCKET_ERROR) 
+		// --- Disconnecting the Client ---
+
+		// When the client is done sending data to the server, the shutdown function
+		// can be called specifying SD_SEND to shutdown the sending side of the socket.
+		shutdown(conn->socket, SD_SEND);
+		closesocket(conn->socket);
+		conn->decoder.Clear(&worker.pool);
+		UnmapShmChannel(conn->shm);
+		delete conn;
+	}
+
+	close(worker.epollFd);
+}
+
+// --- Datagram Mode ---
+
+// Resolve the server and connect one UDP socket to it. Connecting a UDP socket sends nothing; it
+// fixes the destination, so sends need no address, and makes the kernel drop datagrams from anyone else.
+static SOCKET ConnectUdpSocket(const ClientOptions &options)
+{
+	struct addrinfo *result = NULL, hints;
+
+	ZeroMemory(&hints, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
+
+	int iResult = getaddrinfo(options.host, options.port, &hints, &result);
+
+	if (iResult != 0)
+	{
+		printf("getaddrinfo failed with error: %d\n", iResult);
+		return INVALID_SOCKET;
+	}
+
+	SOCKET UdpSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+
+	if (UdpSocket == INVALID_SOCKET)
+	{
+		printf("Socket failed with error: %d\n", WSAGetLastError());
+		freeaddrinfo(result);
+		return INVALID_SOCKET;
+	}
+
+	if (!TuneDatagramSocket(UdpSocket, options.tuning) ||
+		(options.udpGro && !EnableUdpGro(UdpSocket)) ||
+		connect(UdpSocket, result->ai_addr, (int)result->ai_addrlen) == SOCKET_ERROR ||
+		!SetNonBlocking(UdpSocket))
+	{
+		closesocket(UdpSocket);
+		UdpSocket = INVALID_SOCKET;
+	}
+
+	freeaddrinfo(result);
+
+	return UdpSocket;
+}
+
+// Returns false when the server cannot be reached (ICMP port unreachable).
+static bool UdpSendFailed(Worker &worker, UdpFlow &flow)
+{
+	int error = WSAGetLastError();
+
+	if (WouldBlock(error) || error == EINTR || error == ENOBUFS)
+		return true;
+
+	if (error == ECONNREFUSED)
+		printf("Server unreachable\n");
+	else
+		printf("send failed with error: %d\n", error);
+
+	worker.result.errors++;
+	flow.closed = true;
+	epoll_ctl(worker.epollFd, EPOLL_CTL_DEL, flow.socket, NULL);
+
+	return false;
+}
+
+// Top the flow's window up to --pipeline datagrams in flight.
+static void UdpFill(Worker &worker, UdpFlow &flow, vector<char> &train)
+{
+	const ClientOptions &options = *worker.options;
+
+	while (!flow.closed && flow.inflight < options.pipeline)
+	{
+		int want = options.pipeline - flow.inflight;
+		uint64_t now = NowNs();
+
+		if (options.udpGso)
+		{
+			// One send for a whole train of equally sized datagrams: the kernel (or the NIC) cuts it 
+			// into datagrams of segmentSize bytes, each with the send time at its start.
+			size_t segmentSize = options.size.min;
+			int count = want;
+
+			if (count > UDP_MAX_SEGMENTS)
+				count = UDP_MAX_SEGMENTS;
+
+			if ((size_t)count * segmentSize > UDP_MAX_PAYLOAD)
+				count = (int)(UDP_MAX_PAYLOAD / segmentSize);
+
+			for (int i = 0; i < count; i++)
+				memcpy(train.data() + (size_t)i * segmentSize, &now, UDP_TIMESTAMP_SIZE);
+
+			struct iovec iov;
+			iov.iov_base = train.data();
+			iov.iov_len = (size_t)count * segmentSize;
+
+			struct msghdr msg;
+			char control[UDP_SEGMENT_SPACE];
+			ZeroMemory(&msg, sizeof(msg));
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+
+			if (count > 1)
+				SetUdpSegment(&msg, control, (uint16_t)segmentSize);
+
+			if (sendmsg(flow.socket, &msg, 0) < 0)
+			{
+				UdpSendFailed(worker, flow);
+				return;
+			}
+
+			flow.inflight += count;
+			worker.result.datagramsSent += (uint64_t)count;
+			worker.result.bytesSent += iov.iov_len;
+			continue;
+		}
+
+		// One sendmmsg for up to UDP_BATCH datagrams. Each is its send time followed by zeros.
+		struct mmsghdr msgs[UDP_BATCH];
+		struct iovec iov[UDP_BATCH][2];
+		int count = want < UDP_BATCH ? want : UDP_BATCH;
+
+		for (int i = 0; i < count; i++)
+		{
+			uint32_t size = NextSize(worker);
+
+			if (size < UDP_TIMESTAMP_SIZE)
+				size = UDP_TIMESTAMP_SIZE;
+
+			iov[i][0].iov_base = &now;
+			iov[i][0].iov_len = UDP_TIMESTAMP_SIZE;
+			iov[i][1].iov_base = (void *)Payload;
+			iov[i][1].iov_len = size - UDP_TIMESTAMP_SIZE;
+
+			ZeroMemory(&msgs[i].msg_hdr, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov = iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 2;
+		}
+
+		int sent = sendmmsg(flow.socket, msgs, (unsigned)count, 0);
+
+		if (sent <= 0)
+		{
+			if (sent < 0)
+				UdpSendFailed(worker, flow);
+			return;
+		}
+
+		for (int i = 0; i < sent; i++)
+			worker.result.bytesSent += msgs[i].msg_len;
+
+		flow.inflight += sent;
+		worker.result.datagramsSent += (uint64_t)sent;
+
+		// The socket buffer is full; try again in the next iteration.
+		if (sent < count)
+			return;
+	}
+}
+
+// Receive every echo waiting on the flow's socket, UDP_BATCH datagrams (or GRO trains) per call.
+static void UdpDrain(Worker &worker, UdpFlow &flow, vector<char> &buffers, size_t bufferSize)
+{
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	char control[UDP_BATCH][CMSG_SPACE(sizeof(int))];
+
+	for (;;)
+	{
+		for (int i = 0; i < UDP_BATCH; i++)
+		{
+			iov[i].iov_base = buffers.data() + (size_t)i * bufferSize;
+			iov[i].iov_len = bufferSize;
+
+			ZeroMemory(&msgs[i].msg_hdr, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+
+			if (worker.options->udpGro)
+			{
+				msgs[i].msg_hdr.msg_control = control[i];
+				msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+			}
+		}
+
+		int n = recvmmsg(flow.socket, msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+
+		if (n < 0)
+		{
+			if (WSAGetLastError() == ECONNREFUSED)
+				UdpSendFailed(worker, flow);
+			return;
+		}
+
+		uint64_t now = NowNs();
+
+		for (int i = 0; i < n; i++)
+		{
+			size_t length = msgs[i].msg_len;
+			size_t segmentSize = worker.options->udpGro ? (size_t)UdpGroSegmentSize(&msgs[i].msg_hdr) : 0;
+
+			if (segmentSize == 0)
+				segmentSize = length;
+
+			worker.result.bytesReceived += length;
+
+			// A GRO train holds several echoes back to back, all but the last segmentSize bytes long.
+			for (size_t offset = 0; offset < length; offset += segmentSize)
+			{
+				uint64_t sentAt;
+
+				if (length - offset < UDP_TIMESTAMP_SIZE)
+				{
+					worker.result.errors++;
+					continue;
+				}
+
+				memcpy(&sentAt, (char *)iov[i].iov_base + offset, UDP_TIMESTAMP_SIZE);
+
+				worker.result.latency->Record(now - sentAt);
+				worker.result.requests++;
+
+				// Replies that arrive after their datagrams were written off as lost do not open the window further.
+				if (flow.inflight > 0)
+					flow.inflight--;
+			}
+		}
+
+		flow.lastReply = now;
+
+		if (n < UDP_BATCH)
+			return;
+	}
+}
+
+static void RunUdpWorker(Worker &worker)
+{
+	const ClientOptions &options = *worker.options;
+
+	worker.epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+	// Registered by address, so the vector must not move once the first flow is in the epoll set.
+	worker.flows.reserve(worker.connections);
+
+	for (int i = 0; i < worker.connections; i++)
+	{
+		UdpFlow flow;
+		flow.socket = ConnectUdpSocket(options);
+		flow.inflight = 0;
+		flow.lastReply = 0;
+		flow.closed = false;
+
+		if (flow.socket == INVALID_SOCKET)
+		{
+			printf("Unable to create UDP socket!\n");
+			worker.result.connectFailed = true;
+			break;
+		}
+
+		worker.flows.push_back(flow);
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = &worker.flows.back();
+		epoll_ctl(worker.epollFd, EPOLL_CTL_ADD, flow.socket, &ev);
+	}
+
+	// Receive buffers: one per datagram of a batch, or one per GRO train.
+	size_t bufferSize = options.udpGro ? UDP_GRO_BUFFER : options.size.max;
+	vector<char> buffers(bufferSize * UDP_BATCH);
+	vector<char> train(options.udpGso ? UDP_MAX_PAYLOAD : 0);
+
+	uint64_t begin = NowNs();
+	uint64_t end = begin + (uint64_t)(options.duration * 1e9);
+	uint64_t deadline = end + (uint64_t)(DRAIN_SECONDS * 1e9);
+	struct epoll_event events[256];
+
+	for (size_t f = 0; f < worker.flows.size(); f++)
+		worker.flows[f].lastReply = begin;
+
+	while (!worker.result.connectFailed)
+	{
+		uint64_t now = NowNs();
+		bool sending = now < end;
+		bool outstanding = false;
+
+		for (size_t f = 0; f < worker.flows.size(); f++)
+		{
+			UdpFlow &flow = worker.flows[f];
+
+			if (flow.closed)
+				continue;
+
+			// Nothing came back for a while: the datagrams in flight are gone. They count as lost 
+			// (sent but never received) and the window opens again.
+			if (flow.inflight > 0 && now - flow.lastReply > UDP_LOSS_TIMEOUT_NS)
+			{
+				flow.inflight = 0;
+				flow.lastReply = now;
+			}
+
+			if (sending)
+				UdpFill(worker, flow, train);
+
+			if (flow.inflight > 0)
+				outstanding = true;
+		}
+
+		if (!sending && (!outstanding || now >= deadline))
+			break;
+
+		// Wake up in time for the loss timeout even if nothing arrives.
+		int n = epoll_wait(worker.epollFd, events, 256, 10);
+
+		for (int i = 0; i < n; i++)
+		{
+			UdpFlow *flow = (UdpFlow *)events[i].data.ptr;
+
+			if (!flow->closed)
+				UdpDrain(worker, *flow, buffers, bufferSize);
+		}
+	}
+
+	for (size_t f = 0; f < worker.flows.size(); f++)
+		closesocket(worker.flows[f].socket);
+
+	close(worker.epollFd);
+}
+
+static void PrintSummary(const ClientOptions &options, const WorkerResult &total, double elapsed)
+{
+	const Histogram &latency = *total.latency;
+	double throughput = total.requests / elapsed;
+
+	const char *mode = options.rate > 0.0 ? "open-loop" : "closed-loop";
+
+	printf("Mode: %s  Connections: %d  Pipeline: %d  Threads: %d  Duration: %.2f s\n",
+		mode, options.connections, options.pipeline, options.threads, elapsed);
+
+	if (options.rate > 0.0)
+		printf("Target rate: %.0f req/s\n", options.rate);
+
+	printf("Requests: %llu  Errors: %llu\n", (unsigned long long)total.requests, (unsigned long long)total.errors);
+	printf("Throughput: %.1f req/s  %.2f MB/s sent  %.2f MB/s received\n", throughput,
+		total.bytesSent / elapsed / 1e6, total.bytesReceived / elapsed / 1e6);
+	printf("Latency (us): p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f  mean %.1f\n",
+		latency.Percentile(50.0) / 1e3, latency.Percentile(99.0) / 1e3, latency.Percentile(99.9) / 1e3,
+		latency.Max() / 1e3, latency.Mean() / 1e3);
+
+	// Every datagram sent and never echoed was lost on the way there or back. The received
+	// rate is the server's ceiling: offered load beyond it only turns into loss.
+	uint64_t lost = total.datagramsSent > total.requests ? total.datagramsSent - total.requests : 0;
+	double lostPercent = total.datagramsSent > 0 ? 100.0 * lost / total.datagramsSent : 0.0;
+
+	const char *transport = total.transport != 0 ? LocalTransportName(total.transport) : "tcp";
+
+	if (!options.udp && options.transport != TRANSPORT_TCP)
+		printf("Transport: %s\n", transport);
+
+	if (options.udp)
+	{
+		printf("Transport: udp%s%s\n", options.udpGso ? "  gso" : "", options.udpGro ? "  gro" : "");
+		printf("Datagrams: %llu sent  %llu received  %llu lost (%.2f%%)\n", (unsigned long long)total.datagramsSent,
+			(unsigned long long)total.requests, (unsigned long long)lost, lostPercent);
+		printf("Packet rate: %.0f pps sent  %.0f pps received\n", total.datagramsSent / elapsed, throughput);
+	}
+
+	if (options.json && options.udp)
+	{
+		printf("{\"transport\":\"udp\",\"connections\":%d,\"pipeline\":%d,\"threads\":%d,\"duration_s\":%.3f,"
+			"\"gso\":%s,\"gro\":%s,\"datagrams_sent\":%llu,\"datagrams_received\":%llu,\"lost\":%llu,"
+			"\"lost_percent\":%.3f,\"pps_sent\":%.1f,\"pps_received\":%.1f,\"errors\":%llu,"
+			"\"bytes_sent\":%llu,\"bytes_received\":%llu,"
+			"\"latency_us\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f,\"mean\":%.1f}}\n",
+			options.connections, options.pipeline, options.threads, elapsed,
+			options.udpGso ? "true" : "false", options.udpGro ? "true" : "false",
+			(unsigned long long)total.datagramsSent, (unsigned long long)total.requests, (unsigned long long)lost,
+			lostPercent, total.datagramsSent / elapsed, throughput, (unsigned long long)total.errors,
+			(unsigned long long)total.bytesSent, (unsigned long long)total.bytesReceived,
+			latency.Percentile(50.0) / 1e3, latency.Percentile(99.0) / 1e3, latency.Percentile(99.9) / 1e3,
+			latency.Max() / 1e3, latency.Mean() / 1e3);
+	}
+	else if (options.json)
+	{
+		printf("{\"mode\":\"%s\",\"transport\":\"%s\",\"connections\":%d,\"pipeline\":%d,\"threads\":%d,\"duration_s\":%.3f,"
+			"\"target_rate\":%.1f,\"requests\":%llu,\"errors\":%llu,\"throughput_rps\":%.1f,"
+			"\"bytes_sent\":%llu,\"bytes_received\":%llu,"
+			"\"latency_us\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f,\"mean\":%.1f}}\n",
+			mode, transport, options.connections, options.pipeline, options.threads, elapsed,
+			options.rate, (unsigned long long)total.requests, (unsigned long long)total.errors, throughput,
+			(unsigned long long)total.bytesSent, (unsigned long long)total.bytesReceived,
+			latency.Percentile(50.0) / 1e3, latency.Percentile(99.0) / 1e3, latency.Percentile(99.9) / 1e3,
+			latency.Max() / 1e3, latency.Mean() / 1e3);
+	}
+}
+
+// __cdecl is the default calling convention for C and C++ programs.
+// Because the stack is cleaned up by the caller, it can do vararg functions.
+// The __cdecl calling convention creates larger executables than __stdcall,
+// because it requires each function call to include stack cleanup code.
+// This specifier is Microsoft-specific and we should not use them if we want to write portable code.
+// http://www.codeproject.com/Articles/1388/Calling-Conventions-Demystified
+
+int __cdecl main(int argc, char **argv)
+{
+	ClientOptions options;
+
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+    // Initialize Winsock
+    if (SocketStartup() != 0)
 	{
-        printf("shutdown failed with error: %d\n", WSAGetLastError());
-        closesocket(ConnectSocket);
-        WSACleanup();
         return 1;
     }
 
-    // Receive data until the server closes the connection.
-    do {
+	if (options.tls)
+	{
+		if (!KernelTlsAvailable())
+			return 1;
 
-		// BLock until recv function returns
-        iResult = recv(ConnectSocket, recvbuf, recvbuflen, 0);
+		options.tlsContext = CreateTlsClientContext(options.tlsCa, TLS_KERNEL);
 
-        if ( iResult > 0 )
-            printf("Bytes received: %d\n", iResult);
-        else if ( iResult == 0 )
-            printf("Connection closed\n");
-        else
-            printf("recv failed with error: %d\n", WSAGetLastError());
+		if (options.tlsContext == NULL)
+			return 1;
+	}
 
-    } while( iResult > 0 );
+	// --- Sending and Receiving Data on the Client ---
 
-	// Cleanup
-	// When the client application is done receiving data, 
-	// the closesocket function is called to close the socket.
-    closesocket(ConnectSocket);
+	// Connections (and the open-loop rate) are split evenly across worker threads.
+	// Each worker runs its own event loop and records latencies into its own histogram.
+	vector<Worker *> workers;
+	vector<thread> threads;
 
-	// WSACleanup is used to terminate the use of the WS2_32 DLL.
-	// When the client application is completed using the Windows Sockets DLL, 
-	// the WSACleanup function is called to release resources.
-    WSACleanup();
+	for (int t = 0; t < options.threads; t++)
+	{
+		Worker *worker = new Worker();
+		worker->options = &options;
+		worker->connections = options.connections / options.threads + (t < options.connections % options.threads ? 1 : 0);
+		worker->rate = options.rate * worker->connections / options.connections;
+		worker->random.seed(12345 + t);
+		worker->current = NULL;
+		worker->now = 0;
+		worker->sending = false;
+		worker->result.latency = new Histogram();
+		worker->result.requests = 0;
+		worker->result.errors = 0;
+		worker->result.bytesSent = 0;
+		worker->result.bytesReceived = 0;
+		worker->result.connectFailed = false;
+		worker->result.datagramsSent = 0;
+		worker->result.transport = 0;
+		worker->shmConnections = 0;
+		workers.push_back(worker);
+	}
+
+	uint64_t begin = NowNs();
+
+	void (*run)(Worker &) = options.udp ? RunUdpWorker : RunWorker;
+
+	for (int t = 1; t < options.threads; t++)
+		threads.push_back(thread(run, ref(*workers[t])));
+
+	run(*workers[0]);
+
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
 
-	cin.get();
+	double elapsed = (NowNs() - begin) / 1e9;
+
+	if (elapsed > options.duration)
+		elapsed = options.duration;
+
+	// Merge the per-thread results.
+	WorkerResult total = workers[0]->result;
+	bool connectFailed = total.connectFailed;
+
+	for (size_t t = 1; t < workers.size(); t++)
+	{
+		const WorkerResult &r = workers[t]->result;
+
+		total.latency->Merge(*r.latency);
+		total.requests += r.requests;
+		total.errors += r.errors;
+		total.bytesSent += r.bytesSent;
+		total.bytesReceived += r.bytesReceived;
+		total.datagramsSent += r.datagramsSent;
+		connectFailed = connectFailed || r.connectFailed;
+	}
+
+	if (!connectFailed)
+		PrintSummary(options, total, elapsed);
+
+	for (size_t t = 0; t < workers.size(); t++)
+	{
+		delete workers[t]->result.latency;
+		delete workers[t];
+	}
+
+	FreeTlsContext(options.tlsContext);
+
+	// When the client application is completed using the Windows Sockets DLL,
+	// the WSACleanup function is called to release resources.
+    SocketCleanup();
 
-    return 0;
-}
\ No newline at end of file
+	// A non-zero exit code lets scripts and CI fail a run that lost requests.
+    return (connectFailed || total.requests == 0 || total.errors > 0) ? 1 : 0;
+}
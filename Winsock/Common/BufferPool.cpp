@@ -0,0 +1,83 @@
+#include "BufferPool.h"
+
+#include <stdlib.h>
+
+BufferPool::BufferPool()
+	: freeList(NULL), inUse(0)
+{
+}
+
+BufferPool::~BufferPool()
+{
+	for (size_t i = 0; i < slabs.size(); i++)
+	{
+#ifdef _WIN32
+		_aligned_free(slabs[i]);
+#else
+		free(slabs[i]);
+#endif
+	}
+}
+
+Buffer *BufferPool::Acquire(void)
+{
+	if (freeList == NULL && !Grow())
+		return NULL;
+
+	Buffer *buffer = freeList;
+	freeList = buffer->next;
+
+	buffer->next = NULL;
+	buffer->begin = 0;
+	buffer->end = 0;
+	inUse++;
+
+	return buffer;
+}
+
+void BufferPool::Release(Buffer *buffer)
+{
+	buffer->next = freeList;
+	freeList = buffer;
+	inUse--;
+}
+
+bool BufferPool::Reserve(size_t count)
+{
+	while (Capacity() < count)
+	{
+		if (!Grow())
+			return false;
+	}
+
+	return true;
+}
+
+bool BufferPool::Grow(void)
+{
+	// Slabs are page aligned so that every buffer starts on a cache line and 
+	// whole slabs can later be registered with the kernel if needed.
+	size_t slabSize = (size_t)POOL_BUFFER_SIZE * POOL_SLAB_BUFFERS;
+	void *slab = NULL;
+
+#ifdef _WIN32
+	slab = _aligned_malloc(slabSize, 4096);
+#else
+	if (posix_memalign(&slab, 4096, slabSize) != 0)
+		slab = NULL;
+#endif
+
+	if (slab == NULL)
+		return false;
+
+	slabs.push_back((char *)slab);
+
+	for (size_t i = POOL_SLAB_BUFFERS; i-- > 0; )
+	{
+		Buffer *buffer = (Buffer *)((char *)slab + i * POOL_BUFFER_SIZE);
+		buffer->next = freeList;
+		freeList = buffer;
+	}
+
+	return true;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Size of one pooled buffer including its header, and the number of buffers per slab.
+#define POOL_BUFFER_SIZE (16 * 1024)
+#define POOL_SLAB_BUFFERS 64
+
+// A fixed-size buffer handed out by BufferPool. The valid bytes are data[begin, end).
+// Buffers are linked through next to form queues without any extra allocation.
+struct Buffer
+{
+	Buffer *next;
+	uint32_t begin;
+	uint32_t end;
+	char data[POOL_BUFFER_SIZE - sizeof(Buffer *) - 2 * sizeof(uint32_t)];
+
+	size_t Length(void) const { return end - begin; }
+	size_t Space(void) const { return sizeof(data) - end; }
+};
+
+#define BUFFER_CAPACITY (sizeof(((Buffer *)0)->data))
+
+// Slab/arena allocator for I/O buffers owned by one thread (one event loop).
+// Connections borrow a buffer only while they actually hold bytes (a read in progress, a frame 
+// split across reads, unsent output) and give it back immediately afterwards, so idle connections 
+// hold no buffer memory at all and the working set stays proportional to active traffic. 
+// Released buffers are reused LIFO, so the next borrower gets the one that is still hot in cache.
+class BufferPool
+{
+public:
+	BufferPool();
+	~BufferPool();
+
+	// Hand out an empty buffer. Returns NULL only if a new slab cannot be allocated.
+	Buffer *Acquire(void);
+
+	void Release(Buffer *buffer);
+
+	// Pre-allocate slabs for at least count buffers, so the hot path never allocates.
+	bool Reserve(size_t count);
+
+	size_t InUse(void) const { return inUse; }
+	size_t Capacity(void) const { return slabs.size() * POOL_SLAB_BUFFERS; }
+
+private:
+	bool Grow(void);
+
+	std::vector<char *> slabs;
+	Buffer *freeList;
+	size_t inUse;
+};
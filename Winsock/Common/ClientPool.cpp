@@ -0,0 +1,625 @@
+#include "ClientPool.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+// Receive buffer of the pool's thread; replies are decoded in place from it.
+#define POOL_RECEIVE_BUFFER (64 * 1024)
+
+static const uint64_t NsPerMs = 1000000ull;
+
+ConnectionPool::ConnectionPool()
+	: epollFd(-1), wakeFd(-1), running(false), wakeSignaled(0), nextId(POOL_HEALTH_CHECK_ID), random(12345), current(NULL)
+{
+	DefaultTuning(tuning);
+	ZeroMemory(&stats, sizeof(stats));
+}
+
+ConnectionPool::~ConnectionPool()
+{
+	Stop();
+
+	for (size_t i = 0; i < connections.size(); i++)
+		delete connections[i];
+
+	if (epollFd != -1)
+		close(epollFd);
+
+	if (wakeFd != -1)
+		close(wakeFd);
+}
+
+bool ConnectionPool::Start(const char *host, const char *port, int count, const SocketTuning &socketTuning)
+{
+	struct addrinfo *result = NULL, hints;
+
+	ZeroMemory(&hints, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	int iResult = getaddrinfo(host, port, &hints, &result);
+
+	if (iResult != 0)
+	{
+		printf("getaddrinfo failed with error: %d\n", iResult);
+		return false;
+	}
+
+	// Keep every address: a connection that cannot reach one tries the next on its following attempt.
+	for (struct addrinfo *ptr = result; ptr != NULL; ptr = ptr->ai_next)
+	{
+		struct sockaddr_storage address;
+		memcpy(&address, ptr->ai_addr, ptr->ai_addrlen);
+		addresses.push_back(address);
+		addressLengths.push_back((socklen_t)ptr->ai_addrlen);
+	}
+
+	freeaddrinfo(result);
+
+	tuning = socketTuning;
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (epollFd == -1 || wakeFd == -1)
+	{
+		printf("epoll_create1/eventfd failed with error: %d\n", errno);
+		return false;
+	}
+
+	// The wakeup eventfd is the only registration without a connection.
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+
+	for (int i = 0; i < count; i++)
+	{
+		Connection *conn = new Connection();
+		conn->socket = INVALID_SOCKET;
+		conn->state = DISCONNECTED;
+		conn->outputOffset = 0;
+		conn->writeBlocked = false;
+		conn->lastActivity = 0;
+		conn->healthCheckPending = false;
+		conn->retryAt = 0;
+		conn->backoffMs = POOL_BACKOFF_MIN_MS;
+		conn->address = (size_t)i % addresses.size();
+		conn->protocolError = false;
+		connections.push_back(conn);
+	}
+
+	running = true;
+	thread = std::thread(&ConnectionPool::Run, this);
+
+	return true;
+}
+
+void ConnectionPool::Stop(void)
+{
+	if (!running)
+		return;
+
+	running = false;
+	Wake();
+	thread.join();
+
+	// Requests that raced with Stop and arrived after the thread's last look at the inbox.
+	MpscNode *node;
+
+	while ((node = inbox.Pop()) != NULL)
+		Complete((PendingRequest *)node, POOL_STOPPED, NULL, 0);
+}
+
+PoolStats ConnectionPool::Stats(void) const
+{
+	PoolStats copy;
+
+	copy.connects = CounterLoad(stats.connects);
+	copy.connectionsLost = CounterLoad(stats.connectionsLost);
+	copy.healthChecks = CounterLoad(stats.healthChecks);
+	copy.replies = CounterLoad(stats.replies);
+	copy.failed = CounterLoad(stats.failed);
+
+	return copy;
+}
+
+// --- Submitting Requests ---
+
+void ConnectionPool::Send(const char *payload, size_t len, ReplyCallback callback, void *context)
+{
+	if (len > MAX_FRAME_SIZE - REQUEST_ID_SIZE)
+	{
+		callback(POOL_TOO_LARGE, NULL, 0, context);
+		return;
+	}
+
+	// One allocation holds the request and its encoded frame, which is built here, on the caller's
+	// thread, so the pool's thread only copies finished frames into a connection's output.
+	size_t length = FRAME_HEADER_SIZE + REQUEST_ID_SIZE + len;
+	PendingRequest *request = (PendingRequest *)malloc(sizeof(PendingRequest) + length);
+
+	request->id = __atomic_add_fetch(&nextId, 1, __ATOMIC_RELAXED);
+	request->frame = (char *)(request + 1);
+	request->length = length;
+	request->callback = callback;
+	request->context = context;
+
+	EncodeFrameHeader(request->frame, (uint32_t)(REQUEST_ID_SIZE + len));
+	EncodeRequestId(request->frame + FRAME_HEADER_SIZE, request->id);
+	memcpy(request->frame + FRAME_HEADER_SIZE + REQUEST_ID_SIZE, payload, len);
+
+	if (!running)
+	{
+		Complete(request, POOL_STOPPED, NULL, 0);
+		return;
+	}
+
+	inbox.Push(request);
+	Wake();
+}
+
+static void FulfillPromise(PoolStatus status, const char *payload, size_t len, void *context)
+{
+	std::promise<PoolReply> *promise = (std::promise<PoolReply> *)context;
+
+	PoolReply reply;
+	reply.status = status;
+	reply.payload.assign(payload, payload + len);
+
+	promise->set_value(std::move(reply));
+	delete promise;
+}
+
+std::future<PoolReply> ConnectionPool::Request(const char *payload, size_t len)
+{
+	std::promise<PoolReply> *promise = new std::promise<PoolReply>();
+	std::future<PoolReply> future = promise->get_future();
+
+	Send(payload, len, FulfillPromise, promise);
+
+	return future;
+}
+
+void ConnectionPool::Wake(void)
+{
+	// Pairs with the reset in Run: either the pool's thread sees the request, or this sees the flag clear.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_exchange_n(&wakeSignaled, 1, __ATOMIC_SEQ_CST) == 0)
+	{
+		uint64_t one = 1;
+
+		if (write(wakeFd, &one, sizeof(one)) < 0)
+			printf("write failed with error: %d\n", errno);
+	}
+}
+
+void ConnectionPool::Complete(PendingRequest *request, PoolStatus status, const char *payload, size_t len)
+{
+	request->callback(status, payload, len, request->context);
+	free(request);
+}
+
+// --- Connections ---
+
+void ConnectionPool::Watch(Connection *conn, uint32_t events)
+{
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = conn;
+	epoll_ctl(epollFd, EPOLL_CTL_MOD, conn->socket, &ev);
+}
+
+void ConnectionPool::Connect(Connection *conn, uint64_t now)
+{
+	const struct sockaddr_storage &address = addresses[conn->address];
+
+	conn->socket = socket(address.ss_family, SOCK_STREAM, IPPROTO_TCP);
+
+	if (conn->socket == INVALID_SOCKET)
+	{
+		printf("Socket failed with error: %d\n", WSAGetLastError());
+		Fail(conn, now, NULL);
+		return;
+	}
+
+	// Buffer sizes must be set before connect; the connect itself must not block the pool's thread.
+	if (!TuneConnectSocket(conn->socket, tuning) || !SetNonBlocking(conn->socket))
+	{
+		Fail(conn, now, NULL);
+		return;
+	}
+
+	conn->state = CONNECTING;
+	conn->lastActivity = now;
+
+	struct epoll_event ev;
+	ev.events = EPOLLOUT;
+	ev.data.ptr = conn;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, conn->socket, &ev);
+
+	// The handshake completes in the background; EPOLLOUT reports its outcome.
+	if (connect(conn->socket, (const struct sockaddr *)&address, addressLengths[conn->address]) == SOCKET_ERROR &&
+		WSAGetLastError() != EINPROGRESS)
+	{
+		LOG_DEBUG("Pool connect failed with error: %d\n", WSAGetLastError());
+		Fail(conn, now, NULL);
+	}
+}
+
+void ConnectionPool::Fail(Connection *conn, uint64_t now, const char *reason)
+{
+	if (conn->state == CONNECTED)
+	{
+		printf("Pool connection lost: %s\n", reason);
+		CounterAdd(stats.connectionsLost, 1);
+	}
+
+	if (conn->socket != INVALID_SOCKET)
+	{
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->socket, NULL);
+		closesocket(conn->socket);
+		conn->socket = INVALID_SOCKET;
+	}
+
+	// Requests written to a connection that failed may have been executed; the caller decides whether to retry.
+	for (auto it = conn->inflight.begin(); it != conn->inflight.end(); ++it)
+	{
+		CounterAdd(stats.failed, 1);
+		Complete(it->second, POOL_CONNECTION_LOST, NULL, 0);
+	}
+
+	conn->inflight.clear();
+	conn->output.clear();
+	conn->outputOffset = 0;
+	conn->writeBlocked = false;
+	conn->decoder.Clear(NULL);
+	conn->healthCheckPending = false;
+	conn->protocolError = false;
+	conn->state = DISCONNECTED;
+
+	// Wait a random time between half the backoff and the whole backoff, so clients that lost
+	// the server together do not all reconnect at the same instant, then double the backoff.
+	random = random * 1664525u + 1013904223u;
+
+	uint32_t delay = conn->backoffMs / 2 + (random >> 8) % (conn->backoffMs / 2 + 1);
+
+	conn->retryAt = now + (uint64_t)delay * NsPerMs;
+	conn->backoffMs = conn->backoffMs * 2 > POOL_BACKOFF_MAX_MS ? POOL_BACKOFF_MAX_MS : conn->backoffMs * 2;
+	conn->address = (conn->address + 1) % addresses.size();
+}
+
+void ConnectionPool::OnWritable(Connection *conn, uint64_t now)
+{
+	if (conn->state == CONNECTING)
+	{
+		int error = 0;
+		socklen_t length = sizeof(error);
+
+		getsockopt(conn->socket, SOL_SOCKET, SO_ERROR, &error, &length);
+
+		if (error != 0)
+		{
+			LOG_DEBUG("Pool connect failed with error: %d\n", error);
+			Fail(conn, now, NULL);
+			return;
+		}
+
+		TuneConnection(conn->socket, tuning);
+
+		conn->state = CONNECTED;
+		conn->lastActivity = now;
+		CounterAdd(stats.connects, 1);
+
+		Watch(conn, EPOLLIN);
+		return;
+	}
+
+	if (!Flush(conn))
+		Fail(conn, now, "send failed");
+}
+
+// Write queued requests until the kernel stops taking them.
+bool ConnectionPool::Flush(Connection *conn)
+{
+	while (conn->outputOffset < conn->output.size())
+	{
+		ssize_t iResult = send(conn->socket, conn->output.data() + conn->outputOffset,
+			conn->output.size() - conn->outputOffset, MSG_NOSIGNAL);
+
+		if (iResult >= 0)
+		{
+			conn->outputOffset += (size_t)iResult;
+			continue;
+		}
+
+		int error = WSAGetLastError();
+
+		if (error == EINTR)
+			continue;
+
+		if (!WouldBlock(error))
+		{
+			LOG_DEBUG("Pool send failed with error: %d\n", error);
+			return false;
+		}
+
+		// Ask for EPOLLOUT until the backlog has been written.
+		if (!conn->writeBlocked)
+		{
+			Watch(conn, EPOLLIN | EPOLLOUT);
+			conn->writeBlocked = true;
+		}
+
+		return true;
+	}
+
+	conn->output.clear();
+	conn->outputOffset = 0;
+
+	if (conn->writeBlocked)
+	{
+		Watch(conn, EPOLLIN);
+		conn->writeBlocked = false;
+	}
+
+	return true;
+}
+
+void ConnectionPool::OnReadable(Connection *conn, uint64_t now)
+{
+	static thread_local char buffer[POOL_RECEIVE_BUFFER];
+
+	for (;;)
+	{
+		ssize_t iResult = recv(conn->socket, buffer, sizeof(buffer), 0);
+
+		if (iResult > 0)
+		{
+			conn->lastActivity = now;
+			current = conn;
+
+			if (!conn->decoder.Feed(NULL, buffer, (size_t)iResult, OnFrame, this) || conn->protocolError)
+			{
+				Fail(conn, now, "invalid reply");
+				return;
+			}
+
+			continue;
+		}
+
+		if (iResult == 0)
+		{
+			Fail(conn, now, "closed by the server");
+			return;
+		}
+
+		int error = WSAGetLastError();
+
+		if (error == EINTR)
+			continue;
+
+		if (!WouldBlock(error))
+			Fail(conn, now, "recv failed");
+
+		return;
+	}
+}
+
+void ConnectionPool::OnFrame(const char *payload, size_t len, void *context)
+{
+	ConnectionPool *pool = (ConnectionPool *)context;
+	Connection *conn = pool->current;
+
+	if (conn->protocolError)
+		return;
+
+	if (len < REQUEST_ID_SIZE)
+	{
+		conn->protocolError = true;
+		return;
+	}
+
+	uint64_t id = DecodeRequestId(payload);
+
+	// A reply of any kind shows the connection works end to end.
+	conn->backoffMs = POOL_BACKOFF_MIN_MS;
+
+	if (id == POOL_HEALTH_CHECK_ID)
+	{
+		conn->healthCheckPending = false;
+		return;
+	}
+
+	auto it = conn->inflight.find(id);
+
+	if (it == conn->inflight.end())
+	{
+		conn->protocolError = true;
+		return;
+	}
+
+	PendingRequest *request = it->second;
+	conn->inflight.erase(it);
+
+	CounterAdd(pool->stats.replies, 1);
+	pool->Complete(request, POOL_OK, payload + REQUEST_ID_SIZE, len - REQUEST_ID_SIZE);
+}
+
+// --- Scheduling ---
+
+void ConnectionPool::Enqueue(Connection *conn, PendingRequest *request)
+{
+	conn->output.insert(conn->output.end(), request->frame, request->frame + request->length);
+	conn->inflight[request->id] = request;
+}
+
+void ConnectionPool::Dispatch(void)
+{
+	// Each request goes to the connection with the fewest requests in flight, so a connection
+	// slowed down by a large reply (or a slow path) does not hold up the ones queued behind it.
+	while (!pending.empty())
+	{
+		Connection *best = NULL;
+
+		for (size_t i = 0; i < connections.size(); i++)
+		{
+			Connection *conn = connections[i];
+
+			if (conn->state != CONNECTED || conn->inflight.size() >= POOL_MAX_INFLIGHT)
+				continue;
+
+			if (best == NULL || conn->inflight.size() < best->inflight.size())
+				best = conn;
+		}
+
+		if (best == NULL)
+			return;
+
+		Enqueue(best, pending.front());
+		pending.pop_front();
+	}
+}
+
+void ConnectionPool::CheckConnections(uint64_t now)
+{
+	for (size_t i = 0; i < connections.size(); i++)
+	{
+		Connection *conn = connections[i];
+		uint64_t idle = now - conn->lastActivity;
+
+		switch (conn->state)
+		{
+		case DISCONNECTED:
+			if (now >= conn->retryAt)
+				Connect(conn, now);
+			break;
+
+		case CONNECTING:
+			if (idle > POOL_HEALTH_TIMEOUT_MS * NsPerMs)
+			{
+				LOG_DEBUG("Pool connect timed out\n");
+				Fail(conn, now, NULL);
+			}
+			break;
+
+		case CONNECTED:
+			if ((!conn->inflight.empty() || conn->healthCheckPending) && idle > POOL_HEALTH_TIMEOUT_MS * NsPerMs)
+			{
+				Fail(conn, now, "no reply from the server");
+			}
+			else if (!conn->healthCheckPending && idle > POOL_HEALTH_INTERVAL_MS * NsPerMs)
+			{
+				// An empty request: the server echoes the ID back like any other.
+				char frame[FRAME_HEADER_SIZE + REQUEST_ID_SIZE];
+				EncodeFrameHeader(frame, REQUEST_ID_SIZE);
+				EncodeRequestId(frame + FRAME_HEADER_SIZE, POOL_HEALTH_CHECK_ID);
+
+				conn->output.insert(conn->output.end(), frame, frame + sizeof(frame));
+				conn->healthCheckPending = true;
+				CounterAdd(stats.healthChecks, 1);
+			}
+			break;
+		}
+	}
+}
+
+void ConnectionPool::Run(void)
+{
+	struct epoll_event events[64];
+
+	CheckConnections(MetricsClock());
+
+	while (running)
+	{
+		int n = epoll_wait(epollFd, events, 64, POOL_TICK_MS);
+		uint64_t now = MetricsClock();
+
+		for (int i = 0; i < n; i++)
+		{
+			Connection *conn = (Connection *)events[i].data.ptr;
+
+			if (conn == NULL)
+			{
+				uint64_t count;
+
+				if (read(wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+					printf("read failed with error: %d\n", errno);
+
+				continue;
+			}
+
+			// A failed connect reports EPOLLERR; OnWritable reads the error.
+			if (conn->state == CONNECTING)
+			{
+				OnWritable(conn, now);
+				continue;
+			}
+
+			if (conn->state == CONNECTED && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+				OnReadable(conn, now);
+
+			if (conn->state == CONNECTED && (events[i].events & EPOLLOUT))
+				OnWritable(conn, now);
+		}
+
+		// Take the callers' requests. The flag is cleared first, so a request pushed after this
+		// point signals the eventfd again.
+		__atomic_store_n(&wakeSignaled, 0, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		MpscNode *node;
+
+		while ((node = inbox.Pop()) != NULL)
+			pending.push_back((PendingRequest *)node);
+
+		CheckConnections(now);
+		Dispatch();
+
+		// One send per connection per iteration carries every request queued on it.
+		for (size_t i = 0; i < connections.size(); i++)
+		{
+			Connection *conn = connections[i];
+
+			if (conn->state == CONNECTED && !conn->writeBlocked && !conn->output.empty() && !Flush(conn))
+				Fail(conn, now, "send failed");
+		}
+	}
+
+	// Fail whatever is left, so every callback runs exactly once.
+	uint64_t now = MetricsClock();
+
+	for (size_t i = 0; i < connections.size(); i++)
+	{
+		Connection *conn = connections[i];
+
+		for (auto it = conn->inflight.begin(); it != conn->inflight.end(); ++it)
+		{
+			CounterAdd(stats.failed, 1);
+			Complete(it->second, POOL_STOPPED, NULL, 0);
+		}
+
+		conn->inflight.clear();
+		conn->state = DISCONNECTED;
+		Fail(conn, now, NULL);
+	}
+
+	MpscNode *node;
+
+	while ((node = inbox.Pop()) != NULL)
+		pending.push_back((PendingRequest *)node);
+
+	for (size_t i = 0; i < pending.size(); i++)
+	{
+		CounterAdd(stats.failed, 1);
+		Complete(pending[i], POOL_STOPPED, NULL, 0);
+	}
+
+	pending.clear();
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#include "Platform.h"
+#include "Tuning.h"
+#include "Frame.h"
+#include "MpscQueue.h"
+#include "Metrics.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <future>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if __cplusplus >= 202002L
+#include <coroutine>
+#endif
+
+#ifndef __linux__
+#error "ConnectionPool requires Linux epoll"
+#endif
+
+// Requests one connection keeps in flight; more wait in the pool until a connection has room.
+#define POOL_MAX_INFLIGHT 128
+
+// A connection that has received nothing for this long is sent a health check (an empty request).
+#define POOL_HEALTH_INTERVAL_MS 1000
+
+// A connection that owes replies, or has not finished connecting, and has received nothing
+// for this long is considered dead: it is closed and its requests fail.
+#define POOL_HEALTH_TIMEOUT_MS 3000
+
+// Reconnect delay after the first failure, doubled on every further failure up to the maximum.
+#define POOL_BACKOFF_MIN_MS 50
+#define POOL_BACKOFF_MAX_MS 5000
+
+// Request ID of health checks. Requests are numbered from 1.
+#define POOL_HEALTH_CHECK_ID 0
+
+// Longest the pool's thread sleeps between looking at its timers, in milliseconds.
+#define POOL_TICK_MS 50
+
+enum PoolStatus
+{
+	POOL_OK,
+
+	// The connection carrying the request failed before the reply arrived. The request may or may
+	// not have reached the server; the pool does not resend it.
+	POOL_CONNECTION_LOST,
+
+	// The pool was stopped before the request was answered.
+	POOL_STOPPED,
+
+	// The payload is larger than a frame can carry; the request was not sent.
+	POOL_TOO_LARGE
+};
+
+// Called once per request with the reply payload (without the request ID), on the pool's thread.
+// The payload is only valid during the call. On failure payload is NULL and len is 0.
+typedef void (*ReplyCallback)(PoolStatus status, const char *payload, size_t len, void *context);
+
+// Reply of a request made through a future or a coroutine.
+struct PoolReply
+{
+	PoolStatus status;
+	std::vector<char> payload;
+};
+
+// Counters of a pool. Only the pool's thread writes them; Stats may be called from any thread.
+struct PoolStats
+{
+	// Connections established, and established connections that failed.
+	uint64_t connects;
+	uint64_t connectionsLost;
+	uint64_t healthChecks;
+
+	// Requests answered, and requests failed (lost with a connection or stopped).
+	uint64_t replies;
+	uint64_t failed;
+};
+
+// --- Client Connection Pool ---
+
+// Persistent connections to one server, shared by any number of threads. A request is handed to the
+// pool, which sends it on the connected connection with the fewest requests in flight, so requests
+// are pipelined and multiplexed over a few long-lived connections instead of paying a handshake (and
+// leaving a TIME_WAIT, which holds an ephemeral port) each. Every request carries an ID (see Frame.h)
+// and replies are matched by ID, so they may come back in any order.
+//
+// One thread per pool runs an epoll loop over its connections. Callers never touch a socket: Send
+// pushes the request onto a lock-free queue and wakes the pool's thread, which does all the I/O.
+// A connection that fails (error, close, or a missed health check) is closed, its requests fail
+// with POOL_CONNECTION_LOST, and it reconnects after an exponential backoff with jitter, so a server
+// that goes away is not hammered with connection attempts and reconnects of many clients spread out.
+class ConnectionPool
+{
+public:
+	ConnectionPool();
+	~ConnectionPool();
+
+	// Resolve the server and start connections to it on the pool's own thread. Returns false after
+	// printing the reason on failure. Connections that cannot be established yet keep retrying, so
+	// Start succeeds while the server is down, and requests wait until a connection is up.
+	bool Start(const char *host, const char *port, int connections, const SocketTuning &tuning);
+
+	// Fail every request still pending with POOL_STOPPED, close the connections and join the thread.
+	void Stop(void);
+
+	// --- Callback API ---
+
+	// Queue a request. Any thread may call this. callback runs exactly once, on the pool's thread
+	// (or on the calling thread, for a request made after Stop): it must not block, and may call Send again.
+	void Send(const char *payload, size_t len, ReplyCallback callback, void *context);
+
+	// --- Future API ---
+
+	// Queue a request and return a future for its reply. The payload is copied before this returns.
+	std::future<PoolReply> Request(const char *payload, size_t len);
+
+#if __cplusplus >= 202002L
+	// --- Coroutine API ---
+
+	// co_await pool.Call(payload, len) suspends until the reply arrives and yields a PoolReply.
+	// The coroutine resumes on the pool's thread, so it should hand the reply back to its own
+	// thread (or loop) before doing anything that blocks.
+	struct CallAwaiter
+	{
+		ConnectionPool *pool;
+		const char *payload;
+		size_t len;
+		std::coroutine_handle<> waiter;
+		PoolReply reply;
+
+		bool await_ready(void) const noexcept { return false; }
+
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			waiter = handle;
+			pool->Send(payload, len, Resume, this);
+		}
+
+		PoolReply await_resume(void) { return std::move(reply); }
+
+		static void Resume(PoolStatus status, const char *data, size_t length, void *context)
+		{
+			CallAwaiter *self = (CallAwaiter *)context;
+
+			self->reply.status = status;
+			self->reply.payload.assign(data, data + length);
+			self->waiter.resume();
+		}
+	};
+
+	CallAwaiter Call(const char *payload, size_t len) { return CallAwaiter{ this, payload, len, {}, {} }; }
+#endif
+
+	PoolStats Stats(void) const;
+
+private:
+	// A request on its way through the pool: the encoded frame (header, request ID, payload),
+	// then the callback once it has been sent.
+	struct PendingRequest : public MpscNode
+	{
+		uint64_t id;
+		char *frame;
+		size_t length;
+		ReplyCallback callback;
+		void *context;
+	};
+
+	enum ConnectionState
+	{
+		DISCONNECTED,
+		CONNECTING,
+		CONNECTED
+	};
+
+	struct Connection
+	{
+		SOCKET socket;
+		ConnectionState state;
+		FrameDecoder decoder;
+
+		// Encoded requests not yet taken by the kernel.
+		std::vector<char> output;
+		size_t outputOffset;
+		bool writeBlocked;
+
+		// Requests sent (or queued in output) and not answered yet, by ID.
+		std::unordered_map<uint64_t, PendingRequest *> inflight;
+
+		// Last time anything arrived, or the connection attempt started.
+		uint64_t lastActivity;
+		bool healthCheckPending;
+
+		// Reconnect schedule. backoffMs is reset once a reply proves the connection works.
+		uint64_t retryAt;
+		uint32_t backoffMs;
+
+		// Index into addresses of the address to connect to; moves on after every failed attempt.
+		size_t address;
+
+		// Set while decoding when a reply is malformed or answers no request of this connection.
+		bool protocolError;
+	};
+
+	void Run(void);
+	void Wake(void);
+	void Complete(PendingRequest *request, PoolStatus status, const char *payload, size_t len);
+
+	void Connect(Connection *conn, uint64_t now);
+	void Fail(Connection *conn, uint64_t now, const char *reason);
+	void OnWritable(Connection *conn, uint64_t now);
+	void OnReadable(Connection *conn, uint64_t now);
+	static void OnFrame(const char *payload, size_t len, void *context);
+	bool Flush(Connection *conn);
+	void Watch(Connection *conn, uint32_t events);
+	void Enqueue(Connection *conn, PendingRequest *request);
+	void Dispatch(void);
+	void CheckConnections(uint64_t now);
+
+	std::vector<Connection *> connections;
+	std::vector<struct sockaddr_storage> addresses;
+	std::vector<socklen_t> addressLengths;
+	SocketTuning tuning;
+
+	int epollFd;
+	int wakeFd;
+	std::thread thread;
+	volatile bool running;
+
+	// Requests from callers, and requests waiting for a connection with room.
+	MpscQueue inbox;
+	uint32_t wakeSignaled;
+	std::deque<PendingRequest *> pending;
+
+	// Next request ID, taken by callers with an atomic increment.
+	uint64_t nextId;
+	uint32_t random;
+
+	// Connection whose frames are being decoded, for OnFrame.
+	Connection *current;
+
+	PoolStats stats;
+};
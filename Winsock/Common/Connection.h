@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Platform.h"
+#include "Frame.h"
+#include "OutputQueue.h"
+#include "TimerWheel.h"
+
+#include <stddef.h>
+
+struct WorkItem;
+struct LocalChannel;
+
+// Maximum number of queued buffers written by one scatter/gather send.
+#define MAX_SEND_IOVECS 8
+
+// Upper bound on bytes queued for a peer that is not reading its echoes.
+// Once reached the connection stops reading until the output drains (backpressure).
+#define MAX_PENDING_OUTPUT (64 * 1024)
+
+// Per-connection state shared by all I/O backends. Connections are allocated from a per-loop 
+// ObjectPool and hold no buffer memory while idle: receive buffers are borrowed from the loop's 
+// BufferPool only for the duration of a read, and the decoder and output queue borrow pooled 
+// buffers only while a partial frame or unsent output is pending.
+// The connection is its own timer node in the loop's TimerWheel, for the idle and read timeouts.
+struct Connection : public TimerNode
+{
+	SOCKET socket;
+
+	// Number of the connection within its loop, counting from 1, for tracing (see Trace.h).
+	uint32_t id;
+
+	// Reassembly state for a frame split across reads.
+	FrameDecoder decoder;
+
+	// Write state: bytes accepted for sending but not yet taken by the kernel.
+	OutputQueue output;
+
+	// Set when reading was suspended because the output queue reached MAX_PENDING_OUTPUT.
+	bool readPaused;
+
+	// Output was queued during the current loop iteration and the connection is on the loop's 
+	// flush list. Replies are coalesced and written once per iteration, not once per message.
+	bool dirty;
+
+	// Frames handed to the work pool and not yet answered, oldest first (see IoLoop::Offload).
+	WorkItem *workHead;
+	WorkItem *workTail;
+
+	// Monotonic time in nanoseconds of the last bytes received or sent, and of the read in which the 
+	// frame now partly received began to arrive (0 between frames). The loop stores these as it goes 
+	// and checks them only when the connection's timer fires.
+	uint64_t lastActivity;
+	uint64_t frameStarted;
+
+	// Neighbours in the loop's list of open connections.
+	Connection *prevOpen;
+	Connection *nextOpen;
+
+	// Transport state of a connection accepted on a Unix domain socket (see LocalTransport.h), NULL for TCP.
+	LocalChannel *local;
+
+	size_t PendingOutput(void) const { return output.Size(); }
+};
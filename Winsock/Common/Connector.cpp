@@ -0,0 +1,391 @@
+#include "Connector.h"
+#include "Metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/epoll.h>
+
+static const uint64_t NsPerMs = 1000000ull;
+
+void DefaultConnectOptions(ConnectOptions &options)
+{
+	options.attemptDelayMs = CONNECT_ATTEMPT_DELAY_MS;
+	options.timeoutMs = CONNECT_TIMEOUT_MS;
+	options.family = AF_UNSPEC;
+}
+
+// Milliseconds from now until then, rounded up; 0 when then has passed.
+static int MsUntil(uint64_t then, uint64_t now)
+{
+	return then <= now ? 0 : (int)((then - now + NsPerMs - 1) / NsPerMs);
+}
+
+Connector::Connector()
+	: epollFd(-1)
+{
+	DefaultConnectOptions(options);
+	DefaultTuning(tuning);
+}
+
+Connector::~Connector()
+{
+	for (size_t i = 0; i < races.size(); i++)
+	{
+		Race *race = races[i];
+
+		for (size_t j = 0; j < race->attempts.size(); j++)
+		{
+			if (race->attempts[j]->socket != INVALID_SOCKET)
+				closesocket(race->attempts[j]->socket);
+
+			delete race->attempts[j];
+		}
+
+		delete race;
+	}
+
+	if (epollFd != -1)
+		close(epollFd);
+}
+
+bool Connector::Init(const ResolverOptions &resolverOptions, const ConnectOptions &connectOptions, const SocketTuning &socketTuning)
+{
+	options = connectOptions;
+	tuning = socketTuning;
+
+	if (options.attemptDelayMs < CONNECT_MIN_ATTEMPT_DELAY_MS)
+		options.attemptDelayMs = CONNECT_MIN_ATTEMPT_DELAY_MS;
+
+	if (!resolver.Init(resolverOptions))
+		return false;
+
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (epollFd == -1)
+	{
+		printf("epoll_create1 failed with error: %d\n", errno);
+		return false;
+	}
+
+	// The resolver's socket is the only registration without an attempt.
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, resolver.Socket(), &ev);
+
+	return true;
+}
+
+void Connector::Connect(const char *host, const char *port, ConnectCallback callback, void *context)
+{
+	uint64_t now = MetricsClock();
+	Race *race = new Race();
+
+	race->host = host;
+	race->port = (uint16_t)atoi(port);
+	race->callback = callback;
+	race->context = context;
+	race->nextFamily = AF_INET6;
+	race->v6Answered = options.family == AF_INET;
+	race->v4Answered = options.family == AF_INET6;
+	race->v4AnsweredAt = 0;
+	race->resolveFailed = false;
+	race->started = false;
+	race->nextAttemptAt = 0;
+	race->deadline = now + (uint64_t)options.timeoutMs * NsPerMs;
+	race->lastError = 0;
+	race->finished = false;
+
+	races.push_back(race);
+
+	if (race->port == 0)
+	{
+		printf("Invalid port: %s\n", port);
+		race->v6Answered = race->v4Answered = true;
+		return;
+	}
+
+	// Both lookups go out at once; cached answers come back before Resolve returns.
+	if (!race->v6Answered)
+		resolver.Resolve(host, AF_INET6, OnResolved, race, now);
+
+	if (!race->v4Answered)
+		resolver.Resolve(host, AF_INET, OnResolved, race, now);
+}
+
+void Connector::OnResolved(int family, const AddressList &addresses, bool ok, void *context)
+{
+	Race *race = (Race *)context;
+
+	for (size_t i = 0; i < addresses.size(); i++)
+	{
+		struct sockaddr_storage address = addresses[i];
+
+		if (family == AF_INET6)
+		{
+			((struct sockaddr_in6 *)&address)->sin6_port = htons(race->port);
+			race->v6.push_back(address);
+		}
+		else
+		{
+			((struct sockaddr_in *)&address)->sin_port = htons(race->port);
+			race->v4.push_back(address);
+		}
+	}
+
+	// A failed lookup of one family is only reported if the other family has no address either.
+	if (!ok)
+		race->resolveFailed = true;
+
+	if (family == AF_INET6)
+	{
+		race->v6Answered = true;
+	}
+	else
+	{
+		race->v4Answered = true;
+		race->v4AnsweredAt = MetricsClock();
+	}
+}
+
+void Connector::Advance(Race *race, uint64_t now)
+{
+	if (race->finished)
+		return;
+
+	if (now >= race->deadline)
+	{
+		printf("Connecting to %s timed out\n", race->host.c_str());
+		Finish(race, INVALID_SOCKET);
+		return;
+	}
+
+	// Start with the first answer that has addresses, but give the AAAA answer a short head start:
+	// an A answer arriving first only starts connecting after the resolution delay.
+	if (!race->started)
+	{
+		bool bothAnswered = race->v6Answered && race->v4Answered;
+
+		if ((race->v6Answered && !race->v6.empty()) || bothAnswered ||
+			(race->v4Answered && now >= race->v4AnsweredAt + (uint64_t)CONNECT_RESOLUTION_DELAY_MS * NsPerMs))
+		{
+			race->started = true;
+		}
+	}
+
+	if (!race->started)
+		return;
+
+	// A new attempt when there is none in progress, or when the last one has had its head start.
+	while (!race->finished && (!race->v6.empty() || !race->v4.empty()) &&
+		(LiveAttempts(race) == 0 || now >= race->nextAttemptAt))
+	{
+		StartAttempt(race, now);
+	}
+
+	if (!race->finished && LiveAttempts(race) == 0 && race->v6.empty() && race->v4.empty() &&
+		race->v6Answered && race->v4Answered)
+	{
+		if (race->lastError != 0)
+			printf("Connecting to %s failed with error: %d\n", race->host.c_str(), race->lastError);
+		else if (race->resolveFailed)
+			printf("Name resolution of %s failed\n", race->host.c_str());
+		else
+			printf("No address found for %s\n", race->host.c_str());
+
+		Finish(race, INVALID_SOCKET);
+	}
+}
+
+void Connector::StartAttempt(Race *race, uint64_t now)
+{
+	// Alternate between the families, IPv6 first, as long as both have addresses left.
+	std::deque<struct sockaddr_storage> &queue =
+		(race->nextFamily == AF_INET6 && !race->v6.empty()) || race->v4.empty() ? race->v6 : race->v4;
+
+	struct sockaddr_storage address = queue.front();
+	queue.pop_front();
+
+	race->nextFamily = address.ss_family == AF_INET6 ? AF_INET : AF_INET6;
+	race->nextAttemptAt = now + (uint64_t)options.attemptDelayMs * NsPerMs;
+
+	SOCKET s = socket(address.ss_family, SOCK_STREAM, IPPROTO_TCP);
+
+	if (s == INVALID_SOCKET)
+	{
+		race->lastError = WSAGetLastError();
+		return;
+	}
+
+	// Buffer sizes must be set before connect, for the window scale offered in the handshake.
+	if (!TuneConnectSocket(s, tuning) || !SetNonBlocking(s))
+	{
+		race->lastError = WSAGetLastError();
+		closesocket(s);
+		return;
+	}
+
+	if (connect(s, (struct sockaddr *)&address, SocketAddressLength(address)) == 0)
+	{
+		Finish(race, s);
+		return;
+	}
+
+	if (WSAGetLastError() != EINPROGRESS)
+	{
+		// Refused or unreachable right away: the loop in Advance moves on to the next address at once.
+		race->lastError = WSAGetLastError();
+		closesocket(s);
+		return;
+	}
+
+	Attempt *attempt = new Attempt();
+	attempt->race = race;
+	attempt->socket = s;
+	race->attempts.push_back(attempt);
+
+	struct epoll_event ev;
+	ev.events = EPOLLOUT;
+	ev.data.ptr = attempt;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, s, &ev);
+}
+
+void Connector::OnAttempt(Attempt *attempt, uint64_t now)
+{
+	Race *race = attempt->race;
+
+	if (race->finished || attempt->socket == INVALID_SOCKET)
+		return;
+
+	int error = 0;
+	socklen_t length = sizeof(error);
+
+	getsockopt(attempt->socket, SOL_SOCKET, SO_ERROR, &error, &length);
+
+	if (error == 0)
+	{
+		SOCKET s = attempt->socket;
+
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, s, NULL);
+		attempt->socket = INVALID_SOCKET;
+
+		Finish(race, s);
+		return;
+	}
+
+	// A failed attempt hands over to the next address straight away instead of waiting out its delay.
+	race->lastError = error;
+	race->nextAttemptAt = now;
+	Drop(attempt);
+}
+
+void Connector::Drop(Attempt *attempt)
+{
+	// Closing the socket removes it from the epoll set. The attempt itself is freed with its race,
+	// since an event for it may still be waiting in the current batch.
+	closesocket(attempt->socket);
+	attempt->socket = INVALID_SOCKET;
+}
+
+void Connector::Finish(Race *race, SOCKET s)
+{
+	race->finished = true;
+
+	for (size_t i = 0; i < race->attempts.size(); i++)
+	{
+		if (race->attempts[i]->socket != INVALID_SOCKET)
+			Drop(race->attempts[i]);
+	}
+
+	resolver.Cancel(race);
+	race->callback(s, race->context);
+}
+
+// Attempts of a race whose socket is still in its handshake.
+size_t Connector::LiveAttempts(const Race *race)
+{
+	size_t live = 0;
+
+	for (size_t i = 0; i < race->attempts.size(); i++)
+	{
+		if (race->attempts[i]->socket != INVALID_SOCKET)
+			live++;
+	}
+
+	return live;
+}
+
+int Connector::NextTimeoutMs(void) const
+{
+	uint64_t now = MetricsClock();
+	int timeout = resolver.NextTimeoutMs(now);
+
+	for (size_t i = 0; i < races.size(); i++)
+	{
+		const Race *race = races[i];
+		int ms = MsUntil(race->deadline, now);
+
+		if (!race->started && race->v4Answered)
+		{
+			int delay = MsUntil(race->v4AnsweredAt + (uint64_t)CONNECT_RESOLUTION_DELAY_MS * NsPerMs, now);
+			ms = delay < ms ? delay : ms;
+		}
+		else if (race->started && (!race->v6.empty() || !race->v4.empty()))
+		{
+			int delay = MsUntil(race->nextAttemptAt, now);
+			ms = delay < ms ? delay : ms;
+		}
+
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+
+	return timeout;
+}
+
+int Connector::Poll(int timeoutMs)
+{
+	struct epoll_event events[64];
+	int wait = NextTimeoutMs();
+
+	if (wait < 0 || wait > timeoutMs)
+		wait = timeoutMs;
+
+	int n = epoll_wait(epollFd, events, 64, wait);
+	uint64_t now = MetricsClock();
+
+	for (int i = 0; i < n; i++)
+	{
+		if (events[i].data.ptr == NULL)
+			resolver.OnReadable(now);
+		else
+			OnAttempt((Attempt *)events[i].data.ptr, now);
+	}
+
+	resolver.OnTimer(now);
+
+	// A callback may start another setup, which appends to the list.
+	for (size_t i = 0; i < races.size(); i++)
+		Advance(races[i], now);
+
+	for (size_t i = 0; i < races.size(); )
+	{
+		Race *race = races[i];
+
+		if (!race->finished)
+		{
+			i++;
+			continue;
+		}
+
+		for (size_t j = 0; j < race->attempts.size(); j++)
+			delete race->attempts[j];
+
+		delete race;
+		races.erase(races.begin() + i);
+	}
+
+	return Active();
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "Platform.h"
+#include "Tuning.h"
+#include "Resolver.h"
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+// RFC 8305 defaults: how long to wait for the AAAA answer once the A answer is in, and how long
+// one connection attempt runs on its own before the next address is tried alongside it.
+#define CONNECT_RESOLUTION_DELAY_MS 50
+#define CONNECT_ATTEMPT_DELAY_MS 250
+
+// The RFC's floor for the attempt delay; shorter delays start handshakes that are not needed.
+#define CONNECT_MIN_ATTEMPT_DELAY_MS 10
+
+// Longest a connection setup may take, name resolution included, before it fails.
+#define CONNECT_TIMEOUT_MS 10000
+
+struct ConnectOptions
+{
+	int attemptDelayMs;
+	int timeoutMs;
+
+	// AF_UNSPEC races both families; AF_INET or AF_INET6 restricts connects to one.
+	int family;
+};
+
+void DefaultConnectOptions(ConnectOptions &options);
+
+// Called once per Connect with the connected socket, non-blocking and with TuneConnectSocket applied,
+// or with INVALID_SOCKET after the setup failed or timed out (the reason has been printed).
+typedef void (*ConnectCallback)(SOCKET s, void *context);
+
+// --- Happy Eyeballs Connection Setup ---
+
+// Connects to a host name without ever blocking, following RFC 8305 ("Happy Eyeballs"): the AAAA and
+// A lookups are sent together; connecting starts as soon as the AAAA answer is in, or 50 ms after the
+// A answer if the AAAA answer is still missing. Addresses are tried alternating between IPv6 and IPv4,
+// and every attempt gets a head start of the attempt delay before the next one begins in parallel,
+// or none if it fails outright. The first handshake to complete wins and the others are closed.
+// A dead first address therefore costs one attempt delay, not a full TCP connect timeout, and a
+// host whose IPv6 path is broken is still reached quickly over IPv4.
+//
+// A Connector runs any number of setups at once on its own epoll instance, which holds the resolver's
+// socket and every socket still in its handshake. Call Poll until Active() drops to zero, or add Fd()
+// to another epoll set and call Poll(0) whenever it is readable (and at least every NextTimeoutMs).
+class Connector
+{
+public:
+	Connector();
+	~Connector();
+
+	// Returns false after printing the reason on failure.
+	bool Init(const ResolverOptions &resolverOptions, const ConnectOptions &connectOptions, const SocketTuning &tuning);
+
+	// Start connecting to host:port. The callback runs from a later Poll, never from Connect itself.
+	void Connect(const char *host, const char *port, ConnectCallback callback, void *context);
+
+	// Wait up to timeoutMs for progress, then run every step that is due. Returns Active().
+	int Poll(int timeoutMs);
+
+	// Setups not finished yet.
+	int Active(void) const { return (int)races.size(); }
+
+	int Fd(void) const { return epollFd; }
+
+	// Milliseconds until Poll has timed work to do, or -1 when nothing is running.
+	int NextTimeoutMs(void) const;
+
+	Resolver &Names(void) { return resolver; }
+
+private:
+	struct Race;
+
+	// One socket in its handshake. The epoll registration points here.
+	struct Attempt
+	{
+		Race *race;
+		SOCKET socket;
+	};
+
+	struct Race
+	{
+		std::string host;
+		uint16_t port;
+		ConnectCallback callback;
+		void *context;
+
+		// Addresses not tried yet, by family, and the family the next attempt prefers.
+		std::deque<struct sockaddr_storage> v6;
+		std::deque<struct sockaddr_storage> v4;
+		int nextFamily;
+
+		bool v6Answered;
+		bool v4Answered;
+		bool resolveFailed;
+		uint64_t v4AnsweredAt;
+
+		bool started;
+		std::vector<Attempt *> attempts;
+		uint64_t nextAttemptAt;
+		uint64_t deadline;
+		int lastError;
+
+		bool finished;
+	};
+
+	static void OnResolved(int family, const AddressList &addresses, bool ok, void *context);
+	void Advance(Race *race, uint64_t now);
+	void StartAttempt(Race *race, uint64_t now);
+	void OnAttempt(Attempt *attempt, uint64_t now);
+	void Drop(Attempt *attempt);
+	void Finish(Race *race, SOCKET s);
+	static size_t LiveAttempts(const Race *race);
+
+	Resolver resolver;
+	ConnectOptions options;
+	SocketTuning tuning;
+	int epollFd;
+
+	std::vector<Race *> races;
+};
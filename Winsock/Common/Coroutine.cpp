@@ -0,0 +1,432 @@
+// The coroutine API needs C++20. Under an older standard this file compiles to nothing, so the
+// programs that do not use it can keep building ../Common/*.cpp as C++17.
+#if __cplusplus >= 202002L
+
+#include "Coroutine.h"
+#include "Socket.h"
+
+#include <stdio.h>
+
+#ifndef __linux__
+#error "The coroutine loop requires Linux (epoll)"
+#endif
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+// Number of readiness events fetched from the kernel per epoll_wait call.
+#define COROUTINE_MAX_EVENTS 256
+
+// --- Frame Pool ---
+
+// Free lists of the calling thread, one per size class. A freed frame holds the next pointer.
+static thread_local void *frameFreeLists[FRAME_POOL_CLASSES];
+
+void *FramePool::Allocate(size_t size)
+{
+	size_t sizeClass = (size + FRAME_POOL_GRANULE - 1) / FRAME_POOL_GRANULE - 1;
+
+	if (sizeClass >= FRAME_POOL_CLASSES)
+		return malloc(size);
+
+	void *frame = frameFreeLists[sizeClass];
+
+	if (frame == NULL)
+		return malloc((sizeClass + 1) * FRAME_POOL_GRANULE);
+
+	frameFreeLists[sizeClass] = *(void **)frame;
+
+	return frame;
+}
+
+void FramePool::Free(void *frame, size_t size)
+{
+	size_t sizeClass = (size + FRAME_POOL_GRANULE - 1) / FRAME_POOL_GRANULE - 1;
+
+	if (sizeClass >= FRAME_POOL_CLASSES)
+	{
+		free(frame);
+		return;
+	}
+
+	*(void **)frame = frameFreeLists[sizeClass];
+	frameFreeLists[sizeClass] = frame;
+}
+
+// --- Awaiters ---
+
+bool RecvAwaiter::Attempt(void)
+{
+	if (state == NULL || state->closed)
+	{
+		result = -1;
+		return true;
+	}
+
+	for (;;)
+	{
+		ssize_t iResult = recv(state->socket, buffer, length, 0);
+
+		if (iResult >= 0)
+		{
+			result = iResult;
+			return true;
+		}
+
+		if (errno == EINTR)
+			continue;
+
+		if (WouldBlock(errno))
+			return false;
+
+		result = -1;
+		return true;
+	}
+}
+
+bool SendAwaiter::Attempt(void)
+{
+	if (state == NULL || state->closed)
+	{
+		result = -1;
+		return true;
+	}
+
+	while (sent < length)
+	{
+		ssize_t iResult = send(state->socket, data + sent, length - sent, MSG_NOSIGNAL);
+
+		if (iResult >= 0)
+		{
+			sent += (size_t)iResult;
+			continue;
+		}
+
+		if (errno == EINTR)
+			continue;
+
+		// The rest goes out once the socket is writable again.
+		if (WouldBlock(errno))
+			return false;
+
+		result = -1;
+		return true;
+	}
+
+	result = (ssize_t)length;
+	return true;
+}
+
+bool AcceptAwaiter::Attempt(void)
+{
+	accepted = INVALID_SOCKET;
+
+	if (state == NULL || state->closed)
+		return true;
+
+	for (;;)
+	{
+		accepted = accept4(state->socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (accepted != INVALID_SOCKET)
+			return true;
+
+		// The connection was reset while it waited in the queue; take the next one.
+		if (errno == EINTR || errno == ECONNABORTED)
+			continue;
+
+		if (WouldBlock(errno))
+			return false;
+
+		printf("accept failed with error: %d\n", errno);
+		return true;
+	}
+}
+
+AsyncSocket AcceptAwaiter::await_resume()
+{
+	if (accepted == INVALID_SOCKET)
+		return AsyncSocket();
+
+	SocketState *acceptedState = loop->Register(accepted);
+
+	if (acceptedState == NULL)
+		return AsyncSocket();
+
+	TuneConnection(accepted, loop->tuning);
+
+	return AsyncSocket(loop, acceptedState);
+}
+
+// --- Socket Handles ---
+
+AsyncSocket &AsyncSocket::operator=(AsyncSocket &&other) noexcept
+{
+	if (this != &other)
+	{
+		Close();
+		loop = other.loop;
+		state = other.state;
+		other.state = NULL;
+	}
+
+	return *this;
+}
+
+RecvAwaiter AsyncSocket::Recv(char *buffer, size_t len)
+{
+	RecvAwaiter awaiter;
+	awaiter.state = state;
+	awaiter.buffer = buffer;
+	awaiter.length = len;
+	awaiter.result = -1;
+
+	return awaiter;
+}
+
+SendAwaiter AsyncSocket::Send(const char *data, size_t len)
+{
+	SendAwaiter awaiter;
+	awaiter.state = state;
+	awaiter.data = data;
+	awaiter.length = len;
+	awaiter.sent = 0;
+	awaiter.result = -1;
+
+	return awaiter;
+}
+
+void AsyncSocket::Close(void)
+{
+	if (state == NULL)
+		return;
+
+	loop->Close(state);
+	state = NULL;
+}
+
+AcceptAwaiter AsyncListener::Accept(void)
+{
+	AcceptAwaiter awaiter;
+	awaiter.state = state;
+	awaiter.loop = loop;
+	awaiter.accepted = INVALID_SOCKET;
+
+	return awaiter;
+}
+
+void AsyncListener::Close(void)
+{
+	if (state == NULL)
+		return;
+
+	loop->Close(state);
+	state = NULL;
+}
+
+// --- Loop ---
+
+CoroutineLoop::CoroutineLoop()
+	: epollFd(-1), wakeFd(-1), running(false)
+{
+	DefaultTuning(tuning);
+}
+
+CoroutineLoop::~CoroutineLoop()
+{
+	// Coroutines still suspended when the loop stops are not resumed again.
+	if (epollFd != -1)
+		close(epollFd);
+
+	if (wakeFd != -1)
+		close(wakeFd);
+}
+
+bool CoroutineLoop::Init(void)
+{
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (epollFd == -1)
+	{
+		printf("epoll_create1 failed with error: %d\n", errno);
+		return false;
+	}
+
+	// Stop writes to this eventfd so that a loop blocked in epoll_wait notices at once.
+	wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (wakeFd == -1)
+	{
+		printf("eventfd failed with error: %d\n", errno);
+		return false;
+	}
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev) == -1)
+	{
+		printf("epoll_ctl failed with error: %d\n", errno);
+		return false;
+	}
+
+	return true;
+}
+
+SocketState *CoroutineLoop::Register(SOCKET s)
+{
+	SocketState *state = states.Acquire();
+
+	if (state == NULL)
+	{
+		closesocket(s);
+		return NULL;
+	}
+
+	state->socket = s;
+	state->reader = NULL;
+	state->writer = NULL;
+	state->closed = false;
+
+	// Edge-triggered for both directions: an awaiter only parks after its system call
+	// returned EWOULDBLOCK, so the next edge is guaranteed to come after it parked.
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = state;
+
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, s, &ev) == -1)
+	{
+		printf("epoll_ctl failed with error: %d\n", errno);
+		closesocket(s);
+		states.Release(state);
+		return NULL;
+	}
+
+	return state;
+}
+
+AsyncListener CoroutineLoop::Listen(SOCKET listenSocket)
+{
+	SocketState *state = Register(listenSocket);
+
+	if (state == NULL)
+		return AsyncListener();
+
+	return AsyncListener(this, state);
+}
+
+AsyncSocket CoroutineLoop::Adopt(SOCKET s)
+{
+	if (!SetNonBlocking(s))
+	{
+		printf("fcntl failed with error: %d\n", errno);
+		closesocket(s);
+		return AsyncSocket();
+	}
+
+	SocketState *state = Register(s);
+
+	if (state == NULL)
+		return AsyncSocket();
+
+	TuneConnection(s, tuning);
+
+	return AsyncSocket(this, state);
+}
+
+void CoroutineLoop::Spawn(Task<void> task)
+{
+	task.Detach().resume();
+}
+
+void CoroutineLoop::Close(SocketState *state)
+{
+	// Closing the descriptor also removes it from the epoll set. Awaiters of other coroutines
+	// still parked on it are failed at the end of the iteration, not from inside this call.
+	closesocket(state->socket);
+	state->closed = true;
+	closing.push_back(state);
+}
+
+void CoroutineLoop::Wake(IoAwaiter *&slot)
+{
+	IoAwaiter *awaiter = slot;
+
+	if (awaiter == NULL || !awaiter->Attempt())
+		return;
+
+	slot = NULL;
+	awaiter->handle.resume();
+}
+
+int CoroutineLoop::Run(void)
+{
+	struct epoll_event events[COROUTINE_MAX_EVENTS];
+
+	running = true;
+
+	while (running)
+	{
+		int n = epoll_wait(epollFd, events, COROUTINE_MAX_EVENTS, -1);
+
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			printf("epoll_wait failed with error: %d\n", errno);
+			return 1;
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			SocketState *state = (SocketState *)events[i].data.ptr;
+			uint32_t flags = events[i].events;
+
+			if (state == NULL)
+			{
+				uint64_t count;
+
+				if (read(wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+					printf("read failed with error: %d\n", errno);
+
+				continue;
+			}
+
+			// Errors and hang-ups wake both sides; their next system call reports them.
+			if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+				Wake(state->reader);
+
+			if (flags & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+				Wake(state->writer);
+		}
+
+		// Fail the operations still parked on sockets closed during this iteration, then release
+		// the sockets. Resumed coroutines may close further sockets, which join the end of the list.
+		for (size_t i = 0; i < closing.size(); i++)
+		{
+			Wake(closing[i]->reader);
+			Wake(closing[i]->writer);
+		}
+
+		for (size_t i = 0; i < closing.size(); i++)
+			states.Release(closing[i]);
+
+		closing.clear();
+	}
+
+	return 0;
+}
+
+void CoroutineLoop::Stop(void)
+{
+	running = false;
+
+	uint64_t one = 1;
+
+	if (wakeFd != -1 && write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		printf("write failed with error: %d\n", errno);
+}
+
+#endif
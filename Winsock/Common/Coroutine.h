@@ -0,0 +1,350 @@
+#pragma once
+
+#include "Platform.h"
+#include "ObjectPool.h"
+#include "Tuning.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <coroutine>
+#include <utility>
+#include <vector>
+
+// --- Coroutine Socket API (C++20) ---
+
+// The asynchronous C# samples split every connection into callbacks: BeginReceive hands a
+// ReadCallback to the runtime, the callback parses what arrived and calls BeginReceive or BeginSend
+// again, and the connection's state travels between callbacks in a StateObject. With coroutines the
+// same connection is one straight-line function:
+//
+//     Task<> Serve(AsyncSocket client)
+//     {
+//         char buffer[4096];
+//         ssize_t received;
+//
+//         while ((received = co_await client.Recv(buffer, sizeof(buffer))) > 0)
+//             if (co_await client.Send(buffer, (size_t)received) < 0)
+//                 break;
+//     }
+//
+// The coroutine frame is the StateObject and the resume point is the callback. Every operation
+// first tries the system call directly; only when it would block is the coroutine suspended and
+// its awaiter parked on the socket, and the loop's epoll_wait resumes it when the socket becomes
+// ready. No thread ever blocks on a socket, and a loop serves any number of coroutines on one thread.
+
+// Frames are pooled in size classes of this many bytes.
+#define FRAME_POOL_GRANULE 64
+
+// Number of size classes; frames larger than FRAME_POOL_GRANULE * FRAME_POOL_CLASSES (32 KB) come 
+// from malloc. The limit is high enough for a connection handler that keeps its receive buffer in its frame.
+#define FRAME_POOL_CLASSES 512
+
+// Allocator for coroutine frames. A coroutine's frame (its locals and its resume point) is
+// allocated when the coroutine is called and freed when it finishes, i.e. once per connection
+// or per helper call. Freed frames go on a per-thread free list of their size class, so after
+// warm-up starting a coroutine never reaches malloc. Frames are owned by the thread that runs
+// their loop and must be freed on that thread.
+class FramePool
+{
+public:
+	static void *Allocate(size_t size);
+	static void Free(void *frame, size_t size);
+};
+
+// --- Tasks ---
+
+template <typename T> class Task;
+
+struct TaskPromiseBase
+{
+	// Coroutine to resume when this one finishes: the caller that co_awaited it.
+	std::coroutine_handle<> continuation;
+
+	// Set by Task::Detach: nobody will co_await the result, so the frame frees itself when it finishes.
+	bool detached = false;
+
+	static void *operator new(size_t size) { return FramePool::Allocate(size); }
+	static void operator delete(void *frame, size_t size) { FramePool::Free(frame, size); }
+
+	// Tasks are lazy: the body starts when the task is awaited or spawned.
+	std::suspend_always initial_suspend() noexcept { return {}; }
+
+	struct FinalAwaiter
+	{
+		bool await_ready() noexcept { return false; }
+
+		// Jump straight into the waiting caller (symmetric transfer), so chains of
+		// awaited tasks do not grow the thread's stack.
+		template <typename P>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<P> finished) noexcept
+		{
+			TaskPromiseBase &promise = finished.promise();
+
+			if (promise.continuation)
+				return promise.continuation;
+
+			if (promise.detached)
+				finished.destroy();
+
+			return std::noop_coroutine();
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	FinalAwaiter final_suspend() noexcept { return {}; }
+
+	// Errors are return values throughout this code; an exception escaping a coroutine is a bug.
+	void unhandled_exception() { abort(); }
+};
+
+template <typename T>
+struct TaskPromise : public TaskPromiseBase
+{
+	T value;
+
+	Task<T> get_return_object();
+	void return_value(T result) { value = std::move(result); }
+	T Result(void) { return std::move(value); }
+};
+
+template <>
+struct TaskPromise<void> : public TaskPromiseBase
+{
+	Task<void> get_return_object();
+	void return_void() {}
+	void Result(void) {}
+};
+
+// Result of a coroutine. co_await a task to run it and get its co_return value, or hand it to
+// CoroutineLoop::Spawn to run it on its own (a connection handler).
+template <typename T = void>
+class Task
+{
+public:
+	typedef TaskPromise<T> promise_type;
+
+	explicit Task(std::coroutine_handle<promise_type> coroutine) : handle(coroutine) {}
+	Task(Task &&other) noexcept : handle(other.handle) { other.handle = nullptr; }
+	~Task() { if (handle) handle.destroy(); }
+
+	Task(const Task &) = delete;
+	Task &operator=(const Task &) = delete;
+
+	bool await_ready() const noexcept { return false; }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		handle.promise().continuation = awaiting;
+		return handle;
+	}
+
+	T await_resume() { return handle.promise().Result(); }
+
+	// Give up ownership of the coroutine; it frees itself when it finishes.
+	std::coroutine_handle<promise_type> Detach(void)
+	{
+		std::coroutine_handle<promise_type> coroutine = handle;
+
+		handle = nullptr;
+		coroutine.promise().detached = true;
+
+		return coroutine;
+	}
+
+private:
+	std::coroutine_handle<promise_type> handle;
+};
+
+template <typename T>
+inline Task<T> TaskPromise<T>::get_return_object()
+{
+	return Task<T>(std::coroutine_handle<TaskPromise<T> >::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object()
+{
+	return Task<void>(std::coroutine_handle<TaskPromise<void> >::from_promise(*this));
+}
+
+// --- Sockets ---
+
+class CoroutineLoop;
+struct IoAwaiter;
+
+// A socket registered with a loop. Sockets are registered once, edge-triggered for both
+// directions, and an operation that would block parks its awaiter in reader or writer until
+// the loop sees the edge. The state outlives a close until the end of the loop iteration,
+// because events for it may still be waiting in the current epoll_wait batch.
+struct SocketState
+{
+	SOCKET socket;
+	IoAwaiter *reader;
+	IoAwaiter *writer;
+	bool closed;
+};
+
+// One pending socket operation. Attempt performs the system call and returns false if it would
+// block, in which case the loop calls it again after the next readiness edge.
+struct IoAwaiter
+{
+	SocketState *state;
+	std::coroutine_handle<> handle;
+
+	virtual ~IoAwaiter() {}
+	virtual bool Attempt(void) = 0;
+};
+
+// co_await socket.Recv(buffer, len): the bytes received, 0 when the peer closed the connection,
+// or -1 on an error.
+struct RecvAwaiter : public IoAwaiter
+{
+	char *buffer;
+	size_t length;
+	ssize_t result;
+
+	bool Attempt(void);
+
+	bool await_ready() { return Attempt(); }
+	void await_suspend(std::coroutine_handle<> awaiting) { handle = awaiting; state->reader = this; }
+	ssize_t await_resume() { return result; }
+};
+
+// co_await socket.Send(data, len): resumes once all len bytes are in the socket send buffer.
+// Returns len, or -1 on an error.
+struct SendAwaiter : public IoAwaiter
+{
+	const char *data;
+	size_t length;
+	size_t sent;
+	ssize_t result;
+
+	bool Attempt(void);
+
+	bool await_ready() { return Attempt(); }
+	void await_suspend(std::coroutine_handle<> awaiting) { handle = awaiting; state->writer = this; }
+	ssize_t await_resume() { return result; }
+};
+
+class AsyncSocket;
+
+// co_await listener.Accept(): the next connection, registered with the listener's loop.
+// The socket is invalid when the listener failed or was closed.
+struct AcceptAwaiter : public IoAwaiter
+{
+	CoroutineLoop *loop;
+	SOCKET accepted;
+
+	bool Attempt(void);
+
+	bool await_ready() { return Attempt(); }
+	void await_suspend(std::coroutine_handle<> awaiting) { handle = awaiting; state->reader = this; }
+	AsyncSocket await_resume();
+};
+
+// Owning handle to a connected socket of a CoroutineLoop; the socket is closed with the handle.
+// At most one Recv and one Send may be pending at a time, so one coroutine can read while
+// another writes, but two coroutines must not read the same socket.
+class AsyncSocket
+{
+public:
+	AsyncSocket() : loop(NULL), state(NULL) {}
+	AsyncSocket(CoroutineLoop *owner, SocketState *socketState) : loop(owner), state(socketState) {}
+	AsyncSocket(AsyncSocket &&other) noexcept : loop(other.loop), state(other.state) { other.state = NULL; }
+	AsyncSocket &operator=(AsyncSocket &&other) noexcept;
+	~AsyncSocket() { Close(); }
+
+	AsyncSocket(const AsyncSocket &) = delete;
+	AsyncSocket &operator=(const AsyncSocket &) = delete;
+
+	bool Valid(void) const { return state != NULL; }
+	SOCKET Socket(void) const { return state != NULL ? state->socket : INVALID_SOCKET; }
+
+	RecvAwaiter Recv(char *buffer, size_t len);
+	SendAwaiter Send(const char *data, size_t len);
+
+	// Close the socket now. A pending operation of another coroutine completes with an error.
+	void Close(void);
+
+private:
+	CoroutineLoop *loop;
+	SocketState *state;
+};
+
+// Owning handle to a listen socket of a CoroutineLoop.
+class AsyncListener
+{
+public:
+	AsyncListener() : loop(NULL), state(NULL) {}
+	AsyncListener(CoroutineLoop *owner, SocketState *socketState) : loop(owner), state(socketState) {}
+	AsyncListener(AsyncListener &&other) noexcept : loop(other.loop), state(other.state) { other.state = NULL; }
+	~AsyncListener() { Close(); }
+
+	AsyncListener(const AsyncListener &) = delete;
+	AsyncListener &operator=(const AsyncListener &) = delete;
+
+	bool Valid(void) const { return state != NULL; }
+
+	AcceptAwaiter Accept(void);
+
+	void Close(void);
+
+private:
+	CoroutineLoop *loop;
+	SocketState *state;
+};
+
+// --- Loop ---
+
+// Single-threaded, edge-triggered epoll loop that resumes coroutines instead of calling handlers.
+// Everything created from a loop (sockets, listeners, spawned tasks) belongs to the thread that
+// runs it. For more cores, run one loop per thread, each with its own SO_REUSEPORT listen socket.
+class CoroutineLoop
+{
+public:
+	CoroutineLoop();
+	~CoroutineLoop();
+
+	// Create the epoll instance.
+	bool Init(void);
+
+	// Take ownership of a non-blocking listen socket. Returns an invalid listener after printing the reason on failure.
+	AsyncListener Listen(SOCKET listenSocket);
+
+	// Take ownership of a connected socket and make it non-blocking. Returns an invalid socket on failure.
+	AsyncSocket Adopt(SOCKET s);
+
+	// Start a task on its own. It runs on the caller's stack until it first suspends, and its
+	// frame is freed when it finishes.
+	void Spawn(Task<void> task);
+
+	// Resume coroutines as their sockets become ready, until Stop is called.
+	int Run(void);
+
+	// Socket options applied to every accepted or adopted connection.
+	void SetTuning(const SocketTuning &socketTuning) { tuning = socketTuning; }
+
+	// Ask Run to return; safe to call from any thread. Coroutines still suspended are not resumed again.
+	void Stop(void);
+
+private:
+	friend class AsyncSocket;
+	friend class AsyncListener;
+	friend struct AcceptAwaiter;
+
+	SocketState *Register(SOCKET s);
+	void Close(SocketState *state);
+	void Wake(IoAwaiter *&slot);
+
+	int epollFd;
+
+	// eventfd written by Stop to wake a loop blocked in epoll_wait.
+	int wakeFd;
+
+	volatile bool running;
+	SocketTuning tuning;
+	ObjectPool<SocketState> states;
+
+	// Sockets closed during the current iteration, freed once the iteration is over.
+	std::vector<SocketState *> closing;
+};
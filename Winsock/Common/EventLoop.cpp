@@ -0,0 +1,767 @@
+#include "EventLoop.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef __linux__
+#error "EventLoop requires Linux epoll"
+#endif
+
+#include <sys/epoll.h>
+#include <fcntl.h>
+
+// epoll_event.data carries either a Connection pointer, a listen socket or the wake key.
+// Connection objects are at least pointer aligned, so the low bit is free to tag listeners, 
+// and no connection lives at address 2 or 4.
+#define LISTENER_TAG 1u
+#define WAKE_KEY 2u
+#define TLS_KEY 4u
+
+static inline uint64_t ListenerKey(SOCKET s) { return ((uint64_t)s << 1) | LISTENER_TAG; }
+
+EventLoop::EventLoop()
+	: epollFd(-1), largeRead(NULL), spliceSupported(true)
+{
+}
+
+EventLoop::~EventLoop()
+{
+	for (size_t i = 0; i < pipes.size(); i++)
+		close(pipes[i]);
+
+	if (epollFd != -1)
+		close(epollFd);
+
+	free(largeRead);
+}
+
+bool EventLoop::Init(void)
+{
+	if (!InitWake())
+		return false;
+
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (epollFd == -1)
+	{
+		printf("epoll_create1 failed with error: %d\n", errno);
+		return false;
+	}
+
+	return true;
+}
+
+bool EventLoop::AddListener(SOCKET listenSocket)
+{
+	// The listen socket is level-triggered: if accept stops early (for example on EMFILE) 
+	// the remaining pending connections are reported again on the next epoll_wait.
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u64 = ListenerKey(listenSocket);
+
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, listenSocket, &ev) == -1)
+	{
+		printf("epoll_ctl failed with error: %d\n", errno);
+		return false;
+	}
+
+	listeners.push_back(listenSocket);
+
+	return true;
+}
+
+void EventLoop::SetAccepting(bool accept)
+{
+	// Removing the listener from the interest list is what stops accepting: it is level-triggered, 
+	// so it would otherwise report the waiting connections on every epoll_wait.
+	for (size_t i = 0; i < listeners.size(); i++)
+	{
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.u64 = ListenerKey(listeners[i]);
+
+		if (epoll_ctl(epollFd, accept ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, listeners[i], &ev) == -1)
+			printf("epoll_ctl failed with error: %d\n", errno);
+	}
+}
+
+bool EventLoop::Quiescent(const Connection &base) const
+{
+	const EpollConnection &conn = static_cast<const EpollConnection &>(base);
+
+	return IoLoop::Quiescent(conn) && conn.piped == 0;
+}
+
+void EventLoop::CloseConnection(Connection &conn)
+{
+	Close(static_cast<EpollConnection *>(&conn));
+}
+
+int EventLoop::Run(void)
+{
+	struct epoll_event events[MAX_EVENTS];
+
+	if (tuning.maxRead > BUFFER_CAPACITY && largeRead == NULL)
+	{
+		largeRead = (char *)malloc(tuning.maxRead);
+
+		if (largeRead == NULL)
+		{
+			printf("Out of memory for receive buffer\n");
+			return 1;
+		}
+	}
+
+	// Replies from the work pool and drain requests wake the loop like any other event.
+	struct epoll_event wake;
+	wake.events = EPOLLIN;
+	wake.data.u64 = WAKE_KEY;
+
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &wake) == -1 && errno != EEXIST)
+	{
+		printf("epoll_ctl failed with error: %d\n", errno);
+		return 1;
+	}
+
+	// Sockets in their TLS handshake wait on the handshaker's own epoll instance, which is readable 
+	// (level-triggered) whenever one of them has progress to make.
+	if (tls != NULL)
+	{
+		struct epoll_event handshakes;
+		handshakes.events = EPOLLIN;
+		handshakes.data.u64 = TLS_KEY;
+
+		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, tls->Fd(), &handshakes) == -1 && errno != EEXIST)
+		{
+			printf("epoll_ctl failed with error: %d\n", errno);
+			return 1;
+		}
+	}
+
+	running = true;
+
+	while (running)
+	{
+		// Connections whose reading was paused and whose output has since drained still hold 
+		// unread data; poll without blocking so they are served in this iteration. Otherwise 
+		// block until an event arrives or the next timer is due.
+		int n = epoll_wait(epollFd, events, MAX_EVENTS, resume.empty() ? WaitTimeoutMs() : 0);
+
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			printf("epoll_wait failed with error: %d\n", errno);
+			return 1;
+		}
+
+		// Time the work of this iteration, from the return of epoll_wait to the end of the cleanup.
+		uint64_t iterationStart = MetricsClock();
+		now = iterationStart;
+
+		for (int i = 0; i < n; i++)
+		{
+			uint64_t key = events[i].data.u64;
+
+			if (key == WAKE_KEY)
+			{
+				uint64_t count;
+
+				if (read(wakeFd, &count, sizeof(count)) < 0)
+					printf("read failed with error: %d\n", errno);
+
+				OnWake();
+				continue;
+			}
+
+			if (key == TLS_KEY)
+			{
+				OnHandshakes();
+				continue;
+			}
+
+			if (key & LISTENER_TAG)
+			{
+				OnAccept((SOCKET)(key >> 1));
+				continue;
+			}
+
+			EpollConnection *conn = (EpollConnection *)events[i].data.ptr;
+			uint32_t flags = events[i].events;
+
+			// Writable first: draining the output queue may lift backpressure on reading. The doorbell 
+			// of a shared-memory connection may mean that the client made room in its ring.
+			if ((flags & EPOLLOUT) || SharedMemory(*conn))
+				Flush(conn);
+
+			bool resumeRead = conn->readPaused && conn->PendingOutput() < MAX_PENDING_OUTPUT;
+
+			// A splice that stopped on a full send buffer continues once the socket is writable.
+			bool resumeSplice = (flags & EPOLLOUT) && conn->piped > 0;
+
+			if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR) || resumeRead || resumeSplice)
+				OnReadable(conn);
+		}
+
+		if (!resume.empty())
+		{
+			resuming.swap(resume);
+
+			for (size_t i = 0; i < resuming.size(); i++)
+			{
+				if (resuming[i]->readPaused && resuming[i]->PendingOutput() < MAX_PENDING_OUTPUT)
+					OnReadable(resuming[i]);
+			}
+
+			resuming.clear();
+		}
+
+		// Shared-memory connections that still had requests in their ring when they used up their budget.
+		ResumeShm();
+
+		// Write everything queued during this iteration, one scatter/gather send per connection.
+		FlushDirty();
+
+		// Timeouts, the drain and the connection limit; closes connections, so it comes before the cleanup.
+		Housekeeping();
+
+		// A connection it closed may be waiting to resume reading in the next iteration.
+		if (!closing.empty() && !resume.empty())
+		{
+			size_t kept = 0;
+
+			for (size_t i = 0; i < resume.size(); i++)
+			{
+				if (resume[i]->socket != INVALID_SOCKET)
+					resume[kept++] = resume[i];
+			}
+
+			resume.resize(kept);
+		}
+
+		// Connections closed during this batch are released only now, after no event 
+		// in the batch can refer to them any more.
+		for (size_t i = 0; i < closing.size(); i++)
+		{
+			closing[i]->decoder.Clear(&bufferPool);
+			ReleaseLocal(*closing[i]);
+			connections.Release(closing[i]);
+		}
+
+		closing.clear();
+
+		EndIteration(iterationStart);
+
+		if (Drained())
+			break;
+	}
+
+	return 0;
+}
+
+void EventLoop::OnAccept(SOCKET listenSocket)
+{
+	// Accept every connection that is already pending; the listen socket is non-blocking, 
+	// so accept returns EWOULDBLOCK once the queue is empty.
+	for (;;)
+	{
+		// At the connection limit the rest stay in the backlog; Housekeeping disarms the listener.
+		if (AcceptBlocked())
+			return;
+
+		SOCKET ClientSocket = accept4(listenSocket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (ClientSocket == INVALID_SOCKET)
+		{
+			int error = WSAGetLastError();
+
+			if (error == EINTR || error == ECONNABORTED)
+				continue;
+
+			if (!WouldBlock(error))
+			{
+				printf("accept failed with error: %d\n", error);
+				AcceptFailed(error);
+			}
+
+			return;
+		}
+
+		Accepted(ClientSocket, listenSocket);
+	}
+}
+
+Connection *EventLoop::AddConnection(SOCKET ClientSocket, bool local)
+{
+	EpollConnection *conn = connections.Acquire();
+
+	if (conn == NULL)
+	{
+		printf("Out of memory for connection state\n");
+		closesocket(ClientSocket);
+		return NULL;
+	}
+
+	conn->socket = ClientSocket;
+	conn->readPaused = false;
+	conn->dirty = false;
+	conn->workHead = NULL;
+	conn->workTail = NULL;
+	conn->pipeRead = -1;
+	conn->pipeWrite = -1;
+	conn->piped = 0;
+	conn->smallReads = 0;
+	conn->peerClosed = false;
+	conn->local = NULL;
+
+	// Start with one pooled buffer's worth and let the connection's traffic decide from there.
+	conn->readSize = BUFFER_CAPACITY;
+
+	if (conn->readSize > tuning.maxRead)
+		conn->readSize = tuning.maxRead;
+
+	if (conn->readSize < tuning.minRead)
+		conn->readSize = tuning.minRead;
+
+	if (!local)
+		TuneConnection(ClientSocket, tuning);
+
+	// Edge-triggered: one notification per transition, so each handler must drain 
+	// the socket until EWOULDBLOCK. EPOLLOUT stays registered permanently; with 
+	// edge triggering it only fires when the send buffer goes from full to writable.
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = conn;
+
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, ClientSocket, &ev) == -1)
+	{
+		printf("epoll_ctl failed with error: %d\n", errno);
+		closesocket(ClientSocket);
+		connections.Release(conn);
+		return NULL;
+	}
+
+	connectionCount++;
+	TrackConnection(*conn);
+	CounterAdd(metrics.accepts, 1);
+	LOG_DEBUG("Connection accepted: socket %d\n", (int)ClientSocket);
+
+	return conn;
+}
+
+void EventLoop::OnReadable(EpollConnection *conn)
+{
+	if (conn->socket == INVALID_SOCKET || conn->peerClosed)
+		return;
+
+	conn->readPaused = false;
+
+	// The receive buffer is borrowed from the pool only for the duration of the read. 
+	// Pool buffers are reused LIFO, so every read of the loop lands in the same cache-hot buffer.
+	Buffer *recvbuf = bufferPool.Acquire();
+
+	if (recvbuf == NULL)
+	{
+		printf("Out of memory for receive buffer\n");
+		Close(conn);
+		return;
+	}
+
+	bool received = false;
+
+	// Keep receiving until the kernel buffer is empty or the peer shuts down the connection.
+	for (;;)
+	{
+		// The rest of a bulk frame's payload bypasses recv. Once it has been spliced, 
+		// the frames after it are received normally again.
+		if (conn->decoder.PassthroughRemaining() > 0 || conn->piped > 0)
+		{
+			if (!Splice(conn) || conn->socket == INVALID_SOCKET)
+				break;
+		}
+
+		if (conn->PendingOutput() >= MAX_PENDING_OUTPUT)
+		{
+			conn->readPaused = true;
+			break;
+		}
+
+		// Reads that fit go to the pooled buffer; a connection whose reads have grown past it uses the large one.
+		char *readBuffer = conn->readSize <= BUFFER_CAPACITY ? recvbuf->data : largeRead;
+
+		ssize_t iResult = recv(conn->socket, readBuffer, conn->readSize, 0);
+
+		if (iResult > 0)
+		{
+			CounterAdd(metrics.bytesIn, (uint64_t)iResult);
+			LOG_DEBUG("Bytes received: %d\n", (int)iResult);
+			Trace(TRACE_READ, *conn, (uint64_t)iResult);
+
+			AdaptReadSize(conn, (size_t)iResult);
+			received = true;
+
+			Received(*conn, readBuffer, (size_t)iResult);
+
+			// The handler may have closed the connection through a failed Send.
+			if (conn->socket == INVALID_SOCKET)
+				break;
+		}
+		else if (iResult == 0)
+		{
+			// Orderly shutdown from the peer. A client that shuts down its side right after its last 
+			// request still waits for the replies, so the connection stays open until Flush has sent 
+			// them all, including those of frames still with the work pool. The rings of a shared-memory 
+			// connection go with its socket, so it has nobody left to reply to.
+			if (SharedMemory(*conn))
+			{
+				Close(conn);
+				break;
+			}
+
+			conn->peerClosed = true;
+			Flush(conn);
+			break;
+		}
+		else
+		{
+			int error = WSAGetLastError();
+
+			if (error == EINTR)
+				continue;
+
+			if (!WouldBlock(error))
+				Close(conn);
+
+			break;
+		}
+	}
+
+	bufferPool.Release(recvbuf);
+
+	if (received && conn->socket != INVALID_SOCKET)
+		NoteReceived(*conn);
+
+#ifdef TCP_QUICKACK
+	// The kernel leaves quick ACK mode on its own heuristics, so it is switched on again after every batch of reads.
+	if (tuning.quickAck && conn->socket != INVALID_SOCKET && conn->local == NULL)
+	{
+		int quickAck = 1;
+		setsockopt(conn->socket, IPPROTO_TCP, TCP_QUICKACK, &quickAck, sizeof(quickAck));
+	}
+#endif
+}
+
+void EventLoop::AdaptReadSize(EpollConnection *conn, size_t received)
+{
+	// --- Adaptive Read Size ---
+
+	// A read that fills the buffer completely means more data is waiting: double the read size, so a 
+	// bulk transfer needs fewer recv calls and more frames arrive whole. Reads that keep using less 
+	// than half of it mean small messages: halve the read size, so a cheaper pooled buffer is used again.
+	if (received == conn->readSize)
+	{
+		conn->smallReads = 0;
+
+		if (conn->readSize < tuning.maxRead)
+			conn->readSize = conn->readSize * 2 < tuning.maxRead ? conn->readSize * 2 : tuning.maxRead;
+	}
+	else if (received <= conn->readSize / 2 && conn->readSize > tuning.minRead)
+	{
+		if (++conn->smallReads >= ADAPTIVE_SHRINK_READS)
+		{
+			conn->smallReads = 0;
+			conn->readSize = conn->readSize / 2 > tuning.minRead ? conn->readSize / 2 : tuning.minRead;
+		}
+	}
+	else
+	{
+		conn->smallReads = 0;
+	}
+}
+
+bool EventLoop::Send(Connection &base, const char *data, size_t len)
+{
+	EpollConnection *conn = static_cast<EpollConnection *>(&base);
+
+	if (conn->socket == INVALID_SOCKET)
+		return false;
+
+	// Only queue here. All replies produced for a connection during this iteration 
+	// leave together in one sendmsg call from FlushDirty.
+	if (!conn->output.Append(bufferPool, data, len))
+	{
+		printf("Out of memory for output queue\n");
+		Close(conn);
+		return false;
+	}
+
+	if (!conn->dirty)
+	{
+		conn->dirty = true;
+		dirty.push_back(conn);
+	}
+
+	return true;
+}
+
+void EventLoop::FlushDirty(void)
+{
+	for (size_t i = 0; i < dirty.size(); i++)
+	{
+		EpollConnection *conn = dirty[i];
+		conn->dirty = false;
+
+		Flush(conn);
+
+		// Reading stopped at the backpressure limit. If the flush made room there is no edge left 
+		// to report the data still waiting in the kernel, so resume reading on the next iteration.
+		if (conn->socket != INVALID_SOCKET && conn->readPaused && conn->PendingOutput() < MAX_PENDING_OUTPUT)
+			resume.push_back(conn);
+	}
+
+	dirty.clear();
+}
+
+bool EventLoop::Flush(EpollConnection *conn)
+{
+	if (conn->socket == INVALID_SOCKET)
+		return false;
+
+	if (SharedMemory(*conn))
+	{
+		FlushShm(*conn);
+		return true;
+	}
+
+	// Write as much of the pending output as the kernel accepts, gathering up to MAX_SEND_IOVECS 
+	// queued buffers per call; whatever remains is sent when EPOLLOUT reports the socket writable again.
+	while (!conn->output.Empty())
+	{
+		struct iovec iov[MAX_SEND_IOVECS];
+		struct msghdr msg;
+		size_t bytes;
+
+		ZeroMemory(&msg, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = conn->output.Gather(iov, MAX_SEND_IOVECS, &bytes);
+
+		ssize_t iSendResult = sendmsg(conn->socket, &msg, MSG_NOSIGNAL);
+
+		if (iSendResult >= 0)
+		{
+			conn->output.Consume(bufferPool, (size_t)iSendResult);
+			conn->lastActivity = now;
+
+			CounterAdd(metrics.bytesOut, (uint64_t)iSendResult);
+			LOG_DEBUG("Bytes sent: %d\n", (int)iSendResult);
+			Trace(TRACE_WRITE, *conn, (uint64_t)iSendResult);
+
+			// A short write means the socket send buffer is full.
+			if ((size_t)iSendResult < bytes)
+			{
+				CounterAdd(metrics.partialWrites, 1);
+				Trace(TRACE_PARTIAL_WRITE, *conn, bytes - (size_t)iSendResult);
+				return true;
+			}
+
+			continue;
+		}
+
+		int error = WSAGetLastError();
+
+		if (error == EINTR)
+			continue;
+
+		if (WouldBlock(error))
+			return true;
+
+		printf("send failed with error: %d\n", error);
+		Close(conn);
+		return false;
+	}
+
+	// The peer has shut down its side and its last reply is out.
+	if (conn->peerClosed && conn->workHead == NULL)
+	{
+		Close(conn);
+		return false;
+	}
+
+	return true;
+}
+
+void EventLoop::Close(EpollConnection *conn)
+{
+	if (conn->socket == INVALID_SOCKET)
+		return;
+
+	// Closing the descriptor also removes it from the epoll interest list.
+	closesocket(conn->socket);
+	conn->socket = INVALID_SOCKET;
+	connectionCount--;
+	UntrackConnection(*conn);
+	CounterAdd(metrics.closes, 1);
+
+	// Unsent output is dropped right away. The decoder may still be in the middle of Feed, 
+	// so it is cleared together with the connection object at the end of the batch.
+	conn->output.Clear(bufferPool);
+	AbandonWork(*conn);
+
+	if (conn->pipeRead != -1)
+		ReleasePipe(conn);
+
+	closing.push_back(conn);
+}
+
+bool EventLoop::Splice(EpollConnection *conn)
+{
+	// --- Zero-Copy Echo of Bulk Payloads ---
+
+	// The payload moves from the socket's receive queue into a pipe and from the pipe into the same 
+	// socket's send queue. splice only passes page references around, so the bytes never cross into 
+	// user space. Returns true when the payload is done (or has to be copied instead) and recv can 
+	// take over again; false when a socket would block or the connection was closed, in which case 
+	// the next EPOLLIN or EPOLLOUT continues from here.
+	if (!spliceSupported || (conn->pipeRead == -1 && !AcquirePipe(conn)))
+		return true;
+
+	for (;;)
+	{
+		// Bytes already in the pipe leave first, and only after everything queued before them 
+		// (the echoed header and any replies to earlier frames).
+		if (conn->piped > 0)
+		{
+			if (!conn->output.Empty() && (!Flush(conn) || !conn->output.Empty()))
+				return false;
+
+			ssize_t moved = splice(conn->pipeRead, NULL, conn->socket, NULL, conn->piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+			if (moved > 0)
+			{
+				CounterAdd(metrics.bytesOut, (uint64_t)moved);
+				Trace(TRACE_WRITE, *conn, (uint64_t)moved);
+
+				if ((size_t)moved < conn->piped)
+				{
+					CounterAdd(metrics.partialWrites, 1);
+					Trace(TRACE_PARTIAL_WRITE, *conn, conn->piped - (size_t)moved);
+				}
+
+				conn->piped -= (size_t)moved;
+				conn->lastActivity = now;
+				continue;
+			}
+
+			if (moved < 0 && errno == EINTR)
+				continue;
+
+			if (moved < 0 && errno == EAGAIN)
+				return false;
+
+			if (moved < 0 && errno != EPIPE && errno != ECONNRESET)
+				printf("splice failed with error: %d\n", errno);
+
+			Close(conn);
+			return false;
+		}
+
+		uint32_t remaining = conn->decoder.PassthroughRemaining();
+
+		if (remaining == 0)
+		{
+			ReleasePipe(conn);
+			return true;
+		}
+
+		// The pipe is empty here, so a short or failed splice can only be due to the socket.
+		ssize_t moved = splice(conn->socket, NULL, conn->pipeWrite, NULL, remaining, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+		if (moved > 0)
+		{
+			CounterAdd(metrics.bytesIn, (uint64_t)moved);
+			LOG_DEBUG("Bytes spliced: %d\n", (int)moved);
+			Trace(TRACE_READ, *conn, (uint64_t)moved);
+
+			conn->decoder.SkipPassthrough((uint32_t)moved);
+			conn->piped += (size_t)moved;
+			conn->lastActivity = now;
+			continue;
+		}
+
+		if (moved == 0)
+		{
+			// The peer shut down in the middle of the frame.
+			Close(conn);
+			return false;
+		}
+
+		int error = errno;
+
+		if (error == EINTR)
+			continue;
+
+		if (error == EAGAIN)
+			return false;
+
+		if (error == EINVAL)
+		{
+			// Splicing from this kind of socket is not supported: copy through user space from now on.
+			printf("splice is not supported here, echoing bulk frames by copying\n");
+			spliceSupported = false;
+			ReleasePipe(conn);
+			return true;
+		}
+
+		Close(conn);
+		return false;
+	}
+}
+
+bool EventLoop::AcquirePipe(EpollConnection *conn)
+{
+	if (!pipes.empty())
+	{
+		conn->pipeWrite = pipes.back();
+		pipes.pop_back();
+		conn->pipeRead = pipes.back();
+		pipes.pop_back();
+
+		return true;
+	}
+
+	int fds[2];
+
+	// Without a pipe (for example at the descriptor limit) the frame is echoed by copying instead.
+	if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1)
+		return false;
+
+	fcntl(fds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+
+	conn->pipeRead = fds[0];
+	conn->pipeWrite = fds[1];
+
+	return true;
+}
+
+void EventLoop::ReleasePipe(EpollConnection *conn)
+{
+	if (conn->piped == 0)
+	{
+		// An empty pipe is kept for the next bulk frame of any connection.
+		pipes.push_back(conn->pipeRead);
+		pipes.push_back(conn->pipeWrite);
+	}
+	else
+	{
+		// Bytes of a closed connection are still in it; closing the pipe discards them.
+		close(conn->pipeRead);
+		close(conn->pipeWrite);
+	}
+
+	conn->pipeRead = -1;
+	conn->pipeWrite = -1;
+	conn->piped = 0;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "IoLoop.h"
+#include "ObjectPool.h"
+
+#include <vector>
+
+// Number of readiness events fetched from the kernel per epoll_wait call.
+#define MAX_EVENTS 256
+
+// Capacity requested for the pipes that carry spliced payloads. A larger pipe moves more bytes per 
+// splice call; the kernel may round it or refuse (the default of 64 KB is then kept).
+#define SPLICE_PIPE_SIZE (256 * 1024)
+
+// Consecutive reads that use less than half of the read size before the read size is halved.
+#define ADAPTIVE_SHRINK_READS 4
+
+// Connection state for the readiness-based backend.
+struct EpollConnection : public Connection
+{
+	// Pipe carrying the payload of a bulk frame from the socket back out to the same socket, 
+	// or -1 while no bulk frame is being spliced.
+	int pipeRead;
+	int pipeWrite;
+
+	// Payload bytes sitting in the pipe, not yet written to the socket.
+	size_t piped;
+
+	// The peer shut down its side; the connection no longer reads and closes once the replies to 
+	// the requests it sent before that, queued or still with the work pool, are sent.
+	bool peerClosed;
+
+	// Bytes asked for by the next recv, adapted to the sizes actually read (see AdaptReadSize).
+	size_t readSize;
+	unsigned smallReads;
+};
+
+// Single-threaded, non-blocking, edge-triggered epoll event loop.
+// The listen socket stays open for the lifetime of the loop and every accepted 
+// connection is multiplexed on the same thread.
+// With bulk echo enabled, the payload of a large frame is moved socket -> pipe -> socket with splice, 
+// so it is never copied into or out of user space.
+class EventLoop : public IoLoop
+{
+public:
+	EventLoop();
+	~EventLoop();
+
+	// Create the epoll instance.
+	bool Init(void);
+
+	bool AddListener(SOCKET listenSocket);
+
+	bool Send(Connection &conn, const char *data, size_t len);
+
+	void CloseConnection(Connection &conn);
+
+	int Run(void);
+
+protected:
+	Connection *AddConnection(SOCKET s, bool local);
+	void SetAccepting(bool accept);
+	bool Quiescent(const Connection &conn) const;
+
+private:
+	void OnAccept(SOCKET listenSocket);
+	void OnReadable(EpollConnection *conn);
+	void AdaptReadSize(EpollConnection *conn, size_t received);
+	bool Flush(EpollConnection *conn);
+	void FlushDirty(void);
+	void Close(EpollConnection *conn);
+
+	bool Splice(EpollConnection *conn);
+	bool AcquirePipe(EpollConnection *conn);
+	void ReleasePipe(EpollConnection *conn);
+
+	int epollFd;
+	ObjectPool<EpollConnection> connections;
+	std::vector<EpollConnection *> closing;
+
+	// Connections with output queued during the current iteration.
+	std::vector<EpollConnection *> dirty;
+
+	// Connections to read again because their output drained below the backpressure limit.
+	std::vector<EpollConnection *> resume;
+	std::vector<EpollConnection *> resuming;
+
+	// Receive buffer for reads larger than a pooled buffer, tuning.maxRead bytes. Like the pooled 
+	// receive buffer it is only used for the duration of one read, so one per loop serves every connection.
+	char *largeRead;
+
+	// Idle pipes kept for the next bulk frame, as (read end, write end) pairs.
+	std::vector<int> pipes;
+
+	// Cleared when the kernel refuses to splice from a socket; bulk frames are then echoed by copying.
+	bool spliceSupported;
+};
@@ -0,0 +1,202 @@
+#include "Frame.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+size_t EncodeFrame(char *out, const char *payload, uint32_t payloadLength)
+{
+	EncodeFrameHeader(out, payloadLength);
+	memcpy(out + FRAME_HEADER_SIZE, payload, payloadLength);
+
+	return FRAME_HEADER_SIZE + (size_t)payloadLength;
+}
+
+bool FrameDecoder::Reserve(BufferPool *pool, size_t need)
+{
+	if (need <= capacity)
+		return true;
+
+	char *storage;
+	Buffer *buffer = NULL;
+
+	if (pool != NULL && need <= BUFFER_CAPACITY)
+	{
+		buffer = pool->Acquire();
+
+		if (buffer == NULL)
+			return false;
+
+		storage = buffer->data;
+		need = BUFFER_CAPACITY;
+	}
+	else
+	{
+		// Frames larger than a pooled buffer are rare; they get an exact-size heap block.
+		storage = (char *)malloc(need);
+
+		if (storage == NULL)
+			return false;
+	}
+
+	if (partialLength > 0)
+		memcpy(storage, partial, partialLength);
+
+	size_t keep = partialLength;
+	Clear(pool);
+
+	partial = storage;
+	partialLength = keep;
+	capacity = need;
+	pooled = buffer;
+
+	return true;
+}
+
+void FrameDecoder::Append(const char *data, size_t len)
+{
+	memcpy(partial + partialLength, data, len);
+	partialLength += len;
+}
+
+void FrameDecoder::Clear(BufferPool *pool)
+{
+	if (pooled != NULL)
+		pool->Release(pooled);
+	else
+		free(partial);
+
+	partial = NULL;
+	partialLength = 0;
+	capacity = 0;
+	pooled = NULL;
+	passthroughRemaining = 0;
+}
+
+bool FrameDecoder::Feed(BufferPool *pool, const char *data, size_t len, FrameCallback callback, void *context)
+{
+	return Feed(pool, data, len, callback, context, 0, NULL);
+}
+
+bool FrameDecoder::Feed(BufferPool *pool, const char *data, size_t len, FrameCallback callback, void *context, 
+	uint32_t passthroughThreshold, FrameCallback passthrough)
+{
+	// --- Continuing a Pass-through Frame ---
+
+	if (passthroughRemaining > 0)
+	{
+		size_t take = passthroughRemaining < len ? passthroughRemaining : len;
+
+		if (take > 0)
+			passthrough(data, take, context);
+
+		passthroughRemaining -= (uint32_t)take;
+		data += take;
+		len -= take;
+
+		if (passthroughRemaining > 0)
+			return true;
+	}
+
+	// --- Completing a Frame Split Across Reads ---
+
+	if (partialLength > 0)
+	{
+		// First finish the header, then copy exactly the missing payload bytes; nothing is rescanned.
+		if (partialLength < FRAME_HEADER_SIZE)
+		{
+			size_t take = FRAME_HEADER_SIZE - partialLength;
+
+			if (take > len)
+				take = len;
+
+			Append(data, take);
+			data += take;
+			len -= take;
+
+			if (partialLength < FRAME_HEADER_SIZE)
+				return true;
+
+			uint32_t payloadLength = DecodeFrameHeader(partial);
+
+			if (payloadLength > MAX_FRAME_SIZE)
+				return false;
+
+			if (passthroughThreshold > 0 && payloadLength >= passthroughThreshold)
+			{
+				// Only the header was split; the payload goes through without reassembly.
+				passthrough(partial, FRAME_HEADER_SIZE, context);
+				Clear(pool);
+
+				passthroughRemaining = payloadLength;
+
+				return Feed(pool, data, len, callback, context, passthroughThreshold, passthrough);
+			}
+
+			if (!Reserve(pool, FRAME_HEADER_SIZE + (size_t)payloadLength))
+				return false;
+		}
+
+		size_t frameLength = FRAME_HEADER_SIZE + (size_t)DecodeFrameHeader(partial);
+		size_t take = frameLength - partialLength;
+
+		if (take > len)
+			take = len;
+
+		Append(data, take);
+		data += take;
+		len -= take;
+
+		if (partialLength < frameLength)
+			return true;
+
+		callback(partial + FRAME_HEADER_SIZE, frameLength - FRAME_HEADER_SIZE, context);
+
+		// The frame is complete: the storage goes straight back to the pool.
+		Clear(pool);
+	}
+
+	// --- Frames Contained in the Chunk ---
+
+	// Hand out every complete frame as a view into the caller's buffer. Each header is decoded once: 
+	// the length of the frame left incomplete is kept for reserving its storage below.
+	size_t need = FRAME_HEADER_SIZE;
+
+	while (len >= FRAME_HEADER_SIZE)
+	{
+		uint32_t payloadLength = DecodeFrameHeader(data);
+
+		if (payloadLength > MAX_FRAME_SIZE)
+			return false;
+
+		size_t frameLength = FRAME_HEADER_SIZE + (size_t)payloadLength;
+
+		if (passthroughThreshold > 0 && payloadLength >= passthroughThreshold)
+		{
+			passthrough(data, FRAME_HEADER_SIZE, context);
+			passthroughRemaining = payloadLength;
+
+			return Feed(pool, data + FRAME_HEADER_SIZE, len - FRAME_HEADER_SIZE, callback, context, passthroughThreshold, passthrough);
+		}
+
+		if (len < frameLength)
+		{
+			need = frameLength;
+			break;
+		}
+
+		callback(data + FRAME_HEADER_SIZE, payloadLength, context);
+		data += frameLength;
+		len -= frameLength;
+	}
+
+	// Keep the trailing partial frame for the next read.
+	if (len > 0)
+	{
+		if (!Reserve(pool, need))
+			return false;
+
+		Append(data, len);
+	}
+
+	return true;
+}
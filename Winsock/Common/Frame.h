@@ -0,0 +1,119 @@
+#pragma once
+
+#include "BufferPool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// --- Length-Prefixed Framing ---
+
+// Every message on the wire is a 4-byte big-endian payload length followed by the payload.
+// The receiver knows exactly how many bytes complete the current message, so it never scans 
+// the data for a terminator and never has to guess where one message ends and the next begins.
+#define FRAME_HEADER_SIZE 4
+
+// Frames larger than this are treated as a protocol error and the connection is closed, 
+// so a corrupt or hostile header cannot make the server reserve gigabytes.
+#define MAX_FRAME_SIZE (16 * 1024 * 1024)
+
+inline void EncodeFrameHeader(char *out, uint32_t payloadLength)
+{
+	out[0] = (char)(payloadLength >> 24);
+	out[1] = (char)(payloadLength >> 16);
+	out[2] = (char)(payloadLength >> 8);
+	out[3] = (char)(payloadLength);
+}
+
+inline uint32_t DecodeFrameHeader(const char *in)
+{
+	const unsigned char *p = (const unsigned char *)in;
+
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+// Write header and payload to out, which must hold FRAME_HEADER_SIZE + payloadLength bytes.
+// Returns the number of bytes written.
+size_t EncodeFrame(char *out, const char *payload, uint32_t payloadLength);
+
+// Called once per complete frame. The payload is a view into either the receive buffer or the 
+// decoder's reassembly buffer and is only valid during the call. The 4-byte header always 
+// immediately precedes the payload in memory, so payload - FRAME_HEADER_SIZE is the whole frame.
+typedef void (*FrameCallback)(const char *payload, size_t len, void *context);
+
+// Per-connection reassembly of frames from an arbitrarily chunked byte stream.
+// Frames that lie entirely inside a received chunk are handed out in place, so one recv can 
+// yield many frames without copying. Only a frame split across reads is copied, once, into the 
+// reassembly buffer, which then grows by exactly the bytes the header says are still missing.
+// The reassembly buffer is borrowed from the loop's BufferPool (or from the heap for frames larger 
+// than a pooled buffer) only while a partial frame is pending, so a decoder between frames holds no memory.
+class FrameDecoder
+{
+public:
+	FrameDecoder() : partial(NULL), partialLength(0), capacity(0), pooled(NULL), passthroughRemaining(0) {}
+	~FrameDecoder() { if (pooled == NULL) free(partial); }
+
+	// Consume one received chunk and invoke the callback for every frame it completes.
+	// pool may be NULL, in which case partial frames are kept on the heap.
+	// Returns false on a protocol error (a frame larger than MAX_FRAME_SIZE).
+	bool Feed(BufferPool *pool, const char *data, size_t len, FrameCallback callback, void *context);
+
+	// Like Feed, but frames whose payload is at least passthroughThreshold bytes are not reassembled: 
+	// their header and payload bytes are handed to passthrough (with the same context) as they arrive, 
+	// in pieces of any size, and the callback never sees them. A bulk transfer then needs no reassembly 
+	// memory, and the caller may move the rest of the payload itself (see SkipPassthrough).
+	// A threshold of 0 disables pass-through.
+	bool Feed(BufferPool *pool, const char *data, size_t len, FrameCallback callback, void *context, 
+		uint32_t passthroughThreshold, FrameCallback passthrough);
+
+	// Payload bytes of the current pass-through frame that have not arrived yet.
+	uint32_t PassthroughRemaining(void) const { return passthroughRemaining; }
+
+	// The caller consumed n payload bytes of the current pass-through frame without feeding them, 
+	// for example by splicing them from the socket straight to the peer.
+	void SkipPassthrough(uint32_t n) { passthroughRemaining -= n; }
+
+	// Drop any partial frame (or pass-through in progress) and give its storage back. 
+	// Must be called with the same pool before the connection is released.
+	void Clear(BufferPool *pool);
+
+	// Bytes of an incomplete frame carried over to the next read.
+	size_t Buffered(void) const { return partialLength; }
+
+private:
+	// Make the reassembly storage hold at least need bytes, keeping what it already holds.
+	bool Reserve(BufferPool *pool, size_t need);
+
+	// Append bytes to the partial frame; the storage must already be large enough.
+	void Append(const char *data, size_t len);
+
+	// Header and payload bytes of the frame currently being reassembled.
+	char *partial;
+	size_t partialLength;
+	size_t capacity;
+
+	// Pooled buffer backing partial, or NULL when partial is heap memory (or absent).
+	Buffer *pooled;
+
+	uint32_t passthroughRemaining;
+};
+
+// --- Request IDs ---
+
+// A client that keeps many requests in flight on one connection puts an 8-byte big-endian request ID 
+// in front of every payload, and the server sends the ID back in front of the reply. Replies can then 
+// be matched to requests in any order. The ID is part of the payload as far as the framing is concerned, 
+// so the echo server returns it without knowing about it; a server with its own handler copies the 
+// first REQUEST_ID_SIZE bytes of the request into its reply.
+#define REQUEST_ID_SIZE 8
+
+inline void EncodeRequestId(char *out, uint64_t id)
+{
+	EncodeFrameHeader(out, (uint32_t)(id >> 32));
+	EncodeFrameHeader(out + 4, (uint32_t)id);
+}
+
+inline uint64_t DecodeRequestId(const char *in)
+{
+	return ((uint64_t)DecodeFrameHeader(in) << 32) | (uint64_t)DecodeFrameHeader(in + 4);
+}
@@ -0,0 +1,70 @@
+#include "Histogram.h"
+
+#include <string.h>
+
+Histogram::Histogram()
+{
+	Reset();
+}
+
+void Histogram::Reset(void)
+{
+	memset(counts, 0, sizeof(counts));
+	total = 0;
+	sum = 0;
+	maxValue = 0;
+}
+
+void Histogram::Merge(const Histogram &other)
+{
+	uint64_t merged = 0;
+
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		uint64_t count = CounterLoad(other.counts[i]);
+
+		counts[i] += count;
+		merged += count;
+	}
+
+	// The total is recounted from the buckets, so a snapshot taken while the owner is recording 
+	// stays consistent with its own buckets.
+	total += merged;
+	sum += CounterLoad(other.sum);
+
+	uint64_t otherMax = CounterLoad(other.maxValue);
+
+	if (otherMax > maxValue)
+		maxValue = otherMax;
+}
+
+uint64_t Histogram::Percentile(double percentile) const
+{
+	if (total == 0)
+		return 0;
+
+	uint64_t rank = (uint64_t)(percentile / 100.0 * (double)total + 0.5);
+
+	if (rank < 1)
+		rank = 1;
+
+	if (rank > total)
+		rank = total;
+
+	uint64_t seen = 0;
+
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		seen += counts[i];
+
+		if (seen >= rank)
+		{
+			uint64_t value = BucketValue(i);
+
+			// The top bucket's upper bound can exceed the largest sample.
+			return value < maxValue ? value : maxValue;
+		}
+	}
+
+	return maxValue;
+}
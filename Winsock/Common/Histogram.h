@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// --- HDR Latency Histogram ---
+
+// Log-linear histogram in the style of HdrHistogram. Values below 2^HISTOGRAM_SUB_BITS are 
+// counted exactly; above that, every power-of-two range is split into 2^(HISTOGRAM_SUB_BITS - 1) 
+// equal buckets, which keeps the relative error of any recorded value below 0.1%.
+// Recording is a few arithmetic instructions and one increment, with no allocation and no locks, 
+// so each thread records into its own histogram and the results are merged afterwards.
+// A histogram has a single writer, but other threads may Merge it into a snapshot while it is 
+// being written (see Metrics.h): every field is read and written with relaxed atomic accesses, 
+// which compile to plain loads and stores, so the writer pays nothing for it.
+#define HISTOGRAM_SUB_BITS 11
+#define HISTOGRAM_HALF     (1u << (HISTOGRAM_SUB_BITS - 1))
+
+// Values up to 2^HISTOGRAM_MAX_BITS (about 18 minutes in nanoseconds) are tracked; larger ones are clamped.
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS  ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 2) * HISTOGRAM_HALF)
+
+// Add to a counter that only the calling thread writes and that other threads may read at any time.
+// A relaxed load and store instead of an atomic read-modify-write: no lock prefix, no bus locking.
+static inline void CounterAdd(uint64_t &counter, uint64_t value)
+{
+	__atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+// Read a counter written by another thread.
+static inline uint64_t CounterLoad(const uint64_t &counter)
+{
+	return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+}
+
+class Histogram
+{
+public:
+	Histogram();
+
+	void Record(uint64_t value)
+	{
+		if (value >= ((uint64_t)1 << HISTOGRAM_MAX_BITS))
+			value = ((uint64_t)1 << HISTOGRAM_MAX_BITS) - 1;
+
+		CounterAdd(counts[BucketIndex(value)], 1);
+		CounterAdd(total, 1);
+		CounterAdd(sum, value);
+
+		if (value > maxValue)
+			__atomic_store_n(&maxValue, value, __ATOMIC_RELAXED);
+	}
+
+	// Add every count of other into this histogram. Safe while other's owner keeps recording into it.
+	void Merge(const Histogram &other);
+
+	void Reset(void);
+
+	// Smallest recorded value v such that at least percentile% of the samples are <= v 
+	// (to the precision of the bucket). Returns 0 for an empty histogram.
+	uint64_t Percentile(double percentile) const;
+
+	uint64_t Count(void) const { return total; }
+	uint64_t Max(void) const { return maxValue; }
+	double Mean(void) const { return total ? (double)sum / (double)total : 0.0; }
+
+	static unsigned BucketIndex(uint64_t value)
+	{
+		if (value < (2 * HISTOGRAM_HALF))
+			return (unsigned)value;
+
+		// Position of the highest set bit decides the power-of-two range; the next 
+		// HISTOGRAM_SUB_BITS - 1 bits select the bucket within it.
+		unsigned shift = (63 - (unsigned)__builtin_clzll(value)) - (HISTOGRAM_SUB_BITS - 1);
+
+		return (shift + 1) * HISTOGRAM_HALF + (unsigned)(value >> shift) - HISTOGRAM_HALF;
+	}
+
+	// Highest value that falls into the bucket.
+	static uint64_t BucketValue(unsigned index)
+	{
+		if (index < (2 * HISTOGRAM_HALF))
+			return index;
+
+		unsigned shift = index / HISTOGRAM_HALF - 1;
+		uint64_t sub = index % HISTOGRAM_HALF + HISTOGRAM_HALF;
+
+		return ((sub + 1) << shift) - 1;
+	}
+
+private:
+	uint64_t counts[HISTOGRAM_BUCKETS];
+	uint64_t total;
+	uint64_t sum;
+	uint64_t maxValue;
+};
@@ -0,0 +1,934 @@
+#include "IoLoop.h"
+#include "EventLoop.h"
+#include "UringLoop.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/eventfd.h>
+#endif
+
+// Connection a frame was decoded from, threaded through FrameDecoder::Feed.
+struct FrameDispatch
+{
+	IoLoop *loop;
+	Connection *conn;
+};
+
+static void EchoHandler(IoLoop &loop, Connection &conn, const char *data, size_t len, void *)
+{
+	// Echo the buffer back to the sender
+	loop.Send(conn, data, len);
+}
+
+IoLoop::IoLoop()
+	: handler(EchoHandler), handlerContext(NULL), messageHandler(NULL), messageContext(NULL), 
+	  bulkThreshold(0), connectionCount(0), running(false), wakeFd(-1), now(0), accepting(true), draining(false), 
+	  maxConnections(0), acceptRetryAt(0), tls(NULL), trace(NULL), idleTimeout(0), readTimeout(0), openHead(NULL), drainRequested(0), 
+	  drainTimeoutMs(0), drainDeadline(0), nextConnectionId(1), traceThreshold(0), lastTraceDump(0), traceDumpRequested(0), 
+	  offerShm(false), workPool(NULL), completionSignaled(0)
+{
+	DefaultTuning(tuning);
+}
+
+IoLoop::~IoLoop()
+{
+	delete tls;
+	delete trace;
+
+	for (size_t i = 0; i < listeners.size(); i++)
+		closesocket(listeners[i]);
+
+	if (wakeFd != -1)
+		close(wakeFd);
+}
+
+bool IoLoop::InitWake(void)
+{
+	if (wakeFd != -1)
+		return true;
+
+	// Blocking, so the io_uring backend can keep a plain read armed on it; the loop 
+	// only reads it once it is known to be readable, and writers never fill the counter.
+	int fd = eventfd(0, EFD_CLOEXEC);
+
+	if (fd == -1)
+	{
+		printf("eventfd failed with error: %d\n", errno);
+		return false;
+	}
+
+	// Drain may read it from another thread while the loop is still being set up.
+	__atomic_store_n(&wakeFd, fd, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+bool IoLoop::SetTls(SSL_CTX *context)
+{
+	if (tls == NULL)
+		tls = new TlsHandshaker();
+
+	return tls->Init(context, &metrics);
+}
+
+void IoLoop::Accepted(SOCKET s, SOCKET listenSocket)
+{
+	for (size_t i = 0; i < localListeners.size(); i++)
+	{
+		if (localListeners[i] == listenSocket)
+		{
+			AcceptLocal(s);
+			return;
+		}
+	}
+
+	if (tls != NULL)
+		tls->Start(s, now);
+	else
+		AddConnection(s, false);
+}
+
+bool IoLoop::SetTrace(size_t events, unsigned loop, const char *directory, uint32_t thresholdUs)
+{
+	// DumpTrace wakes the loop through the eventfd.
+	if (!InitWake())
+		return false;
+
+	if (trace == NULL)
+		trace = new TraceRing();
+
+	traceThreshold = (uint64_t)thresholdUs * 1000ull;
+
+	return trace->Init(events, loop, directory);
+}
+
+void IoLoop::DumpTrace(void)
+{
+	if (trace == NULL)
+		return;
+
+	// Only an atomic store and a write, as in Drain.
+	__atomic_store_n(&traceDumpRequested, 1, __ATOMIC_RELEASE);
+
+	if (wakeFd != -1)
+	{
+		uint64_t one = 1;
+		ssize_t ignored = write(wakeFd, &one, sizeof(one));
+		(void)ignored;
+	}
+}
+
+void IoLoop::EndIteration(uint64_t iterationStart)
+{
+	uint64_t elapsed = MetricsClock() - iterationStart;
+
+	metrics.iterationTime.Record(elapsed);
+
+	if (trace == NULL || traceThreshold == 0 || elapsed < traceThreshold)
+		return;
+
+	// --- Dumping the Trace of a Slow Iteration ---
+
+	// The ring holds what the loop did during the iteration and before it. Writing the file takes 
+	// this thread, so a stretch of slow iterations dumps once per TRACE_DUMP_INTERVAL_MS.
+	trace->Record(TRACE_SLOW_ITERATION, 0, elapsed / 1000);
+
+	uint64_t clock = iterationStart + elapsed;
+
+	if (lastTraceDump != 0 && clock - lastTraceDump < (uint64_t)TRACE_DUMP_INTERVAL_MS * 1000000ull)
+		return;
+
+	lastTraceDump = clock;
+	trace->Dump();
+}
+
+void IoLoop::OnHandshakeDone(SOCKET s, void *context)
+{
+	IoLoop *loop = (IoLoop *)context;
+
+	// A drain closes the handshakes in progress; none finishes after it began.
+	loop->AddConnection(s, false);
+}
+
+void IoLoop::SetHandler(DataHandler dataHandler, void *context)
+{
+	handler = dataHandler ? dataHandler : EchoHandler;
+	handlerContext = context;
+}
+
+void IoLoop::SetMessageHandler(MessageHandler frameHandler, void *context)
+{
+	messageHandler = frameHandler;
+	messageContext = context;
+
+	SetHandler(FramedDataHandler, NULL);
+}
+
+void IoLoop::FramedDataHandler(IoLoop &loop, Connection &conn, const char *data, size_t len, void *)
+{
+	FrameDispatch dispatch;
+	dispatch.loop = &loop;
+	dispatch.conn = &conn;
+
+	// Bulk echo moves payloads from socket to socket; the frames of a shared-memory connection are in its ring.
+	uint32_t bulkThreshold = SharedMemory(conn) ? 0 : loop.bulkThreshold;
+
+	if (!conn.decoder.Feed(&loop.bufferPool, data, len, OnFrame, &dispatch, bulkThreshold, OnBulkData))
+	{
+		printf("Invalid frame (larger than %d bytes or out of memory), closing connection\n", MAX_FRAME_SIZE);
+		CounterAdd(loop.metrics.frameErrors, 1);
+		loop.CloseConnection(conn);
+	}
+}
+
+void IoLoop::OnFrame(const char *payload, size_t len, void *context)
+{
+	FrameDispatch *dispatch = (FrameDispatch *)context;
+	IoLoop *loop = dispatch->loop;
+
+	CounterAdd(loop->metrics.frames, 1);
+	LOG_DEBUG("Frame received: %zu bytes\n", len);
+
+	// A frame boundary passed in this read; a frame still partial afterwards began in this read.
+	dispatch->conn->frameStarted = 0;
+
+	loop->Trace(TRACE_FRAME, *dispatch->conn, len);
+	loop->Trace(TRACE_HANDLER_START, *dispatch->conn, len);
+
+	loop->messageHandler(*loop, *dispatch->conn, payload, len, loop->messageContext);
+
+	// Connection objects are released only at the end of the iteration, so the ID is still there.
+	loop->Trace(TRACE_HANDLER_END, *dispatch->conn, 0);
+}
+
+void IoLoop::OnBulkData(const char *data, size_t len, void *context)
+{
+	FrameDispatch *dispatch = (FrameDispatch *)context;
+
+	// The header of a bulk frame comes first, before the decoder counts its payload as remaining.
+	if (dispatch->conn->decoder.PassthroughRemaining() == 0)
+		dispatch->conn->frameStarted = 0;
+
+	// Header and payload pieces of a bulk frame, echoed unchanged in arrival order.
+	dispatch->loop->Send(*dispatch->conn, data, len);
+}
+
+// --- Same-Host Transports ---
+
+bool IoLoop::AddLocalListener(SOCKET listenSocket, bool shm)
+{
+	if (!AddListener(listenSocket))
+		return false;
+
+	localListeners.push_back(listenSocket);
+	offerShm = shm;
+
+	return true;
+}
+
+void IoLoop::AcceptLocal(SOCKET s)
+{
+	LocalChannel *local = localChannels.Acquire();
+
+	if (local == NULL)
+	{
+		printf("Out of memory for connection state\n");
+		closesocket(s);
+		return;
+	}
+
+	local->state = LOCAL_NEGOTIATING;
+	local->helloLength = 0;
+	local->shm = NULL;
+	local->closed = false;
+	local->resuming = false;
+
+	// Nothing is received before the next iteration, so the connection has its state in time for the hello.
+	Connection *conn = AddConnection(s, true);
+
+	if (conn == NULL)
+	{
+		localChannels.Release(local);
+		return;
+	}
+
+	conn->local = local;
+}
+
+void IoLoop::ReceivedLocal(Connection &conn, const char *data, size_t len)
+{
+	LocalChannel *local = conn.local;
+
+	// The bytes on the socket of a shared-memory connection are doorbells: the client wrote requests 
+	// into the ring, or made room in the other one, and found the loop asleep.
+	if (local->state == LOCAL_SHM)
+	{
+		ServiceShm(conn);
+		return;
+	}
+
+	size_t take = LOCAL_HELLO_SIZE - local->helloLength;
+
+	if (take > len)
+		take = len;
+
+	memcpy(local->hello + local->helloLength, data, take);
+	local->helloLength += take;
+
+	if (local->helloLength < LOCAL_HELLO_SIZE)
+		return;
+
+	unsigned transport = AnswerLocalHello(conn.socket, local->hello, offerShm, &local->shm);
+
+	if (transport == 0)
+	{
+		CloseConnection(conn);
+		return;
+	}
+
+	LOG_DEBUG("Transport negotiated: socket %d, %s\n", (int)conn.socket, LocalTransportName(transport));
+
+	if (transport == LOCAL_TRANSPORT_SHM)
+	{
+		// The client writes its first request into the ring and rings for it once it has the answer.
+		local->state = LOCAL_SHM;
+		return;
+	}
+
+	// A client that did not wait for the answer may have sent its first frames right behind the hello.
+	local->state = LOCAL_STREAM;
+
+	if (len > take)
+		handler(*this, conn, data + take, len - take, handlerContext);
+}
+
+void IoLoop::ServiceShm(Connection &conn)
+{
+	// --- Serving a Shared-Memory Connection ---
+
+	// The requests are handed to the handler as many as are there: one doorbell can stand for any number 
+	// of them. The ring stops being read while the replies reach the output limit and the ring to the 
+	// client is full, which is the backpressure of a socket connection; the client's doorbell after reading 
+	// its replies brings the loop back here. Once the ring is empty the waiting flag is raised, so the 
+	// client's next request rings again.
+	//
+	// A client on another CPU can keep the ring from ever running empty, so one call takes at most a ring's 
+	// worth of requests, like a bounded batch of reads on a socket. A connection stopped there is served 
+	// again by ResumeShm in the next iteration, after the other connections, the timers and accept had their turn.
+	//
+	// The client can rewrite the ring at any time, also while the handler is reading it, so the handler never 
+	// sees the ring itself: the bytes are first copied into a pooled buffer of the loop, as a recv would.
+	LocalChannel *local = conn.local;
+	ShmRing &ring = local->shm->toServer;
+	bool received = false;
+	size_t budget = SHM_RING_SIZE;
+
+	FlushShm(conn);
+
+	Buffer *copy = NULL;
+
+	while (!local->closed)
+	{
+		if (conn.PendingOutput() >= MAX_PENDING_OUTPUT)
+		{
+			FlushShm(conn);
+
+			if (conn.PendingOutput() >= MAX_PENDING_OUTPUT)
+				break;
+		}
+
+		if (budget == 0)
+		{
+			if (!local->resuming)
+			{
+				local->resuming = true;
+				shmResume.push_back(&conn);
+			}
+
+			break;
+		}
+
+		const char *data;
+		size_t len = ring.Peek(&data);
+
+		if (len == 0)
+		{
+			if (ring.ConsumerSleep())
+				break;
+
+			continue;
+		}
+
+		if (copy == NULL && (copy = bufferPool.Acquire()) == NULL)
+		{
+			printf("Out of memory for receive buffer\n");
+			CloseConnection(conn);
+			break;
+		}
+
+		if (len > BUFFER_CAPACITY)
+			len = BUFFER_CAPACITY;
+
+		if (len > budget)
+			len = budget;
+
+		budget -= len;
+
+		memcpy(copy->data, data, len);
+
+		// The bytes are ours now, so they go back to the client at once; if it was waiting for room, it is woken.
+		ring.Consume(len);
+
+		if (ring.WakeProducer())
+			RingDoorbell(conn.socket);
+
+		CounterAdd(metrics.bytesIn, (uint64_t)len);
+		LOG_DEBUG("Bytes received: %d\n", (int)len);
+		Trace(TRACE_READ, conn, (uint64_t)len);
+
+		received = true;
+
+		handler(*this, conn, copy->data, len, handlerContext);
+	}
+
+	if (copy != NULL)
+		bufferPool.Release(copy);
+
+	if (received && !local->closed)
+		NoteReceived(conn);
+}
+
+void IoLoop::ResumeShm(void)
+{
+	if (shmResume.empty())
+		return;
+
+	// A connection served here may stop at its budget again and go back on shmResume for the next iteration.
+	shmResuming.swap(shmResume);
+
+	for (size_t i = 0; i < shmResuming.size(); i++)
+	{
+		Connection *conn = shmResuming[i];
+		conn->local->resuming = false;
+
+		ServiceShm(*conn);
+	}
+
+	shmResuming.clear();
+}
+
+void IoLoop::FlushShm(Connection &conn)
+{
+	ShmRing &ring = conn.local->shm->toClient;
+	bool written = false;
+
+	while (!conn.output.Empty())
+	{
+		struct iovec iov[MAX_SEND_IOVECS];
+		size_t bytes;
+		size_t count = conn.output.Gather(iov, MAX_SEND_IOVECS, &bytes);
+		size_t total = 0;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			size_t copied = ring.Write(iov[i].iov_base, iov[i].iov_len);
+			total += copied;
+
+			if (copied < iov[i].iov_len)
+				break;
+		}
+
+		if (total > 0)
+		{
+			conn.output.Consume(bufferPool, total);
+			conn.lastActivity = now;
+			written = true;
+
+			CounterAdd(metrics.bytesOut, (uint64_t)total);
+			LOG_DEBUG("Bytes sent: %d\n", (int)total);
+			Trace(TRACE_WRITE, conn, (uint64_t)total);
+		}
+
+		// A full ring is the full send buffer of a socket: the rest waits for the client's doorbell.
+		if (total < bytes)
+		{
+			CounterAdd(metrics.partialWrites, 1);
+			Trace(TRACE_PARTIAL_WRITE, conn, bytes - total);
+
+			if (ring.ProducerSleep())
+				break;
+		}
+	}
+
+	if (written && ring.WakeConsumer())
+		RingDoorbell(conn.socket);
+}
+
+void IoLoop::ReleaseLocal(Connection &conn)
+{
+	if (conn.local == NULL)
+		return;
+
+	UnmapShmChannel(conn.local->shm);
+	localChannels.Release(conn.local);
+	conn.local = NULL;
+}
+
+// --- Offloading Work ---
+
+bool IoLoop::SetWorkPool(WorkPool *pool)
+{
+	if (!InitWake())
+		return false;
+
+	workPool = pool;
+
+	return true;
+}
+
+bool IoLoop::Offload(Connection &conn, const char *payload, size_t len, WorkHandler work, void *context)
+{
+	if (workPool == NULL)
+		return false;
+
+	WorkItem *item = workItems.Acquire();
+
+	if (item == NULL)
+		return false;
+
+	// The payload is only valid during the message handler; the worker gets its own copy, 
+	// in a pooled buffer when it fits.
+	size_t frameLength = FRAME_HEADER_SIZE + len;
+
+	item->buffer = frameLength <= BUFFER_CAPACITY ? bufferPool.Acquire() : NULL;
+	item->frame = item->buffer != NULL ? item->buffer->data : (char *)malloc(frameLength);
+
+	if (item->frame == NULL)
+	{
+		workItems.Release(item);
+		return false;
+	}
+
+	memcpy(item->frame, payload - FRAME_HEADER_SIZE, frameLength);
+
+	item->run = RunWorkItem;
+	item->loop = this;
+	item->conn = &conn;
+	item->nextInConnection = NULL;
+	item->work = work;
+	item->context = context;
+	item->length = len;
+	item->done = false;
+
+	if (conn.workTail != NULL)
+		conn.workTail->nextInConnection = item;
+	else
+		conn.workHead = item;
+
+	conn.workTail = item;
+
+	CounterAdd(metrics.offloads, 1);
+
+	workPool->Submit(item);
+
+	return true;
+}
+
+void IoLoop::RunWorkItem(WorkJob *job)
+{
+	// Worker thread: only the item itself may be touched until it is back on the loop's thread.
+	WorkItem *item = (WorkItem *)job;
+	IoLoop *loop = item->loop;
+
+	size_t length = item->work(item->frame + FRAME_HEADER_SIZE, item->length, item->context);
+
+	if (length < item->length)
+	{
+		item->length = length;
+		EncodeFrameHeader(item->frame, (uint32_t)length);
+	}
+
+	loop->completions.Push(item);
+
+	// Pairs with the fence in DrainCompletions: either the loop still sees the flag set and will 
+	// find this reply in the drain it is about to do, or this thread sees it cleared and signals.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_exchange_n(&loop->completionSignaled, 1, __ATOMIC_SEQ_CST) == 0)
+	{
+		uint64_t one = 1;
+
+		if (write(loop->wakeFd, &one, sizeof(one)) < 0)
+			printf("write failed with error: %d\n", errno);
+	}
+}
+
+void IoLoop::DrainCompletions(void)
+{
+	__atomic_store_n(&completionSignaled, 0, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	MpscNode *node;
+
+	while ((node = completions.Pop()) != NULL)
+	{
+		WorkItem *item = (WorkItem *)node;
+
+		if (item->conn == NULL)
+		{
+			// The connection closed while the frame was being worked on.
+			FreeWorkItem(item);
+			continue;
+		}
+
+		item->done = true;
+
+		// Send every finished reply at the head of the connection's list; a reply that finished 
+		// before an older one waits for it.
+		Connection *conn = item->conn;
+
+		while (conn->workHead != NULL && conn->workHead->done)
+		{
+			WorkItem *head = conn->workHead;
+
+			conn->workHead = head->nextInConnection;
+
+			if (conn->workHead == NULL)
+				conn->workTail = NULL;
+
+			// A failed send closes the connection, which abandons the rest of its list.
+			Send(*conn, head->frame, FRAME_HEADER_SIZE + head->length);
+			FreeWorkItem(head);
+		}
+	}
+}
+
+void IoLoop::AbandonWork(Connection &conn)
+{
+	WorkItem *item = conn.workHead;
+
+	while (item != NULL)
+	{
+		WorkItem *next = item->nextInConnection;
+
+		// Finished replies are freed now; the others when the worker posts them.
+		if (item->done)
+			FreeWorkItem(item);
+		else
+			item->conn = NULL;
+
+		item = next;
+	}
+
+	conn.workHead = NULL;
+	conn.workTail = NULL;
+}
+
+void IoLoop::FreeWorkItem(WorkItem *item)
+{
+	if (item->buffer != NULL)
+		bufferPool.Release(item->buffer);
+	else
+		free(item->frame);
+
+	workItems.Release(item);
+}
+
+// --- Timeouts, Accept Throttling and Draining ---
+
+void IoLoop::SetTimeouts(uint32_t idleMs, uint32_t readMs)
+{
+	idleTimeout = (uint64_t)idleMs * 1000000ull;
+	readTimeout = (uint64_t)readMs * 1000000ull;
+}
+
+void IoLoop::Drain(uint32_t timeoutMs)
+{
+	// Only an atomic store and a write: both are async-signal-safe.
+	__atomic_store_n(&drainTimeoutMs, timeoutMs, __ATOMIC_RELAXED);
+	__atomic_store_n(&drainRequested, 1, __ATOMIC_RELEASE);
+
+	int fd = __atomic_load_n(&wakeFd, __ATOMIC_ACQUIRE);
+
+	if (fd != -1)
+	{
+		uint64_t one = 1;
+		ssize_t ignored = write(fd, &one, sizeof(one));
+		(void)ignored;
+	}
+}
+
+void IoLoop::AcceptFailed(int error)
+{
+	if (error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM)
+		acceptRetryAt = now + (uint64_t)ACCEPT_RETRY_MS * 1000000ull;
+}
+
+void IoLoop::TrackConnection(Connection &conn)
+{
+	conn.id = nextConnectionId++;
+	Trace(TRACE_ACCEPT, conn, (uint64_t)conn.socket);
+
+	conn.lastActivity = now;
+	conn.frameStarted = 0;
+
+	conn.prevOpen = NULL;
+	conn.nextOpen = openHead;
+
+	if (openHead != NULL)
+		openHead->prevOpen = &conn;
+
+	openHead = &conn;
+
+	if (idleTimeout != 0)
+		timers.Schedule(&conn, now + idleTimeout);
+}
+
+void IoLoop::UntrackConnection(Connection &conn)
+{
+	Trace(TRACE_CLOSE, conn, 0);
+	timers.Cancel(&conn);
+
+	if (conn.local != NULL)
+	{
+		conn.local->closed = true;
+
+		// The connection may be released before the next iteration would serve it again.
+		if (conn.local->resuming)
+		{
+			for (size_t i = 0; i < shmResume.size(); i++)
+			{
+				if (shmResume[i] == &conn)
+				{
+					shmResume.erase(shmResume.begin() + i);
+					break;
+				}
+			}
+
+			conn.local->resuming = false;
+		}
+	}
+
+	if (conn.prevOpen != NULL)
+		conn.prevOpen->nextOpen = conn.nextOpen;
+	else
+		openHead = conn.nextOpen;
+
+	if (conn.nextOpen != NULL)
+		conn.nextOpen->prevOpen = conn.prevOpen;
+
+	conn.prevOpen = NULL;
+	conn.nextOpen = NULL;
+}
+
+void IoLoop::NoteReceived(Connection &conn)
+{
+	conn.lastActivity = now;
+
+	if (readTimeout == 0)
+		return;
+
+	if (conn.decoder.Buffered() == 0 && conn.decoder.PassthroughRemaining() == 0)
+	{
+		conn.frameStarted = 0;
+		return;
+	}
+
+	if (conn.frameStarted != 0)
+		return;
+
+	// A new partial frame: its deadline is usually earlier than the idle deadline the timer was 
+	// set for, so the timer moves forward once per frame that spans reads, not once per read.
+	conn.frameStarted = now;
+
+	uint64_t deadline = now + readTimeout;
+
+	if (!TimerWheel::Scheduled(&conn) || timers.ExpiresAt(&conn) > deadline)
+		timers.Schedule(&conn, deadline);
+}
+
+uint64_t IoLoop::Deadline(const Connection &conn) const
+{
+	uint64_t deadline = 0;
+
+	if (idleTimeout != 0)
+		deadline = conn.lastActivity + idleTimeout;
+
+	if (readTimeout != 0 && conn.frameStarted != 0 && (deadline == 0 || conn.frameStarted + readTimeout < deadline))
+		deadline = conn.frameStarted + readTimeout;
+
+	return deadline;
+}
+
+void IoLoop::OnTimer(TimerNode *node, void *context)
+{
+	// --- Lazy Timeouts ---
+
+	// Traffic does not move the timer: a busy connection would otherwise unlink and relink it on 
+	// every read. The timer fires at the deadline it was last given, and only then are the 
+	// timestamps compared. A connection active since then gets its timer again for its new deadline; 
+	// one that was not is closed. Each connection costs one wheel operation per timeout period at most.
+	IoLoop *loop = (IoLoop *)context;
+	Connection *conn = static_cast<Connection *>(node);
+	uint64_t deadline = loop->Deadline(*conn);
+
+	if (deadline == 0)
+		return;
+
+	// A reply still being worked on is the server's delay, not the peer's.
+	if (deadline > loop->now || conn->workHead != NULL)
+	{
+		if (deadline <= loop->now)
+			deadline = loop->now + (loop->idleTimeout != 0 ? loop->idleTimeout : loop->readTimeout);
+
+		loop->timers.Schedule(conn, deadline);
+		return;
+	}
+
+	CounterAdd(loop->metrics.timeouts, 1);
+	LOG_DEBUG("Connection timed out: socket %d\n", (int)conn->socket);
+
+	loop->CloseConnection(*conn);
+}
+
+bool IoLoop::Quiescent(const Connection &conn) const
+{
+	return conn.decoder.Buffered() == 0 && conn.decoder.PassthroughRemaining() == 0 && 
+		conn.PendingOutput() == 0 && conn.workHead == NULL;
+}
+
+void IoLoop::BeginDrain(void)
+{
+	draining = true;
+	drainDeadline = now + (uint64_t)__atomic_load_n(&drainTimeoutMs, __ATOMIC_RELAXED) * 1000000ull;
+
+	// Shutting a listen socket down takes it out of the listening state, so new connections are refused 
+	// at once instead of waiting in a backlog that is never accepted again. Clients can fail over to 
+	// another server right away. The sockets themselves are closed with the loop.
+	for (size_t i = 0; i < listeners.size(); i++)
+		shutdown(listeners[i], SD_BOTH);
+
+	// A connection still in its TLS handshake has sent no request yet.
+	if (tls != NULL)
+		tls->CloseAll();
+}
+
+void IoLoop::Housekeeping(void)
+{
+	if (!draining && __atomic_load_n(&drainRequested, __ATOMIC_ACQUIRE) != 0)
+		BeginDrain();
+
+	if (timers.Size() > 0)
+		timers.Advance(now, OnTimer, this);
+
+	if (tls != NULL)
+		tls->Expire(now);
+
+	if (trace != NULL && __atomic_exchange_n(&traceDumpRequested, 0, __ATOMIC_ACQUIRE) != 0)
+		trace->Dump();
+
+	if (draining)
+	{
+		// --- Graceful Drain ---
+
+		// Connections between requests are closed now; the others as soon as their last reply is out. 
+		// Only open connections are walked, and each one once per iteration until it closes, 
+		// so a drain costs nothing per closed connection however many there were.
+		bool overdue = now >= drainDeadline;
+		Connection *conn = openHead;
+
+		while (conn != NULL)
+		{
+			Connection *next = conn->nextOpen;
+
+			if (overdue || Quiescent(*conn))
+				CloseConnection(*conn);
+
+			conn = next;
+		}
+	}
+
+	// --- Accept Throttling ---
+
+	// At the limit the listeners are disarmed rather than connections accepted and closed again: 
+	// the kernel keeps completing handshakes into the listen backlog, and those clients are served 
+	// in order as soon as connections close here, instead of seeing resets.
+	// After a failed accept the listeners stay disarmed until the pause is over.
+	if (acceptRetryAt != 0 && now >= acceptRetryAt)
+		acceptRetryAt = 0;
+
+	bool accept = !draining && (maxConnections == 0 || Admitted() < maxConnections) && acceptRetryAt == 0;
+
+	if (accept != accepting)
+	{
+		accepting = accept;
+
+		if (!accept && !draining)
+			CounterAdd(metrics.acceptPauses, 1);
+
+		SetAccepting(accept);
+	}
+}
+
+int IoLoop::WaitTimeoutMs(void) const
+{
+	// Shared-memory connections waiting to be served again do not wait for an event, and neither does a 
+	// drain requested before Init created the eventfd that would have signalled it.
+	if (!shmResume.empty() || (!draining && __atomic_load_n(&drainRequested, __ATOMIC_ACQUIRE) != 0))
+		return 0;
+
+	if (timers.Size() == 0 && !draining && (tls == NULL || tls->Pending() == 0) && acceptRetryAt == 0)
+		return -1;
+
+	uint64_t clock = MetricsClock();
+	int timeout = timers.NextTimeoutMs(clock);
+
+	if (tls != NULL && tls->Pending() > 0)
+	{
+		int ms = tls->NextTimeoutMs(clock);
+
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+
+	if (draining)
+	{
+		int ms = drainDeadline <= clock ? 0 : (int)((drainDeadline - clock + 999999) / 1000000);
+
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+
+	if (acceptRetryAt != 0)
+	{
+		int ms = acceptRetryAt <= clock ? 0 : (int)((acceptRetryAt - clock + 999999) / 1000000);
+
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+
+	return timeout;
+}
+
+bool SendFrame(IoLoop &loop, Connection &conn, const char *payload, size_t len)
+{
+	char header[FRAME_HEADER_SIZE];
+	EncodeFrameHeader(header, (uint32_t)len);
+
+	return loop.Send(conn, header, FRAME_HEADER_SIZE) && loop.Send(conn, payload, len);
+}
+
+IoLoop *CreateIoLoop(const char *backend)
+{
+	if (strcmp(backend, "epoll") == 0)
+		return new EventLoop();
+
+	if (strcmp(backend, "uring") == 0)
+		return new UringLoop();
+
+	return NULL;
+}
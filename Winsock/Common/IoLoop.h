@@ -0,0 +1,373 @@
+#pragma once
+
+#include "Connection.h"
+#include "BufferPool.h"
+#include "Metrics.h"
+#include "Tuning.h"
+#include "ObjectPool.h"
+#include "WorkPool.h"
+#include "TimerWheel.h"
+#include "Tls.h"
+#include "Trace.h"
+#include "LocalTransport.h"
+
+#include <vector>
+
+class IoLoop;
+
+// Pause before accepting again after an accept failed for lack of descriptors or memory, in milliseconds.
+#define ACCEPT_RETRY_MS 100
+
+// Called for every chunk of bytes read from a connection. 
+// The handler replies through IoLoop::Send; the data pointer is only valid during the call.
+typedef void (*DataHandler)(IoLoop &loop, Connection &conn, const char *data, size_t len, void *context);
+
+// Called for every complete length-prefixed frame decoded from a connection (see Frame.h).
+// The payload is a view into the receive or reassembly buffer and is only valid during the call; 
+// the frame header immediately precedes it, so a handler can echo a whole frame without re-encoding it.
+typedef void (*MessageHandler)(IoLoop &loop, Connection &conn, const char *payload, size_t len, void *context);
+
+// Runs on a worker thread for a frame handed to IoLoop::Offload. Transforms the payload in place and 
+// returns the length of the reply payload, at most len. It must not touch the connection or the loop.
+typedef size_t (*WorkHandler)(char *payload, size_t len, void *context);
+
+// A frame on its way through the work pool and back to the loop that offloaded it.
+struct WorkItem : public WorkJob
+{
+	IoLoop *loop;
+
+	// Connection the reply goes to, or NULL once the connection has closed.
+	Connection *conn;
+
+	// Next frame offloaded from the same connection.
+	WorkItem *nextInConnection;
+
+	WorkHandler work;
+	void *context;
+
+	// Copy of the whole frame, header followed by payload: in a pooled buffer, or on the heap 
+	// (buffer NULL) when it does not fit one. length is the payload length, updated by the work.
+	char *frame;
+	size_t length;
+	Buffer *buffer;
+
+	// The work has finished and the reply waits for the replies of older frames.
+	bool done;
+};
+
+// Interface shared by the I/O backends (readiness-based epoll and completion-based io_uring).
+// A loop is single-threaded: every method must be called from the thread that runs it.
+class IoLoop
+{
+public:
+	IoLoop();
+	virtual ~IoLoop();
+
+	// Create the kernel objects the backend needs. Returns false after printing the reason on failure.
+	virtual bool Init(void) = 0;
+
+	// Register a non-blocking listen socket. Connections accepted from it are served by this loop.
+	virtual bool AddListener(SOCKET listenSocket) = 0;
+
+	// Register a non-blocking Unix domain listen socket (see LocalTransport.h) for clients on this host. 
+	// Its connections negotiate their transport first: the socket itself, or with shm set, a pair of 
+	// shared-memory rings if the client accepts them. They skip TLS and the TCP socket options, and are 
+	// otherwise served like TCP connections, by the same handlers.
+	bool AddLocalListener(SOCKET listenSocket, bool shm);
+
+	// Queue bytes for a connection. Everything queued during one loop iteration is written with as few 
+	// scatter/gather sends as possible at the end of the iteration, so pipelined replies are coalesced.
+	// Returns false if the connection failed and has been closed.
+	virtual bool Send(Connection &conn, const char *data, size_t len) = 0;
+
+	// Close a connection, for example after a protocol error. Safe to call from a handler.
+	virtual void CloseConnection(Connection &conn) = 0;
+
+	// Run until Stop is called or a drain has finished. Returns 0 on a clean stop, 1 on a fatal error.
+	virtual int Run(void) = 0;
+
+	// Ask Run to return after the current iteration.
+	void Stop(void) { running = false; }
+
+	// Stop accepting and close every connection as soon as nothing of it is in flight: no partial frame, 
+	// no unsent reply and no offloaded frame. Run returns once the last connection has closed, or after 
+	// timeoutMs, when the connections still busy are closed as they are. 
+	// Unlike the other methods, safe to call from any thread and from a signal handler.
+	void Drain(uint32_t timeoutMs);
+
+	// Close connections that have neither received nor sent anything for idleMs, and connections whose 
+	// frame has started arriving but is not complete after readMs (a slow or stalled sender holding a 
+	// partial frame, which the idle timeout alone would let trickle forever). 0 turns a timeout off; 
+	// the read timeout only applies with a message handler. Must be called before Run.
+	void SetTimeouts(uint32_t idleMs, uint32_t readMs);
+
+	// Stop accepting while this loop has max connections open, and resume when one closes. Connections 
+	// arriving meanwhile wait in the listen backlog instead of being refused. 0 (the default) is no limit.
+	void SetMaxConnections(size_t max) { maxConnections = max; }
+
+	// Install the handler invoked for received data. Without one the loop echoes bytes back.
+	void SetHandler(DataHandler handler, void *context);
+
+	// Decode the byte stream of every connection into frames and hand each frame to the handler.
+	void SetMessageHandler(MessageHandler handler, void *context);
+
+	// Echo frames whose payload is at least threshold bytes as they arrive, without reassembling them 
+	// and without passing them to the message handler. The epoll backend splices such payloads from the 
+	// socket back to the socket through a pipe, so bulk data never enters user space; the io_uring backend 
+	// writes each received piece straight back out of its registered buffer. 0 turns bulk echo off.
+	void SetBulkEcho(uint32_t threshold) { bulkThreshold = threshold; }
+
+	// Serve TLS: every accepted connection first completes a TLS handshake with the certificate of context 
+	// and is served once the kernel holds its keys (see TlsHandshaker), so the handlers, bulk echo and the 
+	// send paths work on plaintext exactly as without TLS. The context must outlive the loop. 
+	// Must be called before Run. Returns false after printing the reason on failure.
+	bool SetTls(SSL_CTX *context);
+
+	// Record the lifecycle of every connection of this loop (accept, reads, frames, handler calls, writes 
+	// and close) in a ring of the last events events, loop being the loop's number in the file names and 
+	// the converted trace. The ring is written to a file in directory (which must outlive the loop) on 
+	// DumpTrace, and after every iteration that takes longer than thresholdUs (0: only on DumpTrace), 
+	// at most once per TRACE_DUMP_INTERVAL_MS. Must be called before Run. 
+	// Returns false after printing the reason on failure.
+	bool SetTrace(size_t events, unsigned loop, const char *directory, uint32_t thresholdUs);
+
+	// Write the trace ring to a file at the end of the current iteration. Does nothing without SetTrace. 
+	// Like Drain, safe to call from any thread and from a signal handler.
+	void DumpTrace(void);
+
+	// Socket options for accepted connections and the bounds of the adaptive read size (see Tuning.h).
+	void SetTuning(const SocketTuning &socketTuning) { tuning = socketTuning; }
+
+	// Run slow handlers on a pool of worker threads instead of this loop's thread (see Offload).
+	// Must be called before Run. Returns false after printing the reason on failure.
+	bool SetWorkPool(WorkPool *pool);
+
+	// Hand a frame to the work pool instead of handling it here, so a slow handler does not hold up 
+	// the other connections of this loop. The payload is copied, work transforms the copy on a worker 
+	// thread, and the loop sends the resulting frame back on conn from its own thread. Replies to one 
+	// connection go out in the order the frames were offloaded, however the workers finish them; 
+	// replies queued with Send while offloaded frames are pending overtake them. 
+	// Returns false if the frame could not be offloaded (no pool, or out of memory).
+	bool Offload(Connection &conn, const char *payload, size_t len, WorkHandler work, void *context);
+
+	size_t ConnectionCount(void) const { return connectionCount; }
+
+	// Buffers for partial frames and unsent output of this loop's connections.
+	BufferPool &Buffers(void) { return bufferPool; }
+
+	// Counters of this loop. Only the loop's thread writes them; any thread may read them.
+	const LoopMetrics &Metrics(void) const { return metrics; }
+
+private:
+	static void FramedDataHandler(IoLoop &loop, Connection &conn, const char *data, size_t len, void *context);
+	static void OnFrame(const char *payload, size_t len, void *context);
+	static void OnBulkData(const char *data, size_t len, void *context);
+
+	static void RunWorkItem(WorkJob *job);
+	void FreeWorkItem(WorkItem *item);
+
+	// Pick up the replies posted by the work pool and send those whose turn has come.
+	void DrainCompletions(void);
+
+	static void OnHandshakeDone(SOCKET s, void *context);
+
+	void AcceptLocal(SOCKET s);
+	void ReceivedLocal(Connection &conn, const char *data, size_t len);
+
+	// Hand the requests waiting in the ring of a shared-memory connection to the handler.
+	void ServiceShm(Connection &conn);
+
+	static void OnTimer(TimerNode *node, void *context);
+	uint64_t Deadline(const Connection &conn) const;
+	void BeginDrain(void);
+
+protected:
+	// Create wakeFd. Backends call this from Init. Returns false after printing the reason on failure.
+	bool InitWake(void);
+
+	// Backends call this when wakeFd signals.
+	void OnWake(void) { DrainCompletions(); }
+
+	// Backends call this for every socket accepted on listenSocket: it is served at once, after its 
+	// TLS handshake, or after the transport negotiation of a local connection.
+	void Accepted(SOCKET s, SOCKET listenSocket);
+
+	// Set up the state of a new connection and start serving it. A local connection (Unix domain socket) 
+	// gets none of the TCP socket options. Returns NULL after closing the socket on failure.
+	virtual Connection *AddConnection(SOCKET s, bool local) = 0;
+
+	// Backends hand every chunk of bytes received on a connection to this instead of the handler: 
+	// the transport negotiation and the doorbells of a local connection end here.
+	void Received(Connection &conn, const char *data, size_t len)
+	{
+		if (__builtin_expect(conn.local == NULL || conn.local->state == LOCAL_STREAM, 1))
+			handler(*this, conn, data, len, handlerContext);
+		else
+			ReceivedLocal(conn, data, len);
+	}
+
+	// The connection's requests and replies travel through shared-memory rings instead of its socket.
+	static bool SharedMemory(const Connection &conn) { return conn.local != NULL && conn.local->state == LOCAL_SHM; }
+
+	// Write the output of a shared-memory connection into its ring; backends call this instead of sending. 
+	// What does not fit waits until the client has made room and rung the doorbell.
+	void FlushShm(Connection &conn);
+
+	// Free the local transport state of a connection when the backend releases it.
+	void ReleaseLocal(Connection &conn);
+
+	// Backends call this once per iteration, before flushing: serve again the shared-memory connections 
+	// whose last ServiceShm stopped at its budget with requests still in the ring.
+	void ResumeShm(void);
+
+	// Backends call this when the TLS handshaker's fd is readable.
+	void OnHandshakes(void) { tls->Poll(OnHandshakeDone, this); }
+
+	// Record a trace event of the connection when tracing is on.
+	void Trace(TraceEventType type, const Connection &conn, uint64_t value)
+	{
+		if (__builtin_expect(trace != NULL, 0))
+			trace->Record(type, conn.id, value);
+	}
+
+	// Backends call this at the end of every iteration, which began at iterationStart: records its 
+	// duration, and dumps the trace after a slow one.
+	void EndIteration(uint64_t iterationStart);
+
+	// --- Timeouts, Accept Throttling and Draining ---
+
+	// A connection was accepted: add it to the open list and start its timer.
+	void TrackConnection(Connection &conn);
+
+	// A connection is closing: take it off the open list and cancel its timer.
+	void UntrackConnection(Connection &conn);
+
+	// Bytes were received on the connection and handed to the handler. Backends also set 
+	// lastActivity directly when they send. Neither moves the timer on every call (see OnTimer).
+	void NoteReceived(Connection &conn);
+
+	// Once per iteration, after the replies have been flushed: start a requested drain, fire the timers 
+	// that are due, close drained connections and pause or resume accepting.
+	void Housekeeping(void);
+
+	// Milliseconds the backend may block waiting for events before Housekeeping has work, or -1.
+	int WaitTimeoutMs(void) const;
+
+	// Start or stop accepting on every listener.
+	virtual void SetAccepting(bool accept) = 0;
+
+	// Nothing of the connection is in flight, so a drain may close it.
+	virtual bool Quiescent(const Connection &conn) const;
+
+	// The loop is draining and every connection has closed.
+	bool Drained(void) const { return draining && connectionCount == 0; }
+
+	// Connections open or in their TLS handshake; the connection limit counts both.
+	size_t Admitted(void) const { return connectionCount + (tls != NULL ? tls->Pending() : 0); }
+
+	// Accepting would exceed the connection limit, the loop is draining, or accepting pauses after a failed accept.
+	bool AcceptBlocked(void) const 
+	{ 
+		return !accepting || (maxConnections != 0 && Admitted() >= maxConnections) || acceptRetryAt != 0; 
+	}
+
+	// Backends call this when accept fails with error. Running out of descriptors (EMFILE, ENFILE) or memory 
+	// is not fixed by accepting again at once, which would fail again for as long as the connection waits 
+	// in the backlog: accepting pauses for ACCEPT_RETRY_MS, like at the connection limit.
+	void AcceptFailed(int error);
+
+	// Drop the pending offloaded frames of a closing connection. Backends call this from their close path.
+	void AbandonWork(Connection &conn);
+
+	DataHandler handler;
+	void *handlerContext;
+
+	MessageHandler messageHandler;
+	void *messageContext;
+
+	uint32_t bulkThreshold;
+
+	SocketTuning tuning;
+
+	BufferPool bufferPool;
+
+	size_t connectionCount;
+	volatile bool running;
+
+	LoopMetrics metrics;
+
+	// Listen sockets of the loop, owned by it.
+	std::vector<SOCKET> listeners;
+
+	// eventfd other threads signal to wake the loop: the work pool when it has posted replies, 
+	// and Drain. -1 until InitWake.
+	int wakeFd;
+
+	// Monotonic time in nanoseconds at the start of the current iteration, set by the backend. 
+	// Timeouts are measured against it, so a read or a send only stores it instead of reading the clock.
+	uint64_t now;
+
+	// Whether the listeners are armed; Housekeeping keeps it in line with the limit and the drain.
+	bool accepting;
+
+	bool draining;
+
+	// Connection limit of the loop, 0 for none.
+	size_t maxConnections;
+
+	// Time at which accepting resumes after a failed accept, 0 while it is not paused.
+	uint64_t acceptRetryAt;
+
+	// Handshakes of the connections accepted while serving TLS, or NULL without TLS.
+	TlsHandshaker *tls;
+
+	// Trace ring of the loop, or NULL while tracing is off.
+	TraceRing *trace;
+
+private:
+	TimerWheel timers;
+	uint64_t idleTimeout;
+	uint64_t readTimeout;
+
+	// Connections not closed yet, walked by a drain.
+	Connection *openHead;
+
+	// Set by Drain, possibly from another thread or a signal handler; the loop picks it up in Housekeeping.
+	uint32_t drainRequested;
+	uint32_t drainTimeoutMs;
+	uint64_t drainDeadline;
+
+	// ID of the next connection accepted.
+	uint32_t nextConnectionId;
+
+	// Iterations at least this long dump the trace (0: never), and the time of the last such dump. 
+	// traceDumpRequested is set by DumpTrace, possibly from another thread or a signal handler.
+	uint64_t traceThreshold;
+	uint64_t lastTraceDump;
+	uint32_t traceDumpRequested;
+
+	// Unix domain listen sockets among the listeners, and whether their clients are offered shared memory.
+	std::vector<SOCKET> localListeners;
+	bool offerShm;
+	ObjectPool<LocalChannel> localChannels;
+
+	// Shared-memory connections to serve again next iteration, and the list being served.
+	std::vector<Connection *> shmResume;
+	std::vector<Connection *> shmResuming;
+
+	WorkPool *workPool;
+	ObjectPool<WorkItem> workItems;
+
+	// Replies posted by worker threads, drained by this loop's thread.
+	MpscQueue completions;
+
+	// Set by the first reply posted after the loop last drained completions, so a burst 
+	// of replies costs one eventfd write and one wakeup.
+	alignas(CACHE_LINE_SIZE) uint32_t completionSignaled;
+};
+
+// Encode a frame header for the payload and queue header and payload on the connection.
+bool SendFrame(IoLoop &loop, Connection &conn, const char *payload, size_t len);
+
+// Create the backend named on the command line ("epoll" or "uring"). Returns NULL for an unknown name.
+IoLoop *CreateIoLoop(const char *backend);
@@ -0,0 +1,349 @@
+#include "LocalTransport.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+
+static bool FillUnixAddress(const char *path, struct sockaddr_un &address)
+{
+	ZeroMemory(&address, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		printf("Unix socket path too long: %s\n", path);
+		return false;
+	}
+
+	strcpy(address.sun_path, path);
+
+	return true;
+}
+
+static void EncodeHello(char *hello, unsigned transport)
+{
+	memcpy(hello, LOCAL_HELLO_MAGIC, 4);
+	hello[4] = LOCAL_VERSION;
+	hello[5] = (char)transport;
+	hello[6] = 0;
+	hello[7] = 0;
+}
+
+static bool ValidHello(const char *hello)
+{
+	return memcmp(hello, LOCAL_HELLO_MAGIC, 4) == 0 && hello[4] == LOCAL_VERSION;
+}
+
+SOCKET CreateUnixListenSocket(const char *path, int backlog)
+{
+	struct sockaddr_un address;
+
+	if (!FillUnixAddress(path, address))
+		return INVALID_SOCKET;
+
+	SOCKET ListenSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (ListenSocket == INVALID_SOCKET)
+	{
+		printf("socket failed with error: %d\n", WSAGetLastError());
+		return INVALID_SOCKET;
+	}
+
+	// The socket file of a server that did not exit cleanly would make bind fail with EADDRINUSE.
+	unlink(path);
+
+	if (bind(ListenSocket, (struct sockaddr *)&address, sizeof(address)) == SOCKET_ERROR)
+	{
+		printf("bind(%s) failed with error: %d\n", path, WSAGetLastError());
+		closesocket(ListenSocket);
+		return INVALID_SOCKET;
+	}
+
+	if (listen(ListenSocket, backlog) == SOCKET_ERROR)
+	{
+		printf("listen failed with error: %d\n", WSAGetLastError());
+		closesocket(ListenSocket);
+		unlink(path);
+		return INVALID_SOCKET;
+	}
+
+	return ListenSocket;
+}
+
+// --- Creating and Mapping the Rings ---
+
+static ShmChannel *MapShmChannel(int fd)
+{
+	// Populated up front, so neither side takes page faults on the rings while serving requests.
+	void *memory = mmap(NULL, sizeof(ShmChannel), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+
+	if (memory == MAP_FAILED)
+	{
+		printf("mmap(shared memory channel) failed with error: %d\n", errno);
+		return NULL;
+	}
+
+	return (ShmChannel *)memory;
+}
+
+static ShmChannel *CreateShmChannel(int *fd)
+{
+	// An anonymous memory file: it has no name anyone else could open, and it is freed once the
+	// descriptors and mappings of both processes are gone, however either of them exits.
+	*fd = memfd_create("echo-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+	if (*fd == -1)
+	{
+		printf("memfd_create failed with error: %d\n", errno);
+		return NULL;
+	}
+
+	if (ftruncate(*fd, sizeof(ShmChannel)) == -1)
+	{
+		printf("ftruncate failed with error: %d\n", errno);
+		close(*fd);
+		return NULL;
+	}
+
+	// The client gets the same file: sealed at its size, so it cannot shrink it under the server's
+	// mapping, which would kill the server with SIGBUS on its next access to the rings.
+	if (fcntl(*fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1)
+	{
+		printf("fcntl(F_ADD_SEALS) failed with error: %d\n", errno);
+		close(*fd);
+		return NULL;
+	}
+
+	ShmChannel *channel = MapShmChannel(*fd);
+
+	if (channel == NULL)
+	{
+		close(*fd);
+		return NULL;
+	}
+
+	// The file starts zeroed: both rings empty, nobody waiting. Only the server's side is marked
+	// asleep, since the loop waits in the kernel until the client rings for its first request.
+	channel->magic = SHM_CHANNEL_MAGIC;
+	channel->size = sizeof(ShmChannel);
+	channel->toServer.consumerWaiting = 1;
+
+	return channel;
+}
+
+void UnmapShmChannel(ShmChannel *channel)
+{
+	if (channel != NULL)
+		munmap(channel, sizeof(ShmChannel));
+}
+
+// --- Negotiating the Transport ---
+
+unsigned AnswerLocalHello(SOCKET s, const char *hello, bool offerShm, ShmChannel **channel)
+{
+	*channel = NULL;
+
+	unsigned offered = (unsigned char)hello[5];
+
+	if (!ValidHello(hello) || (offered & (LOCAL_TRANSPORT_UNIX | LOCAL_TRANSPORT_SHM)) == 0)
+	{
+		printf("Invalid transport hello, closing connection\n");
+		return 0;
+	}
+
+	unsigned transport = offerShm && (offered & LOCAL_TRANSPORT_SHM) ? LOCAL_TRANSPORT_SHM : LOCAL_TRANSPORT_UNIX;
+
+	if (transport == LOCAL_TRANSPORT_UNIX && !(offered & LOCAL_TRANSPORT_UNIX))
+	{
+		printf("Client only accepts shared memory, which is not offered; closing connection\n");
+		return 0;
+	}
+
+	char answer[LOCAL_HELLO_SIZE];
+	EncodeHello(answer, transport);
+
+	struct iovec iov;
+	iov.iov_base = answer;
+	iov.iov_len = sizeof(answer);
+
+	struct msghdr msg;
+	ZeroMemory(&msg, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	// The descriptor of the rings travels with the answer as SCM_RIGHTS ancillary data.
+	union
+	{
+		struct cmsghdr header;
+		char space[CMSG_SPACE(sizeof(int))];
+	} control;
+
+	int fd = -1;
+
+	if (transport == LOCAL_TRANSPORT_SHM)
+	{
+		*channel = CreateShmChannel(&fd);
+
+		if (*channel == NULL)
+			return 0;
+
+		ZeroMemory(&control, sizeof(control));
+		msg.msg_control = control.space;
+		msg.msg_controllen = sizeof(control.space);
+
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	// The socket's buffer is empty this early, so 8 bytes never block, whatever mode the backend put it in.
+	ssize_t sent = sendmsg(s, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+	// The client holds the file through its own descriptor now; the server keeps only the mapping.
+	if (fd != -1)
+		close(fd);
+
+	if (sent != (ssize_t)sizeof(answer))
+	{
+		printf("sendmsg failed with error: %d\n", errno);
+		UnmapShmChannel(*channel);
+		*channel = NULL;
+		return 0;
+	}
+
+	return transport;
+}
+
+SOCKET LocalConnect(const char *path, unsigned offered, int timeoutMs, unsigned *transport, ShmChannel **channel)
+{
+	struct sockaddr_un address;
+
+	*channel = NULL;
+
+	if (!FillUnixAddress(path, address))
+		return INVALID_SOCKET;
+
+	SOCKET ConnectSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (ConnectSocket == INVALID_SOCKET)
+	{
+		printf("socket failed with error: %d\n", WSAGetLastError());
+		return INVALID_SOCKET;
+	}
+
+	// Setup is not part of the measurement, so the connect, the hello and the answer simply block;
+	// a Unix domain connect completes at once or fails.
+	char hello[LOCAL_HELLO_SIZE];
+	EncodeHello(hello, offered);
+
+	if (connect(ConnectSocket, (struct sockaddr *)&address, sizeof(address)) == SOCKET_ERROR)
+	{
+		printf("connect(%s) failed with error: %d\n", path, WSAGetLastError());
+		closesocket(ConnectSocket);
+		return INVALID_SOCKET;
+	}
+
+	if (send(ConnectSocket, hello, sizeof(hello), MSG_NOSIGNAL) != (ssize_t)sizeof(hello))
+	{
+		printf("send failed with error: %d\n", WSAGetLastError());
+		closesocket(ConnectSocket);
+		return INVALID_SOCKET;
+	}
+
+	struct pollfd pfd;
+	pfd.fd = ConnectSocket;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	if (poll(&pfd, 1, timeoutMs) != 1)
+	{
+		printf("No transport answer from %s within %d ms\n", path, timeoutMs);
+		closesocket(ConnectSocket);
+		return INVALID_SOCKET;
+	}
+
+	char answer[LOCAL_HELLO_SIZE];
+
+	struct iovec iov;
+	iov.iov_base = answer;
+	iov.iov_len = sizeof(answer);
+
+	union
+	{
+		struct cmsghdr header;
+		char space[CMSG_SPACE(sizeof(int))];
+	} control;
+
+	struct msghdr msg;
+	ZeroMemory(&msg, sizeof(msg));
+	ZeroMemory(&control, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.space;
+	msg.msg_controllen = sizeof(control.space);
+
+	// The answer is one 8-byte send, so it arrives whole, with the descriptor attached to its first byte.
+	ssize_t received = recvmsg(ConnectSocket, &msg, MSG_CMSG_CLOEXEC);
+
+	int fd = -1;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+	if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+	*transport = received == (ssize_t)sizeof(answer) && ValidHello(answer) ? (unsigned char)answer[5] : 0;
+
+	bool ok = (*transport & offered) != 0 && (*transport == LOCAL_TRANSPORT_SHM) == (fd != -1);
+
+	if (ok && fd != -1)
+	{
+		*channel = MapShmChannel(fd);
+		ok = *channel != NULL && (*channel)->magic == SHM_CHANNEL_MAGIC && (*channel)->size == sizeof(ShmChannel);
+	}
+
+	if (fd != -1)
+		close(fd);
+
+	if (!ok)
+	{
+		if (received <= 0)
+			printf("Server at %s closed the connection during transport negotiation\n", path);
+		else
+			printf("Invalid transport answer from %s\n", path);
+
+		UnmapShmChannel(*channel);
+		*channel = NULL;
+		closesocket(ConnectSocket);
+		return INVALID_SOCKET;
+	}
+
+	if (!SetNonBlocking(ConnectSocket))
+	{
+		printf("fcntl failed with error: %d\n", errno);
+		UnmapShmChannel(*channel);
+		*channel = NULL;
+		closesocket(ConnectSocket);
+		return INVALID_SOCKET;
+	}
+
+	return ConnectSocket;
+}
+
+// --- Doorbells ---
+
+void RingDoorbell(SOCKET s)
+{
+	char bell = 0;
+	ssize_t ignored = send(s, &bell, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+	(void)ignored;
+}
+
+const char *LocalTransportName(unsigned transport)
+{
+	return transport == LOCAL_TRANSPORT_SHM ? "shm" : "unix";
+}
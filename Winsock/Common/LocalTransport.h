@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Platform.h"
+#include "ShmRing.h"
+
+#include <stddef.h>
+
+// --- Same-Host Transports ---
+
+// Clients on the same host as the server can skip the TCP/IP stack. They connect to a Unix domain
+// socket instead of the TCP port and open the connection with a hello naming the transports they
+// accept; the server answers with the one it picked:
+// - unix: the frames flow over the Unix domain socket itself, as they would over TCP, minus the
+//   protocol processing, the loopback device and the ACKs;
+// - shm: the frames flow through a pair of shared-memory rings (see ShmRing.h), whose file descriptor
+//   comes with the answer. The socket stays open as the doorbell that wakes a side blocked in the
+//   kernel, and as the connection's lifetime: either side closing it ends the connection.
+// Either way the server runs the same framing and handlers as for TCP connections.
+
+// Where the server listens for same-host clients unless told otherwise.
+#define DEFAULT_UNIX_PATH "/tmp/echo-server.sock"
+
+// Hello and answer: 4 magic bytes, a version byte, a transport byte and 2 reserved zero bytes.
+// In the hello the transport byte is the set of transports the client accepts, in the answer the one picked.
+#define LOCAL_HELLO_SIZE 8
+#define LOCAL_HELLO_MAGIC "ECHL"
+#define LOCAL_VERSION 1
+
+#define LOCAL_TRANSPORT_UNIX 1u
+#define LOCAL_TRANSPORT_SHM 2u
+
+enum LocalState
+{
+	// Waiting for the rest of the client's hello.
+	LOCAL_NEGOTIATING,
+
+	// Frames on the Unix domain socket.
+	LOCAL_STREAM,
+
+	// Frames in the shared-memory rings; bytes on the socket are doorbells.
+	LOCAL_SHM
+};
+
+// Server-side state of a connection accepted on a Unix domain socket (Connection::local).
+struct LocalChannel
+{
+	LocalState state;
+
+	char hello[LOCAL_HELLO_SIZE];
+	size_t helloLength;
+
+	// The rings of a shared-memory connection, mapped until the connection is released; NULL otherwise.
+	ShmChannel *shm;
+
+	// The connection has closed; set by the loop so a ring being served stops at once.
+	bool closed;
+
+	// On the loop's list of shared-memory connections to serve again next iteration (see IoLoop::ResumeShm).
+	bool resuming;
+};
+
+// Create a Unix domain stream socket listening on path, replacing a socket file left behind by an earlier
+// run. The returned socket is non-blocking, like the TCP listen sockets.
+// Returns INVALID_SOCKET on failure after printing the reason.
+SOCKET CreateUnixListenSocket(const char *path, int backlog);
+
+// Server: answer a complete hello on s, picking shared memory if the client accepts it and offerShm
+// is set, the Unix domain socket otherwise. For shared memory the channel is created, mapped into
+// *channel, and its file descriptor sent along with the answer.
+// Returns the transport picked, or 0 after printing the reason if the hello is invalid or the answer failed.
+unsigned AnswerLocalHello(SOCKET s, const char *hello, bool offerShm, ShmChannel **channel);
+
+// Client: connect to the server's Unix domain socket at path, offering the transports in offered,
+// and wait up to timeoutMs for the answer. On success returns the non-blocking socket, with the transport
+// picked in *transport and, for shared memory, the mapped channel in *channel.
+// Returns INVALID_SOCKET on failure after printing the reason.
+SOCKET LocalConnect(const char *path, unsigned offered, int timeoutMs, unsigned *transport, ShmChannel **channel);
+
+// Unmap a channel mapped by AnswerLocalHello or LocalConnect.
+void UnmapShmChannel(ShmChannel *channel);
+
+// Wake the other side of a shared-memory connection. A doorbell that does not fit the socket buffer is
+// dropped: the buffer then already holds doorbells the other side has not read.
+void RingDoorbell(SOCKET s);
+
+// "unix" or "shm".
+const char *LocalTransportName(unsigned transport);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdio.h>
+
+// --- Console Logging ---
+
+// Errors are always printed. Per-connection and per-message messages are printed only at the debug level: 
+// a printf for every message is a serialization point on stdout and costs more than the echo itself.
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_DEBUG 1
+
+// Current level, shared by every thread. Set once at startup, before any loop runs.
+inline int LogLevel = LOG_LEVEL_ERROR;
+
+#define LOG_DEBUG(...) do { if (LogLevel >= LOG_LEVEL_DEBUG) printf(__VA_ARGS__); } while (0)
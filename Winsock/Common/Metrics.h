@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Histogram.h"
+
+#include <stdint.h>
+#include <time.h>
+
+// --- Hot-Path Metrics ---
+
+// Counters are kept per event loop and written only by the loop's own thread, with plain
+// (relaxed atomic) stores: no locks, no atomic read-modify-write and no shared cache lines on
+// the hot path. A reader on another thread (the stats endpoint) sums them across loops on demand.
+
+// Size of a cache line on the CPUs we run on. Each loop's counters start on a line of their own,
+// so two loops updating their counters never invalidate each other's cache (false sharing).
+#define CACHE_LINE_SIZE 64
+
+struct alignas(CACHE_LINE_SIZE) LoopMetrics
+{
+	LoopMetrics()
+		: accepts(0), closes(0), bytesIn(0), bytesOut(0), frames(0), frameErrors(0), partialWrites(0), offloads(0), timeouts(0), acceptPauses(0),
+		  tlsHandshakes(0), tlsFailures(0)
+	{
+	}
+
+	// Connections accepted and closed; the difference is the number of active connections.
+	uint64_t accepts;
+	uint64_t closes;
+
+	uint64_t bytesIn;
+	uint64_t bytesOut;
+
+	// Complete frames decoded, and connections closed for an invalid frame.
+	uint64_t frames;
+	uint64_t frameErrors;
+
+	// Sends the kernel accepted only partly because the socket send buffer was full.
+	uint64_t partialWrites;
+
+	// Frames handed to the work pool.
+	uint64_t offloads;
+
+	// Connections closed by the idle or read timeout, and times accepting paused at the connection limit.
+	uint64_t timeouts;
+	uint64_t acceptPauses;
+
+	// TLS handshakes that ended with the keys in the kernel, and those that failed, timed out or could not be offloaded.
+	uint64_t tlsHandshakes;
+	uint64_t tlsFailures;
+
+	// Time spent handling each loop iteration, in nanoseconds, not counting the wait for events.
+	alignas(CACHE_LINE_SIZE) Histogram iterationTime;
+};
+
+// Monotonic clock in nanoseconds, for timing loop iterations.
+static inline uint64_t MetricsClock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
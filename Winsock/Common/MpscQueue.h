@@ -0,0 +1,89 @@
+#pragma once
+
+#include "Metrics.h"
+
+#include <stddef.h>
+
+// --- Lock-Free Multi-Producer, Single-Consumer Queue ---
+
+// Link embedded in every object that travels through an MpscQueue, so pushing never allocates.
+struct MpscNode
+{
+	MpscNode *next;
+};
+
+// Intrusive MPSC queue (Vyukov): any number of threads push, one thread pops. A push is one
+// atomic exchange and one store, whatever the contention; popping takes no atomic read-modify-write
+// unless the queue is about to become empty. The queue is not linearizable in one corner: while
+// a producer is between its exchange and its store, Pop returns NULL even though older nodes may
+// follow. Consumers therefore need a wakeup that is sent after the push completes (see IoLoop).
+class MpscQueue
+{
+public:
+	MpscQueue() : head(&stub), tail(&stub) { stub.next = NULL; }
+
+	// Any thread.
+	void Push(MpscNode *node)
+	{
+		node->next = NULL;
+
+		MpscNode *prev = __atomic_exchange_n(&head, node, __ATOMIC_ACQ_REL);
+		__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+	}
+
+	// Consumer thread only. Returns NULL when the queue is empty (or a push is still in progress).
+	MpscNode *Pop(void)
+	{
+		MpscNode *first = tail;
+		MpscNode *next = __atomic_load_n(&first->next, __ATOMIC_ACQUIRE);
+
+		// Skip the stub, which is only there so the queue is never truly empty.
+		if (first == &stub)
+		{
+			if (next == NULL)
+				return NULL;
+
+			tail = next;
+			first = next;
+			next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+		}
+
+		if (next != NULL)
+		{
+			tail = next;
+			return first;
+		}
+
+		// first is the last node; a producer may be linking a new one behind it.
+		if (first != __atomic_load_n(&head, __ATOMIC_ACQUIRE))
+			return NULL;
+
+		// Put the stub back behind the last node so the last node can be handed out.
+		Push(&stub);
+
+		next = __atomic_load_n(&first->next, __ATOMIC_ACQUIRE);
+
+		if (next != NULL)
+		{
+			tail = next;
+			return first;
+		}
+
+		return NULL;
+	}
+
+	// Consumer thread only; a hint, as above.
+	bool Empty(void) const
+	{
+		return tail == &stub && __atomic_load_n(&stub.next, __ATOMIC_ACQUIRE) == NULL;
+	}
+
+private:
+	MpscQueue(const MpscQueue &);
+	MpscQueue &operator=(const MpscQueue &);
+
+	// Producers and the consumer touch different ends; keep them on different cache lines.
+	alignas(CACHE_LINE_SIZE) MpscNode *head;
+	alignas(CACHE_LINE_SIZE) MpscNode *tail;
+	MpscNode stub;
+};
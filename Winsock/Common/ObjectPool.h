@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <new>
+#include <vector>
+
+// Number of objects carved out of each slab.
+#define OBJECT_POOL_SLAB 1024
+
+// Slab allocator for fixed-type objects owned by one thread (one event loop).
+// Objects are constructed in place inside large slabs and released objects go on an intrusive 
+// free list, so after warm-up Acquire and Release never reach malloc. Slabs are only returned 
+// to the system when the pool itself is destroyed; every object must be released by then.
+template <typename T>
+class ObjectPool
+{
+public:
+	ObjectPool() : freeList(NULL), live(0) {}
+
+	~ObjectPool()
+	{
+		for (size_t i = 0; i < slabs.size(); i++)
+			free(slabs[i]);
+	}
+
+	// Construct an object. Returns NULL only if a new slab cannot be allocated.
+	T *Acquire(void)
+	{
+		if (freeList == NULL && !Grow())
+			return NULL;
+
+		Slot *slot = freeList;
+		freeList = slot->next;
+		live++;
+
+		return new (slot->storage) T();
+	}
+
+	void Release(T *object)
+	{
+		object->~T();
+
+		Slot *slot = (Slot *)(void *)object;
+		slot->next = freeList;
+		freeList = slot;
+		live--;
+	}
+
+	// Pre-allocate slabs for at least count objects, so the hot path never allocates.
+	bool Reserve(size_t count)
+	{
+		while (Capacity() < count)
+		{
+			if (!Grow())
+				return false;
+		}
+
+		return true;
+	}
+
+	size_t Live(void) const { return live; }
+	size_t Capacity(void) const { return slabs.size() * OBJECT_POOL_SLAB; }
+
+private:
+	// A free slot reuses the object's own storage for the free list link.
+	union Slot
+	{
+		Slot *next;
+		alignas(T) char storage[sizeof(T)];
+	};
+
+	bool Grow(void)
+	{
+		Slot *slab = (Slot *)malloc(sizeof(Slot) * OBJECT_POOL_SLAB);
+
+		if (slab == NULL)
+			return false;
+
+		slabs.push_back(slab);
+
+		// Thread the new slots onto the free list so the lowest address is handed out first.
+		for (size_t i = OBJECT_POOL_SLAB; i-- > 0; )
+		{
+			slab[i].next = freeList;
+			freeList = &slab[i];
+		}
+
+		return true;
+	}
+
+	std::vector<Slot *> slabs;
+	Slot *freeList;
+	size_t live;
+};
@@ -0,0 +1,113 @@
+#include "OutputQueue.h"
+
+#include <string.h>
+
+bool OutputQueue::Append(BufferPool &pool, const char *data, size_t len)
+{
+	while (len > 0)
+	{
+		if (tail == NULL || tail->Space() == 0)
+		{
+			Buffer *buffer = pool.Acquire();
+
+			if (buffer == NULL)
+				return false;
+
+			if (tail == NULL)
+				head = buffer;
+			else
+				tail->next = buffer;
+
+			tail = buffer;
+		}
+
+		size_t take = tail->Space();
+
+		if (take > len)
+			take = len;
+
+		memcpy(tail->data + tail->end, data, take);
+		tail->end += (uint32_t)take;
+		size += take;
+
+		data += take;
+		len -= take;
+	}
+
+	return true;
+}
+
+const char *OutputQueue::Front(size_t *len) const
+{
+	if (head == NULL)
+	{
+		*len = 0;
+		return NULL;
+	}
+
+	*len = head->Length();
+
+	return head->data + head->begin;
+}
+
+#ifndef _WIN32
+int OutputQueue::Gather(struct iovec *iov, int maxCount, size_t *bytes) const
+{
+	int count = 0;
+	size_t total = 0;
+
+	for (Buffer *buffer = head; buffer != NULL && count < maxCount; buffer = buffer->next)
+	{
+		if (buffer->Length() == 0)
+			continue;
+
+		iov[count].iov_base = buffer->data + buffer->begin;
+		iov[count].iov_len = buffer->Length();
+		total += buffer->Length();
+		count++;
+	}
+
+	*bytes = total;
+
+	return count;
+}
+#endif
+
+void OutputQueue::Consume(BufferPool &pool, size_t count)
+{
+	size -= count;
+
+	while (count > 0)
+	{
+		size_t take = head->Length();
+
+		if (take > count)
+			take = count;
+
+		head->begin += (uint32_t)take;
+		count -= take;
+
+		if (head->begin == head->end)
+		{
+			Buffer *next = head->next;
+			pool.Release(head);
+			head = next;
+
+			if (head == NULL)
+				tail = NULL;
+		}
+	}
+}
+
+void OutputQueue::Clear(BufferPool &pool)
+{
+	while (head != NULL)
+	{
+		Buffer *next = head->next;
+		pool.Release(head);
+		head = next;
+	}
+
+	tail = NULL;
+	size = 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "BufferPool.h"
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+// Bytes accepted for sending but not yet taken by the kernel, kept as a chain of pooled buffers.
+// An empty queue holds no memory. Appending never moves bytes already queued, so a backend may 
+// hand the front of the queue to the kernel while more output is appended behind it.
+class OutputQueue
+{
+public:
+	OutputQueue() : head(NULL), tail(NULL), size(0) {}
+
+	// Copy bytes to the back of the queue. Returns false if the pool is exhausted.
+	bool Append(BufferPool &pool, const char *data, size_t len);
+
+	// The first contiguous run of queued bytes; *len is set to its length (0 when empty).
+	const char *Front(size_t *len) const;
+
+#ifndef _WIN32
+	// Describe up to maxCount queued runs, front first, for a single scatter/gather send.
+	// Returns the number of entries filled; *bytes is set to the total length they cover.
+	int Gather(struct iovec *iov, int maxCount, size_t *bytes) const;
+#endif
+
+	// Drop count bytes from the front, returning emptied buffers to the pool.
+	void Consume(BufferPool &pool, size_t count);
+
+	// Return every buffer to the pool.
+	void Clear(BufferPool &pool);
+
+	size_t Size(void) const { return size; }
+	bool Empty(void) const { return size == 0; }
+
+private:
+	Buffer *head;
+	Buffer *tail;
+	size_t size;
+};
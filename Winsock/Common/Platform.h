@@ -0,0 +1,63 @@
+#pragma once
+
+// Platform shims so the Winsock samples and the networking core build on both Windows and Linux.
+// On Windows the real Winsock headers are used. On Linux the handful of Winsock names the samples
+// rely on (SOCKET, INVALID_SOCKET, closesocket, WSAGetLastError, ...) are mapped onto BSD sockets.
+
+#ifdef _WIN32
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+
+#include <windows.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+// Need to link with Ws2_32.lib
+#pragma comment (lib, "Ws2_32.lib")
+
+#else
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
+typedef int SOCKET;
+
+#define INVALID_SOCKET  (-1)
+#define SOCKET_ERROR    (-1)
+#define SD_RECEIVE      SHUT_RD
+#define SD_SEND         SHUT_WR
+#define SD_BOTH         SHUT_RDWR
+
+#define closesocket     close
+#define ZeroMemory(Destination, Length) memset((Destination), 0, (Length))
+
+// __cdecl is Microsoft-specific; GCC and Clang use the cdecl convention by default.
+#define __cdecl
+
+inline int WSAGetLastError(void) { return errno; }
+
+#endif
+
+#define DEFAULT_PORT "27015"
+
+// Initialize and release the socket library. 
+// Winsock requires WSAStartup/WSACleanup around all socket calls; on Linux these are no-ops.
+int SocketStartup(void);
+void SocketCleanup(void);
+
+// Put a socket into non-blocking mode so that recv, send and accept return immediately 
+// with EWOULDBLOCK instead of suspending the calling thread.
+bool SetNonBlocking(SOCKET s);
+
+// Returns true when the last socket error means "try again later" rather than a real failure.
+bool WouldBlock(int error);
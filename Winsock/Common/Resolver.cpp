@@ -0,0 +1,629 @@
+#include "Resolver.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// DNS record types and header bits (RFC 1035, RFC 3596).
+#define DNS_TYPE_A 1
+#define DNS_TYPE_AAAA 28
+#define DNS_CLASS_IN 1
+#define DNS_FLAG_RESPONSE 0x8000
+#define DNS_FLAG_RECURSION_DESIRED 0x0100
+#define DNS_RCODE_MASK 0x000F
+#define DNS_RCODE_NXDOMAIN 3
+#define DNS_HEADER_SIZE 12
+
+// Compression pointers a name may follow before it is taken to be a loop.
+#define DNS_MAX_POINTERS 16
+
+static const uint64_t NsPerSecond = 1000000000ull;
+
+void DefaultResolverOptions(ResolverOptions &options)
+{
+	options.hostsFile = access("/etc/hosts", R_OK) == 0 ? "/etc/hosts" : NULL;
+	options.server = NULL;
+	options.timeoutMs = RESOLVER_TIMEOUT_MS;
+	options.attempts = RESOLVER_ATTEMPTS;
+}
+
+bool ParseSocketAddress(const char *text, uint16_t port, struct sockaddr_storage &address, socklen_t &length)
+{
+	char host[INET6_ADDRSTRLEN];
+	const char *portText = NULL;
+	size_t hostLength;
+
+	if (text[0] == '[')
+	{
+		// [address]:port, the only way to give a port with an IPv6 address.
+		const char *close = strchr(text, ']');
+
+		if (close == NULL)
+			return false;
+
+		hostLength = (size_t)(close - text - 1);
+		text++;
+
+		if (close[1] == ':')
+			portText = close + 2;
+		else if (close[1] != '\0')
+			return false;
+	}
+	else
+	{
+		// A single colon separates an IPv4 address from its port; more colons make an IPv6 address.
+		const char *colon = strchr(text, ':');
+
+		if (colon != NULL && strchr(colon + 1, ':') == NULL)
+		{
+			hostLength = (size_t)(colon - text);
+			portText = colon + 1;
+		}
+		else
+		{
+			hostLength = strlen(text);
+		}
+	}
+
+	if (hostLength == 0 || hostLength >= sizeof(host))
+		return false;
+
+	memcpy(host, text, hostLength);
+	host[hostLength] = '\0';
+
+	if (portText != NULL)
+	{
+		int value = atoi(portText);
+
+		if (value <= 0 || value > 65535)
+			return false;
+
+		port = (uint16_t)value;
+	}
+
+	ZeroMemory(&address, sizeof(address));
+
+	struct sockaddr_in *v4 = (struct sockaddr_in *)&address;
+	struct sockaddr_in6 *v6 = (struct sockaddr_in6 *)&address;
+
+	if (inet_pton(AF_INET, host, &v4->sin_addr) == 1)
+	{
+		v4->sin_family = AF_INET;
+		v4->sin_port = htons(port);
+		length = sizeof(*v4);
+		return true;
+	}
+
+	if (inet_pton(AF_INET6, host, &v6->sin6_addr) == 1)
+	{
+		v6->sin6_family = AF_INET6;
+		v6->sin6_port = htons(port);
+		length = sizeof(*v6);
+		return true;
+	}
+
+	return false;
+}
+
+socklen_t SocketAddressLength(const struct sockaddr_storage &address)
+{
+	return address.ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+// Cache key: the family and the name in lower case, without a trailing dot.
+static std::string CacheKey(const char *name, int family)
+{
+	std::string key = family == AF_INET6 ? "6:" : "4:";
+
+	for (const char *p = name; *p != '\0'; p++)
+		key += (char)tolower((unsigned char)*p);
+
+	if (key.size() > 2 && key[key.size() - 1] == '.')
+		key.erase(key.size() - 1);
+
+	return key;
+}
+
+// Read a possibly compressed name at offset into out (lower case, dot separated) and move offset past it.
+static bool ReadName(const unsigned char *message, size_t len, size_t &offset, std::string &out)
+{
+	size_t position = offset;
+	bool jumped = false;
+	int pointers = 0;
+
+	out.clear();
+
+	for (;;)
+	{
+		if (position >= len)
+			return false;
+
+		unsigned labelLength = message[position];
+
+		if ((labelLength & 0xC0) == 0xC0)
+		{
+			// A pointer to the rest of the name earlier in the message.
+			if (position + 1 >= len || ++pointers > DNS_MAX_POINTERS)
+				return false;
+
+			if (!jumped)
+				offset = position + 2;
+
+			position = ((labelLength & 0x3F) << 8) | message[position + 1];
+			jumped = true;
+			continue;
+		}
+
+		if (labelLength == 0)
+		{
+			if (!jumped)
+				offset = position + 1;
+
+			return true;
+		}
+
+		if (labelLength > 63 || position + 1 + labelLength > len)
+			return false;
+
+		if (!out.empty())
+			out += '.';
+
+		for (unsigned i = 0; i < labelLength; i++)
+			out += (char)tolower(message[position + 1 + i]);
+
+		position += 1 + labelLength;
+	}
+}
+
+static uint16_t Read16(const unsigned char *p)
+{
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t Read32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+Resolver::Resolver()
+	: dnsSocket(INVALID_SOCKET), timeoutMs(RESOLVER_TIMEOUT_MS), maxAttempts(RESOLVER_ATTEMPTS), nextId(0), queries(0), cacheHits(0), timeouts(0)
+{
+	// Query IDs are the only thing that ties an answer to its question; start somewhere unpredictable.
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	nextId = (uint16_t)(ts.tv_nsec ^ getpid());
+}
+
+Resolver::~Resolver()
+{
+	if (dnsSocket != INVALID_SOCKET)
+		closesocket(dnsSocket);
+}
+
+bool Resolver::Init(const ResolverOptions &options)
+{
+	timeoutMs = options.timeoutMs;
+	maxAttempts = options.attempts;
+
+	if (options.hostsFile != NULL && !LoadHosts(options.hostsFile))
+		return false;
+
+	// Without a server given, use the first nameserver line of resolv.conf.
+	char server[128] = "127.0.0.1";
+
+	if (options.server != NULL)
+	{
+		snprintf(server, sizeof(server), "%s", options.server);
+	}
+	else
+	{
+		FILE *file = fopen("/etc/resolv.conf", "r");
+		char line[256];
+
+		while (file != NULL && fgets(line, sizeof(line), file) != NULL)
+		{
+			char address[128];
+
+			if (sscanf(line, " nameserver %127s", address) == 1)
+			{
+				snprintf(server, sizeof(server), "%s", address);
+				break;
+			}
+		}
+
+		if (file != NULL)
+			fclose(file);
+	}
+
+	struct sockaddr_storage address;
+	socklen_t length;
+
+	if (!ParseSocketAddress(server, DNS_PORT, address, length))
+	{
+		printf("Invalid DNS server: %s\n", server);
+		return false;
+	}
+
+	// A connected socket only receives datagrams from the server it asks.
+	dnsSocket = socket(address.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+
+	if (dnsSocket == INVALID_SOCKET)
+	{
+		printf("Socket failed with error: %d\n", WSAGetLastError());
+		return false;
+	}
+
+	if (connect(dnsSocket, (struct sockaddr *)&address, length) == SOCKET_ERROR || !SetNonBlocking(dnsSocket))
+	{
+		printf("connect failed with error: %d\n", WSAGetLastError());
+		return false;
+	}
+
+	return true;
+}
+
+bool Resolver::LoadHosts(const char *path)
+{
+	FILE *file = fopen(path, "r");
+
+	if (file == NULL)
+	{
+		printf("Cannot open hosts file %s (error %d)\n", path, errno);
+		return false;
+	}
+
+	char line[1024];
+
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		char *comment = strchr(line, '#');
+
+		if (comment != NULL)
+			*comment = '\0';
+
+		char *save = NULL;
+		char *addressText = strtok_r(line, " \t\r\n", &save);
+		struct sockaddr_storage address;
+		socklen_t length;
+
+		if (addressText == NULL || !ParseSocketAddress(addressText, 0, address, length))
+			continue;
+
+		// A name in the hosts file is answered from it alone, for both families, as the system resolver does:
+		// a name listed only with an IPv4 address has no IPv6 address.
+		for (char *name = strtok_r(NULL, " \t\r\n", &save); name != NULL; name = strtok_r(NULL, " \t\r\n", &save))
+		{
+			CacheEntry &v4 = cache[CacheKey(name, AF_INET)];
+			CacheEntry &v6 = cache[CacheKey(name, AF_INET6)];
+
+			v4.ok = v6.ok = true;
+			v4.expiresAt = v6.expiresAt = 0;
+
+			(address.ss_family == AF_INET6 ? v6 : v4).addresses.push_back(address);
+		}
+	}
+
+	fclose(file);
+
+	return true;
+}
+
+void Resolver::Resolve(const char *name, int family, ResolveCallback callback, void *context, uint64_t now)
+{
+	AddressList addresses;
+	struct sockaddr_storage address;
+	unsigned char numeric[sizeof(struct in6_addr)];
+
+	// A numeric address is its own answer; it has no address of the other family.
+	if (inet_pton(AF_INET, name, numeric) == 1 || inet_pton(AF_INET6, name, numeric) == 1)
+	{
+		socklen_t length;
+
+		if (ParseSocketAddress(name, 0, address, length) && address.ss_family == family)
+			addresses.push_back(address);
+
+		callback(family, addresses, true, context);
+		return;
+	}
+
+	std::string key = CacheKey(name, family);
+	auto cached = cache.find(key);
+
+	if (cached != cache.end())
+	{
+		if (cached->second.expiresAt == 0 || now < cached->second.expiresAt)
+		{
+			cacheHits++;
+			callback(family, cached->second.addresses, cached->second.ok, context);
+			return;
+		}
+
+		cache.erase(cached);
+	}
+
+	Waiter waiter;
+	waiter.callback = callback;
+	waiter.context = context;
+
+	for (auto it = pending.begin(); it != pending.end(); ++it)
+	{
+		if (it->second.key == key)
+		{
+			it->second.waiters.push_back(waiter);
+			return;
+		}
+	}
+
+	// Pick an ID no pending query uses.
+	do
+	{
+		nextId = (uint16_t)(nextId * 25173u + 13849u);
+	} while (pending.count(nextId) != 0);
+
+	Query &query = pending[nextId];
+	query.key = key;
+	query.name = key.substr(2);
+	query.family = family;
+	query.id = nextId;
+	query.attempts = 1;
+	query.resendAt = now + (uint64_t)timeoutMs * 1000000ull;
+	query.waiters.push_back(waiter);
+
+	queries++;
+
+	if (!Send(query))
+	{
+		pending.erase(query.id);
+		callback(family, addresses, false, context);
+	}
+}
+
+void Resolver::Cancel(void *context)
+{
+	// The query itself stays: its answer is still worth caching.
+	for (auto it = pending.begin(); it != pending.end(); ++it)
+	{
+		std::vector<Waiter> &waiters = it->second.waiters;
+
+		for (size_t i = 0; i < waiters.size(); )
+		{
+			if (waiters[i].context == context)
+				waiters.erase(waiters.begin() + i);
+			else
+				i++;
+		}
+	}
+}
+
+bool Resolver::Send(Query &query)
+{
+	unsigned char message[DNS_MAX_MESSAGE];
+
+	ZeroMemory(message, DNS_HEADER_SIZE);
+
+	message[0] = (unsigned char)(query.id >> 8);
+	message[1] = (unsigned char)query.id;
+	message[2] = (unsigned char)(DNS_FLAG_RECURSION_DESIRED >> 8);
+	message[5] = 1;
+
+	// The question: the name as length-prefixed labels, then its type and class.
+	size_t length = DNS_HEADER_SIZE;
+	const char *label = query.name.c_str();
+
+	while (*label != '\0')
+	{
+		const char *dot = strchr(label, '.');
+		size_t labelLength = dot != NULL ? (size_t)(dot - label) : strlen(label);
+
+		if (labelLength == 0 || labelLength > 63 || length + 1 + labelLength + 5 > sizeof(message))
+		{
+			printf("Invalid name: %s\n", query.name.c_str());
+			return false;
+		}
+
+		message[length++] = (unsigned char)labelLength;
+		memcpy(message + length, label, labelLength);
+		length += labelLength;
+
+		label += labelLength;
+
+		if (*label == '.')
+			label++;
+	}
+
+	uint16_t type = query.family == AF_INET6 ? DNS_TYPE_AAAA : DNS_TYPE_A;
+
+	message[length++] = 0;
+	message[length++] = (unsigned char)(type >> 8);
+	message[length++] = (unsigned char)type;
+	message[length++] = 0;
+	message[length++] = DNS_CLASS_IN;
+
+	// A lost datagram (or a full socket buffer) is covered by the resend timer.
+	if (send(dnsSocket, message, length, 0) < 0 && !WouldBlock(WSAGetLastError()) && WSAGetLastError() != ECONNREFUSED)
+	{
+		printf("send failed with error: %d\n", WSAGetLastError());
+		return false;
+	}
+
+	return true;
+}
+
+void Resolver::OnReadable(uint64_t now)
+{
+	unsigned char message[DNS_MAX_MESSAGE];
+
+	for (;;)
+	{
+		ssize_t received = recv(dnsSocket, message, sizeof(message), 0);
+
+		if (received >= 0)
+		{
+			HandleMessage(message, (size_t)received, now);
+			continue;
+		}
+
+		// ECONNREFUSED: an earlier query hit a port with no server; its resend timer will fail it.
+		int error = WSAGetLastError();
+
+		if (error == EINTR || error == ECONNREFUSED)
+			continue;
+
+		return;
+	}
+}
+
+void Resolver::HandleMessage(const unsigned char *message, size_t len, uint64_t now)
+{
+	if (len < DNS_HEADER_SIZE)
+		return;
+
+	uint16_t id = Read16(message);
+	uint16_t flags = Read16(message + 2);
+	uint16_t questions = Read16(message + 4);
+	uint16_t answers = Read16(message + 6);
+
+	auto it = pending.find(id);
+
+	if (it == pending.end() || !(flags & DNS_FLAG_RESPONSE) || questions != 1)
+		return;
+
+	Query &query = it->second;
+	uint16_t type = query.family == AF_INET6 ? DNS_TYPE_AAAA : DNS_TYPE_A;
+
+	// The answer must repeat the question; anything else is stale or forged.
+	size_t offset = DNS_HEADER_SIZE;
+	std::string name;
+
+	if (!ReadName(message, len, offset, name) || offset + 4 > len || name != query.name || Read16(message + offset) != type)
+		return;
+
+	offset += 4;
+
+	AddressList addresses;
+	uint32_t ttl = RESOLVER_MAX_TTL;
+	int rcode = flags & DNS_RCODE_MASK;
+
+	// Other records (a CNAME chain, for example) come along in the answer section; only the
+	// addresses of the type asked for are taken, and the shortest TTL among them decides.
+	for (uint16_t i = 0; i < answers && rcode == 0; i++)
+	{
+		if (!ReadName(message, len, offset, name) || offset + 10 > len)
+			break;
+
+		uint16_t recordType = Read16(message + offset);
+		uint16_t recordClass = Read16(message + offset + 2);
+		uint32_t recordTtl = Read32(message + offset + 4);
+		uint16_t dataLength = Read16(message + offset + 8);
+
+		offset += 10;
+
+		if (offset + dataLength > len)
+			break;
+
+		struct sockaddr_storage address;
+		ZeroMemory(&address, sizeof(address));
+
+		if (recordClass == DNS_CLASS_IN && recordType == type && type == DNS_TYPE_A && dataLength == 4)
+		{
+			struct sockaddr_in *v4 = (struct sockaddr_in *)&address;
+			v4->sin_family = AF_INET;
+			memcpy(&v4->sin_addr, message + offset, 4);
+			addresses.push_back(address);
+			ttl = recordTtl < ttl ? recordTtl : ttl;
+		}
+		else if (recordClass == DNS_CLASS_IN && recordType == type && type == DNS_TYPE_AAAA && dataLength == 16)
+		{
+			struct sockaddr_in6 *v6 = (struct sockaddr_in6 *)&address;
+			v6->sin6_family = AF_INET6;
+			memcpy(&v6->sin6_addr, message + offset, 16);
+			addresses.push_back(address);
+			ttl = recordTtl < ttl ? recordTtl : ttl;
+		}
+
+		offset += dataLength;
+	}
+
+	// No such name, or no address of this family: a definite answer, remembered for a short while.
+	// Any other error (server failure, refused) is not cached, so the next lookup asks again.
+	bool ok = rcode == 0 || rcode == DNS_RCODE_NXDOMAIN;
+
+	if (addresses.empty())
+		ttl = RESOLVER_NEGATIVE_TTL;
+
+	std::string key = query.key;
+	Answer(key, query.family, addresses, ok, ttl, now);
+}
+
+void Resolver::Answer(const std::string &key, int family, const AddressList &addresses, bool ok, uint32_t ttl, uint64_t now)
+{
+	if (ok && ttl > 0)
+	{
+		CacheEntry &entry = cache[key];
+		entry.addresses = addresses;
+		entry.ok = true;
+		entry.expiresAt = now + (uint64_t)(ttl < RESOLVER_MAX_TTL ? ttl : RESOLVER_MAX_TTL) * NsPerSecond;
+	}
+
+	// Take the waiters out first: a callback may start another lookup, which changes the pending table.
+	std::vector<Waiter> waiters;
+
+	for (auto it = pending.begin(); it != pending.end(); ++it)
+	{
+		if (it->second.key == key)
+		{
+			waiters.swap(it->second.waiters);
+			pending.erase(it);
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < waiters.size(); i++)
+		waiters[i].callback(family, addresses, ok, waiters[i].context);
+}
+
+void Resolver::OnTimer(uint64_t now)
+{
+	std::vector<std::string> expired;
+
+	for (auto it = pending.begin(); it != pending.end(); ++it)
+	{
+		Query &query = it->second;
+
+		if (now < query.resendAt)
+			continue;
+
+		if (query.attempts >= maxAttempts || !Send(query))
+		{
+			expired.push_back(query.key);
+			continue;
+		}
+
+		query.attempts++;
+		query.resendAt = now + (uint64_t)timeoutMs * 1000000ull;
+	}
+
+	for (size_t i = 0; i < expired.size(); i++)
+	{
+		timeouts++;
+		Answer(expired[i], expired[i][0] == '6' ? AF_INET6 : AF_INET, AddressList(), false, 0, now);
+	}
+}
+
+int Resolver::NextTimeoutMs(uint64_t now) const
+{
+	int timeout = -1;
+
+	for (auto it = pending.begin(); it != pending.end(); ++it)
+	{
+		uint64_t resendAt = it->second.resendAt;
+		int ms = resendAt <= now ? 0 : (int)((resendAt - now + 999999) / 1000000);
+
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+
+	return timeout;
+}
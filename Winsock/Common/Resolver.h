@@ -0,0 +1,148 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef __linux__
+#error "Resolver requires Linux"
+#endif
+
+// Wait for an answer before a query is sent again, and number of times it is sent before the lookup fails.
+#define RESOLVER_TIMEOUT_MS 1000
+#define RESOLVER_ATTEMPTS 3
+
+// Cached answers are kept for their TTL, but never longer than this, in seconds.
+#define RESOLVER_MAX_TTL 3600
+
+// A name that does not exist (or has no address of the family) is remembered for this long, in seconds.
+#define RESOLVER_NEGATIVE_TTL 10
+
+// Largest DNS message over UDP without EDNS.
+#define DNS_MAX_MESSAGE 512
+
+#define DNS_PORT 53
+
+// Where names are looked up.
+struct ResolverOptions
+{
+	// Hosts file consulted before DNS, or NULL for none (default /etc/hosts).
+	const char *hostsFile;
+
+	// DNS server as "address" or "address:port" ("[address]:port" for IPv6). NULL takes the first
+	// nameserver of /etc/resolv.conf, or 127.0.0.1 when there is none.
+	const char *server;
+
+	int timeoutMs;
+	int attempts;
+};
+
+void DefaultResolverOptions(ResolverOptions &options);
+
+// Addresses of a name, one family per list. Ports are 0; the caller sets the port it connects to.
+typedef std::vector<struct sockaddr_storage> AddressList;
+
+// Result of one lookup: every address of the family (possibly none), or ok false when the server
+// could not be reached or answered with an error.
+typedef void (*ResolveCallback)(int family, const AddressList &addresses, bool ok, void *context);
+
+// --- Asynchronous Name Resolution ---
+
+// A stub resolver that never blocks: getaddrinfo sends its queries and then sleeps until the answer
+// arrives, holding up every connection of the thread that called it. Resolve instead sends an A or
+// AAAA query over a non-blocking UDP socket and returns; the owner watches Socket() for readability
+// (in its epoll set) and calls OnReadable, and calls OnTimer so unanswered queries are sent again.
+//
+// Answers are cached for their TTL, so a client making many connections to one name asks the server
+// once per TTL, and an expired answer is asked for again on the next use. Numeric addresses and
+// names in the hosts file are answered without a query. Pointing the resolver at a hosts file or a
+// local DNS server of one's own makes lookups (and failures) reproducible on loopback.
+class Resolver
+{
+public:
+	Resolver();
+	~Resolver();
+
+	// Read the hosts file and open the socket to the server. Returns false after printing the reason on failure.
+	bool Init(const ResolverOptions &options);
+
+	// Look up the addresses of name for one family (AF_INET or AF_INET6). Numeric addresses,
+	// hosts file entries and cached answers call back before Resolve returns; otherwise the
+	// callback runs from OnReadable or OnTimer. Lookups of the same name share one query.
+	void Resolve(const char *name, int family, ResolveCallback callback, void *context, uint64_t now);
+
+	// Forget every pending callback with this context, for a caller that no longer wants its answers.
+	void Cancel(void *context);
+
+	// Socket to watch for readability.
+	SOCKET Socket(void) const { return dnsSocket; }
+
+	// Read every answer that has arrived.
+	void OnReadable(uint64_t now);
+
+	// Resend or fail queries whose time is up.
+	void OnTimer(uint64_t now);
+
+	// Milliseconds until OnTimer has work, or -1 when no query is pending.
+	int NextTimeoutMs(uint64_t now) const;
+
+	// Queries sent (not counting resends), lookups answered from the cache or the hosts file, and queries that timed out.
+	uint64_t Queries(void) const { return queries; }
+	uint64_t CacheHits(void) const { return cacheHits; }
+	uint64_t Timeouts(void) const { return timeouts; }
+
+private:
+	struct Waiter
+	{
+		ResolveCallback callback;
+		void *context;
+	};
+
+	struct CacheEntry
+	{
+		AddressList addresses;
+		bool ok;
+
+		// Monotonic time in nanoseconds after which the entry is asked for again; 0 never expires.
+		uint64_t expiresAt;
+	};
+
+	struct Query
+	{
+		std::string key;
+		std::string name;
+		int family;
+		uint16_t id;
+		int attempts;
+		uint64_t resendAt;
+		std::vector<Waiter> waiters;
+	};
+
+	bool LoadHosts(const char *path);
+	bool Send(Query &query);
+	void Answer(const std::string &key, int family, const AddressList &addresses, bool ok, uint32_t ttl, uint64_t now);
+	void HandleMessage(const unsigned char *message, size_t len, uint64_t now);
+
+	SOCKET dnsSocket;
+	int timeoutMs;
+	int maxAttempts;
+
+	// Keyed by family and lower-case name ("4:example.com").
+	std::unordered_map<std::string, CacheEntry> cache;
+	std::unordered_map<uint16_t, Query> pending;
+
+	uint16_t nextId;
+	uint64_t queries;
+	uint64_t cacheHits;
+	uint64_t timeouts;
+};
+
+// Parse "address", "address:port" or "[address]:port" into a socket address. port is used when the text has none.
+bool ParseSocketAddress(const char *text, uint16_t port, struct sockaddr_storage &address, socklen_t &length);
+
+// Length of a socket address of the given family.
+socklen_t SocketAddressLength(const struct sockaddr_storage &address);
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "Metrics.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// --- Shared-Memory Byte Ring ---
+
+// Bytes per direction of a shared-memory channel, as much as a socket connection may have queued
+// (MAX_PENDING_OUTPUT). A power of two, so positions wrap with a mask.
+#define SHM_RING_SIZE (64 * 1024)
+
+// Single-producer, single-consumer byte ring living in memory shared by two processes. It carries
+// the same stream of length-prefixed frames a socket would, so the framing and the handlers do not
+// change. The producer owns tail and the consumer owns head; each publishes its position with a release
+// store and reads the other's with an acquire load, so a byte is never read before it has been written
+// or overwritten before it has been read. Positions are free-running 32-bit counters: tail - head is
+// the number of bytes in the ring, also across the wrap of the counters.
+//
+// Neither side can be woken through the ring itself. A side that finds nothing to do raises its
+// waiting flag before it blocks in the kernel, and the other side rings a doorbell (a byte on the
+// Unix domain socket the channel was set up on, see LocalTransport.h) when it sees the flag after
+// making progress. Both check after a full fence, so either the sleeper sees the progress or the other
+// side sees the flag: a wakeup is never lost, and a side that keeps finding work never costs a syscall.
+struct ShmRing
+{
+	// Producer side.
+	alignas(CACHE_LINE_SIZE) uint32_t tail;
+	uint32_t producerWaiting;
+
+	// Consumer side.
+	alignas(CACHE_LINE_SIZE) uint32_t head;
+	uint32_t consumerWaiting;
+
+	alignas(CACHE_LINE_SIZE) char data[SHM_RING_SIZE];
+
+	// Producer: copy up to len bytes into the ring and publish them. Returns the bytes taken,
+	// fewer than len when the ring is full.
+	size_t Write(const void *src, size_t len)
+	{
+		uint32_t position = tail;
+		size_t space = SHM_RING_SIZE - (size_t)(position - __atomic_load_n(&head, __ATOMIC_ACQUIRE));
+
+		if (len > space)
+			len = space;
+
+		size_t offset = position & (SHM_RING_SIZE - 1);
+		size_t first = len < SHM_RING_SIZE - offset ? len : SHM_RING_SIZE - offset;
+
+		memcpy(data + offset, src, first);
+		memcpy(data, (const char *)src + first, len - first);
+
+		__atomic_store_n(&tail, position + (uint32_t)len, __ATOMIC_RELEASE);
+
+		return len;
+	}
+
+	// Consumer: the bytes that can be read in place, up to the end of the ring; the rest of a
+	// wrapped stretch follows from the start once these are consumed. Returns 0 when the ring is empty.
+	size_t Peek(const char **bytes) const
+	{
+		uint32_t position = head;
+		size_t available = (size_t)(__atomic_load_n(&tail, __ATOMIC_ACQUIRE) - position);
+		size_t offset = position & (SHM_RING_SIZE - 1);
+
+		*bytes = data + offset;
+
+		return available < SHM_RING_SIZE - offset ? available : SHM_RING_SIZE - offset;
+	}
+
+	// Consumer: hand len peeked bytes back to the producer.
+	void Consume(size_t len)
+	{
+		__atomic_store_n(&head, head + (uint32_t)len, __ATOMIC_RELEASE);
+	}
+
+	// Consumer, about to block: returns true if the ring is still empty with the waiting flag raised,
+	// in which case the producer rings the doorbell after its next write.
+	bool ConsumerSleep(void)
+	{
+		__atomic_store_n(&consumerWaiting, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		if (__atomic_load_n(&tail, __ATOMIC_ACQUIRE) != head)
+		{
+			__atomic_store_n(&consumerWaiting, 0, __ATOMIC_RELAXED);
+			return false;
+		}
+
+		return true;
+	}
+
+	// Producer, after a write: returns true once per sleep of the consumer, when the doorbell must be rung.
+	bool WakeConsumer(void)
+	{
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		return __atomic_load_n(&consumerWaiting, __ATOMIC_RELAXED) != 0 &&
+			__atomic_exchange_n(&consumerWaiting, 0, __ATOMIC_RELAXED) != 0;
+	}
+
+	// Producer, on a full ring: returns true if the ring is still full with the waiting flag raised,
+	// in which case the consumer rings the doorbell after it next consumes.
+	bool ProducerSleep(void)
+	{
+		__atomic_store_n(&producerWaiting, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		if (tail - __atomic_load_n(&head, __ATOMIC_ACQUIRE) < SHM_RING_SIZE)
+		{
+			__atomic_store_n(&producerWaiting, 0, __ATOMIC_RELAXED);
+			return false;
+		}
+
+		return true;
+	}
+
+	// Consumer, after consuming: returns true once per sleep of the producer, when the doorbell must be rung.
+	bool WakeProducer(void)
+	{
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		return __atomic_load_n(&producerWaiting, __ATOMIC_RELAXED) != 0 &&
+			__atomic_exchange_n(&producerWaiting, 0, __ATOMIC_RELAXED) != 0;
+	}
+};
+
+// First bytes of a shared-memory channel, checked by the client after mapping it.
+#define SHM_CHANNEL_MAGIC 0x45434853u
+
+// The shared memory of one connection: a ring in each direction. The server creates it, zeroed, and
+// passes its file descriptor to the client; both map it whole.
+struct ShmChannel
+{
+	uint32_t magic;
+	uint32_t size;
+
+	// Requests, written by the client and read by the server.
+	ShmRing toServer;
+
+	// Responses, written by the server and read by the client.
+	ShmRing toClient;
+};
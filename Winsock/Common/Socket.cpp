@@ -0,0 +1,249 @@
+#include "Socket.h"
+
+#include <stdio.h>
+
+int SocketStartup(void)
+{
+#ifdef _WIN32
+	// All processes (applications or DLLs) that call Winsock functions must initialize 
+	// the use of the Windows Sockets DLL before making other Winsock functions calls. 
+	// This also makes certain that Winsock is supported on the system.
+	WSADATA wsaData;
+
+	int iResult = WSAStartup(MAKEWORD(2,2), &wsaData);
+
+	if (iResult != 0) 
+	{
+		printf("WSAStartup failed with error: %d\n", iResult);
+		return 1;
+	}
+#endif
+
+	return 0;
+}
+
+void SocketCleanup(void)
+{
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+bool SetNonBlocking(SOCKET s)
+{
+#ifdef _WIN32
+	u_long iMode = 1;
+	return ioctlsocket(s, FIONBIO, &iMode) == 0;
+#else
+	int flags = fcntl(s, F_GETFL, 0);
+
+	if (flags == -1)
+		return false;
+
+	return fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+bool WouldBlock(int error)
+{
+#ifdef _WIN32
+	return error == WSAEWOULDBLOCK;
+#else
+	return error == EAGAIN || error == EWOULDBLOCK;
+#endif
+}
+
+SOCKET CreateListenSocket(const char *port, int backlog, bool reusePort, const SocketTuning *tuning)
+{
+	SOCKET ListenSocket = INVALID_SOCKET;
+
+	struct addrinfo hints;
+	struct addrinfo *result = NULL;
+
+	int iResult;
+
+	// --- Creating a Socket for the Server ---
+
+	// The getaddrinfo function is used to determine the values in the sockaddr structure:
+	// - AF_INET is used to specify the IPv4 address family.
+	// - SOCK_STREAM is used to specify a stream socket.
+	// - IPPROTO_TCP is used to specify the TCP protocol .
+	// - AI_PASSIVE flag indicates the caller intends to use the returned socket address structure 
+	//   in a call to the bind function. When the AI_PASSIVE flag is set and nodename parameter to 
+	//   the getaddrinfo function is a NULL pointer, the IP address portion of the socket address 
+	//   structure is set to INADDR_ANY for IPv4 addresses or IN6ADDR_ANY_INIT for IPv6 addresses.
+
+	ZeroMemory(&hints, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_flags = AI_PASSIVE;
+
+	// Resolve the server address and port
+	iResult = getaddrinfo(NULL, port, &hints, &result);
+
+	if ( iResult != 0 ) 
+	{
+		printf("getaddrinfo failed with error: %d\n", iResult);
+		return INVALID_SOCKET;
+	}
+
+	// Create a SOCKET object called ListenSocket for the server to listen for client connections.
+	ListenSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+
+	// Check for errors to ensure that the socket is a valid socket.
+	if (ListenSocket == INVALID_SOCKET) 
+	{
+		printf("socket failed with error: %d\n", WSAGetLastError());
+		freeaddrinfo(result);
+		return INVALID_SOCKET;
+	}
+
+#ifndef _WIN32
+	// Allow the server to be restarted immediately while old connections linger in TIME_WAIT.
+	int reuse = 1;
+	setsockopt(ListenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	// SO_REUSEPORT lets every worker own a private listen socket on the same port. The kernel 
+	// hashes each incoming connection to one of them, so the workers never contend on a shared accept queue.
+	if (reusePort && setsockopt(ListenSocket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == SOCKET_ERROR)
+	{
+		printf("setsockopt(SO_REUSEPORT) failed with error: %d\n", WSAGetLastError());
+		freeaddrinfo(result);
+		closesocket(ListenSocket);
+		return INVALID_SOCKET;
+	}
+#else
+	if (reusePort)
+	{
+		printf("SO_REUSEPORT is not supported on this platform\n");
+		freeaddrinfo(result);
+		closesocket(ListenSocket);
+		return INVALID_SOCKET;
+	}
+#endif
+
+	// --- Binding a Socket ---
+
+	// For a server to accept client connections, it must be bound to a network address within the system. 
+	// Call the bind function, passing the created socket and sockaddr structure returned from the getaddrinfo 
+	// function as parameters.
+	iResult = bind(ListenSocket, result->ai_addr, (int)result->ai_addrlen);
+
+	// Check for general errors.
+	if (iResult == SOCKET_ERROR) 
+	{
+		printf("bind failed with error: %d\n", WSAGetLastError());
+		freeaddrinfo(result);
+		closesocket(ListenSocket);
+		return INVALID_SOCKET;
+	}
+
+	// Once the bind function is called, the address information returned by the getaddrinfo function is no longer needed. 
+	freeaddrinfo(result);
+
+	// Buffer sizes must be in place before listen: the receive buffer decides the TCP window scale 
+	// offered in the handshake, and accepted sockets inherit both sizes from the listen socket.
+	if (tuning != NULL && !TuneListenSocket(ListenSocket, *tuning))
+	{
+		closesocket(ListenSocket);
+		return INVALID_SOCKET;
+	}
+
+	// --- Listening on a Socket ---
+
+	// After the socket is bound to an IP address and port on the system, the server 
+	// must then listen on that IP address and port for incoming connection requests.
+	// The backlog is the maximum length of the queue of pending connections to accept.
+	iResult = listen(ListenSocket, backlog);
+
+	// Check the return value for general errors.
+	if (iResult == SOCKET_ERROR) 
+	{
+		printf("listen failed with error: %d\n", WSAGetLastError());
+		closesocket(ListenSocket);
+		return INVALID_SOCKET;
+	}
+
+	// The listen socket is polled by the event loop instead of blocking in accept.
+	if (!SetNonBlocking(ListenSocket))
+	{
+		printf("SetNonBlocking failed with error: %d\n", WSAGetLastError());
+		closesocket(ListenSocket);
+		return INVALID_SOCKET;
+	}
+
+	return ListenSocket;
+}
+
+SOCKET CreateUdpSocket(const char *port, bool reusePort, const SocketTuning *tuning)
+{
+	struct addrinfo hints;
+	struct addrinfo *result = NULL;
+
+	// Same as for the TCP listen socket, but a datagram socket: no connections, no listen and no accept. 
+	// Every recv returns one whole datagram from any client, together with the client's address.
+	ZeroMemory(&hints, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
+	hints.ai_flags = AI_PASSIVE;
+
+	int iResult = getaddrinfo(NULL, port, &hints, &result);
+
+	if (iResult != 0)
+	{
+		printf("getaddrinfo failed with error: %d\n", iResult);
+		return INVALID_SOCKET;
+	}
+
+	SOCKET UdpSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+
+	if (UdpSocket == INVALID_SOCKET)
+	{
+		printf("socket failed with error: %d\n", WSAGetLastError());
+		freeaddrinfo(result);
+		return INVALID_SOCKET;
+	}
+
+#ifndef _WIN32
+	int reuse = 1;
+
+	if (reusePort && setsockopt(UdpSocket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == SOCKET_ERROR)
+	{
+		printf("setsockopt(SO_REUSEPORT) failed with error: %d\n", WSAGetLastError());
+		freeaddrinfo(result);
+		closesocket(UdpSocket);
+		return INVALID_SOCKET;
+	}
+#else
+	if (reusePort)
+	{
+		printf("SO_REUSEPORT is not supported on this platform\n");
+		freeaddrinfo(result);
+		closesocket(UdpSocket);
+		return INVALID_SOCKET;
+	}
+#endif
+
+	// A burst of datagrams that does not fit the receive buffer is dropped by the kernel, 
+	// so the buffer sizes matter even more than for TCP.
+	if (tuning != NULL && !TuneDatagramSocket(UdpSocket, *tuning))
+	{
+		freeaddrinfo(result);
+		closesocket(UdpSocket);
+		return INVALID_SOCKET;
+	}
+
+	iResult = bind(UdpSocket, result->ai_addr, (int)result->ai_addrlen);
+	freeaddrinfo(result);
+
+	if (iResult == SOCKET_ERROR)
+	{
+		printf("bind failed with error: %d\n", WSAGetLastError());
+		closesocket(UdpSocket);
+		return INVALID_SOCKET;
+	}
+
+	return UdpSocket;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "Platform.h"
+#include "Tuning.h"
+
+// Create a TCP socket bound to the given port on all local IPv4 addresses and put it in the listening state.
+// The returned socket is non-blocking so it can be registered with an event loop.
+// With reusePort set the socket is bound with SO_REUSEPORT, so several sockets (one per worker thread) 
+// can listen on the same port and the kernel spreads incoming connections across them.
+// With a tuning given, its listen socket options (buffer sizes, TCP_DEFER_ACCEPT) are set before listen.
+// Returns INVALID_SOCKET on failure after printing the reason.
+SOCKET CreateListenSocket(const char *port, int backlog, bool reusePort, const SocketTuning *tuning = NULL);
+
+// Create a UDP socket bound to the given port on all local IPv4 addresses. The socket is left blocking: 
+// a datagram loop sleeps in recvmmsg. reusePort and tuning work as for CreateListenSocket, so every 
+// worker can own a socket on the same port and the kernel hashes each client's datagrams to one of them.
+// Returns INVALID_SOCKET on failure after printing the reason.
+SOCKET CreateUdpSocket(const char *port, bool reusePort, const SocketTuning *tuning = NULL);
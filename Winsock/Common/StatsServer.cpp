@@ -0,0 +1,209 @@
+#include "StatsServer.h"
+#include "Metrics.h"
+#include "Socket.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+// How often the stats thread checks whether it has been stopped while no one is connecting, in milliseconds.
+#define STATS_POLL_INTERVAL 200
+
+// Time a scraper gets to send its request before it is answered anyway, in milliseconds.
+#define STATS_REQUEST_TIMEOUT 1000
+
+// Prefix of every exported metric name.
+#define STATS_PREFIX "echo_"
+
+StatsServer::StatsServer()
+	: listenSocket(INVALID_SOCKET), running(false)
+{
+}
+
+StatsServer::~StatsServer()
+{
+	Stop();
+}
+
+bool StatsServer::Start(const char *port, const std::vector<const LoopMetrics *> &loopMetrics)
+{
+	listenSocket = CreateListenSocket(port, SOMAXCONN, false);
+
+	if (listenSocket == INVALID_SOCKET)
+		return false;
+
+	metrics = loopMetrics;
+	running = true;
+	worker = std::thread(&StatsServer::Serve, this);
+
+	return true;
+}
+
+void StatsServer::Stop(void)
+{
+	if (!worker.joinable())
+		return;
+
+	running = false;
+	worker.join();
+
+	closesocket(listenSocket);
+	listenSocket = INVALID_SOCKET;
+}
+
+void StatsServer::Serve(void)
+{
+	// The listen socket is non-blocking; wait for connections with a timeout so Stop is noticed.
+	while (running)
+	{
+		struct pollfd pfd;
+		pfd.fd = listenSocket;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, STATS_POLL_INTERVAL) <= 0)
+			continue;
+
+		SOCKET ClientSocket = accept(listenSocket, NULL, NULL);
+
+		if (ClientSocket == INVALID_SOCKET)
+			continue;
+
+		Respond(ClientSocket);
+		closesocket(ClientSocket);
+	}
+}
+
+static void AppendMetric(std::string &out, const char *name, const char *type, const char *help)
+{
+	char line[256];
+
+	snprintf(line, sizeof(line), "# HELP " STATS_PREFIX "%s %s\n# TYPE " STATS_PREFIX "%s %s\n", name, help, name, type);
+	out += line;
+}
+
+static void AppendSample(std::string &out, const char *name, size_t loop, uint64_t value)
+{
+	char line[256];
+
+	snprintf(line, sizeof(line), STATS_PREFIX "%s{loop=\"%zu\"} %llu\n", name, loop, (unsigned long long)value);
+	out += line;
+}
+
+void StatsServer::Respond(SOCKET ClientSocket)
+{
+	// Read whatever request the scraper sends. Its content does not matter: every request gets
+	// the full snapshot, but HTTP clients expect a status line and headers in front of it.
+	char request[1024];
+	int received = 0;
+
+	struct pollfd pfd;
+	pfd.fd = ClientSocket;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	if (poll(&pfd, 1, STATS_REQUEST_TIMEOUT) > 0)
+		received = (int)recv(ClientSocket, request, sizeof(request) - 1, 0);
+
+	bool http = received >= 4 && memcmp(request, "GET ", 4) == 0;
+
+	// --- Snapshot ---
+
+	// Each counter is read once with a relaxed load. Counters of one loop are not read at one
+	// instant, so a snapshot can be a few events apart between counters, never torn within one.
+	std::string body;
+	size_t count = metrics.size();
+
+	struct Counter
+	{
+		const char *name;
+		const char *type;
+		const char *help;
+		uint64_t LoopMetrics::*field;
+	};
+
+	static const Counter counters[] =
+	{
+		{ "accepts_total", "counter", "Connections accepted.", &LoopMetrics::accepts },
+		{ "closes_total", "counter", "Connections closed.", &LoopMetrics::closes },
+		{ "bytes_in_total", "counter", "Bytes received from clients.", &LoopMetrics::bytesIn },
+		{ "bytes_out_total", "counter", "Bytes sent to clients.", &LoopMetrics::bytesOut },
+		{ "frames_total", "counter", "Complete frames decoded (datagrams, in UDP mode).", &LoopMetrics::frames },
+		{ "frame_errors_total", "counter", "Connections closed for an invalid frame.", &LoopMetrics::frameErrors },
+		{ "partial_writes_total", "counter", "Sends cut short by a full socket send buffer.", &LoopMetrics::partialWrites },
+		{ "offloads_total", "counter", "Frames handed to the work pool.", &LoopMetrics::offloads },
+		{ "timeouts_total", "counter", "Connections closed by the idle or read timeout.", &LoopMetrics::timeouts },
+		{ "accept_pauses_total", "counter", "Times accepting paused at the connection limit.", &LoopMetrics::acceptPauses },
+		{ "tls_handshakes_total", "counter", "TLS handshakes completed with the keys handed to the kernel.", &LoopMetrics::tlsHandshakes },
+		{ "tls_failures_total", "counter", "TLS handshakes that failed, timed out or could not be offloaded.", &LoopMetrics::tlsFailures },
+	};
+
+	for (size_t c = 0; c < sizeof(counters) / sizeof(counters[0]); c++)
+	{
+		AppendMetric(body, counters[c].name, counters[c].type, counters[c].help);
+
+		for (size_t i = 0; i < count; i++)
+			AppendSample(body, counters[c].name, i, CounterLoad(metrics[i]->*counters[c].field));
+	}
+
+	AppendMetric(body, "connections_active", "gauge", "Connections currently open.");
+
+	for (size_t i = 0; i < count; i++)
+		AppendSample(body, "connections_active", i, CounterLoad(metrics[i]->accepts) - CounterLoad(metrics[i]->closes));
+
+	// Loop iteration time across all loops, merged into one snapshot histogram.
+	Histogram *merged = new Histogram();
+
+	for (size_t i = 0; i < count; i++)
+		merged->Merge(metrics[i]->iterationTime);
+
+	AppendMetric(body, "loop_iteration_seconds", "summary", "Time spent handling one event loop iteration.");
+
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	char line[256];
+
+	for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+	{
+		snprintf(line, sizeof(line), STATS_PREFIX "loop_iteration_seconds{quantile=\"%g\"} %.9f\n",
+			quantiles[q], merged->Percentile(quantiles[q] * 100.0) / 1e9);
+		body += line;
+	}
+
+	snprintf(line, sizeof(line), STATS_PREFIX "loop_iteration_seconds_sum %.9f\n" STATS_PREFIX "loop_iteration_seconds_count %llu\n",
+		merged->Mean() * (double)merged->Count() / 1e9, (unsigned long long)merged->Count());
+	body += line;
+
+	AppendMetric(body, "loop_iteration_max_seconds", "gauge", "Longest event loop iteration so far.");
+
+	snprintf(line, sizeof(line), STATS_PREFIX "loop_iteration_max_seconds %.9f\n", merged->Max() / 1e9);
+	body += line;
+
+	delete merged;
+
+	std::string response;
+
+	if (http)
+	{
+		snprintf(line, sizeof(line), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body.size());
+		response = line;
+	}
+
+	response += body;
+
+	// The response is small; a blocking-style loop over send is enough here.
+	size_t sent = 0;
+
+	while (sent < response.size())
+	{
+		ssize_t iResult = send(ClientSocket, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+
+		if (iResult <= 0)
+			break;
+
+		sent += (size_t)iResult;
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+struct LoopMetrics;
+
+// --- Live Stats Endpoint ---
+
+// Serves the metrics of a set of event loops on a TCP port of its own, in the Prometheus text
+// exposition format. Every connection gets one snapshot and is then closed, so both
+// "curl http://host:port/metrics" (or a Prometheus scrape) and a plain "nc host port" work.
+// The endpoint runs on its own thread and only reads the loops' counters: the loops never
+// wait for it and never take a lock because of it.
+class StatsServer
+{
+public:
+	StatsServer();
+	~StatsServer();
+
+	// Listen on the port and start serving snapshots of the given loops' metrics (IoLoop::Metrics, 
+	// UdpEchoLoop::Metrics). The loops must outlive the server (or Stop must be called first).
+	// Returns false after printing the reason on failure.
+	bool Start(const char *port, const std::vector<const LoopMetrics *> &loopMetrics);
+
+	// Stop serving and wait for the stats thread to finish.
+	void Stop(void);
+
+private:
+	void Serve(void);
+	void Respond(SOCKET ClientSocket);
+
+	SOCKET listenSocket;
+	std::vector<const LoopMetrics *> metrics;
+	std::thread worker;
+	std::atomic<bool> running;
+};
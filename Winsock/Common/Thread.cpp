@@ -0,0 +1,39 @@
+#include "Thread.h"
+
+#include <stdio.h>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+bool PinCurrentThread(int cpu)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	int iResult = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	if (iResult != 0)
+	{
+		printf("pthread_setaffinity_np(%d) failed with error: %d\n", cpu, iResult);
+		return false;
+	}
+
+	return true;
+#else
+	(void)cpu;
+	printf("CPU pinning is not supported on this platform\n");
+	return false;
+#endif
+}
+
+int CpuCount(void)
+{
+	unsigned int n = std::thread::hardware_concurrency();
+
+	return n ? (int)n : 1;
+}
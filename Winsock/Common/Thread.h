@@ -0,0 +1,9 @@
+#pragma once
+
+// Bind the calling thread to a single CPU so its event loop, its sockets' cache lines 
+// and (with RSS/RPS) its NIC queue all stay on one core.
+// Returns false after printing the reason when the platform or the CPU index is not supported.
+bool PinCurrentThread(int cpu);
+
+// Number of CPUs available to this process.
+int CpuCount(void);
@@ -0,0 +1,180 @@
+#include "TimerWheel.h"
+#include "Metrics.h"
+
+#include <string.h>
+
+// The occupancy bitmap of a level is one 64-bit word.
+static_assert(TIMER_WHEEL_SLOTS <= 64, "TIMER_WHEEL_BITS must be at most 6");
+
+#define SLOT_MASK ((uint64_t)TIMER_WHEEL_SLOTS - 1)
+
+// Largest distance from the current tick that the levels can represent.
+#define MAX_DELTA (((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+TimerWheel::TimerWheel()
+	: origin(MetricsClock()), tickNs((uint64_t)TIMER_WHEEL_TICK_MS * 1000000ull), current(0), count(0)
+{
+	memset(slots, 0, sizeof(slots));
+	memset(occupied, 0, sizeof(occupied));
+}
+
+void TimerWheel::Schedule(TimerNode *node, uint64_t when)
+{
+	if (node->pprev != NULL)
+		Cancel(node);
+
+	// Round up, so the timer never fires before its time; a time already passed fires on the next tick.
+	uint64_t tick = when > origin ? (when - origin + tickNs - 1) / tickNs : 0;
+
+	node->expires = tick > current ? tick : current + 1;
+
+	Link(node);
+	count++;
+}
+
+void TimerWheel::Link(TimerNode *node)
+{
+	// The level is picked by how far away the expiry is, the slot within the level by the expiry
+	// itself. A timer beyond the top level is parked at the top level's farthest slot for now.
+	uint64_t delta = node->expires - current;
+	uint64_t expires = node->expires;
+
+	if (delta > MAX_DELTA)
+	{
+		delta = MAX_DELTA;
+		expires = current + MAX_DELTA;
+	}
+
+	// A timer cascaded on its own tick has a distance of 0 and goes to the slot about to fire.
+	unsigned level = delta < TIMER_WHEEL_SLOTS ? 0 : (unsigned)((63 - __builtin_clzll(delta)) / TIMER_WHEEL_BITS);
+	unsigned index = (unsigned)((expires >> (level * TIMER_WHEEL_BITS)) & SLOT_MASK);
+
+	TimerNode **head = &slots[level][index];
+
+	node->next = *head;
+	node->pprev = head;
+
+	if (*head != NULL)
+		(*head)->pprev = &node->next;
+
+	*head = node;
+
+	node->slot = level * TIMER_WHEEL_SLOTS + index;
+	occupied[level] |= 1ull << index;
+}
+
+void TimerWheel::Cancel(TimerNode *node)
+{
+	if (node->pprev == NULL)
+		return;
+
+	*node->pprev = node->next;
+
+	if (node->next != NULL)
+		node->next->pprev = node->pprev;
+
+	unsigned level = node->slot / TIMER_WHEEL_SLOTS;
+	unsigned index = node->slot % TIMER_WHEEL_SLOTS;
+
+	if (slots[level][index] == NULL)
+		occupied[level] &= ~(1ull << index);
+
+	node->next = NULL;
+	node->pprev = NULL;
+	count--;
+}
+
+void TimerWheel::Cascade(unsigned level)
+{
+	unsigned index = (unsigned)((current >> (level * TIMER_WHEEL_BITS)) & SLOT_MASK);
+
+	// The level above moves down first when this level wraps as well; none of its timers
+	// can land in the slot about to be emptied here, which covers ticks already reached.
+	if (index == 0 && level + 1 < TIMER_WHEEL_LEVELS)
+		Cascade(level + 1);
+
+	TimerNode *node = slots[level][index];
+
+	slots[level][index] = NULL;
+	occupied[level] &= ~(1ull << index);
+
+	// Every timer of the slot is now within the span of a lower level (or still parked at the top).
+	while (node != NULL)
+	{
+		TimerNode *next = node->next;
+
+		Link(node);
+		node = next;
+	}
+}
+
+size_t TimerWheel::Advance(uint64_t now, TimerCallback callback, void *context)
+{
+	uint64_t target = now > origin ? (now - origin) / tickNs : 0;
+	size_t fired = 0;
+
+	while (current < target)
+	{
+		if (count == 0)
+		{
+			current = target;
+			break;
+		}
+
+		// Nothing left in this turn of the lowest level: jump to its last tick, so the next step wraps
+		// it and cascades. An idle stretch costs one step per turn, not one per tick.
+		if (occupied[0] == 0)
+		{
+			uint64_t end = current | SLOT_MASK;
+
+			current = end < target ? end : target;
+
+			if (current == target)
+				break;
+		}
+
+		current++;
+
+		unsigned index = (unsigned)(current & SLOT_MASK);
+
+		if (index == 0)
+			Cascade(1);
+
+		// The callback may schedule the node again, always at a later tick and so in another slot,
+		// or cancel other timers, so the slot is emptied one node at a time.
+		TimerNode *node;
+
+		while ((node = slots[0][index]) != NULL)
+		{
+			Cancel(node);
+			callback(node, context);
+			fired++;
+		}
+	}
+
+	return fired;
+}
+
+int TimerWheel::NextTimeoutMs(uint64_t now) const
+{
+	if (count == 0)
+		return -1;
+
+	// The next occupied slot of the lowest level within its current turn, or else the end of
+	// the turn, where the level above cascades and may bring timers into range.
+	unsigned index = (unsigned)(current & SLOT_MASK);
+	uint64_t ahead = index + 1 < TIMER_WHEEL_SLOTS ? occupied[0] >> (index + 1) : 0;
+	uint64_t tick;
+
+	if (ahead != 0)
+		tick = current + 1 + (uint64_t)__builtin_ctzll(ahead);
+	else
+		tick = (current | SLOT_MASK) + 1;
+
+	uint64_t at = origin + tick * tickNs;
+
+	if (at <= now)
+		return 0;
+
+	return (int)((at - now + 999999) / 1000000);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Resolution of the wheel. Timers fire at the first tick at or after their expiry,
+// so a timeout is never early and at most one tick (plus the loop's own latency) late.
+#define TIMER_WHEEL_TICK_MS 10
+
+// Each level has 2^TIMER_WHEEL_BITS slots and covers that many times the span of the level below.
+// Four levels of 64 slots cover 2^24 ticks, about 46 hours at 10 ms; longer timers are parked
+// in the top level and cascade down until they come within range.
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_BITS)
+
+// A timer embedded in the object it belongs to (objects inherit from it, like WorkJob).
+// Linking it into the wheel allocates nothing.
+struct TimerNode
+{
+	TimerNode() : next(NULL), pprev(NULL), expires(0), slot(0) {}
+
+	TimerNode *next;
+
+	// The pointer that points at this node (the slot head or the previous node's next),
+	// so a node unlinks itself without knowing its slot; NULL while the timer is not scheduled.
+	TimerNode **pprev;
+
+	// Tick at which the timer fires.
+	uint64_t expires;
+
+	// Level * TIMER_WHEEL_SLOTS + index of the slot holding the node.
+	uint32_t slot;
+};
+
+// Called for every timer that expires, after it has been unlinked; it may schedule the node again.
+typedef void (*TimerCallback)(TimerNode *node, void *context);
+
+// --- Hierarchical Timer Wheel ---
+
+// Per-connection timeouts for hundreds of thousands of connections. A sorted structure (a heap or
+// a tree) pays O(log n) for every insert and cancel; the wheel hashes a timer into the slot of its
+// expiry tick, so Schedule and Cancel are a few pointer writes each. Timers far in the future go to
+// the coarse upper levels and are redistributed (cascaded) into the finer level below when the lower
+// level wraps around, so each timer is touched at most once per level on its way to firing.
+// An occupancy bitmap per level lets Advance skip empty stretches and NextTimeoutMs find the next
+// slot with work without walking the slots. Single-threaded, like the loop that owns it.
+class TimerWheel
+{
+public:
+	TimerWheel();
+
+	// Schedule node to fire at the monotonic time when (in nanoseconds, see MetricsClock),
+	// moving it if it is already scheduled. A time in the past fires on the next tick.
+	void Schedule(TimerNode *node, uint64_t when);
+
+	// Unschedule node; nothing happens if it is not scheduled.
+	void Cancel(TimerNode *node);
+
+	static bool Scheduled(const TimerNode *node) { return node->pprev != NULL; }
+
+	// Monotonic time in nanoseconds at which a scheduled node fires.
+	uint64_t ExpiresAt(const TimerNode *node) const { return origin + node->expires * tickNs; }
+
+	// Fire every timer due at the monotonic time now. Returns the number fired.
+	size_t Advance(uint64_t now, TimerCallback callback, void *context);
+
+	// Milliseconds from now until Advance has work (a timer to fire or to cascade),
+	// or -1 when no timer is scheduled. Suitable as an epoll_wait timeout.
+	int NextTimeoutMs(uint64_t now) const;
+
+	size_t Size(void) const { return count; }
+
+private:
+	void Link(TimerNode *node);
+	void Cascade(unsigned level);
+
+	TimerNode *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	uint64_t occupied[TIMER_WHEEL_LEVELS];
+
+	// Monotonic time of tick 0, the length of a tick, and the last tick processed.
+	uint64_t origin;
+	uint64_t tickNs;
+	uint64_t current;
+
+	size_t count;
+};
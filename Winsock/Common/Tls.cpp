@@ -0,0 +1,488 @@
+#include "Tls.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <poll.h>
+#include <sys/epoll.h>
+
+#include <openssl/ec.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+// Build: link with -lssl -lcrypto (OpenSSL 3.0 or later, built with kTLS support, which is the default on Linux).
+
+// TLS 1.2 suites whose record protection the kernel implements (AES-GCM and ChaCha20-Poly1305).
+// All TLS 1.3 suites enabled by default qualify as well.
+static const char KernelCiphers[] =
+	"ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:"
+	"ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:"
+	"ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305";
+
+// Print the reason OpenSSL gives for the last failure of call.
+static void PrintTlsError(const char *call)
+{
+	char text[256];
+
+	ERR_error_string_n(ERR_get_error(), text, sizeof(text));
+	ERR_clear_error();
+
+	printf("%s failed with error: %s\n", call, text);
+}
+
+static SSL_CTX *Fail(const char *call, SSL_CTX *context)
+{
+	PrintTlsError(call);
+	SSL_CTX_free(context);
+
+	return NULL;
+}
+
+// Settings shared by both ends, so both modes negotiate the same protocol and cipher and differ
+// only in where the records are processed.
+static bool ConfigureContext(SSL_CTX *context, TlsMode mode)
+{
+	SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+
+#if OPENSSL_VERSION_NUMBER < 0x30200000L
+	// Before 3.2 OpenSSL hands only the sending side of a TLS 1.3 connection to the kernel,
+	// which leaves the receiving side in user space; TLS 1.2 is offloaded in both directions.
+	SSL_CTX_set_max_proto_version(context, TLS1_2_VERSION);
+#endif
+
+	if (SSL_CTX_set_cipher_list(context, KernelCiphers) != 1)
+	{
+		PrintTlsError("SSL_CTX_set_cipher_list");
+		return false;
+	}
+
+	// Once the kernel has the keys, a record that is not application data (a renegotiation, a TLS 1.3
+	// session ticket or key update) cannot be handled any more: the socket fails the read with EIO.
+	// None of them is needed here, so none is sent or accepted.
+	SSL_CTX_set_options(context, SSL_OP_NO_RENEGOTIATION);
+	SSL_CTX_set_num_tickets(context, 0);
+
+	if (mode == TLS_KERNEL)
+		SSL_CTX_set_options(context, SSL_OP_ENABLE_KTLS);
+
+	return true;
+}
+
+// A throwaway P-256 key with a certificate for "localhost" signed by itself.
+static bool UseSelfSignedCertificate(SSL_CTX *context)
+{
+	EVP_PKEY *key = EVP_EC_gen("P-256");
+	X509 *cert = X509_new();
+	bool ok = false;
+
+	if (key != NULL && cert != NULL)
+	{
+		X509_NAME *name = X509_get_subject_name(cert);
+
+		X509_set_version(cert, 2);
+		ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+		X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+		X509_gmtime_adj(X509_getm_notAfter(cert), (long)TLS_SELF_SIGNED_DAYS * 24 * 3600);
+		X509_set_pubkey(cert, key);
+		X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0);
+		X509_set_issuer_name(cert, name);
+
+		ok = X509_sign(cert, key, EVP_sha256()) != 0 &&
+			SSL_CTX_use_certificate(context, cert) == 1 &&
+			SSL_CTX_use_PrivateKey(context, key) == 1;
+	}
+
+	if (!ok)
+		PrintTlsError("Generating a self-signed certificate");
+
+	X509_free(cert);
+	EVP_PKEY_free(key);
+
+	return ok;
+}
+
+SSL_CTX *CreateTlsServerContext(const char *certFile, const char *keyFile, TlsMode mode)
+{
+	SSL_CTX *context = SSL_CTX_new(TLS_server_method());
+
+	if (context == NULL)
+	{
+		PrintTlsError("SSL_CTX_new");
+		return NULL;
+	}
+
+	if (!ConfigureContext(context, mode))
+	{
+		SSL_CTX_free(context);
+		return NULL;
+	}
+
+	if (certFile == NULL)
+	{
+		if (!UseSelfSignedCertificate(context))
+		{
+			SSL_CTX_free(context);
+			return NULL;
+		}
+
+		return context;
+	}
+
+	if (SSL_CTX_use_certificate_chain_file(context, certFile) != 1)
+		return Fail("SSL_CTX_use_certificate_chain_file", context);
+
+	if (SSL_CTX_use_PrivateKey_file(context, keyFile != NULL ? keyFile : certFile, SSL_FILETYPE_PEM) != 1)
+		return Fail("SSL_CTX_use_PrivateKey_file", context);
+
+	return context;
+}
+
+SSL_CTX *CreateTlsClientContext(const char *caFile, TlsMode mode)
+{
+	SSL_CTX *context = SSL_CTX_new(TLS_client_method());
+
+	if (context == NULL)
+	{
+		PrintTlsError("SSL_CTX_new");
+		return NULL;
+	}
+
+	if (!ConfigureContext(context, mode))
+	{
+		SSL_CTX_free(context);
+		return NULL;
+	}
+
+	if (caFile != NULL)
+	{
+		if (SSL_CTX_load_verify_locations(context, caFile, NULL) != 1)
+			return Fail("SSL_CTX_load_verify_locations", context);
+
+		SSL_CTX_set_verify(context, SSL_VERIFY_PEER, NULL);
+	}
+
+	return context;
+}
+
+void FreeTlsContext(SSL_CTX *context)
+{
+	SSL_CTX_free(context);
+}
+
+bool KernelTlsAvailable(void)
+{
+	static int available = -1;
+
+	if (available != -1)
+		return available != 0;
+
+	// Attaching the upper layer protocol looks it up (loading the module on demand) before checking
+	// the socket, so an unconnected socket tells whether the kernel has it: ENOENT when it does not,
+	// ENOTCONN when it does but needs an established connection.
+	SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+	if (s == INVALID_SOCKET)
+	{
+		printf("socket failed with error: %d\n", WSAGetLastError());
+		return false;
+	}
+
+	int error = setsockopt(s, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) == 0 ? 0 : WSAGetLastError();
+
+	closesocket(s);
+
+	available = error == 0 || error == ENOTCONN || error == EISCONN;
+
+	if (!available)
+	{
+		if (error == ENOENT)
+			printf("Kernel TLS is not available: the kernel has no tls module (modprobe tls)\n");
+		else
+			printf("Kernel TLS is not available: setsockopt TCP_ULP failed with error: %d\n", error);
+	}
+
+	return available != 0;
+}
+
+// Milliseconds from now until the monotonic time deadline, 0 once it has passed.
+static int MsUntil(uint64_t deadline, uint64_t now)
+{
+	return deadline <= now ? 0 : (int)((deadline - now + 999999) / 1000000);
+}
+
+SSL *TlsConnect(SSL_CTX *context, SOCKET s, const char *host, int timeoutMs)
+{
+	SSL *ssl = SSL_new(context);
+
+	if (ssl == NULL || SSL_set_fd(ssl, s) != 1)
+	{
+		PrintTlsError("SSL_new");
+		SSL_free(ssl);
+		return NULL;
+	}
+
+	SSL_set_connect_state(ssl);
+
+	// Only a name goes into the server name extension, and is checked against a verified certificate.
+	struct in6_addr address;
+
+	if (host != NULL && inet_pton(AF_INET, host, &address) != 1 && inet_pton(AF_INET6, host, &address) != 1)
+	{
+		SSL_set_tlsext_host_name(ssl, host);
+
+		if (SSL_CTX_get_verify_mode(context) & SSL_VERIFY_PEER)
+			SSL_set1_host(ssl, host);
+	}
+
+	uint64_t deadline = MetricsClock() + (uint64_t)timeoutMs * 1000000ull;
+
+	for (;;)
+	{
+		int result = SSL_do_handshake(ssl);
+
+		if (result == 1)
+			return ssl;
+
+		int error = SSL_get_error(ssl, result);
+
+		if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE)
+		{
+			if (error == SSL_ERROR_SYSCALL && ERR_peek_error() == 0)
+				printf("TLS handshake failed with error: %d\n", WSAGetLastError());
+			else
+				PrintTlsError("TLS handshake");
+
+			SSL_free(ssl);
+			return NULL;
+		}
+
+		// A non-blocking socket waits here for the next handshake message; a blocking one never gets here.
+		struct pollfd pfd;
+		pfd.fd = s;
+		pfd.events = error == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT;
+
+		int ready = poll(&pfd, 1, MsUntil(deadline, MetricsClock()));
+
+		if (ready == 0)
+		{
+			printf("TLS handshake timed out\n");
+			SSL_free(ssl);
+			return NULL;
+		}
+
+		if (ready < 0 && errno != EINTR)
+		{
+			printf("poll failed with error: %d\n", errno);
+			SSL_free(ssl);
+			return NULL;
+		}
+	}
+}
+
+bool TlsHandOff(SSL *ssl)
+{
+	// Records read ahead by OpenSSL are not in the socket any more, so the stream could not continue there.
+	bool offloaded = BIO_get_ktls_send(SSL_get_wbio(ssl)) && BIO_get_ktls_recv(SSL_get_rbio(ssl)) && !SSL_has_pending(ssl);
+
+	// The socket BIO does not own the socket, and without SSL_shutdown freeing the session sends nothing.
+	SSL_free(ssl);
+
+	return offloaded;
+}
+
+TlsHandshaker::TlsHandshaker()
+	: context(NULL), metrics(NULL), epollFd(-1), head(NULL), tail(NULL), warnedNoOffload(false)
+{
+}
+
+TlsHandshaker::~TlsHandshaker()
+{
+	CloseAll();
+
+	if (epollFd != -1)
+		close(epollFd);
+}
+
+bool TlsHandshaker::Init(SSL_CTX *sslContext, LoopMetrics *loopMetrics)
+{
+	context = sslContext;
+	metrics = loopMetrics;
+
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (epollFd == -1)
+	{
+		printf("epoll_create1 failed with error: %d\n", errno);
+		return false;
+	}
+
+	return true;
+}
+
+void TlsHandshaker::Start(SOCKET s, uint64_t now)
+{
+	Handshake *handshake = handshakes.Acquire();
+	SSL *ssl = handshake != NULL ? SSL_new(context) : NULL;
+
+	if (ssl == NULL || SSL_set_fd(ssl, s) != 1)
+	{
+		printf("Out of memory for TLS handshake\n");
+		ERR_clear_error();
+		SSL_free(ssl);
+
+		if (handshake != NULL)
+			handshakes.Release(handshake);
+
+		closesocket(s);
+		return;
+	}
+
+	SSL_set_accept_state(ssl);
+
+	// OpenSSL drives the handshake with its own reads and writes, which must not block the loop.
+	int flags = fcntl(s, F_GETFL, 0);
+
+	handshake->ssl = ssl;
+	handshake->socket = s;
+	handshake->deadline = now + (uint64_t)TLS_HANDSHAKE_TIMEOUT_MS * 1000000ull;
+	handshake->wasBlocking = (flags & O_NONBLOCK) == 0;
+	handshake->prev = tail;
+	handshake->next = NULL;
+
+	if (tail != NULL)
+		tail->next = handshake;
+	else
+		head = handshake;
+
+	tail = handshake;
+
+	if (handshake->wasBlocking)
+		SetNonBlocking(s);
+
+	// Edge-triggered for both directions. Adding a writable socket reports it at once, so the first
+	// step of the handshake runs from the next Poll, with the ClientHello usually already there.
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = handshake;
+
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, s, &ev) == -1)
+	{
+		printf("epoll_ctl failed with error: %d\n", errno);
+		Finish(handshake, true);
+	}
+}
+
+void TlsHandshaker::Poll(HandshakeCallback ready, void *readyContext)
+{
+	struct epoll_event events[64];
+	int n;
+
+	do
+	{
+		n = epoll_wait(epollFd, events, 64, 0);
+
+		// Every socket appears once per batch, and only Step can finish a handshake meanwhile.
+		for (int i = 0; i < n; i++)
+			Step((Handshake *)events[i].data.ptr, ready, readyContext);
+	} while (n == 64);
+}
+
+void TlsHandshaker::Step(Handshake *handshake, HandshakeCallback ready, void *readyContext)
+{
+	int result = SSL_do_handshake(handshake->ssl);
+
+	if (result != 1)
+	{
+		int error = SSL_get_error(handshake->ssl, result);
+
+		// Waiting for the next flight from the client, or for room in the send buffer.
+		if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+			return;
+
+		// A client that gives up or speaks something else is routine for a server, not worth a line each.
+		ERR_clear_error();
+		LOG_DEBUG("TLS handshake failed: socket %d\n", (int)handshake->socket);
+		CounterAdd(metrics->tlsFailures, 1);
+		Finish(handshake, true);
+		return;
+	}
+
+	SOCKET s = handshake->socket;
+	SSL *ssl = handshake->ssl;
+	bool wasBlocking = handshake->wasBlocking;
+
+	handshake->ssl = NULL;
+	Finish(handshake, false);
+
+	if (!TlsHandOff(ssl))
+	{
+		if (!warnedNoOffload)
+		{
+			printf("TLS keys were not handed to the kernel (kTLS missing or cipher not supported); closing such connections\n");
+			warnedNoOffload = true;
+		}
+
+		CounterAdd(metrics->tlsFailures, 1);
+		closesocket(s);
+		return;
+	}
+
+	if (wasBlocking)
+		fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) & ~O_NONBLOCK);
+
+	CounterAdd(metrics->tlsHandshakes, 1);
+	LOG_DEBUG("TLS handshake done: socket %d\n", (int)s);
+
+	ready(s, readyContext);
+}
+
+void TlsHandshaker::Expire(uint64_t now)
+{
+	while (head != NULL && head->deadline <= now)
+	{
+		LOG_DEBUG("TLS handshake timed out: socket %d\n", (int)head->socket);
+		CounterAdd(metrics->tlsFailures, 1);
+		Finish(head, true);
+	}
+}
+
+void TlsHandshaker::CloseAll(void)
+{
+	while (head != NULL)
+		Finish(head, true);
+}
+
+void TlsHandshaker::Finish(Handshake *handshake, bool closeSocket)
+{
+	if (handshake->prev != NULL)
+		handshake->prev->next = handshake->next;
+	else
+		head = handshake->next;
+
+	if (handshake->next != NULL)
+		handshake->next->prev = handshake->prev;
+	else
+		tail = handshake->prev;
+
+	if (closeSocket)
+	{
+		// Closing the socket takes it out of the epoll set as well.
+		SSL_free(handshake->ssl);
+		closesocket(handshake->socket);
+	}
+	else
+	{
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, handshake->socket, NULL);
+	}
+
+	handshakes.Release(handshake);
+}
+
+int TlsHandshaker::NextTimeoutMs(uint64_t now) const
+{
+	return head != NULL ? MsUntil(head->deadline, now) : -1;
+}
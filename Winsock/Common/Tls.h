@@ -0,0 +1,135 @@
+#pragma once
+
+#include "Platform.h"
+#include "Metrics.h"
+#include "ObjectPool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Longest a TLS handshake may take before the server gives up on the connection.
+#define TLS_HANDSHAKE_TIMEOUT_MS 10000
+
+// Validity of the certificate generated when no certificate file is given.
+#define TLS_SELF_SIGNED_DAYS 30
+
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_st SSL;
+
+// Where the record layer (encryption and framing of the application data) runs once the handshake is done.
+enum TlsMode
+{
+	// In the kernel (kTLS, TCP_ULP "tls"): after the handshake the socket reads and writes plaintext
+	// and the kernel encrypts and decrypts, so send, recv, sendmsg, splice and io_uring keep working
+	// unchanged on the connection and the application never copies ciphertext.
+	TLS_KERNEL,
+
+	// In OpenSSL: every byte goes through SSL_read and SSL_write (for comparison only).
+	TLS_USER
+};
+
+// --- TLS Contexts ---
+
+// Create a server context with the certificate chain and private key in the given PEM files, or with a
+// freshly generated self-signed P-256 certificate for "localhost" when certFile is NULL.
+// Returns NULL after printing the reason on failure.
+SSL_CTX *CreateTlsServerContext(const char *certFile, const char *keyFile, TlsMode mode);
+
+// Create a client context. With caFile the server's certificate is verified against it (and against the
+// host name passed to TlsConnect); without it the certificate is not checked, for self-signed test servers.
+// Returns NULL after printing the reason on failure.
+SSL_CTX *CreateTlsClientContext(const char *caFile, TlsMode mode);
+
+void FreeTlsContext(SSL_CTX *context);
+
+// Whether the kernel can take over TLS records (the tls module is loaded or built in).
+// Returns false after printing the reason, checked once per process.
+bool KernelTlsAvailable(void);
+
+// --- Handshakes ---
+
+// Run the client handshake on a connected socket, blocking or not, for at most timeoutMs.
+// Returns the session, or NULL after printing the reason on failure. The socket stays open either way.
+SSL *TlsConnect(SSL_CTX *context, SOCKET s, const char *host, int timeoutMs);
+
+// Hand a handshaken connection over to the kernel: succeeds if OpenSSL installed kTLS for both directions
+// and holds no records it read ahead, so the socket alone carries the rest of the stream. The session is
+// freed either way; the socket stays open, and is only usable on success.
+bool TlsHandOff(SSL *ssl);
+
+// Called for every connection whose server handshake finished and was handed to the kernel.
+typedef void (*HandshakeCallback)(SOCKET s, void *context);
+
+// --- Server-Side Handshakes ---
+
+// Runs the server handshakes of one event loop without blocking it. Accepted sockets are parked on an
+// epoll instance of their own until OpenSSL has finished the handshake and the kernel holds the keys;
+// only then does the loop see them, as plain connections. The loop waits for Fd() to become readable
+// (as one more file in its epoll set, or with a poll request on its ring) and calls Poll, so the
+// handshakes of one loop cost it no thread and no wakeups of their own.
+// Handshakes time out after TLS_HANDSHAKE_TIMEOUT_MS; they are in order of their deadlines, since the
+// timeout is the same for all of them, so expiring them looks only at the oldest.
+// There is no user space record layer here: a connection whose keys did not end up in the kernel
+// (no kTLS in the kernel, or a cipher it cannot offload) is closed, counted in tlsFailures.
+// Single-threaded, like the loop that owns it.
+class TlsHandshaker
+{
+public:
+	TlsHandshaker();
+	~TlsHandshaker();
+
+	// context is shared with other loops and must outlive the handshaker. metrics receives the
+	// handshake counters. Returns false after printing the reason on failure.
+	bool Init(SSL_CTX *context, LoopMetrics *metrics);
+
+	// Start the handshake of an accepted socket, taking ownership of it.
+	void Start(SOCKET s, uint64_t now);
+
+	// Continue the handshakes whose sockets are ready. Every finished one is passed to ready,
+	// with the socket in the blocking mode it came in.
+	void Poll(HandshakeCallback ready, void *context);
+
+	// Close the handshakes that have run out of time.
+	void Expire(uint64_t now);
+
+	// Close every handshake in progress, for a drain.
+	void CloseAll(void);
+
+	// Milliseconds from now until the oldest handshake times out, or -1 when none is in progress.
+	int NextTimeoutMs(uint64_t now) const;
+
+	size_t Pending(void) const { return handshakes.Live(); }
+
+	int Fd(void) const { return epollFd; }
+
+private:
+	struct Handshake
+	{
+		SSL *ssl;
+		SOCKET socket;
+		uint64_t deadline;
+
+		// The socket was blocking when accepted and is made blocking again when handed over.
+		bool wasBlocking;
+
+		// Neighbours in deadline order.
+		Handshake *prev;
+		Handshake *next;
+	};
+
+	void Step(Handshake *handshake, HandshakeCallback ready, void *context);
+	void Finish(Handshake *handshake, bool closeSocket);
+
+	SSL_CTX *context;
+	LoopMetrics *metrics;
+	int epollFd;
+
+	ObjectPool<Handshake> handshakes;
+
+	// Oldest and newest handshake in progress.
+	Handshake *head;
+	Handshake *tail;
+
+	// Printed once: connections are closed because the keys stayed in user space.
+	bool warnedNoOffload;
+};
@@ -0,0 +1,115 @@
+#include "Trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+TraceRing::TraceRing()
+	: events(NULL), mask(0), head(0), loop(0), directory("."), dumps(0), startTicks(0), startNs(0)
+{
+}
+
+TraceRing::~TraceRing()
+{
+	free(events);
+}
+
+bool TraceRing::Init(size_t capacity, unsigned loopIndex, const char *dumpDirectory)
+{
+	size_t size = 1;
+
+	while (size < capacity)
+		size <<= 1;
+
+	events = (TraceEvent *)malloc(size * sizeof(TraceEvent));
+
+	if (events == NULL)
+	{
+		printf("Out of memory for %zu trace events\n", size);
+		return false;
+	}
+
+	// Touched up front, so recording never takes a page fault on a fresh page.
+	memset(events, 0, size * sizeof(TraceEvent));
+
+	mask = size - 1;
+	loop = loopIndex;
+	directory = dumpDirectory;
+
+	startTicks = TraceClock();
+	startNs = MetricsClock();
+
+	return true;
+}
+
+static bool WriteAll(int fd, const void *data, size_t len)
+{
+	const char *p = (const char *)data;
+
+	while (len > 0)
+	{
+		ssize_t written = write(fd, p, len);
+
+		if (written < 0 && errno == EINTR)
+			continue;
+
+		if (written <= 0)
+			return false;
+
+		p += written;
+		len -= (size_t)written;
+	}
+
+	return true;
+}
+
+bool TraceRing::Dump(void)
+{
+	char path[4096];
+
+	snprintf(path, sizeof(path), "%s/trace-%d-%u-%u.bin", directory, (int)getpid(), loop, dumps++);
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd == -1)
+	{
+		printf("open(%s) failed with error: %d\n", path, errno);
+		return false;
+	}
+
+	uint64_t size = mask + 1;
+	uint64_t count = head < size ? head : size;
+	uint64_t first = head - count;
+
+	TraceFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.pid = (uint32_t)getpid();
+	header.loop = loop;
+	header.count = count;
+	header.recorded = head;
+	header.startTicks = startTicks;
+	header.startNs = startNs;
+	header.dumpTicks = TraceClock();
+	header.dumpNs = MetricsClock();
+
+	// Oldest first: from the oldest event to the end of the array, then the part that has wrapped around.
+	uint64_t start = first & mask;
+	uint64_t tail = count < size - start ? count : size - start;
+
+	bool ok = WriteAll(fd, &header, sizeof(header)) &&
+		WriteAll(fd, events + start, (size_t)tail * sizeof(TraceEvent)) &&
+		WriteAll(fd, events, (size_t)(count - tail) * sizeof(TraceEvent));
+
+	if (!ok)
+		printf("write(%s) failed with error: %d\n", path, errno);
+	else
+		printf("Trace of loop %u written to %s (%llu events)\n", loop, path, (unsigned long long)count);
+
+	close(fd);
+
+	return ok;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "Metrics.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// --- Connection Lifecycle Tracing ---
+
+// Every loop can keep the most recent events of its connections in a ring of fixed-size binary records:
+// a timestamp read from the CPU's time stamp counter, the connection's ID and a byte count. Recording
+// an event is a counter read and three stores into memory only the loop's thread touches; there are
+// no locks, no atomics and no formatting. The ring is written to a file on request (SIGUSR1 in the
+// server) or when an iteration of the loop takes longer than a threshold, and TraceConvert turns the
+// files into a Chrome trace (chrome://tracing, ui.perfetto.dev) offline.
+// With tracing off the loop's ring pointer is NULL, and every trace point costs one predictable branch.
+
+// A loop dumps after a slow iteration at most once per interval, so a stretch of slow iterations
+// does not turn into a stream of files (and of more slow iterations).
+#define TRACE_DUMP_INTERVAL_MS 1000
+
+// The byte count of an event saturates at 24 bits.
+#define TRACE_VALUE_MAX 0xFFFFFFu
+
+// First bytes of a trace file.
+#define TRACE_MAGIC "ECHOTRC1"
+
+enum TraceEventType
+{
+	// A connection was accepted (and, with TLS, has finished its handshake). Value: the socket.
+	TRACE_ACCEPT = 1,
+
+	// Bytes received, by recv, a multishot recv completion or splice. Value: bytes.
+	TRACE_READ,
+
+	// A complete frame was decoded. Value: payload bytes.
+	TRACE_FRAME,
+
+	// The message handler was called for a frame, and returned. Value: payload bytes, and 0.
+	TRACE_HANDLER_START,
+	TRACE_HANDLER_END,
+
+	// Bytes sent, by sendmsg, a write completion or splice; a partial write also records how much
+	// the kernel did not take because the send buffer was full. Value: bytes.
+	TRACE_WRITE,
+	TRACE_PARTIAL_WRITE,
+
+	// The connection was closed. Value: 0.
+	TRACE_CLOSE,
+
+	// An iteration of the loop took longer than the dump threshold. Connection 0, value: microseconds.
+	TRACE_SLOW_ITERATION
+};
+
+// One event, 16 bytes: four per cache line.
+struct TraceEvent
+{
+	// Time stamp counter (nanoseconds on CPUs without one).
+	uint64_t ticks;
+
+	// Per-loop connection ID (Connection::id), 0 for events of the loop itself.
+	uint32_t connection;
+
+	// Event type in the top 8 bits, value in the low 24.
+	uint32_t info;
+};
+
+// Header of a trace file, followed by count events, oldest first. Two readings of the time stamp counter
+// and the monotonic clock, taken when the ring was created and when it was dumped, map the ticks of the
+// events to CLOCK_MONOTONIC, so the dumps of different loops line up on one time axis.
+struct TraceFileHeader
+{
+	char magic[8];
+	uint32_t pid;
+	uint32_t loop;
+	uint64_t count;
+
+	// Events recorded over the ring's lifetime; those before the last count were overwritten.
+	uint64_t recorded;
+
+	uint64_t startTicks;
+	uint64_t startNs;
+	uint64_t dumpTicks;
+	uint64_t dumpNs;
+};
+
+// Current value of the clock events are stamped with.
+static inline uint64_t TraceClock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return MetricsClock();
+#endif
+}
+
+// The ring of one loop. Written and dumped only by the loop's thread.
+class TraceRing
+{
+public:
+	TraceRing();
+	~TraceRing();
+
+	// Keep the last events events (rounded up to a power of two) of loop number loop, and write dumps
+	// to files in directory, which must outlive the ring. Returns false after printing the reason on failure.
+	bool Init(size_t events, unsigned loop, const char *directory);
+
+	void Record(TraceEventType type, uint32_t connection, uint64_t value)
+	{
+		TraceEvent &event = events[head & mask];
+
+		event.ticks = TraceClock();
+		event.connection = connection;
+		event.info = ((uint32_t)type << 24) | (value < TRACE_VALUE_MAX ? (uint32_t)value : TRACE_VALUE_MAX);
+
+		head++;
+	}
+
+	// Write the events in the ring to a new file, named after the process, the loop and a sequence number.
+	// Returns false after printing the reason on failure.
+	bool Dump(void);
+
+private:
+	TraceEvent *events;
+	uint64_t mask;
+
+	// Events recorded so far; the next one goes to events[head & mask].
+	uint64_t head;
+
+	unsigned loop;
+	const char *directory;
+	unsigned dumps;
+
+	uint64_t startTicks;
+	uint64_t startNs;
+};
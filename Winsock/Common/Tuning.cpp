@@ -0,0 +1,272 @@
+#include "Tuning.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void DefaultTuning(SocketTuning &tuning)
+{
+	tuning.backlog = SOMAXCONN;
+	tuning.receiveBuffer = 0;
+	tuning.sendBuffer = 0;
+	tuning.noDelay = true;
+	tuning.quickAck = false;
+	tuning.deferAccept = 0;
+	tuning.busyPoll = 0;
+	tuning.minRead = 2 * 1024;
+	tuning.maxRead = 256 * 1024;
+}
+
+bool ApplyTuningProfile(const char *name, SocketTuning &tuning)
+{
+	if (strcmp(name, "latency") == 0)
+	{
+		// Small messages: nothing waits for a timer (Nagle, delayed ACK), receives spin briefly
+		// instead of sleeping, and reads stay small so every buffer touched is cache hot.
+		tuning.noDelay = true;
+		tuning.quickAck = true;
+		tuning.busyPoll = 50;
+		tuning.deferAccept = 0;
+		tuning.minRead = 512;
+		tuning.maxRead = 16 * 1024;
+		return true;
+	}
+
+	if (strcmp(name, "throughput") == 0)
+	{
+		// Bulk transfer: windows large enough to keep a fast link busy, few large reads,
+		// and no accept until the client has actually sent something.
+		tuning.noDelay = true;
+		tuning.quickAck = false;
+		tuning.busyPoll = 0;
+		tuning.deferAccept = 1;
+		tuning.receiveBuffer = 4 * 1024 * 1024;
+		tuning.sendBuffer = 4 * 1024 * 1024;
+		tuning.minRead = 16 * 1024;
+		tuning.maxRead = 1024 * 1024;
+		return true;
+	}
+
+	return false;
+}
+
+// Parse a number with an optional K or M suffix, no smaller than min.
+static bool ParseSize(const char *value, size_t min, size_t &result)
+{
+	char *end;
+	unsigned long long number = strtoull(value, &end, 10);
+
+	if (end == value || value[0] == '-')
+		return false;
+
+	if (*end == 'K' || *end == 'k')
+	{
+		number *= 1024;
+		end++;
+	}
+	else if (*end == 'M' || *end == 'm')
+	{
+		number *= 1024 * 1024;
+		end++;
+	}
+
+	if (*end != '\0' || number < min || number > 0x7fffffff)
+		return false;
+
+	result = (size_t)number;
+
+	return true;
+}
+
+static bool ParseInt(const char *value, int min, int &result)
+{
+	size_t number;
+
+	if (!ParseSize(value, (size_t)min, number))
+		return false;
+
+	result = (int)number;
+
+	return true;
+}
+
+static bool ParseSwitch(const char *value, bool &result)
+{
+	if (strcmp(value, "1") == 0 || strcmp(value, "on") == 0 || strcmp(value, "true") == 0)
+		result = true;
+	else if (strcmp(value, "0") == 0 || strcmp(value, "off") == 0 || strcmp(value, "false") == 0)
+		result = false;
+	else
+		return false;
+
+	return true;
+}
+
+bool SetTuningOption(const char *name, const char *value, SocketTuning &tuning)
+{
+	bool valid;
+
+	if (strcmp(name, "profile") == 0)
+		valid = ApplyTuningProfile(value, tuning);
+	else if (strcmp(name, "backlog") == 0)
+		valid = ParseInt(value, 1, tuning.backlog);
+	else if (strcmp(name, "rcvbuf") == 0)
+		valid = ParseInt(value, 0, tuning.receiveBuffer);
+	else if (strcmp(name, "sndbuf") == 0)
+		valid = ParseInt(value, 0, tuning.sendBuffer);
+	else if (strcmp(name, "nodelay") == 0)
+		valid = ParseSwitch(value, tuning.noDelay);
+	else if (strcmp(name, "quickack") == 0)
+		valid = ParseSwitch(value, tuning.quickAck);
+	else if (strcmp(name, "defer-accept") == 0)
+		valid = ParseInt(value, 0, tuning.deferAccept);
+	else if (strcmp(name, "busy-poll") == 0)
+		valid = ParseInt(value, 0, tuning.busyPoll);
+	else if (strcmp(name, "min-read") == 0)
+		valid = ParseSize(value, 1, tuning.minRead);
+	else if (strcmp(name, "max-read") == 0)
+		valid = ParseSize(value, 1, tuning.maxRead);
+	else
+		return false;
+
+	if (!valid)
+	{
+		printf("Invalid value for %s: %s\n", name, value);
+		return false;
+	}
+
+	return true;
+}
+
+bool LoadTuningFile(const char *path, SocketTuning &tuning)
+{
+	FILE *file = fopen(path, "r");
+
+	if (file == NULL)
+	{
+		printf("Cannot open tuning file %s\n", path);
+		return false;
+	}
+
+	char line[256];
+	int lineNumber = 0;
+	bool ok = true;
+
+	while (ok && fgets(line, sizeof(line), file) != NULL)
+	{
+		lineNumber++;
+
+		// Strip the comment, then split "name = value" and trim both sides.
+		char *hash = strchr(line, '#');
+
+		if (hash != NULL)
+			*hash = '\0';
+
+		char name[64], value[64];
+		char tail;
+		int fields = sscanf(line, " %63[^= \t\r\n] = %63s %c", name, value, &tail);
+
+		// Blank and comment-only lines.
+		if (fields == EOF)
+			continue;
+
+		if (fields != 2)
+		{
+			printf("%s:%d: expected \"name = value\"\n", path, lineNumber);
+			ok = false;
+		}
+		else if (!SetTuningOption(name, value, tuning))
+		{
+			printf("%s:%d: unknown or invalid setting %s\n", path, lineNumber, name);
+			ok = false;
+		}
+	}
+
+	fclose(file);
+
+	return ok;
+}
+
+void PrintTuning(const SocketTuning &tuning)
+{
+	printf("backlog = %d\n", tuning.backlog);
+	printf("rcvbuf = %d\n", tuning.receiveBuffer);
+	printf("sndbuf = %d\n", tuning.sendBuffer);
+	printf("nodelay = %d\n", tuning.noDelay ? 1 : 0);
+	printf("quickack = %d\n", tuning.quickAck ? 1 : 0);
+	printf("defer-accept = %d\n", tuning.deferAccept);
+	printf("busy-poll = %d\n", tuning.busyPoll);
+	printf("min-read = %zu\n", tuning.minRead);
+	printf("max-read = %zu\n", tuning.maxRead);
+}
+
+static bool SetIntOption(SOCKET s, int level, int option, int value, const char *name)
+{
+	if (setsockopt(s, level, option, (const char *)&value, sizeof(value)) == SOCKET_ERROR)
+	{
+		printf("setsockopt(%s) failed with error: %d\n", name, WSAGetLastError());
+		return false;
+	}
+
+	return true;
+}
+
+static bool SetBufferSizes(SOCKET s, const SocketTuning &tuning)
+{
+	if (tuning.receiveBuffer > 0 && !SetIntOption(s, SOL_SOCKET, SO_RCVBUF, tuning.receiveBuffer, "SO_RCVBUF"))
+		return false;
+
+	if (tuning.sendBuffer > 0 && !SetIntOption(s, SOL_SOCKET, SO_SNDBUF, tuning.sendBuffer, "SO_SNDBUF"))
+		return false;
+
+	return true;
+}
+
+bool TuneConnectSocket(SOCKET ConnectSocket, const SocketTuning &tuning)
+{
+	return SetBufferSizes(ConnectSocket, tuning);
+}
+
+bool TuneListenSocket(SOCKET ListenSocket, const SocketTuning &tuning)
+{
+	if (!SetBufferSizes(ListenSocket, tuning))
+		return false;
+
+#ifdef TCP_DEFER_ACCEPT
+	if (tuning.deferAccept > 0 && !SetIntOption(ListenSocket, IPPROTO_TCP, TCP_DEFER_ACCEPT, tuning.deferAccept, "TCP_DEFER_ACCEPT"))
+		return false;
+#endif
+
+	return true;
+}
+
+bool TuneDatagramSocket(SOCKET DatagramSocket, const SocketTuning &tuning)
+{
+	if (!SetBufferSizes(DatagramSocket, tuning))
+		return false;
+
+#ifdef SO_BUSY_POLL
+	if (tuning.busyPoll > 0)
+		SetIntOption(DatagramSocket, SOL_SOCKET, SO_BUSY_POLL, tuning.busyPoll, "SO_BUSY_POLL");
+#endif
+
+	return true;
+}
+
+void TuneConnection(SOCKET ClientSocket, const SocketTuning &tuning)
+{
+	if (tuning.noDelay)
+		SetIntOption(ClientSocket, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+
+#ifdef TCP_QUICKACK
+	// The kernel may fall back to delayed ACKs later; the epoll loop sets this again after every read.
+	if (tuning.quickAck)
+		SetIntOption(ClientSocket, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+#endif
+
+#ifdef SO_BUSY_POLL
+	// Values above net.core.busy_read need CAP_NET_ADMIN.
+	if (tuning.busyPoll > 0)
+		SetIntOption(ClientSocket, SOL_SOCKET, SO_BUSY_POLL, tuning.busyPoll, "SO_BUSY_POLL");
+#endif
+}
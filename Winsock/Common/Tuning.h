@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Platform.h"
+
+#include <stddef.h>
+
+// --- Socket Tuning Profile ---
+
+// Socket options and read sizes that trade latency against throughput. Small request/response
+// traffic wants acknowledgements and segments sent immediately and the CPU spinning on the NIC
+// instead of sleeping; bulk transfers want large kernel buffers (a TCP window wide enough for the
+// bandwidth-delay product) and large reads. A tuning starts from the defaults, can take a named
+// profile, and can then be adjusted setting by setting from a config file or the command line.
+struct SocketTuning
+{
+	// Length of the listen queue of pending connections.
+	int backlog;
+
+	// SO_RCVBUF and SO_SNDBUF in bytes. 0 keeps the kernel's automatic buffer sizing, which is
+	// switched off for a socket as soon as its size is set explicitly.
+	int receiveBuffer;
+	int sendBuffer;
+
+	// TCP_NODELAY: send small segments immediately instead of coalescing them (Nagle's algorithm).
+	bool noDelay;
+
+	// TCP_QUICKACK: acknowledge every segment immediately instead of delaying the ACK.
+	bool quickAck;
+
+	// TCP_DEFER_ACCEPT: seconds the kernel holds a new connection back until its first data arrives,
+	// so accept never returns a connection with nothing to read yet. 0 turns it off.
+	int deferAccept;
+
+	// SO_BUSY_POLL: microseconds a blocking receive spins on the device queue before sleeping. 0 turns it off.
+	int busyPoll;
+
+	// Bounds of the adaptive read size. Each connection starts in between, doubles its read size
+	// while reads fill the buffer completely and halves it while reads stay small.
+	size_t minRead;
+	size_t maxRead;
+};
+
+// Kernel defaults for buffers, Nagle off, a backlog of SOMAXCONN and reads between 2 KB and 256 KB.
+void DefaultTuning(SocketTuning &tuning);
+
+// Apply a named profile on top of the current settings: "latency" (small messages) or "throughput"
+// (bulk transfer). Returns false for an unknown name.
+bool ApplyTuningProfile(const char *name, SocketTuning &tuning);
+
+// Change one setting by name, with the same names in the config file and on the command line
+// ("--rcvbuf 4M" or "rcvbuf = 4M"). Sizes accept K and M suffixes, switches accept 0/1, on/off
+// and true/false, and "profile" applies a profile. Returns false for an unknown name, and
+// false after printing the reason for an invalid value.
+bool SetTuningOption(const char *name, const char *value, SocketTuning &tuning);
+
+// Read settings from a file of "name = value" lines; '#' starts a comment.
+// Returns false after printing the reason if the file cannot be read or has an invalid line.
+bool LoadTuningFile(const char *path, SocketTuning &tuning);
+
+// Print the settings in config file syntax.
+void PrintTuning(const SocketTuning &tuning);
+
+// Set the options of a listen socket. Must be called before listen: accepted connections inherit
+// the buffer sizes, and the receive buffer size decides the window scale offered in the handshake.
+// Returns false after printing the reason on failure.
+bool TuneListenSocket(SOCKET ListenSocket, const SocketTuning &tuning);
+
+// Set the buffer sizes of a client socket. Must be called before connect, for the same reason.
+// Returns false after printing the reason on failure.
+bool TuneConnectSocket(SOCKET ConnectSocket, const SocketTuning &tuning);
+
+// Set the options of a UDP socket: buffer sizes and SO_BUSY_POLL. 
+// Returns false after printing the reason on failure.
+bool TuneDatagramSocket(SOCKET DatagramSocket, const SocketTuning &tuning);
+
+// Set the per-connection options of an accepted or connected socket. Failures are printed and otherwise ignored:
+// a connection that misses an optimization still works.
+void TuneConnection(SOCKET ClientSocket, const SocketTuning &tuning);
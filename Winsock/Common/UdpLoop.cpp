@@ -0,0 +1,222 @@
+#include "UdpLoop.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef __linux__
+#error "UdpEchoLoop requires Linux recvmmsg/sendmmsg"
+#endif
+
+#include <netinet/udp.h>
+#include <sys/uio.h>
+
+// Older headers lack the GRO/GSO socket options.
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// Room for the GRO control message of one received datagram.
+#define UDP_GRO_SPACE CMSG_SPACE(sizeof(int))
+
+bool EnableUdpGro(SOCKET s)
+{
+	int on = 1;
+
+	if (setsockopt(s, IPPROTO_UDP, UDP_GRO, &on, sizeof(on)) == SOCKET_ERROR)
+	{
+		printf("setsockopt(UDP_GRO) failed with error: %d\n", WSAGetLastError());
+		return false;
+	}
+
+	return true;
+}
+
+int UdpGroSegmentSize(const struct msghdr *msg)
+{
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR((struct msghdr *)msg, cmsg))
+	{
+		if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO)
+		{
+			int segmentSize;
+			memcpy(&segmentSize, CMSG_DATA(cmsg), sizeof(segmentSize));
+			return segmentSize;
+		}
+	}
+
+	return 0;
+}
+
+void SetUdpSegment(struct msghdr *msg, char *control, uint16_t segmentSize)
+{
+	msg->msg_control = control;
+	msg->msg_controllen = UDP_SEGMENT_SPACE;
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+	cmsg->cmsg_level = IPPROTO_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+}
+
+UdpEchoLoop::UdpEchoLoop()
+	: udpSocket(INVALID_SOCKET), gro(false), bufferSize(0), buffers(NULL), running(false)
+{
+}
+
+UdpEchoLoop::~UdpEchoLoop()
+{
+	if (udpSocket != INVALID_SOCKET)
+		closesocket(udpSocket);
+
+	free(buffers);
+}
+
+bool UdpEchoLoop::Init(SOCKET s, bool enableGro)
+{
+	udpSocket = s;
+	gro = enableGro && EnableUdpGro(s);
+
+	if (enableGro && !gro)
+		return false;
+
+	bufferSize = gro ? UDP_GRO_BUFFER : UDP_DATAGRAM_BUFFER;
+	buffers = (char *)malloc(bufferSize * UDP_BATCH);
+
+	if (buffers == NULL)
+	{
+		printf("Out of memory for datagram buffers\n");
+		return false;
+	}
+
+	return true;
+}
+
+void UdpEchoLoop::Stop(void)
+{
+	running = false;
+
+	// Wakes a recvmmsg blocked on the socket. On an unconnected UDP socket shutdown reports
+	// ENOTCONN, but still marks the socket shut down and wakes its readers.
+	shutdown(udpSocket, SD_BOTH);
+}
+
+int UdpEchoLoop::Run(void)
+{
+	struct mmsghdr in[UDP_BATCH];
+	struct mmsghdr out[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	struct sockaddr_storage peers[UDP_BATCH];
+	char groControl[UDP_BATCH][UDP_GRO_SPACE];
+	char segmentControl[UDP_BATCH][UDP_SEGMENT_SPACE];
+
+	running = true;
+
+	while (running)
+	{
+		// The receive descriptors are reset every time: recvmmsg overwrites the name and control lengths.
+		for (int i = 0; i < UDP_BATCH; i++)
+		{
+			iov[i].iov_base = buffers + (size_t)i * bufferSize;
+			iov[i].iov_len = bufferSize;
+
+			ZeroMemory(&in[i].msg_hdr, sizeof(in[i].msg_hdr));
+			in[i].msg_hdr.msg_name = &peers[i];
+			in[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+			in[i].msg_hdr.msg_iov = &iov[i];
+			in[i].msg_hdr.msg_iovlen = 1;
+
+			if (gro)
+			{
+				in[i].msg_hdr.msg_control = groControl[i];
+				in[i].msg_hdr.msg_controllen = sizeof(groControl[i]);
+			}
+		}
+
+		// --- Receiving a Batch ---
+
+		// MSG_WAITFORONE: sleep until the first datagram arrives, then take whatever else
+		// is already queued without waiting for the batch to fill up.
+		int n = recvmmsg(udpSocket, in, UDP_BATCH, MSG_WAITFORONE, NULL);
+
+		if (!running)
+			break;
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			printf("recvmmsg failed with error: %d\n", errno);
+			return 1;
+		}
+
+		uint64_t iterationStart = MetricsClock();
+		uint64_t received = 0, datagrams = 0;
+
+		// --- Echoing the Batch ---
+
+		for (int i = 0; i < n; i++)
+		{
+			size_t length = in[i].msg_len;
+
+			received += length;
+			iov[i].iov_len = length;
+
+			ZeroMemory(&out[i].msg_hdr, sizeof(out[i].msg_hdr));
+			out[i].msg_hdr.msg_name = &peers[i];
+			out[i].msg_hdr.msg_namelen = in[i].msg_hdr.msg_namelen;
+			out[i].msg_hdr.msg_iov = &iov[i];
+			out[i].msg_hdr.msg_iovlen = 1;
+
+			// A coalesced train goes back as one GSO send that the kernel splits into the original datagrams.
+			int segmentSize = gro ? UdpGroSegmentSize(&in[i].msg_hdr) : 0;
+
+			if (segmentSize > 0 && (size_t)segmentSize < length)
+			{
+				SetUdpSegment(&out[i].msg_hdr, segmentControl[i], (uint16_t)segmentSize);
+				datagrams += (length + (size_t)segmentSize - 1) / (size_t)segmentSize;
+			}
+			else
+			{
+				datagrams++;
+			}
+		}
+
+		CounterAdd(metrics.bytesIn, received);
+		CounterAdd(metrics.frames, datagrams);
+
+		int sent = 0;
+
+		while (sent < n)
+		{
+			int iResult = sendmmsg(udpSocket, out + sent, (unsigned)(n - sent), 0);
+
+			if (iResult > 0)
+			{
+				for (int i = sent; i < sent + iResult; i++)
+					CounterAdd(metrics.bytesOut, out[i].msg_len);
+
+				sent += iResult;
+				continue;
+			}
+
+			if (iResult < 0 && errno == EINTR)
+				continue;
+
+			// sendmmsg reports an error only for the first message of the call; skip that echo
+			// (for example a client that has gone away) and send the rest.
+			if (iResult < 0 && errno != ECONNREFUSED && errno != EPERM)
+				printf("sendmmsg failed with error: %d\n", errno);
+
+			sent++;
+		}
+
+		metrics.iterationTime.Record(MetricsClock() - iterationStart);
+	}
+
+	return 0;
+}
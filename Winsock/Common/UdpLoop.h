@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Platform.h"
+#include "Metrics.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Datagrams received or sent per recvmmsg/sendmmsg call.
+#define UDP_BATCH 64
+
+// Receive buffer per datagram: room for the largest datagram on an Ethernet path, or with GRO
+// for a whole coalesced train of datagrams (at most 64 KB, the largest UDP packet).
+#define UDP_DATAGRAM_BUFFER 2048
+#define UDP_GRO_BUFFER (64 * 1024)
+
+// Largest payload of a single UDP datagram over IPv4.
+#define UDP_MAX_PAYLOAD 65507
+
+// Largest number of segments the kernel accepts in one UDP_SEGMENT send.
+#define UDP_MAX_SEGMENTS 64
+
+// --- Datagram Echo Loop ---
+
+// Echoes every datagram back to its sender, UDP_BATCH at a time: one recvmmsg fetches a batch of
+// datagrams from any number of clients and one sendmmsg returns all the echoes, so the per-datagram
+// cost is a fraction of a system call. There are no connections, so no accept, no per-client state
+// and no framing: a datagram is a message.
+//
+// With GRO enabled the kernel may coalesce consecutive datagrams of one sender into a single buffer
+// and reports the size of the original datagrams. The echo sends that buffer back in one piece with
+// UDP_SEGMENT (GSO) set to the same size, and the kernel cuts it into the original datagrams again,
+// so a train of small datagrams crosses the stack once in each direction.
+class UdpEchoLoop
+{
+public:
+	UdpEchoLoop();
+	~UdpEchoLoop();
+
+	// Take ownership of a bound, blocking UDP socket. Returns false after printing the reason on failure.
+	bool Init(SOCKET udpSocket, bool gro);
+
+	// Echo datagrams until Stop is called. Returns 0 on a clean stop, 1 on a fatal error.
+	int Run(void);
+
+	// Ask Run to return. Safe to call from any thread.
+	void Stop(void);
+
+	// Counters of this loop: bytesIn/bytesOut and frames (datagrams echoed). Only the loop's thread
+	// writes them; any thread may read them.
+	const LoopMetrics &Metrics(void) const { return metrics; }
+
+private:
+	SOCKET udpSocket;
+	bool gro;
+	size_t bufferSize;
+	char *buffers;
+	volatile bool running;
+
+	LoopMetrics metrics;
+};
+
+// Turn on UDP_GRO for a socket. Returns false after printing the reason when the kernel does not support it.
+bool EnableUdpGro(SOCKET s);
+
+// Segment size reported by GRO for a received message, or 0 if the datagram was not coalesced.
+int UdpGroSegmentSize(const struct msghdr *msg);
+
+// Add a UDP_SEGMENT control message to msg, which must have room for it in control (UDP_SEGMENT_SPACE bytes).
+void SetUdpSegment(struct msghdr *msg, char *control, uint16_t segmentSize);
+
+#define UDP_SEGMENT_SPACE CMSG_SPACE(sizeof(uint16_t))
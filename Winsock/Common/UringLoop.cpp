@@ -0,0 +1,874 @@
+#include "UringLoop.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef __linux__
+#error "UringLoop requires Linux io_uring"
+#endif
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+// The operation that produced a completion is encoded in the low bits of user_data.
+// Connection objects are at least 8-byte aligned; listen sockets are shifted past the tag.
+#define OP_ACCEPT 1u
+#define OP_RECV   2u
+#define OP_WRITE  3u
+#define OP_CANCEL 4u
+#define OP_WAKE   5u
+#define OP_ACCEPT_CANCEL 6u
+#define OP_TLS    7u
+#define OP_MASK   7u
+
+// Provided buffer group used for every multishot recv of the loop.
+#define BUFFER_GROUP 0
+
+static inline uint64_t MakeUserData(void *ptr, unsigned op) { return (uint64_t)(uintptr_t)ptr | op; }
+
+static inline int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, 
+	const void *arg = NULL, size_t argSize = 0)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+static inline int io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nrArgs)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+UringLoop::UringLoop()
+	: ringFd(-1), sqHead(NULL), sqTail(NULL), sqMask(0), sqArray(NULL), sqes(NULL), sqLocalTail(0), 
+	  cqHead(NULL), cqTail(NULL), cqMask(0), cqes(NULL), 
+	  sqRingPtr(MAP_FAILED), sqRingSize(0), cqRingPtr(MAP_FAILED), cqRingSize(0), sqesSize(0), 
+	  bufRing((io_uring_buf_ring *)MAP_FAILED), bufRingSize(0), buffers((char *)MAP_FAILED), bufTail(0), 
+	  currentBuffer(-1), currentBufferLent(false)
+{
+}
+
+UringLoop::~UringLoop()
+{
+	// Closing the ring fd cancels everything still in flight and drops the registrations.
+	if (ringFd != -1)
+		close(ringFd);
+
+	if (sqes != NULL)
+		munmap(sqes, sqesSize);
+
+	if (cqRingPtr != MAP_FAILED && cqRingPtr != sqRingPtr)
+		munmap(cqRingPtr, cqRingSize);
+
+	if (sqRingPtr != MAP_FAILED)
+		munmap(sqRingPtr, sqRingSize);
+
+	if ((void *)bufRing != MAP_FAILED)
+		munmap(bufRing, bufRingSize);
+
+	if ((void *)buffers != MAP_FAILED)
+		munmap(buffers, (size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+}
+
+bool UringLoop::Init(void)
+{
+	struct io_uring_params params;
+
+	if (!InitWake())
+		return false;
+
+	// --- Creating the Ring ---
+
+	// SINGLE_ISSUER and COOP_TASKRUN tell the kernel only this thread submits, so completions are 
+	// run when the thread enters the kernel anyway instead of through interrupting task work.
+	ZeroMemory(&params, sizeof(params));
+	params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+
+	ringFd = io_uring_setup(URING_ENTRIES, &params);
+
+	if (ringFd < 0 && errno == EINVAL)
+	{
+		// Older kernel: retry without the optional setup flags.
+		ZeroMemory(&params, sizeof(params));
+		ringFd = io_uring_setup(URING_ENTRIES, &params);
+	}
+
+	if (ringFd < 0)
+	{
+		printf("io_uring_setup failed with error: %d\n", errno);
+		return false;
+	}
+
+	// --- Mapping the Submission and Completion Queues ---
+
+	sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (cqRingSize > sqRingSize)
+			sqRingSize = cqRingSize;
+
+		cqRingSize = sqRingSize;
+	}
+
+	sqRingPtr = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+
+	if (sqRingPtr == MAP_FAILED)
+	{
+		printf("mmap(SQ ring) failed with error: %d\n", errno);
+		return false;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		cqRingPtr = sqRingPtr;
+	else
+		cqRingPtr = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+
+	if (cqRingPtr == MAP_FAILED)
+	{
+		printf("mmap(CQ ring) failed with error: %d\n", errno);
+		return false;
+	}
+
+	sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = (io_uring_sqe *)mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+
+	if ((void *)sqes == MAP_FAILED)
+	{
+		sqes = NULL;
+		printf("mmap(SQEs) failed with error: %d\n", errno);
+		return false;
+	}
+
+	char *sq = (char *)sqRingPtr;
+	sqHead = (unsigned *)(sq + params.sq_off.head);
+	sqTail = (unsigned *)(sq + params.sq_off.tail);
+	sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+	sqArray = (unsigned *)(sq + params.sq_off.array);
+	sqLocalTail = *sqTail;
+
+	// SQ slot i always refers to SQE i, so the indirection array is filled once.
+	for (unsigned i = 0; i < params.sq_entries; i++)
+		sqArray[i] = i;
+
+	char *cq = (char *)cqRingPtr;
+	cqHead = (unsigned *)(cq + params.cq_off.head);
+	cqTail = (unsigned *)(cq + params.cq_off.tail);
+	cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+	cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	// --- Registering the Receive Buffers ---
+
+	// One contiguous region holds every receive buffer. It is registered twice:
+	// - as fixed buffer 0, so writes out of it skip the per-request page pinning;
+	// - through a provided buffer ring, from which multishot recv picks a buffer only when data arrives.
+	size_t regionSize = (size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE;
+
+	buffers = (char *)mmap(NULL, regionSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+
+	if ((void *)buffers == MAP_FAILED)
+	{
+		printf("mmap(buffers) failed with error: %d\n", errno);
+		return false;
+	}
+
+	struct iovec region;
+	region.iov_base = buffers;
+	region.iov_len = regionSize;
+
+	if (io_uring_register(ringFd, IORING_REGISTER_BUFFERS, &region, 1) < 0)
+	{
+		printf("io_uring_register(BUFFERS) failed with error: %d\n", errno);
+		return false;
+	}
+
+	bufRingSize = URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+	bufRing = (io_uring_buf_ring *)mmap(NULL, bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+
+	if ((void *)bufRing == MAP_FAILED)
+	{
+		printf("mmap(buffer ring) failed with error: %d\n", errno);
+		return false;
+	}
+
+	struct io_uring_buf_reg reg;
+	ZeroMemory(&reg, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)bufRing;
+	reg.ring_entries = URING_BUFFER_COUNT;
+	reg.bgid = BUFFER_GROUP;
+
+	if (io_uring_register(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	{
+		printf("io_uring_register(PBUF_RING) failed with error: %d\n", errno);
+		return false;
+	}
+
+	for (int bid = 0; bid < URING_BUFFER_COUNT; bid++)
+		RecycleBuffer(bid);
+
+	return true;
+}
+
+io_uring_sqe *UringLoop::GetSqe(void)
+{
+	// When every slot holds an unsubmitted entry, hand the batch to the kernel to make room.
+	while (sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) > sqMask)
+	{
+		if (Submit(0, -1) < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+		{
+			printf("io_uring_enter failed with error: %d\n", errno);
+			abort();
+		}
+	}
+
+	io_uring_sqe *sqe = &sqes[sqLocalTail & sqMask];
+	ZeroMemory(sqe, sizeof(*sqe));
+	sqLocalTail++;
+
+	return sqe;
+}
+
+int UringLoop::Submit(unsigned waitFor, int timeoutMs)
+{
+	__atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+
+	unsigned toSubmit = sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+
+	if (waitFor == 0 || timeoutMs < 0)
+		return io_uring_enter(ringFd, toSubmit, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0);
+
+	// The wait is bounded through the extended argument rather than a timeout request on the ring, 
+	// so waking up for the next timer costs no submission entry and no completion. 
+	// Without a completion in time the call fails with ETIME.
+	struct __kernel_timespec ts;
+	ts.tv_sec = timeoutMs / 1000;
+	ts.tv_nsec = (long long)(timeoutMs % 1000) * 1000000;
+
+	struct io_uring_getevents_arg arg;
+	ZeroMemory(&arg, sizeof(arg));
+	arg.ts = (uint64_t)(uintptr_t)&ts;
+
+	return io_uring_enter(ringFd, toSubmit, waitFor, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+void UringLoop::ReturnHeldBuffer(UringConnection *conn)
+{
+	if (conn->heldBuffer < 0)
+		return;
+
+	RecycleBuffer(conn->heldBuffer);
+	conn->heldBuffer = -1;
+	conn->heldData = NULL;
+	conn->heldLength = 0;
+}
+
+void UringLoop::RecycleBuffer(int bid)
+{
+	// Publish the buffer at the ring tail; the kernel consumes buffers from the head.
+	// The entries are indexed from the start of the ring rather than through bufRing->bufs: 
+	// in C++ the header's flexible-array wrapper places bufs 8 bytes past the ring base.
+	struct io_uring_buf *buf = (struct io_uring_buf *)bufRing + (bufTail & (URING_BUFFER_COUNT - 1));
+	buf->addr = (uint64_t)(uintptr_t)(buffers + (size_t)bid * URING_BUFFER_SIZE);
+	buf->len = URING_BUFFER_SIZE;
+	buf->bid = (uint16_t)bid;
+
+	bufTail++;
+	__atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+}
+
+bool UringLoop::AddListener(SOCKET listenSocket)
+{
+	// The accept is armed when Run starts, once the connection limit is known.
+	listeners.push_back(listenSocket);
+	acceptArmed.push_back(false);
+
+	return true;
+}
+
+void UringLoop::ArmAccept(size_t listener)
+{
+	// A multishot accept stays armed and posts one completion per accepted connection. With a connection 
+	// limit every accept is armed singly instead: a multishot accept would take a whole burst of waiting 
+	// connections before a cancel could stop it, while a single one is re-armed only below the limit.
+	io_uring_sqe *sqe = GetSqe();
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = listeners[listener];
+	sqe->ioprio = maxConnections == 0 ? IORING_ACCEPT_MULTISHOT : 0;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = ((uint64_t)listeners[listener] << 3) | OP_ACCEPT;
+
+	acceptArmed[listener] = true;
+}
+
+void UringLoop::SetAccepting(bool accept)
+{
+	for (size_t i = 0; i < listeners.size(); i++)
+	{
+		if (accept && !acceptArmed[i])
+		{
+			ArmAccept(i);
+		}
+		else if (!accept && acceptArmed[i])
+		{
+			// Cancelling ends the accept with a last completion, after which it is re-armed only if 
+			// accepting has resumed by then.
+			io_uring_sqe *sqe = GetSqe();
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = ((uint64_t)listeners[i] << 3) | OP_ACCEPT;
+			sqe->user_data = OP_ACCEPT_CANCEL;
+		}
+	}
+}
+
+bool UringLoop::Quiescent(const Connection &base) const
+{
+	const UringConnection &conn = static_cast<const UringConnection &>(base);
+
+	return IoLoop::Quiescent(conn) && !conn.writing && conn.heldLength == 0;
+}
+
+void UringLoop::ArmRecv(UringConnection *conn)
+{
+	// A multishot recv with buffer selection: the kernel picks a buffer from the provided ring 
+	// for every chunk it receives and keeps the request armed until an error or end of stream.
+	io_uring_sqe *sqe = GetSqe();
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = conn->socket;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = BUFFER_GROUP;
+	sqe->user_data = MakeUserData(conn, OP_RECV);
+
+	conn->receiving = true;
+	conn->readPaused = false;
+	conn->inFlight++;
+}
+
+void UringLoop::StartWrite(UringConnection *conn)
+{
+	io_uring_sqe *sqe = GetSqe();
+
+	if (conn->heldBuffer >= 0)
+	{
+		// Zero-copy echo: write straight out of the registered receive buffer.
+		sqe->opcode = IORING_OP_WRITE_FIXED;
+		sqe->addr = (uint64_t)(uintptr_t)conn->heldData;
+		sqe->len = (uint32_t)conn->heldLength;
+		sqe->buf_index = 0;
+	}
+	else
+	{
+		// Gather the queued buffers into one sendmsg.
+		size_t bytes;
+
+		ZeroMemory(&conn->msg, sizeof(conn->msg));
+		conn->msg.msg_iov = conn->iov;
+		conn->msg.msg_iovlen = conn->output.Gather(conn->iov, MAX_SEND_IOVECS, &bytes);
+
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->addr = (uint64_t)(uintptr_t)&conn->msg;
+		sqe->len = 1;
+		sqe->msg_flags = MSG_NOSIGNAL;
+
+		conn->inflightLength = bytes;
+	}
+
+	sqe->fd = conn->socket;
+	sqe->user_data = MakeUserData(conn, OP_WRITE);
+
+	conn->writing = true;
+	conn->inFlight++;
+}
+
+bool UringLoop::Send(Connection &base, const char *data, size_t len)
+{
+	UringConnection *conn = static_cast<UringConnection *>(&base);
+
+	if (conn->closing)
+		return false;
+
+	const char *current = buffers + (size_t)currentBuffer * URING_BUFFER_SIZE;
+
+	bool inCurrent = currentBuffer >= 0 && data >= current && data + len <= current + URING_BUFFER_SIZE;
+
+	if (inCurrent && !conn->writing && conn->Unsent() == 0 && !currentBufferLent)
+	{
+		// The reply lies inside the buffer just received: lend the buffer to the write 
+		// instead of copying, and return it to the ring when the write completes.
+		currentBufferLent = true;
+		conn->heldBuffer = currentBuffer;
+		conn->heldData = data;
+		conn->heldLength = len;
+	}
+	else if (inCurrent && !conn->writing && conn->heldBuffer == currentBuffer && 
+		conn->output.Empty() && data == conn->heldData + conn->heldLength)
+	{
+		// The next pipelined reply directly follows the previous one in the same buffer: 
+		// grow the lent region, so a whole batch of echoed frames leaves in one fixed write. 
+		// The buffer is still the one lent above, so however the region ends (written, failed, 
+		// or dropped with the connection) ReturnHeldBuffer gives it back once.
+		conn->heldLength += len;
+	}
+	else
+	{
+		if (!conn->output.Append(bufferPool, data, len))
+		{
+			printf("Out of memory for output queue\n");
+			Close(conn);
+			return false;
+		}
+	}
+
+	// The write itself is issued once per iteration from FlushDirty, after every 
+	// reply produced by this batch of completions has been queued.
+	if (!conn->dirty)
+	{
+		conn->dirty = true;
+		dirty.push_back(conn);
+	}
+
+	// Backpressure: stop receiving while the peer is not reading its replies. A shared-memory connection 
+	// stops reading its ring instead, and keeps receiving the doorbell that says the client made room.
+	if (conn->Unsent() >= MAX_PENDING_OUTPUT && conn->receiving && !conn->readPaused && !SharedMemory(*conn))
+	{
+		io_uring_sqe *sqe = GetSqe();
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = MakeUserData(conn, OP_RECV);
+		sqe->user_data = MakeUserData(conn, OP_CANCEL);
+
+		conn->readPaused = true;
+		conn->inFlight++;
+	}
+
+	return true;
+}
+
+void UringLoop::CloseConnection(Connection &conn)
+{
+	Close(static_cast<UringConnection *>(&conn));
+}
+
+void UringLoop::FlushDirty(void)
+{
+	// One write per connection for everything queued during this iteration. A connection that 
+	// already has a write in flight continues from OnWrite when that write completes.
+	for (size_t i = 0; i < dirty.size(); i++)
+	{
+		UringConnection *conn = dirty[i];
+		conn->dirty = false;
+
+		if (conn->closing)
+			continue;
+
+		if (SharedMemory(*conn))
+			FlushShm(*conn);
+		else if (!conn->writing && conn->Unsent() > 0)
+			StartWrite(conn);
+	}
+
+	dirty.clear();
+}
+
+void UringLoop::ArmWakeRead(void)
+{
+	// The read consumes the eventfd counter, so the next reply posted (or drain request) signals it again.
+	io_uring_sqe *sqe = GetSqe();
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = wakeFd;
+	sqe->addr = (uint64_t)(uintptr_t)&wakeCount;
+	sqe->len = sizeof(wakeCount);
+	sqe->off = (uint64_t)-1;
+	sqe->user_data = OP_WAKE;
+}
+
+void UringLoop::ArmHandshakePoll(void)
+{
+	// The handshaker's epoll instance is readable while a socket in its TLS handshake has progress to make.
+	io_uring_sqe *sqe = GetSqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = tls->Fd();
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = OP_TLS;
+}
+
+int UringLoop::Run(void)
+{
+	// Replies from the work pool and drain requests complete a read on the eventfd like any other operation.
+	ArmWakeRead();
+
+	if (tls != NULL)
+		ArmHandshakePoll();
+
+	SetAccepting(accepting);
+
+	running = true;
+
+	while (running)
+	{
+		// One system call submits everything queued during the previous iteration 
+		// and waits for at least one completion, or until the next timer is due.
+		if (Submit(1, WaitTimeoutMs()) < 0 && errno != ETIME)
+		{
+			if (errno == EINTR || errno == EBUSY || errno == EAGAIN)
+				continue;
+
+			printf("io_uring_enter failed with error: %d\n", errno);
+			return 1;
+		}
+
+		// Time the work of this iteration, from the return of io_uring_enter to the end of the cleanup.
+		uint64_t iterationStart = MetricsClock();
+		now = iterationStart;
+
+		unsigned head = *cqHead;
+
+		while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+		{
+			io_uring_cqe cqe = cqes[head & cqMask];
+
+			// Release the slot before dispatching, so handlers that submit work never see a full CQ.
+			head++;
+			__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+			unsigned op = (unsigned)(cqe.user_data & OP_MASK);
+
+			if (op == OP_ACCEPT)
+			{
+				OnAccept(&cqe, (SOCKET)(cqe.user_data >> 3));
+				continue;
+			}
+
+			if (op == OP_WAKE)
+			{
+				OnWake();
+
+				if (running)
+					ArmWakeRead();
+				continue;
+			}
+
+			if (op == OP_ACCEPT_CANCEL)
+				continue;
+
+			if (op == OP_TLS)
+			{
+				OnHandshakes();
+
+				if (running)
+					ArmHandshakePoll();
+				continue;
+			}
+
+			UringConnection *conn = (UringConnection *)(uintptr_t)(cqe.user_data & ~(uint64_t)OP_MASK);
+
+			if (op == OP_RECV)
+				OnRecv(&cqe, conn);
+			else if (op == OP_WRITE)
+				OnWrite(&cqe, conn);
+			else if (--conn->inFlight == 0 && conn->closing)
+				Release(conn);
+		}
+
+		// Shared-memory connections that still had requests in their ring when they used up their budget.
+		ResumeShm();
+
+		FlushDirty();
+
+		// Timeouts, the drain and the connection limit. Connections it closes are skipped below.
+		Housekeeping();
+
+		// Re-arm connections whose recv ran out of provided buffers; buffers recycled 
+		// during this iteration make room for them again.
+		if (!starved.empty())
+		{
+			std::vector<UringConnection *> retry;
+			retry.swap(starved);
+
+			for (size_t i = 0; i < retry.size(); i++)
+			{
+				if (!retry[i]->closing && !retry[i]->receiving && !retry[i]->readPaused)
+					ArmRecv(retry[i]);
+			}
+		}
+
+		// Connections released during this iteration are freed only now, after nothing 
+		// in the batch or in the starved list can refer to them any more.
+		for (size_t i = 0; i < released.size(); i++)
+		{
+			// A buffer lent to a reply that was never written, or only partly, goes back to the ring: 
+			// nothing else returns it once the connection is closing.
+			ReturnHeldBuffer(released[i]);
+
+			closesocket(released[i]->socket);
+			released[i]->decoder.Clear(&bufferPool);
+			released[i]->output.Clear(bufferPool);
+			ReleaseLocal(*released[i]);
+			connections.Release(released[i]);
+		}
+
+		released.clear();
+
+		EndIteration(iterationStart);
+
+		// Closed connections are gone once their last operation has completed.
+		if (Drained() && connections.Live() == 0)
+			break;
+	}
+
+	return 0;
+}
+
+void UringLoop::OnAccept(io_uring_cqe *cqe, SOCKET listenSocket)
+{
+	if (cqe->res >= 0)
+	{
+		Accepted(cqe->res, listenSocket);
+	}
+	else if (accepting && cqe->res != -EINTR && cqe->res != -ECONNABORTED && cqe->res != -EAGAIN)
+	{
+		printf("accept failed with error: %d\n", -cqe->res);
+		AcceptFailed(-cqe->res);
+	}
+
+	// The kernel ends a multishot request on some errors, and on a cancel when accepting paused; 
+	// a single accept ends with every completion. Re-arm it to keep accepting unless accepting is 
+	// paused. A connection that reaches the limit pauses it right here, so the listener stays 
+	// disarmed until Housekeeping sees a connection close; so does an accept that failed for lack 
+	// of descriptors, until Housekeeping ends the pause.
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+	{
+		for (size_t i = 0; i < listeners.size(); i++)
+		{
+			if (listeners[i] != listenSocket)
+				continue;
+
+			acceptArmed[i] = false;
+
+			if (running && accepting && AcceptBlocked())
+			{
+				accepting = false;
+				CounterAdd(metrics.acceptPauses, 1);
+			}
+
+			if (running && accepting)
+				ArmAccept(i);
+		}
+	}
+}
+
+Connection *UringLoop::AddConnection(SOCKET s, bool local)
+{
+	UringConnection *conn = connections.Acquire();
+
+	if (conn == NULL)
+	{
+		printf("Out of memory for connection state\n");
+		closesocket(s);
+		return NULL;
+	}
+
+	conn->socket = s;
+	conn->readPaused = false;
+	conn->inFlight = 0;
+	conn->receiving = false;
+	conn->writing = false;
+	conn->closing = false;
+	conn->peerClosed = false;
+	conn->releasing = false;
+	conn->heldBuffer = -1;
+	conn->heldData = NULL;
+	conn->heldLength = 0;
+	conn->inflightLength = 0;
+	conn->dirty = false;
+	conn->workHead = NULL;
+	conn->workTail = NULL;
+	conn->local = NULL;
+
+	// The kernel picks receive buffers from the provided ring, so only the socket options 
+	// of the tuning apply here, not the adaptive read size.
+	if (!local)
+		TuneConnection(conn->socket, tuning);
+
+	ArmRecv(conn);
+	connectionCount++;
+	TrackConnection(*conn);
+	CounterAdd(metrics.accepts, 1);
+	LOG_DEBUG("Connection accepted: socket %d\n", (int)s);
+
+	return conn;
+}
+
+void UringLoop::OnRecv(io_uring_cqe *cqe, UringConnection *conn)
+{
+	bool more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+
+	if (!more)
+	{
+		conn->receiving = false;
+		conn->inFlight--;
+	}
+
+	if (cqe->res > 0)
+	{
+		int bid = (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+		CounterAdd(metrics.bytesIn, (uint64_t)cqe->res);
+		LOG_DEBUG("Bytes received: %d\n", cqe->res);
+		Trace(TRACE_READ, *conn, (uint64_t)cqe->res);
+
+		if (!conn->closing)
+		{
+			currentBuffer = bid;
+			currentBufferLent = false;
+
+			Received(*conn, buffers + (size_t)bid * URING_BUFFER_SIZE, (size_t)cqe->res);
+
+			currentBuffer = -1;
+
+			if (!conn->closing)
+				NoteReceived(*conn);
+		}
+
+		if (!currentBufferLent)
+			RecycleBuffer(bid);
+
+		currentBufferLent = false;
+	}
+	else if (cqe->res == 0)
+	{
+		// Orderly shutdown from the peer. A client that shuts down its side right after its last 
+		// request still waits for the replies, so those queued, being written or still with the work pool
+		// are sent first.
+		if ((conn->Unsent() > 0 || conn->writing || conn->workHead != NULL) && !SharedMemory(*conn))
+			conn->peerClosed = true;
+		else
+			Close(conn);
+	}
+	else if (cqe->res == -ENOBUFS)
+	{
+		// Every provided buffer is in use; retry once some have been recycled. A closing connection is 
+		// not retried, but this may have been its last operation, so it still goes on to be released.
+		if (!conn->closing)
+			starved.push_back(conn);
+	}
+	else if (cqe->res != -ECANCELED)
+	{
+		Close(conn);
+	}
+
+	if (conn->closing)
+	{
+		if (conn->inFlight == 0)
+			Release(conn);
+	}
+	else if (!more && cqe->res != -ENOBUFS && !conn->peerClosed && (conn->Unsent() < MAX_PENDING_OUTPUT || SharedMemory(*conn)))
+	{
+		// The multishot request ended without closing the connection: after a CQ overflow, 
+		// or after a backpressure cancel whose output has meanwhile drained.
+		ArmRecv(conn);
+	}
+}
+
+void UringLoop::OnWrite(io_uring_cqe *cqe, UringConnection *conn)
+{
+	conn->writing = false;
+	conn->inFlight--;
+
+	if (cqe->res >= 0)
+	{
+		CounterAdd(metrics.bytesOut, (uint64_t)cqe->res);
+		LOG_DEBUG("Bytes sent: %d\n", cqe->res);
+		Trace(TRACE_WRITE, *conn, (uint64_t)cqe->res);
+
+		conn->lastActivity = now;
+
+		size_t requested = conn->heldBuffer >= 0 ? conn->heldLength : conn->inflightLength;
+
+		if ((size_t)cqe->res < requested)
+		{
+			CounterAdd(metrics.partialWrites, 1);
+			Trace(TRACE_PARTIAL_WRITE, *conn, requested - (size_t)cqe->res);
+		}
+	}
+
+	if (cqe->res < 0)
+	{
+		ReturnHeldBuffer(conn);
+
+		if (!conn->closing && cqe->res != -EPIPE && cqe->res != -ECONNRESET)
+			printf("send failed with error: %d\n", -cqe->res);
+
+		Close(conn);
+	}
+	else if (conn->heldBuffer >= 0)
+	{
+		// A short write leaves the rest of the lent buffer to be written next.
+		conn->heldData += cqe->res;
+		conn->heldLength -= (size_t)cqe->res;
+
+		if (conn->heldLength == 0)
+			ReturnHeldBuffer(conn);
+	}
+	else
+	{
+		// A short send leaves the rest of the front run queued for the next send.
+		conn->output.Consume(bufferPool, (size_t)cqe->res);
+		conn->inflightLength = 0;
+	}
+
+	if (conn->closing)
+	{
+		if (conn->inFlight == 0)
+			Release(conn);
+		return;
+	}
+
+	if (conn->Unsent() > 0)
+	{
+		StartWrite(conn);
+	}
+	else if (conn->peerClosed && conn->workHead == NULL)
+	{
+		Close(conn);
+		return;
+	}
+
+	// Resume receiving once the output queue has drained below the backpressure limit.
+	if (conn->readPaused && !conn->peerClosed && !conn->receiving && conn->Unsent() < MAX_PENDING_OUTPUT)
+		ArmRecv(conn);
+}
+
+void UringLoop::Close(UringConnection *conn)
+{
+	if (conn->closing)
+		return;
+
+	// Shutting the socket down completes the armed recv and fails any pending write, 
+	// after which the last completion releases the connection.
+	conn->closing = true;
+	shutdown(conn->socket, SD_BOTH);
+	AbandonWork(*conn);
+	connectionCount--;
+	UntrackConnection(*conn);
+	CounterAdd(metrics.closes, 1);
+
+	if (conn->inFlight == 0)
+		Release(conn);
+}
+
+void UringLoop::Release(UringConnection *conn)
+{
+	if (conn->releasing)
+		return;
+
+	conn->releasing = true;
+	released.push_back(conn);
+}
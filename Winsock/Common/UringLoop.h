@@ -0,0 +1,160 @@
+#pragma once
+
+#include "IoLoop.h"
+#include "ObjectPool.h"
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <vector>
+
+// Number of submission queue entries; the completion queue is sized at twice this by the kernel.
+#define URING_ENTRIES 4096
+
+// Receive buffers shared by every connection of one loop. The count must be a power of two.
+// The same memory is registered as fixed buffer 0, so an echo can be written straight out of 
+// the buffer the kernel received it into.
+#define URING_BUFFER_COUNT 1024
+#define URING_BUFFER_SIZE  4096
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+// Connection state for the completion-based backend.
+struct UringConnection : public Connection
+{
+	// Operations submitted to the kernel and not yet completed. 
+	// The connection is released only when this drops to zero after close.
+	unsigned inFlight;
+
+	// A multishot recv is armed on the socket.
+	bool receiving;
+
+	// A send is in flight; sends on one connection are serialized to keep the byte stream in order.
+	bool writing;
+
+	bool closing;
+
+	// The peer shut down its side; the connection closes once the replies to the requests it sent 
+	// before that, queued or still with the work pool, are sent.
+	bool peerClosed;
+
+	// Already queued for release at the end of the loop iteration.
+	bool releasing;
+
+	// Receive buffer lent to an in-flight zero-copy echo (fixed write), or -1.
+	int heldBuffer;
+	const char *heldData;
+	size_t heldLength;
+
+	// Bytes of the output queue's front handed to the send in flight. The kernel may read them at any 
+	// time until the completion arrives; the queue never moves queued bytes, so appending is still safe.
+	size_t inflightLength;
+
+	// Scatter/gather description of the sendmsg in flight; the kernel may read it until completion.
+	struct msghdr msg;
+	struct iovec iov[MAX_SEND_IOVECS];
+
+	size_t Unsent(void) const { return PendingOutput() + heldLength; }
+};
+
+// Completion-based io_uring backend. Compared with the epoll loop it replaces one syscall per 
+// recv/send with one io_uring_enter per loop iteration for the whole batch:
+// - a multishot accept on each listen socket posts one completion per new connection;
+// - a multishot recv on each connection receives into buffers picked by the kernel from a 
+//   provided buffer ring, so idle connections hold no receive memory;
+// - the provided buffers are also registered as a fixed buffer, so echoing a received chunk is 
+//   a fixed write straight out of that buffer with no user space copy.
+class UringLoop : public IoLoop
+{
+public:
+	UringLoop();
+	~UringLoop();
+
+	// Create the ring, map its queues and register the provided buffer ring and fixed buffer.
+	bool Init(void);
+
+	bool AddListener(SOCKET listenSocket);
+
+	bool Send(Connection &conn, const char *data, size_t len);
+
+	void CloseConnection(Connection &conn);
+
+	int Run(void);
+
+protected:
+	Connection *AddConnection(SOCKET s, bool local);
+	void SetAccepting(bool accept);
+	bool Quiescent(const Connection &conn) const;
+
+private:
+	io_uring_sqe *GetSqe(void);
+	int Submit(unsigned waitFor, int timeoutMs);
+
+	void ArmAccept(size_t listener);
+	void ArmWakeRead(void);
+	void ArmHandshakePoll(void);
+	void ArmRecv(UringConnection *conn);
+	void StartWrite(UringConnection *conn);
+	void FlushDirty(void);
+	void RecycleBuffer(int bid);
+
+	// End the connection's lent region, if any, and give its receive buffer back to the ring.
+	void ReturnHeldBuffer(UringConnection *conn);
+
+	void OnAccept(io_uring_cqe *cqe, SOCKET listenSocket);
+	void OnRecv(io_uring_cqe *cqe, UringConnection *conn);
+	void OnWrite(io_uring_cqe *cqe, UringConnection *conn);
+	void Close(UringConnection *conn);
+	void Release(UringConnection *conn);
+
+	int ringFd;
+
+	// Submission queue
+	unsigned *sqHead;
+	unsigned *sqTail;
+	unsigned sqMask;
+	unsigned *sqArray;
+	io_uring_sqe *sqes;
+	unsigned sqLocalTail;
+
+	// Completion queue
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned cqMask;
+	io_uring_cqe *cqes;
+
+	void *sqRingPtr;
+	size_t sqRingSize;
+	void *cqRingPtr;
+	size_t cqRingSize;
+	size_t sqesSize;
+
+	// Provided buffer ring and the buffer memory behind it.
+	io_uring_buf_ring *bufRing;
+	size_t bufRingSize;
+	char *buffers;
+	uint16_t bufTail;
+
+	// Target of the read armed on wakeFd.
+	uint64_t wakeCount;
+
+	// Recv buffer currently being handed to the handler and whether Send borrowed it.
+	int currentBuffer;
+	bool currentBufferLent;
+
+	// Whether the multishot accept of each listener (same index) is still armed.
+	std::vector<bool> acceptArmed;
+
+	ObjectPool<UringConnection> connections;
+
+	// Connections whose multishot recv stopped because the buffer ring ran dry.
+	std::vector<UringConnection *> starved;
+
+	// Connections with output queued during the current iteration.
+	std::vector<UringConnection *> dirty;
+
+	// Connections whose last operation completed after close, freed at the end of the iteration.
+	std::vector<UringConnection *> released;
+};
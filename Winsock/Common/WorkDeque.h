@@ -0,0 +1,101 @@
+#pragma once
+
+#include "Metrics.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// --- Chase-Lev Work-Stealing Deque ---
+
+// Fixed-capacity work-stealing deque (Chase and Lev, with the memory orderings of Lê et al.,
+// "Correct and Efficient Work-Stealing for Weak Memory Models"). The owning worker pushes and
+// pops at the bottom like a stack, without any atomic read-modify-write except when it takes
+// the very last item; idle workers steal from the top with one compare-and-swap. Owner and
+// thieves only contend for the last item, so a busy worker pays almost nothing for being
+// stealable. Capacity must be a power of two; Push fails when the deque is full.
+template <typename T, size_t Capacity>
+class WorkDeque
+{
+public:
+	WorkDeque() : top(0), bottom(0) {}
+
+	// Owner only. Returns false when the deque is full.
+	bool Push(T *item)
+	{
+		int64_t b = __atomic_load_n(&bottom, __ATOMIC_RELAXED);
+		int64_t t = __atomic_load_n(&top, __ATOMIC_ACQUIRE);
+
+		if (b - t >= (int64_t)Capacity)
+			return false;
+
+		__atomic_store_n(&slots[b & (Capacity - 1)], item, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		__atomic_store_n(&bottom, b + 1, __ATOMIC_RELAXED);
+
+		return true;
+	}
+
+	// Owner only. Takes the most recently pushed item, or returns NULL.
+	T *Pop(void)
+	{
+		int64_t b = __atomic_load_n(&bottom, __ATOMIC_RELAXED) - 1;
+		__atomic_store_n(&bottom, b, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		int64_t t = __atomic_load_n(&top, __ATOMIC_RELAXED);
+
+		if (t > b)
+		{
+			// Empty.
+			__atomic_store_n(&bottom, b + 1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+
+		T *item = __atomic_load_n(&slots[b & (Capacity - 1)], __ATOMIC_RELAXED);
+
+		if (t == b)
+		{
+			// Last item: race the thieves for it.
+			if (!__atomic_compare_exchange_n(&top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+				item = NULL;
+
+			__atomic_store_n(&bottom, b + 1, __ATOMIC_RELAXED);
+		}
+
+		return item;
+	}
+
+	// Any thread. Takes the oldest item, or returns NULL when the deque is empty or another thread won the race.
+	T *Steal(void)
+	{
+		int64_t t = __atomic_load_n(&top, __ATOMIC_ACQUIRE);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		int64_t b = __atomic_load_n(&bottom, __ATOMIC_ACQUIRE);
+
+		if (t >= b)
+			return NULL;
+
+		T *item = __atomic_load_n(&slots[t & (Capacity - 1)], __ATOMIC_RELAXED);
+
+		if (!__atomic_compare_exchange_n(&top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			return NULL;
+
+		return item;
+	}
+
+	// Any thread; only a hint while other threads are active.
+	size_t Size(void) const
+	{
+		int64_t b = __atomic_load_n(&bottom, __ATOMIC_RELAXED);
+		int64_t t = __atomic_load_n(&top, __ATOMIC_RELAXED);
+
+		return b > t ? (size_t)(b - t) : 0;
+	}
+
+private:
+	static_assert((Capacity & (Capacity - 1)) == 0, "WorkDeque capacity must be a power of two");
+
+	// Thieves write top, the owner writes bottom; keep them on different cache lines.
+	alignas(CACHE_LINE_SIZE) int64_t top;
+	alignas(CACHE_LINE_SIZE) int64_t bottom;
+	alignas(CACHE_LINE_SIZE) T *slots[Capacity];
+};
@@ -0,0 +1,252 @@
+#include "WorkPool.h"
+
+#include <stdio.h>
+
+#ifndef __linux__
+#error "WorkPool requires Linux futexes"
+#endif
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static void FutexWait(uint32_t *word, uint32_t value)
+{
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void FutexWake(uint32_t *word)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static inline void CpuRelax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+WorkPool::WorkPool()
+	: running(false)
+{
+}
+
+WorkPool::~WorkPool()
+{
+	Stop();
+}
+
+bool WorkPool::Start(int threads)
+{
+	for (int i = 0; i < threads; i++)
+	{
+		Worker *worker = new Worker();
+		worker->idle = 1;
+		worker->sleeping = 0;
+		workers.push_back(worker);
+	}
+
+	running = true;
+
+	for (int i = 0; i < threads; i++)
+		workers[i]->thread = std::thread(&WorkPool::Run, this, i);
+
+	return true;
+}
+
+void WorkPool::Stop(void)
+{
+	if (!running)
+		return;
+
+	running = false;
+
+	for (size_t i = 0; i < workers.size(); i++)
+		Wake(workers[i]);
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i]->thread.join();
+		delete workers[i];
+	}
+
+	workers.clear();
+}
+
+void WorkPool::Wake(Worker *worker)
+{
+	if (__atomic_exchange_n(&worker->sleeping, 0, __ATOMIC_SEQ_CST) != 0)
+		FutexWake(&worker->sleeping);
+}
+
+void WorkPool::Submit(WorkJob *job)
+{
+	// Spread submissions round-robin, but hand the job to an idle worker when there is one:
+	// a job in the inbox of a worker busy with a slow job waits until that job is finished.
+	static thread_local unsigned next = 0;
+
+	size_t count = workers.size();
+	unsigned start = next++;
+	Worker *target = workers[start % count];
+
+	for (size_t i = 0; i < count; i++)
+	{
+		Worker *candidate = workers[(start + i) % count];
+
+		if (__atomic_load_n(&candidate->idle, __ATOMIC_RELAXED))
+		{
+			target = candidate;
+			break;
+		}
+	}
+
+	target->inbox.Push(job);
+
+	// Pairs with the fence in Run: either the worker sees the job before it sleeps, or this sees it sleeping.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&target->sleeping, __ATOMIC_RELAXED))
+		Wake(target);
+}
+
+void WorkPool::WakeIdle(int index)
+{
+	// Pairs with the fence in Run, like Submit: either a worker going to sleep sees the jobs in the
+	// deque, or this sees it sleeping.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		if (i != (size_t)index && __atomic_load_n(&workers[i]->sleeping, __ATOMIC_RELAXED))
+		{
+			Wake(workers[i]);
+			return;
+		}
+	}
+}
+
+bool WorkPool::Stealable(int index) const
+{
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		if (i != (size_t)index && workers[i]->deque.Size() > 0)
+			return true;
+	}
+
+	return false;
+}
+
+WorkJob *WorkPool::FindJob(int index, uint32_t &random)
+{
+	Worker *self = workers[index];
+
+	// The owner pops the job it pushed last, whose frame is still hot in its cache; thieves take the
+	// oldest from the other end.
+	WorkJob *job = self->deque.Pop();
+
+	if (job != NULL)
+		return job;
+
+	// Move the inbox into the deque, where idle workers can steal from it. The oldest job is run 
+	// right away, so the deque only holds the rest.
+	size_t moved = 0;
+	MpscNode *node;
+
+	while ((node = self->inbox.Pop()) != NULL)
+	{
+		if (job == NULL)
+		{
+			job = (WorkJob *)node;
+			continue;
+		}
+
+		if (!self->deque.Push((WorkJob *)node))
+		{
+			// The deque is full: the rest stays in the inbox, this one at its end.
+			self->inbox.Push(node);
+			break;
+		}
+
+		moved++;
+	}
+
+	// More jobs than this worker is about to start: wake a sleeping worker to steal the rest.
+	if (moved > 0)
+		WakeIdle(index);
+
+	if (job != NULL)
+		return job;
+
+	// Steal from the others, starting at a random victim so thieves do not all pile onto one worker.
+	size_t count = workers.size();
+
+	random = random * 1664525u + 1013904223u;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t victim = (random + i) % count;
+
+		if (victim == (size_t)index)
+			continue;
+
+		job = workers[victim]->deque.Steal();
+
+		if (job != NULL)
+		{
+			// Sleeping workers are woken one at a time: pass the wakeup on while there is more to steal.
+			if (workers[victim]->deque.Size() > 0)
+				WakeIdle(index);
+
+			return job;
+		}
+	}
+
+	return NULL;
+}
+
+void WorkPool::Run(int index)
+{
+	Worker *self = workers[index];
+	uint32_t random = (uint32_t)index * 2654435761u + 1;
+	int spins = 0;
+
+	while (running)
+	{
+		WorkJob *job = FindJob(index, random);
+
+		if (job != NULL)
+		{
+			__atomic_store_n(&self->idle, 0, __ATOMIC_RELAXED);
+			job->run(job);
+			spins = 0;
+			continue;
+		}
+
+		__atomic_store_n(&self->idle, 1, __ATOMIC_RELAXED);
+
+		// Spin briefly: under load the next job usually arrives within microseconds,
+		// much sooner than a sleeping thread could be woken.
+		if (++spins < WORK_IDLE_SPINS)
+		{
+			CpuRelax();
+			continue;
+		}
+
+		spins = 0;
+
+		__atomic_store_n(&self->sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		// No timeout: Submit wakes the worker it hands a job to, and a worker that leaves jobs in a deque
+		// wakes a sleeper to steal them.
+		if (!self->inbox.Empty() || Stealable(index) || !running)
+		{
+			__atomic_store_n(&self->sleeping, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		FutexWait(&self->sleeping, 1);
+		__atomic_store_n(&self->sleeping, 0, __ATOMIC_RELAXED);
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "MpscQueue.h"
+#include "WorkDeque.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Items a worker's deque holds; a worker whose deque is full leaves new work in its inbox.
+#define WORK_DEQUE_CAPACITY 4096
+
+// Rounds an idle worker spends looking for work to steal before it goes to sleep.
+#define WORK_IDLE_SPINS 200
+
+// A unit of CPU work. Run is called once, on some worker thread; the job owns itself from then on.
+struct WorkJob : public MpscNode
+{
+	void (*run)(WorkJob *job);
+};
+
+// --- Work-Stealing Thread Pool ---
+
+// Worker threads for handlers too slow to run on an I/O thread. Every worker owns a Chase-Lev
+// deque that it works through from the bottom, and idle workers steal from the top of the others'
+// deques, so a burst of jobs that lands on one worker spreads over all of them without any lock.
+// Threads outside the pool (the I/O loops) cannot push to a deque, which belongs to its worker:
+// they push to the worker's lock-free inbox instead, preferring a worker that is idle, and the
+// worker moves its inbox into its deque, where the others can steal from it. A worker with nothing
+// to run or steal sleeps until it is handed a job or another worker has jobs left over for it.
+class WorkPool
+{
+public:
+	WorkPool();
+	~WorkPool();
+
+	// Start the worker threads. Returns false after printing the reason on failure.
+	bool Start(int threads);
+
+	// Stop and join the workers. Jobs not yet started are never run.
+	void Stop(void);
+
+	// Queue a job. Any thread may call this, concurrently with the others.
+	void Submit(WorkJob *job);
+
+	int Threads(void) const { return (int)workers.size(); }
+
+private:
+	struct alignas(CACHE_LINE_SIZE) Worker
+	{
+		WorkDeque<WorkJob, WORK_DEQUE_CAPACITY> deque;
+		MpscQueue inbox;
+
+		// 1 while the worker is between jobs; Submit prefers idle workers.
+		alignas(CACHE_LINE_SIZE) uint32_t idle;
+
+		// Futex word: 1 while the worker sleeps or is about to, set back to 0 to wake it.
+		uint32_t sleeping;
+
+		std::thread thread;
+	};
+
+	void Run(int index);
+	WorkJob *FindJob(int index, uint32_t &random);
+	void Wake(Worker *worker);
+	void WakeIdle(int index);
+	bool Stealable(int index) const;
+
+	std::vector<Worker *> workers;
+	std::atomic<bool> running;
+};
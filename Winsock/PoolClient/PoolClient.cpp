@@ -0,0 +1,381 @@
+#undef UNICODE
+
+#include "../Common/Socket.h"
+#include "../Common/ClientPool.h"
+#include "../Common/Coroutine.h"
+#include "../Common/Frame.h"
+#include "../Common/Histogram.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <future>
+#include <vector>
+using namespace std;
+
+// Build (Linux): g++ -O2 -std=c++20 -pthread PoolClient.cpp ../Common/*.cpp -lssl -lcrypto -o poolclient
+
+// Connection pool client: sends a number of echo requests through a ConnectionPool, with a fixed
+// number in flight, using one of the pool's three interfaces (callbacks, futures or coroutines),
+// and reports throughput and latency. For comparison it can also make every request the way the
+// original client did: connect, send, shut down, wait for the close. That pays a TCP handshake per
+// request and leaves a TIME_WAIT behind on this side, holding a local port for a minute, so at high
+// request rates the ephemeral port range runs out.
+
+// Command line options.
+struct PoolClientOptions
+{
+	const char *host;
+	const char *port;
+
+	// callback, future, coroutine or connect (one connection per request).
+	const char *api;
+
+	// Connections in the pool, and requests kept in flight across all of them.
+	int connections;
+	int inflight;
+
+	uint64_t requests;
+	uint32_t size;
+
+	SocketTuning tuning;
+};
+
+static void PrintUsage(const char *program)
+{
+	printf("usage: %s [options]\n", program);
+	printf("  --host H          server name or address (default localhost)\n");
+	printf("  --port P          server port (default %s)\n", DEFAULT_PORT);
+	printf("  --api A           callback, future, coroutine or connect (a new connection per request; default callback)\n");
+	printf("  --connections N   connections in the pool (default 4)\n");
+	printf("  --inflight K      requests in flight at once (default 64)\n");
+	printf("  --requests N      requests to send (default 100000)\n");
+	printf("  --size B          payload bytes per request, at least 8 (default 64)\n");
+	printf("  --profile NAME    socket tuning profile: latency or throughput\n");
+	printf("  --config FILE     socket tuning file (see the server's usage for the setting names)\n");
+}
+
+static bool ParseOptions(int argc, char **argv, PoolClientOptions &options)
+{
+	options.host = "localhost";
+	options.port = DEFAULT_PORT;
+	options.api = "callback";
+	options.connections = 4;
+	options.inflight = 64;
+	options.requests = 100000;
+	options.size = 64;
+	DefaultTuning(options.tuning);
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--host") == 0 && i + 1 < argc)
+			options.host = argv[++i];
+		else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+			options.port = argv[++i];
+		else if (strcmp(argv[i], "--api") == 0 && i + 1 < argc)
+			options.api = argv[++i];
+		else if (strcmp(argv[i], "--connections") == 0 && i + 1 < argc)
+			options.connections = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--inflight") == 0 && i + 1 < argc)
+			options.inflight = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc)
+			options.requests = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+			options.size = (uint32_t)atoi(argv[++i]);
+		else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc)
+		{
+			if (!LoadTuningFile(argv[++i], options.tuning))
+				return false;
+		}
+		else if (strncmp(argv[i], "--", 2) == 0 && i + 1 < argc && SetTuningOption(argv[i] + 2, argv[i + 1], options.tuning))
+			i++;
+		else
+			return false;
+	}
+
+	if (strcmp(options.api, "callback") != 0 && strcmp(options.api, "future") != 0 &&
+		strcmp(options.api, "coroutine") != 0 && strcmp(options.api, "connect") != 0)
+	{
+		printf("Unknown API: %s\n", options.api);
+		return false;
+	}
+
+	// Every payload starts with a tag the reply must carry back, which checks that replies are matched correctly.
+	return options.connections >= 1 && options.inflight >= 1 && options.requests >= 1 &&
+		options.size >= sizeof(uint64_t) && options.size <= MAX_FRAME_SIZE - REQUEST_ID_SIZE;
+}
+
+static uint64_t NowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// State shared by the requests of one run.
+struct Bench
+{
+	const PoolClientOptions *options;
+	ConnectionPool *pool;
+
+	// Requests handed out, taken with an atomic increment by whichever thread issues the next one.
+	uint64_t issued;
+
+	// Written only by the thread that sees the replies.
+	uint64_t completed;
+	uint64_t errors;
+	Histogram latency;
+
+	// Set when the last reply has arrived.
+	promise<void> done;
+};
+
+// One of the --inflight request slots: when its reply arrives, the slot sends the next request.
+struct Slot
+{
+	Bench *bench;
+	vector<char> payload;
+	uint64_t tag;
+	uint64_t sentAt;
+};
+
+// Take the next request number, or return false when all have been issued.
+static bool NextRequest(Bench &bench, Slot &slot)
+{
+	uint64_t n = __atomic_fetch_add(&bench.issued, 1, __ATOMIC_RELAXED);
+
+	if (n >= bench.options->requests)
+		return false;
+
+	slot.tag = n + 1;
+	memcpy(slot.payload.data(), &slot.tag, sizeof(slot.tag));
+	slot.sentAt = NowNs();
+
+	return true;
+}
+
+static void RecordReply(Bench &bench, Slot &slot, PoolStatus status, const char *payload, size_t len)
+{
+	uint64_t tag = 0;
+
+	if (len >= sizeof(tag))
+		memcpy(&tag, payload, sizeof(tag));
+
+	if (status != POOL_OK || len != slot.payload.size() || tag != slot.tag)
+		bench.errors++;
+	else
+		bench.latency.Record(NowNs() - slot.sentAt);
+
+	if (++bench.completed == bench.options->requests)
+		bench.done.set_value();
+}
+
+// --- Callback API ---
+
+static void OnReply(PoolStatus status, const char *payload, size_t len, void *context)
+{
+	Slot *slot = (Slot *)context;
+	Bench &bench = *slot->bench;
+
+	RecordReply(bench, *slot, status, payload, len);
+
+	if (NextRequest(bench, *slot))
+		bench.pool->Send(slot->payload.data(), slot->payload.size(), OnReply, slot);
+}
+
+static void RunCallbacks(Bench &bench, vector<Slot> &slots)
+{
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		if (NextRequest(bench, slots[i]))
+			bench.pool->Send(slots[i].payload.data(), slots[i].payload.size(), OnReply, &slots[i]);
+	}
+
+	bench.done.get_future().wait();
+}
+
+// --- Future API ---
+
+// The calling thread sends a window of requests, then waits for each reply in turn.
+static void RunFutures(Bench &bench, vector<Slot> &slots)
+{
+	vector<future<PoolReply> > replies(slots.size());
+
+	for (;;)
+	{
+		size_t count = 0;
+
+		while (count < slots.size() && NextRequest(bench, slots[count]))
+		{
+			replies[count] = bench.pool->Request(slots[count].payload.data(), slots[count].payload.size());
+			count++;
+		}
+
+		if (count == 0)
+			break;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			PoolReply reply = replies[i].get();
+			RecordReply(bench, slots[i], reply.status, reply.payload.data(), reply.payload.size());
+		}
+	}
+}
+
+// --- Coroutine API ---
+
+// Each slot is a coroutine that sends its requests one after another. It runs on the pool's
+// thread from its first reply on, so nothing here may block.
+static Task<> Caller(Bench &bench, Slot &slot)
+{
+	while (NextRequest(bench, slot))
+	{
+		PoolReply reply = co_await bench.pool->Call(slot.payload.data(), slot.payload.size());
+		RecordReply(bench, slot, reply.status, reply.payload.data(), reply.payload.size());
+	}
+}
+
+static void RunCoroutines(Bench &bench, vector<Slot> &slots)
+{
+	for (size_t i = 0; i < slots.size(); i++)
+		Caller(bench, slots[i]).Detach().resume();
+
+	bench.done.get_future().wait();
+}
+
+// --- One Connection per Request ---
+
+// What the pool replaces: a blocking connect, one request, a shutdown and a wait for the server to close.
+static void RunConnectPerRequest(Bench &bench, Slot &slot)
+{
+	const PoolClientOptions &options = *bench.options;
+	struct addrinfo *result = NULL, hints;
+
+	ZeroMemory(&hints, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	int iResult = getaddrinfo(options.host, options.port, &hints, &result);
+
+	if (iResult != 0)
+	{
+		printf("getaddrinfo failed with error: %d\n", iResult);
+		bench.errors = options.requests;
+		return;
+	}
+
+	vector<char> frame(FRAME_HEADER_SIZE + REQUEST_ID_SIZE + slot.payload.size());
+	vector<char> reply(frame.size());
+
+	while (NextRequest(bench, slot))
+	{
+		EncodeFrameHeader(frame.data(), (uint32_t)(REQUEST_ID_SIZE + slot.payload.size()));
+		EncodeRequestId(frame.data() + FRAME_HEADER_SIZE, slot.tag);
+		memcpy(frame.data() + FRAME_HEADER_SIZE + REQUEST_ID_SIZE, slot.payload.data(), slot.payload.size());
+
+		SOCKET ConnectSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+		size_t received = 0;
+
+		if (ConnectSocket != INVALID_SOCKET &&
+			connect(ConnectSocket, result->ai_addr, (int)result->ai_addrlen) != SOCKET_ERROR &&
+			send(ConnectSocket, frame.data(), frame.size(), MSG_NOSIGNAL) == (ssize_t)frame.size())
+		{
+			shutdown(ConnectSocket, SD_SEND);
+
+			ssize_t n;
+
+			while (received < reply.size() && (n = recv(ConnectSocket, reply.data() + received, reply.size() - received, 0)) > 0)
+				received += (size_t)n;
+		}
+
+		if (ConnectSocket != INVALID_SOCKET)
+			closesocket(ConnectSocket);
+
+		if (received == reply.size())
+			RecordReply(bench, slot, POOL_OK, reply.data() + FRAME_HEADER_SIZE + REQUEST_ID_SIZE, slot.payload.size());
+		else
+			RecordReply(bench, slot, POOL_CONNECTION_LOST, NULL, 0);
+	}
+
+	freeaddrinfo(result);
+}
+
+// __cdecl is the default calling convention for C and C++ programs.
+// This specifier is Microsoft-specific and we should not use them if we want to write portable code.
+
+int __cdecl main(int argc, char **argv)
+{
+	PoolClientOptions options;
+
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	if (SocketStartup() != 0)
+		return 1;
+
+	bool connectPerRequest = strcmp(options.api, "connect") == 0;
+	ConnectionPool pool;
+
+	if (!connectPerRequest && !pool.Start(options.host, options.port, options.connections, options.tuning))
+	{
+		SocketCleanup();
+		return 1;
+	}
+
+	Bench bench;
+	bench.options = &options;
+	bench.pool = &pool;
+	bench.issued = 0;
+	bench.completed = 0;
+	bench.errors = 0;
+
+	vector<Slot> slots(connectPerRequest ? 1 : (size_t)options.inflight);
+
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		slots[i].bench = &bench;
+		slots[i].payload.assign(options.size, 'x');
+	}
+
+	uint64_t begin = NowNs();
+
+	if (connectPerRequest)
+		RunConnectPerRequest(bench, slots[0]);
+	else if (strcmp(options.api, "future") == 0)
+		RunFutures(bench, slots);
+	else if (strcmp(options.api, "coroutine") == 0)
+		RunCoroutines(bench, slots);
+	else
+		RunCallbacks(bench, slots);
+
+	double elapsed = (NowNs() - begin) / 1e9;
+
+	pool.Stop();
+
+	printf("API: %s  Connections: %d  In flight: %d  Size: %u\n", options.api,
+		connectPerRequest ? 1 : options.connections, (int)slots.size(), options.size);
+	printf("Requests: %llu  Errors: %llu  Time: %.2f s\n", (unsigned long long)bench.completed,
+		(unsigned long long)bench.errors, elapsed);
+	printf("Throughput: %.1f req/s\n", bench.completed / elapsed);
+	printf("Latency (us): p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f  mean %.1f\n",
+		bench.latency.Percentile(50.0) / 1e3, bench.latency.Percentile(99.0) / 1e3, bench.latency.Percentile(99.9) / 1e3,
+		bench.latency.Max() / 1e3, bench.latency.Mean() / 1e3);
+
+	if (!connectPerRequest)
+	{
+		PoolStats stats = pool.Stats();
+
+		printf("Pool: %llu connects  %llu lost  %llu health checks  %llu failed\n",
+			(unsigned long long)stats.connects, (unsigned long long)stats.connectionsLost,
+			(unsigned long long)stats.healthChecks, (unsigned long long)stats.failed);
+	}
+
+	SocketCleanup();
+
+	return bench.errors > 0 ? 1 : 0;
+}
@@ -1,281 +1,886 @@
 #undef UNICODE
 
-#define WIN32_LEAN_AND_MEAN
-
-#include <windows.h>
-#include <winsock2.h>
-#include <ws2tcpip.h>
+#include "../Common/Socket.h"
+#include "../Common/IoLoop.h"
+#include "../Common/Thread.h"
+#include "../Common/StatsServer.h"
+#include "../Common/UdpLoop.h"
+#include "../Common/Tls.h"
+#include "../Common/LocalTransport.h"
+#include "../Common/Log.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
 #include <iostream>
+#include <thread>
+#include <vector>
 using namespace std;
 
+// Frames with at least this many payload bytes are echoed by the kernel without entering user space.
+#define DEFAULT_BULK_THRESHOLD (64 * 1024)
+
+// Longest a graceful shutdown waits for busy connections to finish their replies.
+#define DEFAULT_DRAIN_TIMEOUT_MS 10000
+
 // http://msdn.microsoft.com/en-us/library/windows/desktop/bb530751(v=vs.85).aspx
 // http://msdn.microsoft.com/en-us/library/windows/desktop/ms737593(v=vs.85).aspx
 
-// Need to link with Ws2_32.lib
-#pragma comment (lib, "Ws2_32.lib")
-// #pragma comment (lib, "Mswsock.lib")
+// Build (Linux): g++ -O2 -std=c++17 -pthread Server.cpp ../Common/*.cpp -lssl -lcrypto -o server
+
+// Command line options.
+struct ServerOptions
+{
+	// Number of worker threads. Each worker owns a listen socket bound with SO_REUSEPORT 
+	// and runs its own event loop, so workers share no locks and no connections.
+	int threads;
+
+	// Pin worker i to CPU (i % CPU count).
+	bool pin;
+
+	// I/O backend: "epoll" (readiness-based) or "uring" (completion-based io_uring).
+	const char *backend;
+
+	// Payload size from which frames are echoed in bulk mode (see IoLoop::SetBulkEcho); 0 disables it.
+	uint32_t bulkThreshold;
+
+	// Port of the stats endpoint, or NULL to run without one.
+	const char *statsPort;
+
+	// Print a line for every connection and every message (slow; for debugging only).
+	bool verbose;
+
+	// Answer frames with the C# server's transform instead of a plain echo, taking at least 
+	// workMicroseconds of CPU per frame, on a pool of workThreads threads (0: on the I/O thread).
+	bool transform;
+	int workThreads;
+	int workMicroseconds;
+
+	// Echo UDP datagrams instead of TCP frames, optionally with UDP_GRO (and GSO for the echoes).
+	bool udp;
+	bool udpGro;
+
+	// Close connections idle for idleTimeoutMs, or taking longer than readTimeoutMs to deliver a frame (0: never).
+	uint32_t idleTimeoutMs;
+	uint32_t readTimeoutMs;
+
+	// Connections open at once across all workers (0: no limit), and the time SIGTERM gives busy ones to finish.
+	size_t maxConnections;
+	uint32_t drainTimeoutMs;
+
+	// Serve TLS with the certificate and key in these PEM files, or with a self-signed certificate (NULL).
+	bool tls;
+	const char *tlsCert;
+	const char *tlsKey;
+
+	// Keep the last traceEvents connection events of every worker (0: no tracing), and write them to 
+	// traceDir on SIGUSR1 or after a loop iteration longer than traceThresholdUs (0: on SIGUSR1 only).
+	size_t traceEvents;
+	const char *traceDir;
+	uint32_t traceThresholdUs;
+
+	// Also listen on the Unix domain socket at unixPath (NULL: TCP only), offering its clients 
+	// shared-memory rings if shm is set.
+	const char *unixPath;
+	bool shm;
+
+	// Socket options, listen backlog and read sizes, from --profile, --config and the individual options.
+	SocketTuning tuning;
+};
+
+static void PrintUsage(const char *program)
+{
+	printf("usage: %s [--threads N] [--pin] [--backend epoll|uring] [--bulk-threshold N] [--stats-port P] [--verbose]\n", program);
+	printf("  --threads N          run N workers, each with its own SO_REUSEPORT listen socket and event loop (default 1)\n");
+	printf("  --pin                pin each worker thread to its own CPU\n");
+	printf("  --backend B          epoll: edge-triggered readiness loop (default)\n");
+	printf("                       uring: io_uring with multishot accept/recv, provided buffer ring and fixed buffers\n");
+	printf("  --bulk-threshold N   echo frames with at least N payload bytes without reassembling them; with epoll the\n");
+	printf("                       payload is spliced and never enters user space (default %d, 0 = off)\n", DEFAULT_BULK_THRESHOLD);
+	printf("  --stats-port P       serve live counters and loop latency in Prometheus text format on port P\n");
+	printf("  --verbose            log every connection and every message (debug level; slows the server down)\n");
+	printf("  --work-us U          answer with the payload's \"Client\" replaced by \"Server\", burning U microseconds\n");
+	printf("                       of CPU per frame to stand in for a slow handler (turns bulk echo off)\n");
+	printf("  --work-threads N     run that handler on a work-stealing pool of N threads instead of the I/O threads\n");
+	printf("  --udp                echo UDP datagrams on the same port, batched with recvmmsg/sendmmsg\n");
+	printf("  --udp-gro            with --udp: receive coalesced datagram trains (UDP_GRO) and echo them with UDP_SEGMENT\n");
+	printf("  --idle-timeout MS    close connections that have received and sent nothing for MS milliseconds\n");
+	printf("  --read-timeout MS    close connections that take longer than MS milliseconds to deliver a started frame\n");
+	printf("  --max-connections N  stop accepting while N connections are open (split evenly across the workers)\n");
+	printf("  --drain-timeout MS   on SIGTERM or SIGINT, wait up to MS milliseconds for busy connections (default 10000)\n");
+	printf("  --tls                serve TLS: OpenSSL runs the handshake and the kernel (kTLS) the encryption,\n");
+	printf("                       with a generated self-signed certificate unless --tls-cert is given\n");
+	printf("  --tls-cert FILE      PEM certificate chain for --tls (implies --tls)\n");
+	printf("  --tls-key FILE       PEM private key for --tls-cert (default: the certificate file)\n");
+	printf("  --trace N            keep each worker's last N connection events (accept, read, frame, handler, write,\n");
+	printf("                       close) in a binary ring, written to a file on SIGUSR1; see TraceConvert\n");
+	printf("  --trace-dir DIR      directory of the trace files (default .)\n");
+	printf("  --trace-threshold-us US  also write a worker's trace after a loop iteration longer than US microseconds\n");
+	printf("  --unix PATH          also serve clients on this host on the Unix domain socket PATH (e.g. %s),\n", DEFAULT_UNIX_PATH);
+	printf("                       bypassing TCP/IP; these connections are never TLS\n");
+	printf("  --shm                with --unix: move the frames of clients that accept it through shared-memory\n");
+	printf("                       rings instead of the socket (%d KB per connection)\n", (int)(sizeof(ShmChannel) / 1024));
+	printf("\nSocket tuning, applied in command line order (later settings win):\n");
+	printf("  --profile NAME       latency (small messages) or throughput (bulk transfer)\n");
+	printf("  --config FILE        read \"name = value\" lines with the setting names below\n");
+	printf("  --backlog N          listen backlog (default SOMAXCONN)\n");
+	printf("  --rcvbuf BYTES       SO_RCVBUF, 0 = kernel autotuning (default)\n");
+	printf("  --sndbuf BYTES       SO_SNDBUF, 0 = kernel autotuning (default)\n");
+	printf("  --nodelay 0|1        TCP_NODELAY (default 1)\n");
+	printf("  --quickack 0|1       TCP_QUICKACK (default 0)\n");
+	printf("  --defer-accept S     TCP_DEFER_ACCEPT seconds, 0 = off (default)\n");
+	printf("  --busy-poll US       SO_BUSY_POLL microseconds, 0 = off (default)\n");
+	printf("  --min-read BYTES     smallest adaptive read size (default 2K)\n");
+	printf("  --max-read BYTES     largest adaptive read size (default 256K)\n");
+}
+
+static bool ParseOptions(int argc, char **argv, ServerOptions &options)
+{
+	options.threads = 1;
+	options.pin = false;
+	options.backend = "epoll";
+	options.bulkThreshold = DEFAULT_BULK_THRESHOLD;
+	options.statsPort = NULL;
+	options.verbose = false;
+	options.transform = false;
+	options.workThreads = 0;
+	options.workMicroseconds = 0;
+	options.udp = false;
+	options.udpGro = false;
+	options.idleTimeoutMs = 0;
+	options.readTimeoutMs = 0;
+	options.maxConnections = 0;
+	options.drainTimeoutMs = DEFAULT_DRAIN_TIMEOUT_MS;
+	options.tls = false;
+	options.tlsCert = NULL;
+	options.tlsKey = NULL;
+	options.traceEvents = 0;
+	options.traceDir = ".";
+	options.traceThresholdUs = 0;
+	options.unixPath = NULL;
+	options.shm = false;
+	DefaultTuning(options.tuning);
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			options.threads = atoi(argv[++i]);
+
+			if (options.threads < 1)
+				return false;
+		}
+		else if (strcmp(argv[i], "--pin") == 0)
+		{
+			options.pin = true;
+		}
+		else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+		{
+			options.backend = argv[++i];
+
+			if (strcmp(options.backend, "epoll") != 0 && strcmp(options.backend, "uring") != 0)
+				return false;
+		}
+		else if (strcmp(argv[i], "--bulk-threshold") == 0 && i + 1 < argc)
+		{
+			options.bulkThreshold = (uint32_t)strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--stats-port") == 0 && i + 1 < argc)
+		{
+			options.statsPort = argv[++i];
+		}
+		else if (strcmp(argv[i], "--verbose") == 0)
+		{
+			options.verbose = true;
+		}
+		else if (strcmp(argv[i], "--udp") == 0)
+		{
+			options.udp = true;
+		}
+		else if (strcmp(argv[i], "--udp-gro") == 0)
+		{
+			options.udpGro = true;
+		}
+		else if (strcmp(argv[i], "--work-us") == 0 && i + 1 < argc)
+		{
+			options.workMicroseconds = atoi(argv[++i]);
+			options.transform = true;
+
+			if (options.workMicroseconds < 0)
+				return false;
+		}
+		else if (strcmp(argv[i], "--work-threads") == 0 && i + 1 < argc)
+		{
+			options.workThreads = atoi(argv[++i]);
+			options.transform = true;
+
+			if (options.workThreads < 0)
+				return false;
+		}
+		else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc)
+		{
+			options.idleTimeoutMs = (uint32_t)strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--read-timeout") == 0 && i + 1 < argc)
+		{
+			options.readTimeoutMs = (uint32_t)strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--max-connections") == 0 && i + 1 < argc)
+		{
+			options.maxConnections = (size_t)strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--drain-timeout") == 0 && i + 1 < argc)
+		{
+			options.drainTimeoutMs = (uint32_t)strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--tls") == 0)
+		{
+			options.tls = true;
+		}
+		else if (strcmp(argv[i], "--tls-cert") == 0 && i + 1 < argc)
+		{
+			options.tlsCert = argv[++i];
+			options.tls = true;
+		}
+		else if (strcmp(argv[i], "--tls-key") == 0 && i + 1 < argc)
+		{
+			options.tlsKey = argv[++i];
+		}
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+		{
+			options.traceEvents = (size_t)strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--trace-dir") == 0 && i + 1 < argc)
+		{
+			options.traceDir = argv[++i];
+		}
+		else if (strcmp(argv[i], "--trace-threshold-us") == 0 && i + 1 < argc)
+		{
+			options.traceThresholdUs = (uint32_t)strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--unix") == 0 && i + 1 < argc)
+		{
+			options.unixPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--shm") == 0)
+		{
+			options.shm = true;
+		}
+		else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc)
+		{
+			if (!LoadTuningFile(argv[++i], options.tuning))
+				return false;
+		}
+		else if (strncmp(argv[i], "--", 2) == 0 && i + 1 < argc && SetTuningOption(argv[i] + 2, argv[i + 1], options.tuning))
+		{
+			i++;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	if (options.udpGro && !options.udp)
+	{
+		printf("--udp-gro requires --udp\n");
+		return false;
+	}
+
+	if (options.udp && (options.transform || strcmp(options.backend, "epoll") != 0))
+	{
+		printf("--udp cannot be combined with --backend, --work-us or --work-threads\n");
+		return false;
+	}
+
+	if (options.udp && options.tls)
+	{
+		printf("--tls cannot be combined with --udp\n");
+		return false;
+	}
+
+	if (options.udp && options.traceEvents > 0)
+	{
+		printf("--trace cannot be combined with --udp\n");
+		return false;
+	}
+
+	if (options.shm && options.unixPath == NULL)
+	{
+		printf("--shm requires --unix\n");
+		return false;
+	}
+
+	if (options.udp && options.unixPath != NULL)
+	{
+		printf("--unix cannot be combined with --udp\n");
+		return false;
+	}
+
+	if (options.tlsKey != NULL && options.tlsCert == NULL)
+	{
+		printf("--tls-key requires --tls-cert\n");
+		return false;
+	}
+
+	if (options.tuning.minRead > options.tuning.maxRead)
+	{
+		printf("min-read must not be larger than max-read\n");
+		return false;
+	}
+
+	return true;
+}
+
+// Echo a frame back to the sender. The header immediately precedes the payload, 
+// so the whole frame goes back as one contiguous send without being re-encoded.
+static void EchoFrame(IoLoop &loop, Connection &conn, const char *payload, size_t len, void *)
+{
+	loop.Send(conn, payload - FRAME_HEADER_SIZE, len + FRAME_HEADER_SIZE);
+}
+
+// The C# server answers with content_received.Replace("Client", "Server"). Both words have the same 
+// length, so the payload is rewritten in place and the frame header stays valid. The busy loop 
+// afterwards stands in for a handler that really costs this much CPU.
+static size_t TransformPayload(char *payload, size_t len, void *context)
+{
+	const ServerOptions *options = (const ServerOptions *)context;
+	char *end = payload + len;
+
+	for (char *p = payload; (p = (char *)memmem(p, (size_t)(end - p), "Client", 6)) != NULL; p += 6)
+		memcpy(p, "Server", 6);
+
+	if (options->workMicroseconds > 0)
+	{
+		struct timespec start, now;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		do
+		{
+			clock_gettime(CLOCK_MONOTONIC, &now);
+		} while ((now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000 < options->workMicroseconds);
+	}
+
+	return len;
+}
+
+// Answer a frame with the transformed payload. With a work pool the frame is handed to a worker and 
+// the loop moves on to other connections; the reply is sent when the worker is done. Without one 
+// the transform runs right here and every connection of this loop waits for it.
+static void TransformFrame(IoLoop &loop, Connection &conn, const char *payload, size_t len, void *context)
+{
+	if (loop.Offload(conn, payload, len, TransformPayload, context))
+		return;
+
+	static thread_local vector<char> frame;
+
+	frame.assign(payload - FRAME_HEADER_SIZE, payload + len);
+	TransformPayload(frame.data() + FRAME_HEADER_SIZE, len, context);
+
+	loop.Send(conn, frame.data(), frame.size());
+}
+
+// Body of one worker: an event loop that serves every connection accepted on its own listen socket, 
+// and on its descriptor of the Unix domain listen socket (INVALID_SOCKET without --unix).
+static int RunWorker(int index, IoLoop *loop, SOCKET ListenSocket, SOCKET LocalSocket, WorkPool *pool, SSL_CTX *tlsContext, const ServerOptions &options)
+{
+	if (options.pin)
+		PinCurrentThread(index % CpuCount());
+
+	if (!loop->Init() || !loop->AddListener(ListenSocket)) 
+	{
+		// A loop that failed to initialize does not own the listen sockets yet.
+		closesocket(ListenSocket);
+
+		if (LocalSocket != INVALID_SOCKET)
+			closesocket(LocalSocket);
+
+		return 1;
+	}
+
+	if (LocalSocket != INVALID_SOCKET && !loop->AddLocalListener(LocalSocket, options.shm))
+	{
+		closesocket(LocalSocket);
+		return 1;
+	}
+
+	loop->SetTuning(options.tuning);
+	loop->SetTimeouts(options.idleTimeoutMs, options.readTimeoutMs);
+
+	if (tlsContext != NULL && !loop->SetTls(tlsContext))
+		return 1;
+
+	if (options.traceEvents > 0 && !loop->SetTrace(options.traceEvents, (unsigned)index, options.traceDir, options.traceThresholdUs))
+		return 1;
+
+	// The limit is per loop: SO_REUSEPORT spreads connections evenly, so each takes its share.
+	if (options.maxConnections > 0)
+		loop->SetMaxConnections((options.maxConnections + options.threads - 1) / options.threads);
+
+	if (options.transform)
+	{
+		// Every frame must reach the handler, so none is echoed in bulk.
+		loop->SetMessageHandler(TransformFrame, (void *)&options);
+
+		if (pool != NULL && !loop->SetWorkPool(pool))
+			return 1;
+	}
+	else
+	{
+		loop->SetMessageHandler(EchoFrame, NULL);
+		loop->SetBulkEcho(options.bulkThreshold);
+	}
 
-#define DEFAULT_BUFLEN 512
-#define DEFAULT_PORT "27015"
+	return loop->Run();
+}
 
-int __cdecl main(void) 
+// --- Graceful Shutdown ---
+
+// Loops told to drain when SIGTERM or SIGINT arrives.
+static vector<IoLoop *> *DrainLoops;
+static uint32_t DrainTimeoutMs;
+
+static void OnTerminate(int)
+{
+	// IoLoop::Drain only stores a flag and writes to an eventfd, which is safe in a signal handler.
+	for (size_t i = 0; i < DrainLoops->size(); i++)
+		(*DrainLoops)[i]->Drain(DrainTimeoutMs);
+}
+
+static void HandleTermination(vector<IoLoop *> *loops, uint32_t timeoutMs)
 {
-	// All processes (applications or DLLs) that call Winsock functions must initialize 
-	// the use of the Windows Sockets DLL before making other Winsock functions calls. 
-	// This also makes certain that Winsock is supported on the system.
-    WSADATA wsaData;
+	DrainLoops = loops;
+	DrainTimeoutMs = timeoutMs;
+
+	// SA_RESETHAND: a second signal during the drain terminates the process as it always did.
+	struct sigaction action;
+	ZeroMemory(&action, sizeof(action));
+	action.sa_handler = loops != NULL ? OnTerminate : SIG_DFL;
+	action.sa_flags = loops != NULL ? SA_RESETHAND : 0;
+	sigemptyset(&action.sa_mask);
+
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+}
+
+// A worker that failed to set up its loop, or whose loop failed, leaves the server short of a shard, and 
+// the others would keep serving while main waits for them. Take them down with it, at once, so the 
+// server exits and reports the failure.
+static void StopWorkers(vector<IoLoop *> &loops)
+{
+	for (size_t i = 0; i < loops.size(); i++)
+		loops[i]->Drain(0);
+}
+
+// --- Tracing ---
+
+// Loops whose trace SIGUSR1 writes out.
+static vector<IoLoop *> *TraceLoops;
+
+static void OnTraceSignal(int)
+{
+	// Like Drain, IoLoop::DumpTrace only stores a flag and writes to an eventfd; each loop writes its own file.
+	for (size_t i = 0; i < TraceLoops->size(); i++)
+		(*TraceLoops)[i]->DumpTrace();
+}
+
+static void HandleTraceSignal(vector<IoLoop *> *loops)
+{
+	TraceLoops = loops;
+
+	struct sigaction action;
+	ZeroMemory(&action, sizeof(action));
+	action.sa_handler = loops != NULL ? OnTraceSignal : SIG_DFL;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+
+	sigaction(SIGUSR1, &action, NULL);
+}
+
+// --- Datagram Mode ---
+
+// UDP counterpart of the TCP workers below: every worker owns a UDP socket bound to the same port with 
+// SO_REUSEPORT, and the kernel hashes each client address and port to one of them, so a client's 
+// datagrams always reach the same worker and the workers share nothing.
+static int RunUdpServer(const ServerOptions &options)
+{
+	vector<UdpEchoLoop *> loops;
+	vector<const LoopMetrics *> metrics;
+
+	for (int i = 0; i < options.threads; i++)
+	{
+		SOCKET UdpSocket = CreateUdpSocket(DEFAULT_PORT, options.threads > 1, &options.tuning);
+		UdpEchoLoop *loop = new UdpEchoLoop();
+
+		loops.push_back(loop);
+		metrics.push_back(&loop->Metrics());
+
+		if (UdpSocket == INVALID_SOCKET || !loop->Init(UdpSocket, options.udpGro))
+		{
+			for (size_t j = 0; j < loops.size(); j++)
+				delete loops[j];
 
-	// Declare a SOCKET object called ListenSocket for the server to listen for client connections.
-    SOCKET ListenSocket = INVALID_SOCKET;
+			return 1;
+		}
+	}
+
+	StatsServer stats;
+
+	if (options.statsPort != NULL && !stats.Start(options.statsPort, metrics))
+	{
+		for (size_t i = 0; i < loops.size(); i++)
+			delete loops[i];
+
+		return 1;
+	}
+
+	vector<thread> workers;
+	vector<int> results(options.threads, 0);
+
+	for (int i = 1; i < options.threads; i++)
+	{
+		workers.push_back(thread([i, &loops, &options, &results]()
+		{
+			if (options.pin)
+				PinCurrentThread(i % CpuCount());
+
+			results[i] = loops[i]->Run();
+		}));
+	}
+
+	if (options.pin)
+		PinCurrentThread(0);
+
+	results[0] = loops[0]->Run();
+
+	int iResult = 0;
+
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	for (int i = 0; i < options.threads; i++)
+		iResult |= results[i];
 
-	// Declare a temporary SOCKET object called ClientSocket for accepting connections from clients.
-    SOCKET ClientSocket = INVALID_SOCKET;
+	stats.Stop();
+
+	for (size_t i = 0; i < loops.size(); i++)
+		delete loops[i];
+
+	return iResult;
+}
+
+int __cdecl main(int argc, char **argv) 
+{
+	ServerOptions options;
+
+	// One listen socket per worker thread.
+	vector<SOCKET> ListenSockets;
 
-	struct addrinfo hints;
-    struct addrinfo *result = NULL;
-    
 	int iResult;
-    int iSendResult;
-    char recvbuf[DEFAULT_BUFLEN];
-    const int recvbuflen = DEFAULT_BUFLEN;
-    
+
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	if (options.verbose)
+	{
+		LogLevel = LOG_LEVEL_DEBUG;
+		PrintTuning(options.tuning);
+	}
+
     // Initialize Winsock
-    iResult = WSAStartup(MAKEWORD(2,2), &wsaData);
+    iResult = SocketStartup();
 
     if (iResult != 0) 
 	{
-        printf("WSAStartup failed with error: %d\n", iResult);
         return 1;
     }
 
-	// --- Creating a Socket for the Server ---
+	// Datagrams need no listen socket, no accept and no connection state; that mode has a loop of its own.
+	if (options.udp)
+	{
+		iResult = RunUdpServer(options);
+		SocketCleanup();
+		return iResult;
+	}
+
+	// --- Encrypting Connections ---
+
+	// With --tls every connection starts with a TLS handshake, run by OpenSSL on the thread of the loop 
+	// that accepted it. Once it is done the session keys go to the kernel (kTLS), which from then on 
+	// encrypts what the loop sends and decrypts what it receives. The loops, the frame handlers, the 
+	// coalesced scatter/gather sends, splice and the io_uring fixed writes all work on plaintext as 
+	// before, and no byte is copied through a record layer in user space. There is no fallback to one: 
+	// without kTLS in the kernel the server refuses to start. One context serves every loop.
+	SSL_CTX *tlsContext = NULL;
+
+	if (options.tls)
+	{
+		if (!KernelTlsAvailable())
+		{
+			SocketCleanup();
+			return 1;
+		}
+
+		tlsContext = CreateTlsServerContext(options.tlsCert, options.tlsKey, TLS_KERNEL);
 
-	// The getaddrinfo function is used to determine the values in the sockaddr structure:
-	// - AF_INET is used to specify the IPv4 address family.
-	// - SOCK_STREAM is used to specify a stream socket.
-	// - IPPROTO_TCP is used to specify the TCP protocol .
-	// - AI_PASSIVE flag indicates the caller intends to use the returned socket address structure 
-	//   in a call to the bind function. When the AI_PASSIVE flag is set and nodename parameter to 
-	//   the getaddrinfo function is a NULL pointer, the IP address portion of the socket address 
-	//   structure is set to INADDR_ANY for IPv4 addresses or IN6ADDR_ANY_INIT for IPv6 addresses.
-	// - 27015 is the port number associated with the server that the client will connect to.
+		if (tlsContext == NULL)
+		{
+			SocketCleanup();
+			return 1;
+		}
+	}
 
-    ZeroMemory(&hints, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
-    hints.ai_flags = AI_PASSIVE;
+	// --- Creating, Binding and Listening on a Socket ---
 
-    // Resolve the server address and port
-    iResult = getaddrinfo(NULL, DEFAULT_PORT, &hints, &result);
+	// CreateListenSocket resolves the local address with getaddrinfo, creates a TCP stream socket 
+	// for IPv4, binds it to DEFAULT_PORT and calls listen with the configured backlog. The default, 
+	// SOMAXCONN, is a special constant that instructs the socket provider to allow 
+	// a maximum reasonable number of pending connections in the queue. 
+	// The socket is returned in non-blocking mode so that accept never suspends the server.
 
-    if ( iResult != 0 ) 
-	{
-        printf("getaddrinfo failed with error: %d\n", iResult);
-        WSACleanup();
-        return 1;
-    }
+	// The tuning profile decides the trade-off between latency and throughput: buffer sizes and 
+	// TCP_DEFER_ACCEPT are set on the listen socket before listen (accepted sockets inherit them), 
+	// TCP_NODELAY, TCP_QUICKACK and SO_BUSY_POLL on every accepted socket by its event loop.
 
-	// Call the socket function and return its value to the ListenSocket variable. 
-	// For this server application, use the first IP address returned by the call to getaddrinfo 
-	// that matched the address family, socket type, and protocol specified in the hints parameter. 
-	// In this example, a TCP stream socket for IPv4 was requested with an address family of IPv4, 
-	// a socket type of SOCK_STREAM and a protocol of IPPROTO_TCP. 
-	// So an IPv4 address is requested for the ListenSocket.
-	// If the server application wants to listen on IPv6, then the address family needs to be set 
-	// to AF_INET6 in the hints parameter. If a server wants to listen on both IPv6 and IPv4, two 
-	// listen sockets must be created, one for IPv6 and one for IPv4. These two sockets must be handled 
-	// separately by the application. 
-	// Windows Vista and later offer the ability to create a single IPv6 socket that is put in dual stack
-	// mode to listen on both IPv6 and IPv4. For more information on this feature, see Dual-Stack Sockets.
-
-	// Create a SOCKET object called ListenSocket for the server to listen for client connections.
-    ListenSocket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-
-	// Check for errors to ensure that the socket is a valid socket.
-    if (ListenSocket == INVALID_SOCKET) 
+	// With more than one worker every worker gets its own listen socket on the same port, bound with 
+	// SO_REUSEPORT. The kernel distributes incoming connections across the sockets, so connection rate 
+	// and echo throughput grow with the number of cores instead of being funneled through one accept queue.
+	// All sockets are created up front so that a bind failure is reported before any worker starts.
+	for (int i = 0; i < options.threads; i++)
 	{
-        printf("socket failed with error: %ld\n", WSAGetLastError());
-        freeaddrinfo(result);
-        WSACleanup();
-        return 1;
-    }
+		SOCKET ListenSocket = CreateListenSocket(DEFAULT_PORT, options.tuning.backlog, options.threads > 1, &options.tuning);
 
-	// --- Binding a Socket ---
+		if (ListenSocket == INVALID_SOCKET) 
+		{
+			for (size_t j = 0; j < ListenSockets.size(); j++)
+				closesocket(ListenSockets[j]);
+
+			FreeTlsContext(tlsContext);
+			SocketCleanup();
+			return 1;
+		}
 
-	// For a server to accept client connections, it must be bound to a network address within the system. 
-	// The following code demonstrates how to bind a socket that has already been created to an IP address and port. 
-	// Client applications use the IP address and port to connect to the host network.
+		ListenSockets.push_back(ListenSocket);
+	}
 
-	// The sockaddr structure holds information regarding the address family, IP address, and port number.
-	// Call the bind function, passing the created socket and sockaddr structure returned from the getaddrinfo 
-	// function as parameters.
+	// --- Serving Clients on the Same Host ---
 
-    // Setup the TCP listening socket
-    iResult = bind(ListenSocket, result->ai_addr, (int)result->ai_addrlen);
+	// With --unix the server also listens on a Unix domain socket. A client on this host connects there 
+	// instead of to the TCP port and says in a short hello which transports it accepts: the Unix socket 
+	// itself, which skips the TCP/IP stack (segments, checksums, ACKs, the loopback device), or with --shm 
+	// a pair of shared-memory rings, where a request costs a copy into memory the server reads in place 
+	// and at most a one-byte doorbell when the other side is asleep (see ShmRing.h). The frames and the 
+	// handlers are the same as over TCP. There is no SO_REUSEPORT for Unix domain sockets, so the workers 
+	// share one listen socket, each through a descriptor of its own, and whichever accepts first serves 
+	// the connection.
+	vector<SOCKET> LocalSockets(options.threads, INVALID_SOCKET);
 
-	// Check for general errors.
-    if (iResult == SOCKET_ERROR) 
+	if (options.unixPath != NULL)
 	{
-        printf("bind failed with error: %d\n", WSAGetLastError());
-        freeaddrinfo(result);
-        closesocket(ListenSocket);
-        WSACleanup();
-        return 1;
-    }
+		LocalSockets[0] = CreateUnixListenSocket(options.unixPath, options.tuning.backlog);
 
-	// Once the bind function is called, the address information returned by the getaddrinfo function is no longer needed. 
-	// The freeaddrinfo function is called to free the memory allocated by the getaddrinfo function for this address information.
-    freeaddrinfo(result);
+		for (int i = 1; i < options.threads && LocalSockets[0] != INVALID_SOCKET; i++)
+		{
+			LocalSockets[i] = fcntl(LocalSockets[0], F_DUPFD_CLOEXEC, 0);
 
+			if (LocalSockets[i] == INVALID_SOCKET)
+				printf("fcntl(F_DUPFD_CLOEXEC) failed with error: %d\n", errno);
+		}
 
-	// --- Listening on a Socket ---
+		bool failed = false;
 
-	// After the socket is bound to an IP address and port on the system, the server 
-	// must then listen on that IP address and port for incoming connection requests.
+		for (int i = 0; i < options.threads; i++)
+			failed = failed || LocalSockets[i] == INVALID_SOCKET;
 
-	// Call the listen function, passing as parameters the created socket and a value 
-	// for the backlog, maximum length of the queue of pending connections to accept. 
-	// In this example, the backlog parameter was set to SOMAXCONN. 
-	// This value is a special constant that instructs the Winsock provider for this 
-	// socket to allow a maximum reasonable number of pending connections in the queue. 
-    iResult = listen(ListenSocket, SOMAXCONN);
+		if (failed)
+		{
+			for (int i = 0; i < options.threads; i++)
+			{
+				closesocket(ListenSockets[i]);
 
-	// Check the return value for general errors.
-    if (iResult == SOCKET_ERROR) 
-	{
-        printf("listen failed with error: %d\n", WSAGetLastError());
-        closesocket(ListenSocket);
-        WSACleanup();
-        return 1;
-    }
+				if (LocalSockets[i] != INVALID_SOCKET)
+					closesocket(LocalSockets[i]);
+			}
 
+			if (LocalSockets[0] != INVALID_SOCKET)
+				unlink(options.unixPath);
 
-	// --- Accepting a Connection ---
+			FreeTlsContext(tlsContext);
+			SocketCleanup();
+			return 1;
+		}
+	}
 
-	// Once the socket is listening for a connection, the program must handle connection requests on that socket.
+	// --- Accepting Connections ---
 
 	// Normally a server application would be designed to listen for connections from multiple clients. 
-	// For high-performance servers, multiple threads are commonly used to handle the multiple client connections.
-	// There are several different programming techniques using Winsock that can be used to listen for multiple 
-	// client connections. One programming technique is to create a continuous loop that checks for connection 
-	// requests using the listen function (see Listening on a Socket). If a connection request occurs, the 
-	// application calls the accept, AcceptEx, or WSAAccept function and passes the work to another thread to 
-	// handle the request. Several other programming techniques are possible.
-	// Note that this basic example is very simple and does not use multiple threads. 
-	// The example also just listens for and accepts only a single connection.
-
-	// When the client connection has been accepted, a server application would normally pass the accepted client 
-	// socket (the ClientSocket variable in the above sample code) to a worker thread or an I/O completion port and 
-	// continue accepting additional connections. In this basic example, the server continues to the next step.
-
-	// There are a number of other programming techniques that can be used to listen for and accept multiple connections. 
-	// These include using the select or WSAPoll functions. Examples of some of these various programming techniques are 
-	// illustrated in the Advanced Winsock Samples included with the Microsoft Windows Software Development Kit (SDK).
+	// Instead of accepting a single connection and closing the listen socket, each worker registers its 
+	// listen socket with an edge-triggered epoll event loop. The loop accepts every pending connection 
+	// when the listen socket becomes readable and keeps the listen socket open for the lifetime of the server.
+
+	// Each accepted client socket is made non-blocking and registered with the same loop, so a single 
+	// thread serves tens of thousands of concurrent connections without ever blocking in recv or send. 
+	// Every connection keeps its own read buffer and its own queue of bytes still waiting to be written, 
+	// and stays on the worker that accepted it for its whole lifetime.
 
 	// Note: On Unix systems, a common programming technique for servers was for an application to listen for connections. 
 	// When a connection was accepted, the parent process would call the fork function to create a new child process to 
 	// handle the client connection, inheriting the socket from the parent. 
-	// This programming technique is not supported on Windows, since the fork function is not supported. 
-	// This technique is also not usually suitable for high-performance servers, since the resources needed 
-	// to create a new process are much greater than those needed for a thread.
+	// This technique is not suitable for high-performance servers, since the resources needed 
+	// to create a new process are much greater than those needed to track one more socket in an event loop.
 
-    // Accept a client socket
-    ClientSocket = accept(ListenSocket, NULL, NULL);
 
-    if (ClientSocket == INVALID_SOCKET) 
-	{
-        printf("accept failed with error: %d\n", WSAGetLastError());
-        closesocket(ListenSocket);
-        WSACleanup();
-        return 1;
-    }
-	
-	// No longer need server socket
-    closesocket(ListenSocket);
-
-	
 	// --- Receiving and Sending Data on the Server ---
 
-	// The following code demonstrates the recv and send functions used by the server.
+	// Clients send length-prefixed frames: a 4-byte big-endian payload length followed by the payload.
+	// Each connection reassembles frames from whatever chunks recv returns, so one recv can deliver many 
+	// frames and one frame can span many reads. Every complete frame is handed to EchoFrame as a view 
+	// into the receive buffer and echoed back unchanged, header included.
+	// Large frames (--bulk-threshold) are not reassembled at all: their bytes are echoed as they arrive, 
+	// and with the epoll backend the payload is spliced from the socket back to the socket through a pipe, 
+	// so bulk transfers cost neither reassembly memory nor copies through user space.
 
-	// The send and recv functions both return an integer value of the number of bytes sent 
-	// or received, respectively, or an error. Each function also takes the same parameters: 
-	// the active socket, a char buffer, the number of bytes to send or receive, and any flags to use.
+	// With the epoll backend, when a client socket becomes readable the loop calls recv until it returns 
+	// EWOULDBLOCK. The io_uring backend instead keeps a multishot recv armed on every socket and echoes 
+	// frames with a fixed write straight from the receive buffer, submitting the whole batch of operations 
+	// with one system call per loop iteration. If send accepts only part of the data, the remainder 
+	// is queued on the connection and written when the socket becomes writable again. 
+	// When the peer shuts down its side of the connection, recv returns 0 and the loop stops reading from it, 
+	// but closes the socket only once the replies it owes are sent: those queued on the connection and 
+	// those of frames still with the work pool.
 
-	// Keep receiving until the peer shuts down the connection
-	do {
+	// The loops are created here rather than in their threads, so the stats endpoint can be 
+	// given all of them before any starts running.
+	vector<IoLoop *> loops;
 
-        iResult = recv(ClientSocket, recvbuf, recvbuflen, 0);
+	for (int i = 0; i < options.threads; i++)
+		loops.push_back(CreateIoLoop(options.backend));
 
-        if (iResult > 0) 
-		{
-            printf("Bytes received: %d\n", iResult);
-
-			recvbuf[iResult] = '\0';
 
-			printf("Text received: %s\n", recvbuf);
+	// --- Monitoring the Server ---
 
-			// Echo the buffer back to the sender
-            iSendResult = send(ClientSocket, recvbuf, iResult, 0);
+	// Per-message console output is a serialization point that costs more than the echo itself, so 
+	// it is only printed with --verbose. Instead every loop counts accepts, bytes, frames and partial 
+	// writes and records the duration of each iteration in counters of its own, on cache lines of their own.
+	// The stats endpoint sums them on its own thread whenever it is scraped, without stopping the loops.
+	StatsServer stats;
+	vector<const LoopMetrics *> metrics;
 
-            if (iSendResult == SOCKET_ERROR) 
-			{
-                printf("send failed with error: %d\n", WSAGetLastError());
-                closesocket(ClientSocket);
-                WSACleanup();
-                return 1;
-            }
+	for (int i = 0; i < options.threads; i++)
+		metrics.push_back(&loops[i]->Metrics());
 
-            printf("Bytes sent: %d\n", iSendResult);
-        }
-        else if (iResult == 0)
+	if (options.statsPort != NULL && !stats.Start(options.statsPort, metrics))
+	{
+		for (int i = 0; i < options.threads; i++)
 		{
-            printf("Connection closing...\n");
+			closesocket(ListenSockets[i]);
+
+			if (LocalSockets[i] != INVALID_SOCKET)
+				closesocket(LocalSockets[i]);
+
+			delete loops[i];
 		}
-        else  
-		{
-            printf("recv failed with error: %d\n", WSAGetLastError());
-            closesocket(ClientSocket);
-            WSACleanup();
-            return 1;
-        }
 
-    } while (iResult > 0);
+		if (options.unixPath != NULL)
+			unlink(options.unixPath);
 
+		FreeTlsContext(tlsContext);
+		SocketCleanup();
+		return 1;
+	}
 
-	// --- Disconnecting the Server ---
+	// --- Offloading Slow Handlers ---
+
+	// A handler that takes hundreds of microseconds stalls every other connection of its loop. With 
+	// --work-threads the loops copy each frame into a job for a work-stealing pool and go straight back 
+	// to their sockets; a worker transforms the frame and posts the reply to the loop's lock-free 
+	// completion queue, waking the loop through its eventfd, and the loop sends it in request order.
+	WorkPool pool;
+
+	if (options.workThreads > 0)
+		pool.Start(options.workThreads);
+
+	// --- Draining on Shutdown ---
 
-	// Once the server is completed receiving data from the client and sending data back 
-	// to the client, the server disconnects from the client and shutdowns the socket.
+	// SIGTERM (or Ctrl+C) does not kill the server mid-reply. Every loop stops accepting and shuts its 
+	// listen socket down, so new clients are refused and can go elsewhere; connections between requests 
+	// close at once, and connections with a frame in flight close as soon as its reply has been sent. 
+	// The workers return when their last connection is gone, or when --drain-timeout runs out.
+	HandleTermination(&loops, options.drainTimeoutMs);
 
-	// When the server is done sending data to the client, the shutdown function 
-	// can be called specifying SD_SEND to shutdown the sending side of the socket. 
-	// This allows the client to release some of the resources for this socket. 
-	// The server application can still receive data on the socket.
+	// --- Tracing Tail Latency ---
 
-    // Shutdown the connection since we're done
-    iResult = shutdown(ClientSocket, SD_SEND);
+	// With --trace every loop records its connections' lifecycle events into a ring of its own: a time 
+	// stamp counter reading, the connection's ID and a byte count per event, 16 bytes and no formatting. 
+	// kill -USR1 writes the rings of all loops to files, and --trace-threshold-us has a loop write its 
+	// ring when an iteration was slow, so the events leading up to a latency spike are on disk. 
+	// TraceConvert turns the files into a Chrome trace. Without --trace the trace points cost a branch.
+	if (options.traceEvents > 0)
+		HandleTraceSignal(&loops);
 
-    if (iResult == SOCKET_ERROR) 
+	// Worker 0 runs on the main thread; the others get a thread each.
+	vector<thread> workers;
+	vector<int> results(options.threads, 0);
+
+	for (int i = 1; i < options.threads; i++)
 	{
-        printf("shutdown failed with error: %d\n", WSAGetLastError());
-        closesocket(ClientSocket);
-        WSACleanup();
-        return 1;
-    }
+		workers.push_back(thread([i, &loops, &ListenSockets, &LocalSockets, &pool, tlsContext, &options, &results]() 
+		{
+			results[i] = RunWorker(i, loops[i], ListenSockets[i], LocalSockets[i], options.workThreads > 0 ? &pool : NULL, tlsContext, options);
 
-	// Cleanup
-	// When the client application is done receiving data, the closesocket function is called to close the socket.
-    closesocket(ClientSocket);
+			if (results[i] != 0)
+				StopWorkers(loops);
+		}));
+	}
 
-	// When the client application is completed using the Windows Sockets DLL, 
-	// the WSACleanup function is called to release resources.
-    WSACleanup();
+	results[0] = RunWorker(0, loops[0], ListenSockets[0], LocalSockets[0], options.workThreads > 0 ? &pool : NULL, tlsContext, options);
+
+	if (results[0] != 0)
+		StopWorkers(loops);
+
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
 
-	cin.get();
+	HandleTermination(NULL, 0);
+
+	if (options.traceEvents > 0)
+		HandleTraceSignal(NULL);
+
+	iResult = 0;
+
+	for (int i = 0; i < options.threads; i++)
+		iResult |= results[i];
+
+	if (iResult == 0)
+		printf("Server drained, shutting down\n");
+
+	// The stats thread reads the loops' counters and the workers post to their queues; 
+	// stop both before the loops go away.
+	stats.Stop();
+	pool.Stop();
+
+	for (int i = 0; i < options.threads; i++)
+		delete loops[i];
+
+	// The socket file outlives the socket; a later run would replace it, but clients would find it meanwhile.
+	if (options.unixPath != NULL)
+		unlink(options.unixPath);
+
+	FreeTlsContext(tlsContext);
+
+
+	// --- Disconnecting the Server ---
+
+	// Each event loop owns its listen socket and closes it together with its epoll instance. 
+	// The loops have already shut their listen sockets down and closed every connection while draining.
+
+	// When the server application is completed using the Windows Sockets DLL, 
+	// the WSACleanup function is called to release resources.
+    SocketCleanup();
 
-    return 0;
-}
\ No newline at end of file
+    return iResult;
+}
@@ -0,0 +1,215 @@
+#include "../Common/Platform.h"
+#include "../Common/Trace.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// Build (Linux): g++ -O2 -std=c++17 TraceConvert.cpp -o traceconvert
+
+// Trace converter: turns the binary trace files the server writes with --trace (see Trace.h) into one
+// Chrome trace in JSON, which chrome://tracing and ui.perfetto.dev open. Every loop is a thread of the
+// server's process:
+// - a connection is an async slice from accept to close, on a track of its own;
+// - a handler call is a slice on the loop's thread, so a slow one stands out as a long bar;
+// - reads, decoded frames, writes and partial writes are instant events with the connection and byte count;
+// - a slow iteration that triggered a dump is a slice of its length, ending where it was detected.
+// Files of the same loop that overlap (two dumps in a row) are merged without duplicating events.
+//
+// usage: traceconvert trace-*.bin > trace.json
+
+// One trace file, read whole.
+struct TraceFile
+{
+	const char *path;
+	TraceFileHeader header;
+	vector<TraceEvent> events;
+};
+
+static const char *EventNames[] =
+{
+	"", "accept", "read", "frame", "handler", "handler", "write", "partial write", "close", "slow iteration"
+};
+
+static bool ReadTraceFile(const char *path, TraceFile &file)
+{
+	FILE *f = fopen(path, "rb");
+
+	if (f == NULL)
+	{
+		fprintf(stderr, "fopen(%s) failed\n", path);
+		return false;
+	}
+
+	file.path = path;
+
+	bool ok = fread(&file.header, sizeof(file.header), 1, f) == 1 &&
+		memcmp(file.header.magic, TRACE_MAGIC, sizeof(file.header.magic)) == 0 &&
+		file.header.count <= file.header.recorded;
+
+	if (ok)
+	{
+		file.events.resize((size_t)file.header.count);
+		ok = fread(file.events.data(), sizeof(TraceEvent), file.events.size(), f) == file.events.size();
+	}
+
+	fclose(f);
+
+	if (!ok)
+		fprintf(stderr, "%s is not a complete trace file\n", path);
+
+	return ok;
+}
+
+// Map a tick count of the file to CLOCK_MONOTONIC nanoseconds, by the two readings in its header.
+static double TicksToNs(const TraceFileHeader &header, uint64_t ticks)
+{
+	double ticksPerNs = 1.0;
+
+	if (header.dumpTicks > header.startTicks && header.dumpNs > header.startNs)
+		ticksPerNs = (double)(header.dumpTicks - header.startTicks) / (double)(header.dumpNs - header.startNs);
+
+	return (double)header.startNs + ((double)ticks - (double)header.startTicks) / ticksPerNs;
+}
+
+static bool Earlier(const TraceFile *a, const TraceFile *b)
+{
+	if (a->header.pid != b->header.pid)
+		return a->header.pid < b->header.pid;
+
+	if (a->header.loop != b->header.loop)
+		return a->header.loop < b->header.loop;
+
+	return a->header.recorded < b->header.recorded;
+}
+
+int __cdecl main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s TRACEFILE... > trace.json\n", argv[0]);
+		return 1;
+	}
+
+	vector<TraceFile> files(argc - 1);
+	vector<TraceFile *> order;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!ReadTraceFile(argv[i], files[i - 1]))
+			return 1;
+
+		order.push_back(&files[i - 1]);
+	}
+
+	// Oldest dump of each loop first, so a later dump only adds the events recorded after the earlier one.
+	sort(order.begin(), order.end(), Earlier);
+
+	// Timestamps are microseconds from the first event of any file.
+	double originNs = 0.0;
+	bool haveOrigin = false;
+
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		if (order[i]->events.empty())
+			continue;
+
+		double ns = TicksToNs(order[i]->header, order[i]->events[0].ticks);
+
+		if (!haveOrigin || ns < originNs)
+			originNs = ns;
+
+		haveOrigin = true;
+	}
+
+	// Events already written per loop, by the index of the next one (see TraceFileHeader::recorded).
+	map<pair<uint32_t, uint32_t>, uint64_t> written;
+	bool first = true;
+
+	printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		const TraceFileHeader &header = order[i]->header;
+		pair<uint32_t, uint32_t> loop(header.pid, header.loop);
+
+		if (written.find(loop) == written.end())
+		{
+			printf("%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"loop %u\"}}",
+				first ? "" : ",\n", header.pid, header.loop, header.loop);
+			first = false;
+			written[loop] = 0;
+		}
+
+		uint64_t index = header.recorded - header.count;
+
+		for (size_t j = 0; j < order[i]->events.size(); j++, index++)
+		{
+			if (index < written[loop])
+				continue;
+
+			const TraceEvent &event = order[i]->events[j];
+			unsigned type = event.info >> 24;
+			unsigned value = event.info & TRACE_VALUE_MAX;
+			double ts = (TicksToNs(header, event.ticks) - originNs) / 1000.0;
+
+			if (type < TRACE_ACCEPT || type > TRACE_SLOW_ITERATION)
+				continue;
+
+			printf(",\n");
+
+			// Connection IDs are per loop; the async ID puts the loop in the upper half.
+			unsigned long long id = ((unsigned long long)header.loop << 32) | event.connection;
+
+			switch (type)
+			{
+			case TRACE_ACCEPT:
+			case TRACE_CLOSE:
+				printf("{\"ph\":\"%s\",\"cat\":\"connection\",\"name\":\"connection %u\",\"id\":\"0x%llx\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f",
+					type == TRACE_ACCEPT ? "b" : "e", event.connection, id, header.pid, header.loop, ts);
+
+				if (type == TRACE_ACCEPT)
+					printf(",\"args\":{\"socket\":%u}", value);
+
+				printf("}");
+				break;
+
+			case TRACE_HANDLER_START:
+			case TRACE_HANDLER_END:
+				printf("{\"ph\":\"%s\",\"name\":\"handler\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f",
+					type == TRACE_HANDLER_START ? "B" : "E", header.pid, header.loop, ts);
+
+				if (type == TRACE_HANDLER_START)
+					printf(",\"args\":{\"connection\":%u,\"bytes\":%u}", event.connection, value);
+
+				printf("}");
+				break;
+
+			case TRACE_SLOW_ITERATION:
+				printf("{\"ph\":\"X\",\"name\":\"slow iteration\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%u}",
+					header.pid, header.loop, ts - value, value);
+				break;
+
+			default:
+				printf("{\"ph\":\"i\",\"s\":\"t\",\"name\":\"%s\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"args\":{\"connection\":%u,\"bytes\":%u}}",
+					EventNames[type], header.pid, header.loop, ts, event.connection, value);
+				break;
+			}
+		}
+
+		if (index > written[loop])
+			written[loop] = index;
+
+		// The summary goes to stderr, out of the way of the JSON.
+		fprintf(stderr, "%s: loop %u, %llu events of %llu recorded\n", order[i]->path, header.loop,
+			(unsigned long long)header.count, (unsigned long long)header.recorded);
+	}
+
+	printf("\n]}\n");
+
+	return 0;
+}